@@ -52,6 +52,9 @@ typedef struct
   stp_parameter_list_t (*list_parameters)(const stp_vars_t *v);
   void (*describe_parameter)(const stp_vars_t *v, const char *name,
 			     stp_parameter_t *description);
+  /* Optional: convert a row to the channel input, into out if not NULL */
+  int (*convert_row)(stp_vars_t *v, stp_image_t *image, int row,
+		     unsigned short *out, unsigned *zero_mask);
 } stp_colorfuncs_t;
 
 
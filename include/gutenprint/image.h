@@ -122,6 +122,22 @@ typedef struct stp_image
    * need to be associated with the image object.
    */
   void *rep;
+  /**
+   * This optional callback is used instead of get_row() when the row
+   * is already in memory in the form get_row() would copy it.  Rather
+   * than copying the row, it sets *data to point to it.  The data must
+   * remain valid until the next call to get_row(), get_row_ptr() or
+   * conclude().  It may set *data to NULL for any row, in which case the
+   * row is fetched with get_row().  Rows of 16 bit data must be aligned
+   * as for unsigned short.  It returns the same status as get_row().
+   * @param image the image in use.
+   * @param data set to the pixel data of the row, or NULL.
+   * @param byte_limit (image width * number of channels).
+   * @param row the row wanted.
+   */
+  stp_image_status_t (*get_row_ptr)(struct stp_image *image,
+				    const unsigned char **data,
+				    size_t byte_limit, int row);
 } stp_image_t;
 
 extern void stp_image_init(stp_image_t *image);
@@ -131,6 +147,9 @@ extern int stp_image_height(stp_image_t *image);
 extern stp_image_status_t stp_image_get_row(stp_image_t *image,
 					    unsigned char *data,
 					    size_t limit, int row);
+extern stp_image_status_t stp_image_get_row_ptr(stp_image_t *image,
+						const unsigned char **data,
+						size_t limit, int row);
 extern const char *stp_image_get_appname(stp_image_t *image);
 extern void stp_image_conclude(stp_image_t *image);
 
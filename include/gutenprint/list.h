@@ -45,7 +45,9 @@ extern "C" {
  * remove, iterate over the list, copy whole lists), plus some
  * (optional) less common features: finding items by index, name or
  * long name, and sorting.  These should also be fairly fast, due to
- * caching in the list head.
+ * caching in the list head; longer lists are also indexed by name and
+ * long name, so looking an item up by either takes constant time.  The
+ * name and long name of an item must not change while it is in a list.
  *
  * @defgroup list list
  * @{
@@ -320,7 +322,8 @@ extern "C" {
   /**
    * Set the data associated with a list item.
    * @warning Note that if a sortfunc is in use, changing the data
-   * will NOT re-sort the list!
+   * will NOT re-sort the list!  Nor will the list find the item under
+   * a different name or long name.
    * @param item the list item to use.
    * @param data the data to set.
    * @returns 0 on success, 1 on failure (if data is NULL).
@@ -115,6 +115,7 @@ struct stp_mxml_node_s			/**** An XML node. ****/
   stp_mxml_node_t	*child;			/* First child node */
   stp_mxml_node_t	*last_child;		/* Last child node */
   stp_mxml_value_t	value;			/* Node value */
+  struct stp_mxml_arena_s *arena;		/* Document arena or NULL */
 };
 
 
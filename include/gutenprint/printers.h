@@ -230,6 +230,50 @@ extern int stp_start_job(const stp_vars_t *v, stp_image_t *image);
  */
 extern int stp_end_job(const stp_vars_t *v, stp_image_t *image);
 
+struct stp_session;
+/**
+ * The session opaque data type.  A session keeps the verified settings,
+ * color tables and dither matrix of a page for the pages after it, so
+ * that a job whose pages share their settings only sets them up once.
+ * Anything kept is discarded as soon as a page's settings differ from
+ * the previous page's in anything but the page number.
+ */
+typedef struct stp_session stp_session_t;
+
+/**
+ * Create a render session, normally one per job.
+ * @returns the new session.  It must be freed with stp_session_destroy().
+ */
+extern stp_session_t *stp_session_create(void);
+
+/**
+ * Destroy a session and everything it has kept.
+ * @param session the session to destroy.
+ */
+extern void stp_session_destroy(stp_session_t *session);
+
+/**
+ * Verify parameters, as stp_verify() does, reusing the result for
+ * settings already verified in this session.
+ * @param session the session to use.
+ * @param v the vars to use.
+ * @returns 0 on failure, 1 on success; other status values are reserved.
+ */
+extern int stp_session_verify(stp_session_t *session, stp_vars_t *v);
+
+/**
+ * Print the image, as stp_print() does, reusing whatever was set up for
+ * the previous page of the session if the settings have not changed.
+ * Only one page may be printed in a session at a time.
+ * @param session the session to use.
+ * @param v the vars to use.
+ * @param image the image to print.
+ * @returns 0 on failure, 1 on success, 2 on abort requested by the
+ * driver.
+ */
+extern int stp_session_print(stp_session_t *session, const stp_vars_t *v,
+			     stp_image_t *image);
+
 /**
  * Retrieve options that need to be passed to the underlying print
  * system.
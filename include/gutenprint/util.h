@@ -98,6 +98,15 @@ extern void stp_putraw(const stp_raw_t *r, const stp_vars_t *v);
 extern void stp_send_command(const stp_vars_t *v, const char *command,
 			     const char *format, ...);
 
+/*
+ * Output is collected in a buffer shared by a vars object and its
+ * copies, and sent to the output function when the buffer fills, when
+ * stp_print(), stp_start_job() or stp_end_job() returns, when the output
+ * function or data is changed and when the last vars object using the
+ * buffer is destroyed.  stp_flush_output() sends it immediately.
+ */
+extern void stp_flush_output(const stp_vars_t *v);
+
 extern void stp_erputc(int ch);
 
 extern void stp_eprintf(const stp_vars_t *v, const char *format, ...)
@@ -200,6 +200,18 @@ typedef const void *stp_const_parameter_list_t;
  */
 typedef void (*stp_outfunc_t) (void *data, const char *buffer, size_t bytes);
 
+/**
+ * Vectored output function optionally supplied by the calling
+ * application.  If supplied, it is used instead of the output function
+ * to send buffered output together with a large block of data in one
+ * call, in the manner of writev().
+ * @param data a pointer to an opaque object owned by the calling
+ *             application.
+ * @param vec the blocks of data to output, in order.
+ * @param count the number of blocks.
+ */
+typedef void (*stp_outvfunc_t) (void *data, const stp_raw_t *vec, int count);
+
 
 /****************************************************************
 *                                                               *
@@ -382,6 +394,22 @@ extern void stp_set_outfunc(stp_vars_t *v, stp_outfunc_t val);
  */
 extern stp_outfunc_t stp_get_outfunc(const stp_vars_t *v);
 
+/**
+ * Set the vectored function used to print output information.  This
+ * is optional; output is sent to outfunc if it is not set.  It is
+ * passed the same outdata as outfunc.
+ * @param v the vars to use.
+ * @param val the value to set.
+ */
+extern void stp_set_outvfunc(stp_vars_t *v, stp_outvfunc_t val);
+
+/**
+ * Get the vectored function used to print output information.
+ * @param v the vars to use.
+ * @returns the outvfunc.
+ */
+extern stp_outvfunc_t stp_get_outvfunc(const stp_vars_t *v);
+
 /**
  * Set the function used to print error and diagnostic information.
  * These must be supplied by the caller.  errdata is passed as an
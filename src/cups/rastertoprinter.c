@@ -23,9 +23,11 @@
  *
  *   main()                    - Main entry and processing of driver.
  *   cups_writefunc()          - Write data to a file...
+ *   cups_writevfunc()         - Write several blocks of data to a file...
  *   cancel_job()              - Cancel the current job...
  *   Image_get_appname()       - Get the application we are running.
  *   Image_get_row()           - Get one row of the image.
+ *   Image_get_row_ptr()       - Lend one row of the image.
  *   Image_height()            - Return the height of an image.
  *   Image_init()              - Initialize an image.
  *   Image_conclude()          - Close the progress display.
@@ -53,9 +55,15 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/times.h>
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
 #ifdef HAVE_LIMITS_H
 #include <limits.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include "i18n.h"
 #include <gutenprint/xml.h>
 
@@ -77,6 +85,8 @@
 #define CUPS_READ_HEADER cupsRasterReadHeader
 #endif
 
+struct read_ahead;
+
 typedef struct
 {
   cups_raster_t		*ras;		/* Raster stream to read from */
@@ -97,19 +107,26 @@ typedef struct
   int			last_percent;
   int			shrink_to_fit;
   CUPS_HEADER_T		header;		/* Page header from file */
+  struct read_ahead	*read_ahead;	/* Rows read by another thread */
 } cups_image_t;
 
 static void	cups_writefunc(void *file, const char *buf, size_t bytes);
+static void	cups_writevfunc(void *file, const stp_raw_t *vec, int count);
 static void	cups_errfunc(void *file, const char *buf, size_t bytes);
 static void	cancel_job(int sig);
 static const char *Image_get_appname(stp_image_t *image);
 static stp_image_status_t Image_get_row(stp_image_t *image,
 					unsigned char *data,
 					size_t byte_limit, int row);
+static stp_image_status_t Image_get_row_ptr(stp_image_t *image,
+					    const unsigned char **data,
+					    size_t byte_limit, int row);
 static int	Image_height(stp_image_t *image);
 static int	Image_width(stp_image_t *image);
 static void	Image_conclude(stp_image_t *image);
 static void	Image_init(stp_image_t *image);
+static void	read_ahead_start(cups_image_t *cups);
+static void	read_ahead_finish(cups_image_t *cups, int purge);
 
 static stp_image_t theImage =
 {
@@ -120,7 +137,8 @@ static stp_image_t theImage =
   Image_get_row,
   Image_get_appname,
   Image_conclude,
-  NULL
+  NULL,
+  Image_get_row_ptr
 };
 
 static volatile stp_image_status_t Image_status = STP_IMAGE_STATUS_OK;
@@ -347,6 +365,7 @@ initialize_page(cups_image_t *cups, const stp_vars_t *default_settings,
     fprintf(stderr, "DEBUG: Gutenprint: Initialize page\n");
 
   stp_set_outfunc(v, cups_writefunc);
+  stp_set_outvfunc(v, cups_writevfunc);
   stp_set_errfunc(v, cups_errfunc);
   stp_set_outdata(v, stdout);
   stp_set_errdata(v, stderr);
@@ -1089,6 +1108,7 @@ main(int  argc,				/* I - Number of command-line arguments */
   cups_option_t		*options;	/* CUPS options */
   stp_vars_t		*v = NULL;
   stp_vars_t		*default_settings;
+  stp_session_t		*session;	/* Setup shared between pages */
   int			initialized_job = 0;
   const char            *version_id;
   const char            *release_version_id;
@@ -1310,6 +1330,14 @@ main(int  argc,				/* I - Number of command-line arguments */
   */
 
   cups.page = 0;
+  cups.read_ahead = NULL;
+
+ /*
+  * Pages with the same settings reuse each other's verification, color
+  * tables and dither matrix.
+  */
+
+  session = stp_session_create();
 
   if (! suppress_messages)
     fprintf(stderr, "DEBUG: Gutenprint: About to start printing loop.\n");
@@ -1361,7 +1389,7 @@ main(int  argc,				/* I - Number of command-line arguments */
       if (! suppress_messages)
 	print_debug_block(v, &cups);
       print_messages_as_errors = 1;
-      if (!stp_verify(v))
+      if (!stp_session_verify(session, v))
 	{
 	  fprintf(stderr, "DEBUG: Gutenprint: Options failed to verify.\n");
 	  fprintf(stderr, "DEBUG: Gutenprint: Make sure that you are using ESP Ghostscript rather\n");
@@ -1377,8 +1405,10 @@ main(int  argc,				/* I - Number of command-line arguments */
 	  initialized_job = 1;
 	}
 
-      if (!stp_print(v, &theImage))
+      read_ahead_start(&cups);
+      if (!stp_session_print(session, v, &theImage))
 	{
+	  read_ahead_finish(&cups, 0);
 	  aborted = 1;
 	  break;
 	}
@@ -1389,6 +1419,7 @@ main(int  argc,				/* I - Number of command-line arguments */
       /*
        * Purge any remaining bitmap data...
        */
+      read_ahead_finish(&cups, 1);
       if (cups.row < cups.header.cupsHeight)
 	purge_excess_data(&cups);
       if (! suppress_messages)
@@ -1404,6 +1435,7 @@ main(int  argc,				/* I - Number of command-line arguments */
       fflush(stdout);
       stp_vars_destroy(v);
     }
+  stp_session_destroy(session);
   cupsRasterClose(cups.ras);
   (void) times(&tms);
   (void) gettimeofday(&t2, &tz);
@@ -1440,6 +1472,59 @@ cups_writefunc(void *file, const char *buf, size_t bytes)
   fwrite(buf, 1, bytes, prn);
 }
 
+
+/*
+ * 'cups_writevfunc()' - Write several blocks of data to a file...
+ *
+ * Anything already buffered by stdio is flushed first so that the
+ * blocks follow it.  Whatever writev() doesn't write goes through
+ * stdio, which reports any error the same way cups_writefunc() does.
+ */
+
+#define WRITEV_BLOCKS 8
+
+static void
+cups_writevfunc(void *file, const stp_raw_t *vec, int count)
+{
+  FILE *prn = (FILE *)file;
+  int i = 0;
+#ifdef HAVE_SYS_UIO_H
+  struct iovec iov[WRITEV_BLOCKS];
+  ssize_t written;
+
+  if (count <= WRITEV_BLOCKS && fflush(prn) == 0)
+    {
+      for (i = 0; i < count; i++)
+	{
+	  iov[i].iov_base = (void *) vec[i].data;
+	  iov[i].iov_len = vec[i].bytes;
+	  total_bytes_printed += vec[i].bytes;
+	}
+      i = 0;
+      while (i < count)
+	{
+	  written = writev(fileno(prn), iov + i, count - i);
+	  if (written < 0 && errno == EINTR)
+	    continue;
+	  if (written <= 0)
+	    break;
+	  while (i < count && (size_t) written >= iov[i].iov_len)
+	    written -= iov[i++].iov_len;
+	  if (i < count)
+	    {
+	      iov[i].iov_base = (char *) iov[i].iov_base + written;
+	      iov[i].iov_len -= written;
+	    }
+	}
+      for (; i < count; i++)
+	fwrite(iov[i].iov_base, 1, iov[i].iov_len, prn);
+      return;
+    }
+#endif
+  for (; i < count; i++)
+    cups_writefunc(file, vec[i].data, vec[i].bytes);
+}
+
 static void
 cups_errfunc(void *file, const char *buf, size_t bytes)
 {
@@ -1493,7 +1578,7 @@ Image_get_appname(stp_image_t *image)		/* I - Image */
 
 
 /*
- * 'Image_get_row()' - Get one row of the image.
+ * 'throwaway_data()' - Skip raster data we don't print.
  */
 
 static void
@@ -1511,6 +1596,246 @@ throwaway_data(int amount, cups_image_t *cups)
     cupsRasterReadPixels(cups->ras, trash, leftover);
 }
 
+/*
+ * 'row_bytes() - Bytes printed from each row, and the bytes around them.
+ */
+
+static int
+row_bytes(const cups_image_t *cups, int *left_margin, int *right_margin)
+{
+  int bytes_per_line =
+    ((cups->adjusted_width * cups->header.cupsBitsPerPixel) + CHAR_BIT - 1) /
+    CHAR_BIT;
+
+  *left_margin = ((cups->left_trim * cups->header.cupsBitsPerPixel) + CHAR_BIT - 1) /
+    CHAR_BIT;
+  /* Everything after the printed bytes, including any padding */
+  *right_margin = cups->header.cupsBytesPerLine - *left_margin - bytes_per_line;
+  return bytes_per_line;
+}
+
+/*
+ * 'read_row()' - Read the next row of the page, without its margins.
+ */
+
+static void
+read_row(cups_image_t *cups, unsigned char *data)
+{
+  int left_margin, right_margin;
+  int bytes_per_line = row_bytes(cups, &left_margin, &right_margin);
+
+  if (left_margin > 0)
+    {
+      if (! suppress_messages && ! suppress_verbose_messages)
+	fprintf(stderr, "DEBUG2: Gutenprint: Tossing left %d (%d)\n",
+		left_margin, cups->left_trim);
+      throwaway_data(left_margin, cups);
+    }
+  cupsRasterReadPixels(cups->ras, data, bytes_per_line);
+  if (right_margin > 0)
+    {
+      if (! suppress_messages && ! suppress_verbose_messages)
+	fprintf(stderr, "DEBUG2: Gutenprint: Tossing right %d (%d)\n",
+		right_margin, cups->right_trim);
+      throwaway_data(right_margin, cups);
+    }
+}
+
+/*
+ * Read-ahead: while the driver renders one row, a second thread reads the
+ * rows after it from the raster stream into a ring of READ_AHEAD_ROWS
+ * buffers, so that waiting for Ghostscript overlaps with color conversion
+ * and dithering instead of adding to it.  The driver asks for rows in
+ * increasing order; a row stays in the ring until a later one is asked
+ * for.  Without threads, or if the thread can't be started, rows are
+ * read when they are asked for, as they always were.
+ */
+
+#define READ_AHEAD_ROWS 32
+
+typedef struct read_ahead
+{
+#ifdef HAVE_PTHREAD_H
+  pthread_t		thread;
+  pthread_mutex_t	lock;
+  pthread_cond_t	cond;		/* A row was read or released */
+#endif
+  unsigned char		*rows;		/* READ_AHEAD_ROWS rows */
+  unsigned char		*trash;		/* Row being purged */
+  int			row_size;	/* Bytes from one row to the next */
+  int			rows_read;	/* Rows read by the thread */
+  int			rows_released;	/* Rows the driver is done with */
+  int			purge;		/* Read the rest of the page unkept */
+  int			stop;		/* Stop reading now */
+  int			done;		/* The thread has stopped */
+} read_ahead_t;
+
+#ifdef HAVE_PTHREAD_H
+static void *
+read_ahead_thread(void *arg)
+{
+  cups_image_t *cups = (cups_image_t *) arg;
+  read_ahead_t *ra = cups->read_ahead;
+  int row;
+
+  for (row = 0; row < cups->header.cupsHeight; row++)
+    {
+      unsigned char *data;
+      pthread_mutex_lock(&(ra->lock));
+      while (!ra->stop && !ra->purge &&
+	     row - ra->rows_released >= READ_AHEAD_ROWS)
+	pthread_cond_wait(&(ra->cond), &(ra->lock));
+      if (ra->stop)
+	{
+	  pthread_mutex_unlock(&(ra->lock));
+	  break;
+	}
+      if (ra->purge)
+	data = ra->trash;
+      else
+	data = ra->rows + (row % READ_AHEAD_ROWS) * ra->row_size;
+      pthread_mutex_unlock(&(ra->lock));
+
+      read_row(cups, data);
+
+      pthread_mutex_lock(&(ra->lock));
+      ra->rows_read = row + 1;
+      pthread_cond_broadcast(&(ra->cond));
+      pthread_mutex_unlock(&(ra->lock));
+    }
+  pthread_mutex_lock(&(ra->lock));
+  ra->done = 1;
+  pthread_cond_broadcast(&(ra->cond));
+  pthread_mutex_unlock(&(ra->lock));
+  return NULL;
+}
+#endif
+
+/*
+ * 'read_ahead_start()' - Start reading the rows of the page.
+ */
+
+static void
+read_ahead_start(cups_image_t *cups)
+{
+#ifdef HAVE_PTHREAD_H
+  read_ahead_t *ra;
+  int left_margin, right_margin;
+  int bytes_per_line = row_bytes(cups, &left_margin, &right_margin);
+
+  if (cups->header.cupsHeight == 0)
+    return;
+  ra = stp_zalloc(sizeof(read_ahead_t));
+  ra->row_size = (bytes_per_line + 15) & ~15;
+  ra->rows = stp_malloc(ra->row_size * READ_AHEAD_ROWS);
+  ra->trash = stp_malloc(ra->row_size);
+  pthread_mutex_init(&(ra->lock), NULL);
+  pthread_cond_init(&(ra->cond), NULL);
+  cups->read_ahead = ra;
+  if (pthread_create(&(ra->thread), NULL, read_ahead_thread, cups) != 0)
+    {
+      pthread_cond_destroy(&(ra->cond));
+      pthread_mutex_destroy(&(ra->lock));
+      stp_free(ra->trash);
+      stp_free(ra->rows);
+      stp_free(ra);
+      cups->read_ahead = NULL;
+    }
+#endif
+}
+
+/*
+ * 'read_ahead_finish()' - Stop reading the page, reading the rest of it
+ *                         if purge is set, and wait for the thread.
+ */
+
+static void
+read_ahead_finish(cups_image_t *cups, int purge)
+{
+#ifdef HAVE_PTHREAD_H
+  read_ahead_t *ra = cups->read_ahead;
+
+  if (!ra)
+    return;
+  pthread_mutex_lock(&(ra->lock));
+  if (purge)
+    ra->purge = 1;
+  else
+    ra->stop = 1;
+  pthread_cond_broadcast(&(ra->cond));
+  pthread_mutex_unlock(&(ra->lock));
+  pthread_join(ra->thread, NULL);
+  if (! suppress_messages && ra->rows_read > ra->rows_released + 1)
+    fprintf(stderr, "DEBUG: Gutenprint: Purged %d rows\n",
+	    ra->rows_read - ra->rows_released - 1);
+  cups->row = ra->rows_read;
+  pthread_cond_destroy(&(ra->cond));
+  pthread_mutex_destroy(&(ra->lock));
+  stp_free(ra->trash);
+  stp_free(ra->rows);
+  stp_free(ra);
+  cups->read_ahead = NULL;
+#endif
+}
+
+/*
+ * 'read_ahead_get_row()' - Wait for a row to be read, and release the
+ *                          rows before it.
+ */
+
+static const unsigned char *
+read_ahead_get_row(read_ahead_t *ra, int row)
+{
+  const unsigned char *data = NULL;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock(&(ra->lock));
+  if (row > ra->rows_released)
+    {
+      ra->rows_released = row;
+      pthread_cond_broadcast(&(ra->cond));
+    }
+  while (ra->rows_read <= row && !ra->done)
+    pthread_cond_wait(&(ra->cond), &(ra->lock));
+  if (ra->rows_read > row && row >= ra->rows_released)
+    data = ra->rows + (row % READ_AHEAD_ROWS) * ra->row_size;
+  pthread_mutex_unlock(&(ra->lock));
+#endif
+  return data;
+}
+
+/*
+ * 'row_status()' - Report progress and return the image status.
+ */
+
+static stp_image_status_t
+row_status(cups_image_t *cups)
+{
+  stp_image_status_t tmp_image_status = Image_status;
+  int new_percent = (int) (100.0 * cups->row / cups->header.cupsHeight);
+
+  if (new_percent > cups->last_percent)
+    {
+      if (! suppress_messages)
+	{
+	  stp_i18n_printf(po, _("INFO: Printing page %d, %d%%\n"),
+			  cups->page + 1, new_percent);
+	  fprintf(stderr, "ATTR: job-media-progress=%d\n", new_percent);
+	}
+      cups->last_percent = new_percent;
+    }
+
+  if (tmp_image_status != STP_IMAGE_STATUS_OK)
+    {
+      if (! suppress_messages)
+	fprintf(stderr, "DEBUG: Gutenprint: Image status %d\n", tmp_image_status);
+    }
+  return tmp_image_status;
+}
+
+/*
+ * 'Image_get_row()' - Get one row of the image.
+ */
+
 static stp_image_status_t
 Image_get_row(stp_image_t   *image,	/* I - Image */
 	      unsigned char *data,	/* O - Row */
@@ -1520,11 +1845,8 @@ Image_get_row(stp_image_t   *image,	/* I - Image */
   cups_image_t	*cups;			/* CUPS image */
   int		i;			/* Looping var */
   int 		bytes_per_line;
-  int		margin;
-  stp_image_status_t tmp_image_status = Image_status;
   unsigned char *orig = data;           /* Temporary pointer */
   static int warned = 0;                /* Error warning printed? */
-  int new_percent;
   int left_margin, right_margin;
 
   if ((cups = (cups_image_t *)(image->rep)) == NULL)
@@ -1534,41 +1856,32 @@ Image_get_row(stp_image_t   *image,	/* I - Image */
 			    "gimp-print-devel@lists.sourceforge.net\n"));
       return STP_IMAGE_STATUS_ABORT;
     }
-  bytes_per_line =
-    ((cups->adjusted_width * cups->header.cupsBitsPerPixel) + CHAR_BIT - 1) /
-    CHAR_BIT;
-
-  left_margin = ((cups->left_trim * cups->header.cupsBitsPerPixel) + CHAR_BIT - 1) /
-    CHAR_BIT;
-  right_margin = ((cups->right_trim * cups->header.cupsBitsPerPixel) + CHAR_BIT - 1) /
-    CHAR_BIT;
-  margin = cups->header.cupsBytesPerLine - left_margin - bytes_per_line -
-    right_margin;
+  bytes_per_line = row_bytes(cups, &left_margin, &right_margin);
 
   if (cups->row < cups->header.cupsHeight)
   {
     if (! suppress_messages && ! suppress_verbose_messages)
       fprintf(stderr, "DEBUG2: Gutenprint: Reading %d %d\n",
 	      bytes_per_line, cups->row);
-    while (cups->row <= row && cups->row < cups->header.cupsHeight)
+    if (cups->read_ahead)
       {
-	if (left_margin > 0)
+	if (cups->row <= row)
 	  {
-	    if (! suppress_messages && ! suppress_verbose_messages)
-	      fprintf(stderr, "DEBUG2: Gutenprint: Tossing left %d (%d)\n",
-		      left_margin, cups->left_trim);
-	    throwaway_data(left_margin, cups);
-	  }
-	cupsRasterReadPixels(cups->ras, data, bytes_per_line);
-	cups->row ++;
-	if (margin + right_margin > 0)
-	  {
-	    if (! suppress_messages && ! suppress_verbose_messages)
-	      fprintf(stderr, "DEBUG2: Gutenprint: Tossing right %d (%d) + %d\n",
-		      right_margin, cups->right_trim, margin);
-	    throwaway_data(margin + right_margin, cups);
+	    const unsigned char *ahead;
+	    if (row >= cups->header.cupsHeight)
+	      row = cups->header.cupsHeight - 1;
+	    ahead = read_ahead_get_row(cups->read_ahead, row);
+	    if (ahead)
+	      memcpy(data, ahead, bytes_per_line);
+	    cups->row = row + 1;
 	  }
       }
+    else
+      while (cups->row <= row && cups->row < cups->header.cupsHeight)
+	{
+	  read_row(cups, data);
+	  cups->row ++;
+	}
   }
   else
     {
@@ -1615,24 +1928,38 @@ Image_get_row(stp_image_t   *image,	/* I - Image */
 	}
     }
 
-  new_percent = (int) (100.0 * cups->row / cups->header.cupsHeight);
-  if (new_percent > cups->last_percent)
-    {
-      if (! suppress_messages)
-	{
-	  stp_i18n_printf(po, _("INFO: Printing page %d, %d%%\n"),
-			  cups->page + 1, new_percent);
-	  fprintf(stderr, "ATTR: job-media-progress=%d\n", new_percent);
-	}
-      cups->last_percent = new_percent;
-    }
+  return row_status(cups);
+}
 
-  if (tmp_image_status != STP_IMAGE_STATUS_OK)
+/*
+ * 'Image_get_row_ptr()' - Lend one row of the image.
+ *
+ * Rows that have been read ahead are lent from the ring rather than
+ * copied.  Anything else is left to Image_get_row().
+ */
+
+static stp_image_status_t
+Image_get_row_ptr(stp_image_t   *image,	/* I - Image */
+		  const unsigned char **data, /* O - Row */
+		  size_t	byte_limit,	/* I - how many bytes wanted */
+		  int		row)		/* I - Row number */
+{
+  cups_image_t	*cups;			/* CUPS image */
+  int		left_margin, right_margin;
+
+  if ((cups = (cups_image_t *)(image->rep)) == NULL || !cups->read_ahead ||
+      cups->header.cupsBitsPerPixel == 1 || row < cups->row ||
+      row >= cups->header.cupsHeight ||
+      (size_t) row_bytes(cups, &left_margin, &right_margin) < byte_limit)
+    return STP_IMAGE_STATUS_OK;
+
+  *data = read_ahead_get_row(cups->read_ahead, row);
+  if (*data)
     {
-      if (! suppress_messages)
-	fprintf(stderr, "DEBUG: Gutenprint: Image status %d\n", tmp_image_status);
+      cups->row = row + 1;
+      return row_status(cups);
     }
-  return tmp_image_status;
+  return STP_IMAGE_STATUS_OK;
 }
 
 
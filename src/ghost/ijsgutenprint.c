@@ -34,10 +34,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
 #include <locale.h>
 #include <ijs.h>
 #include <ijs_server.h>
 #include <errno.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include <gutenprint/gutenprint-intl-internal.h>
 
 
@@ -63,6 +69,8 @@ struct _GutenprintParamList {
   int value_size;
 };
 
+struct read_ahead;
+
 typedef struct _IMAGE
 {
   IjsServerCtx *ctx;
@@ -86,6 +94,7 @@ typedef struct _IMAGE
   char *row_buf;	/* buffer for raster */
   double total_bytes;	/* total size of raster */
   double bytes_left;	/* bytes remaining to be read */
+  struct read_ahead *read_ahead;	/* rows read by another thread */
   GutenprintParamList *params;
 } IMAGE;
 
@@ -902,6 +911,55 @@ gutenprint_outfunc(void *data, const char *buffer, size_t bytes)
     fwrite(buffer, 1, bytes, (FILE *)data);
 }
 
+/*
+ * Write several blocks at once, after anything stdio has buffered.
+ * Whatever writev() doesn't write goes through stdio.
+ */
+#define WRITEV_BLOCKS 8
+
+static void
+gutenprint_outvfunc(void *data, const stp_raw_t *vec, int count)
+{
+  FILE *f = (FILE *)data;
+  int i = 0;
+#ifdef HAVE_SYS_UIO_H
+  struct iovec iov[WRITEV_BLOCKS];
+  ssize_t written;
+
+  if (f != NULL && count <= WRITEV_BLOCKS && fflush(f) == 0)
+    {
+      for (i = 0; i < count; i++)
+	{
+	  iov[i].iov_base = (void *) vec[i].data;
+	  iov[i].iov_len = vec[i].bytes;
+	  page_bytes_printed += vec[i].bytes;
+	  total_bytes_printed += vec[i].bytes;
+	}
+      i = 0;
+      while (i < count)
+	{
+	  written = writev(fileno(f), iov + i, count - i);
+	  if (written < 0 && errno == EINTR)
+	    continue;
+	  if (written <= 0)
+	    break;
+	  while (i < count && (size_t) written >= iov[i].iov_len)
+	    written -= iov[i++].iov_len;
+	  if (i < count)
+	    {
+	      iov[i].iov_base = (char *) iov[i].iov_base + written;
+	      iov[i].iov_len -= written;
+	    }
+	}
+      for (; i < count; i++)
+	fwrite(iov[i].iov_base, 1, iov[i].iov_len, f);
+      return;
+    }
+#endif
+  for (; i < count; i++)
+    gutenprint_outfunc(data, vec[i].data, vec[i].bytes);
+}
+
 /**********************************************************/
 /* stp_image_t functions */
 
@@ -938,7 +996,7 @@ throwaway_data(int amount, IMAGE *img)
 }
 
 static int
-image_next_row(IMAGE *img)
+image_read_row(IMAGE *img, char *buf)
 {
   int status = 0;
   double n_bytes = img->bytes_left;
@@ -952,7 +1010,7 @@ image_next_row(IMAGE *img)
 			img->bytes_left, (int) n_bytes, img->row));
 #endif
       throwaway_data(img->left_margin, img);
-      status = ijs_server_get_data(img->ctx, img->row_buf, (int) n_bytes);
+      status = ijs_server_get_data(img->ctx, buf, (int) n_bytes);
       if (status)
 	{
 	  STP_DEBUG(fprintf(stderr, "ERROR: ijsgutenprint: page aborted (%d) at line %d!\n",
@@ -972,63 +1030,249 @@ image_next_row(IMAGE *img)
   return status;
 }
 
+static int
+image_next_row(IMAGE *img)
+{
+  return image_read_row(img, img->row_buf);
+}
+
+/*
+ * Read-ahead: while the driver renders one row, a second thread reads the
+ * rows after it from Ghostscript into a ring of READ_AHEAD_ROWS buffers,
+ * so that waiting for the pipe overlaps with color conversion and
+ * dithering instead of adding to it.  Ghostscript sends nothing but image
+ * data until the page is complete, so the thread has the IJS connection
+ * to itself.  Physical rows are asked for in increasing order, and stay in
+ * the ring until a later one is asked for.  Without threads, or if the
+ * thread can't be started, rows are read when they are asked for.
+ */
+
+#define READ_AHEAD_ROWS 32
+
+typedef struct read_ahead
+{
+#ifdef HAVE_PTHREAD_H
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;		/* a row was read or released */
+#endif
+  char *rows;			/* READ_AHEAD_ROWS rows */
+  char *trash;			/* row being purged */
+  int row_size;			/* bytes from one row to the next */
+  int rows_read;		/* rows read by the thread */
+  int rows_released;		/* rows the driver is done with */
+  int purge;			/* read the rest of the page unkept */
+  int stop;			/* stop reading now */
+  int done;			/* the thread has stopped */
+} read_ahead_t;
+
+#ifdef HAVE_PTHREAD_H
+static void *
+read_ahead_thread(void *arg)
+{
+  IMAGE *img = (IMAGE *) arg;
+  read_ahead_t *ra = img->read_ahead;
+  int row;
+
+  for (row = 0; img->bytes_left; row++)
+    {
+      char *buf;
+      pthread_mutex_lock(&(ra->lock));
+      while (!ra->stop && !ra->purge &&
+	     row - ra->rows_released >= READ_AHEAD_ROWS)
+	pthread_cond_wait(&(ra->cond), &(ra->lock));
+      if (ra->stop)
+	{
+	  pthread_mutex_unlock(&(ra->lock));
+	  break;
+	}
+      if (ra->purge)
+	buf = ra->trash;
+      else
+	buf = ra->rows + (row % READ_AHEAD_ROWS) * ra->row_size;
+      pthread_mutex_unlock(&(ra->lock));
+
+      if (image_read_row(img, buf))
+	break;
+
+      pthread_mutex_lock(&(ra->lock));
+      ra->rows_read = row + 1;
+      pthread_cond_broadcast(&(ra->cond));
+      pthread_mutex_unlock(&(ra->lock));
+    }
+  pthread_mutex_lock(&(ra->lock));
+  ra->done = 1;
+  pthread_cond_broadcast(&(ra->cond));
+  pthread_mutex_unlock(&(ra->lock));
+  return NULL;
+}
+#endif
+
+static void
+read_ahead_start(IMAGE *img)
+{
+#ifdef HAVE_PTHREAD_H
+  read_ahead_t *ra;
+
+  if (!img->bytes_left || img->row_width <= 0)
+    return;
+  ra = stp_zalloc(sizeof(read_ahead_t));
+  ra->row_size = (img->row_width + 15) & ~15;
+  ra->rows = stp_malloc(ra->row_size * READ_AHEAD_ROWS);
+  ra->trash = stp_malloc(ra->row_size);
+  pthread_mutex_init(&(ra->lock), NULL);
+  pthread_cond_init(&(ra->cond), NULL);
+  img->read_ahead = ra;
+  if (pthread_create(&(ra->thread), NULL, read_ahead_thread, img) != 0)
+    {
+      pthread_cond_destroy(&(ra->cond));
+      pthread_mutex_destroy(&(ra->lock));
+      stp_free(ra->trash);
+      stp_free(ra->rows);
+      stp_free(ra);
+      img->read_ahead = NULL;
+    }
+#endif
+}
+
+/*
+ * Stop reading the page, reading the rest of it if purge is set, and wait
+ * for the thread.
+ */
+static void
+read_ahead_finish(IMAGE *img, int purge)
+{
+#ifdef HAVE_PTHREAD_H
+  read_ahead_t *ra = img->read_ahead;
+
+  if (!ra)
+    return;
+  pthread_mutex_lock(&(ra->lock));
+  if (purge)
+    ra->purge = 1;
+  else
+    ra->stop = 1;
+  pthread_cond_broadcast(&(ra->cond));
+  pthread_mutex_unlock(&(ra->lock));
+  pthread_join(ra->thread, NULL);
+  pthread_cond_destroy(&(ra->cond));
+  pthread_mutex_destroy(&(ra->lock));
+  stp_free(ra->trash);
+  stp_free(ra->rows);
+  stp_free(ra);
+  img->read_ahead = NULL;
+#endif
+}
+
+/* Wait for a row to be read, and release the rows before it */
+static const char *
+read_ahead_get_row(read_ahead_t *ra, int row)
+{
+  const char *data = NULL;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock(&(ra->lock));
+  if (row > ra->rows_released)
+    {
+      ra->rows_released = row;
+      pthread_cond_broadcast(&(ra->cond));
+    }
+  while (ra->rows_read <= row && !ra->done)
+    pthread_cond_wait(&(ra->cond), &(ra->lock));
+  if (ra->rows_read > row && row >= ra->rows_released)
+    data = ra->rows + (row % READ_AHEAD_ROWS) * ra->row_size;
+  pthread_mutex_unlock(&(ra->lock));
+#endif
+  return data;
+}
+
+/* The row with the given physical row number, or NULL if it can't be read */
+static const char *
+image_get_physical_row(IMAGE *img, int physical_row)
+{
+  if (img->read_ahead)
+    return read_ahead_get_row(img->read_ahead, physical_row);
+
+  /* Read until we reach the requested row. */
+  while (physical_row > img->row)
+    {
+      if (image_next_row(img))
+	return NULL;
+    }
+
+  if (physical_row != img->row)
+    return NULL;
+  return img->row_buf;
+}
+
 static stp_image_status_t
 gutenprint_image_get_row(stp_image_t *image, unsigned char *data, size_t byte_limit,
 		   int row)
 {
   IMAGE *img = (IMAGE *)(image->rep);
   int physical_row = row * img->yres / img->xres;
+  const char *row_buf;
+  unsigned i, j, length;
 
   if ((physical_row < 0) || (physical_row >= img->height))
     return STP_IMAGE_STATUS_ABORT;
 
-  /* Read until we reach the requested row. */
-  while (physical_row > img->row)
-    {
-      if (image_next_row(img))
-	return STP_IMAGE_STATUS_ABORT;
-    }
+  row_buf = image_get_physical_row(img, physical_row);
+  if (!row_buf)
+    return STP_IMAGE_STATUS_ABORT;
 
-  if (physical_row == img->row)
+  switch (img->bps)
     {
-      unsigned i, j, length;
-      switch (img->bps)
+    case 16:
+    case 8:
+      memcpy(data, row_buf, img->row_width);
+      break;
+    case 1:
+      length = img->width / 8;
+      for (i = 0; i < length; i++)
+	for (j = 128; j > 0; j >>= 1)
+	  {
+	    if (row_buf[i] & j)
+	      data[0] = 255;
+	    else
+	      data[0] = 0;
+	    data++;
+	  }
+      length = img->width % 8;
+      for (j = 128; j > 1 << (7 - length); j >>= 1)
 	{
-	case 16:
-	case 8:
-	  memcpy(data, img->row_buf, img->row_width);
-	  break;
-	case 1:
-	  length = img->width / 8;
-	  for (i = 0; i < length; i++)
-	    for (j = 128; j > 0; j >>= 1)
-	      {
-		if (img->row_buf[i] & j)
-		  data[0] = 255;
-		else
-		  data[0] = 0;
-		data++;
-	      }
-	  length = img->width % 8;
-	  for (j = 128; j > 1 << (7 - length); j >>= 1)
-	    {
-	      if (img->row_buf[i] & j)
-		data[0] = 255;
-	      else
-		data[0] = 0;
-	      data++;
-	    }
-	  break;
-	default:
-	  return STP_IMAGE_STATUS_ABORT;
+	  if (row_buf[i] & j)
+	    data[0] = 255;
+	  else
+	    data[0] = 0;
+	  data++;
 	}
+      break;
+    default:
+      return STP_IMAGE_STATUS_ABORT;
     }
-  else
-    return STP_IMAGE_STATUS_ABORT;
   return STP_IMAGE_STATUS_OK;
 }
 
 
+/* 8 and 16 bit rows are passed on as they were read */
+static stp_image_status_t
+gutenprint_image_get_row_ptr(stp_image_t *image, const unsigned char **data,
+			     size_t byte_limit, int row)
+{
+  IMAGE *img = (IMAGE *)(image->rep);
+  int physical_row = row * img->yres / img->xres;
+
+  if ((img->bps != 8 && img->bps != 16) || img->row_width < byte_limit)
+    return STP_IMAGE_STATUS_OK;
+  if ((physical_row < 0) || (physical_row >= img->height))
+    return STP_IMAGE_STATUS_ABORT;
+
+  *data = (const unsigned char *) image_get_physical_row(img, physical_row);
+  if (!*data)
+    return STP_IMAGE_STATUS_ABORT;
+  return STP_IMAGE_STATUS_OK;
+}
+
 static const char *
 gutenprint_image_get_appname(stp_image_t *image)
 {
@@ -1279,12 +1523,14 @@ main (int argc, char **argv)
 
   /* Printer data goes to file f, but we haven't opened it yet. */
   stp_set_outfunc(img.v, gutenprint_outfunc);
+  stp_set_outvfunc(img.v, gutenprint_outvfunc);
   stp_set_outdata(img.v, NULL);
 
   memset(&si, 0, sizeof(si));
   si.width = gutenprint_image_width;
   si.height = gutenprint_image_height;
   si.get_row = gutenprint_image_get_row;
+  si.get_row_ptr = gutenprint_image_get_row_ptr;
   si.get_appname = gutenprint_image_get_appname;
   si.rep = &img;
 
@@ -1509,7 +1755,9 @@ main (int argc, char **argv)
 	  page_bytes_printed = 0;
 	  if (page == 0)
 	    stp_start_job(img.v, &si);
+	  read_ahead_start(&img);
 	  stp_print(img.v, &si);
+	  read_ahead_finish(&img, 1);
 	  STP_DEBUG(fprintf(stderr, "ijsgutenprint: printed page %d, %.0f bytes\n",
 			    page, page_bytes_printed));
 	  old_v = stp_vars_create_copy(img.v);
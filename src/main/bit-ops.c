@@ -36,88 +36,1096 @@
 #include <limits.h>
 #endif
 
-void
-stp_fold(const unsigned char *line,
-	 int single_length,
-	 unsigned char *outbuf)
+#if defined(HAVE_X86_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#define USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Bit plane folding and unpacking kernels.  The portable versions look
+ * up whole bytes in tables built by stpi_init_bit_kernels(); on x86 with
+ * a suitable compiler, SSE2 and AVX2 versions selected at run time
+ * handle 16 or 32 bytes per step, and the odd 3-bit layouts use the BMI2
+ * bit deposit instruction.  All of them produce exactly the same output.
+ */
+
+typedef void (*fold_func_t)(const unsigned char *line, int single_length,
+			    unsigned char *outbuf);
+typedef void (*unpack_func_t)(int length, const unsigned char *in,
+			      unsigned char **outs);
+
+typedef struct
+{
+  fold_func_t fold_2;
+  fold_func_t fold_3;
+  fold_func_t fold_3_323;
+  fold_func_t fold_4;
+  fold_func_t fold_8;
+  /* Indexed by [bits - 1][log2(n) - 1] */
+  unpack_func_t unpack[2][4];
+} bit_kernels_t;
+
+/* Bit k of a byte moved to bit 2k, 3k or 4k */
+static unsigned short spread_2[256];
+static unsigned spread_3[256];
+static unsigned spread_4[256];
+/* Bits 7-4 (hi) or 3-0 (lo) of a byte moved to bit 0 of bytes 3-0 */
+static unsigned spread_8_hi[256];
+static unsigned spread_8_lo[256];
+/* One byte of stp_fold_3bit_323 output from pixel triples of A, B, C */
+static unsigned char fold_323[512];
+/* Odd bits (hi nibble) and even bits (lo nibble) of a byte, packed */
+static unsigned char unpack_2_1_bits[256];
+/* Pixels 0 and 2 (hi nibble) and 1 and 3 (lo nibble) of a 2-bit byte */
+static unsigned char unpack_2_2_bits[256];
+/* Bits 7-j and 3-j of a byte in bits 1 and 0 of byte j */
+static unsigned unpack_4_1_bits[256];
+/* Pixel j of a 2-bit byte in byte j */
+static unsigned unpack_4_2_bits[256];
+/* Bit 7-j (hi) or 3-j (lo) of a byte in bit 0 of byte j */
+static unsigned unpack_8_1_hi[256];
+static unsigned unpack_8_1_lo[256];
+/* Set pixels of even rank (bits 0-7) and odd count (bit 8), for 1 or 2 bits */
+static unsigned short split_2_bits[2][256];
+
+static void
+build_bit_tables(void)
 {
+  static int built = 0;
+  int i, k;
+  if (built)
+    return;
+  for (i = 0; i < 256; i++)
+    {
+      int rank;
+      spread_2[i] = 0;
+      spread_3[i] = 0;
+      spread_4[i] = 0;
+      spread_8_hi[i] = 0;
+      spread_8_lo[i] = 0;
+      unpack_2_1_bits[i] = 0;
+      unpack_4_1_bits[i] = 0;
+      unpack_8_1_hi[i] = 0;
+      unpack_8_1_lo[i] = 0;
+      for (k = 0; k < 8; k++)
+	if (i & (1 << k))
+	  {
+	    spread_2[i] |= 1 << (2 * k);
+	    spread_3[i] |= 1u << (3 * k);
+	    spread_4[i] |= 1u << (4 * k);
+	    if (k >= 4)
+	      spread_8_hi[i] |= 1u << (8 * (k - 4));
+	    else
+	      spread_8_lo[i] |= 1u << (8 * k);
+	    unpack_2_1_bits[i] |= 1 << ((k & 1) * 4 + k / 2);
+	    unpack_4_1_bits[i] |= 1u << (8 * (3 - (k & 3)) + k / 4);
+	    if (k >= 4)
+	      unpack_8_1_hi[i] |= 1u << (8 * (7 - k));
+	    else
+	      unpack_8_1_lo[i] |= 1u << (8 * (3 - k));
+	  }
+      unpack_2_2_bits[i] = (i & 0xc0) | ((i & 0x0c) << 2) |
+	((i & 0x30) >> 2) | (i & 0x03);
+      unpack_4_2_bits[i] = 0;
+      for (k = 0; k < 4; k++)
+	unpack_4_2_bits[i] |= ((i >> (6 - 2 * k)) & 3u) << (8 * k);
+
+      split_2_bits[0][i] = 0;
+      for (k = 0, rank = 0; k < 8; k++)
+	if (i & (1 << k))
+	  {
+	    if (!(rank & 1))
+	      split_2_bits[0][i] |= 1 << k;
+	    rank++;
+	  }
+      split_2_bits[0][i] |= (rank & 1) << 8;
+      split_2_bits[1][i] = 0;
+      for (k = 0, rank = 0; k < 4; k++)
+	if (i & (3 << (2 * k)))
+	  {
+	    if (!(rank & 1))
+	      split_2_bits[1][i] |= i & (3 << (2 * k));
+	    rank++;
+	  }
+      split_2_bits[1][i] |= (rank & 1) << 8;
+    }
+
+  /*
+   * Each byte of stp_fold_3bit_323 output holds three pixels as
+   * C B A, B A, C B A; the middle pixel has no C bit.
+   */
+  for (i = 0; i < 512; i++)
+    {
+      int a = i & 7, b = (i >> 3) & 7, c = (i >> 6) & 7;
+      fold_323[i] =
+	((c & 4) << 5) | ((b & 4) << 4) | ((a & 4) << 3) |
+	((b & 2) << 3) | ((a & 2) << 2) |
+	((c & 1) << 2) | ((b & 1) << 1) | (a & 1);
+    }
+  built = 1;
+}
+
+static void
+fold_2_c(const unsigned char *line, int single_length, unsigned char *outbuf)
+{
+  const unsigned char *l1 = line + single_length;
   int i;
-  memset(outbuf, 0, single_length * 2);
   for (i = 0; i < single_length; i++)
     {
-      unsigned char l0 = line[0];
-      unsigned char l1 = line[single_length];
-      if (l0 || l1)
+      unsigned out = spread_2[line[i]] | (spread_2[l1[i]] << 1);
+      outbuf[0] = out >> 8;	/* B7 A7 B6 A6 B5 A5 B4 A4 */
+      outbuf[1] = out;		/* B3 A3 B2 A2 B1 A1 B0 A0 */
+      outbuf += 2;
+    }
+}
+
+/*
+ * The portable 3, 4 and 8 plane folds start at byte "start" of each
+ * plane, so that the vector kernels can finish a line with them.
+ */
+static void
+fold_3_from(const unsigned char *line, int single_length, int start,
+	    unsigned char *outbuf)
+{
+  const unsigned char *l1 = line + single_length;
+  const unsigned char *l2 = l1 + single_length;
+  int i;
+  outbuf += start * 3;
+  for (i = start; i < single_length; i++)
+    {
+      unsigned out = spread_3[line[i]] | (spread_3[l1[i]] << 1) |
+	(spread_3[l2[i]] << 2);
+      outbuf[0] = out >> 16;	/* C7 B7 A7 C6 B6 A6 C5 B5 */
+      outbuf[1] = out >> 8;	/* A5 C4 B4 A4 C3 B3 A3 C2 */
+      outbuf[2] = out;		/* B2 A2 C1 B1 A1 C0 B0 A0 */
+      outbuf += 3;
+    }
+}
+
+static void
+fold_3_c(const unsigned char *line, int single_length, unsigned char *outbuf)
+{
+  fold_3_from(line, single_length, 0, outbuf);
+}
+
+/*
+ * Groups of three bytes of each plane make eight bytes of output; a
+ * group that runs off the end of the line is padded with zero.  As
+ * before, only the first single_length * 3 bytes are cleared, and only
+ * groups with some ink are written.
+ */
+static void
+fold_3_323_c(const unsigned char *line, int single_length,
+	     unsigned char *outbuf)
+{
+  int i, m;
+  memset(outbuf, 0, single_length * 3);
+  for (i = 0; i < single_length; i += 3)
+    {
+      unsigned a = line[i] << 16;
+      unsigned b = line[single_length + i] << 16;
+      unsigned c = line[2 * single_length + i] << 16;
+      if (i + 1 < single_length)
 	{
-	  outbuf[0] =		/* B7 A7 B6 A6 B5 A5 B4 A4 */
-	    ((l0 & (1 << 7)) >> 1) +
-	    ((l0 & (1 << 6)) >> 2) +
-	    ((l0 & (1 << 5)) >> 3) +
-	    ((l0 & (1 << 4)) >> 4) +
-	    ((l1 & (1 << 7)) >> 0) +
-	    ((l1 & (1 << 6)) >> 1) +
-	    ((l1 & (1 << 5)) >> 2) +
-	    ((l1 & (1 << 4)) >> 3);
-	  outbuf[1] =		/* B3 A3 B2 A2 B1 A1 B0 A0 */
-	    ((l0 & (1 << 3)) << 3) +
-	    ((l0 & (1 << 2)) << 2) +
-	    ((l0 & (1 << 1)) << 1) +
-	    ((l0 & (1 << 0)) << 0) +
-	    ((l1 & (1 << 3)) << 4) +
-	    ((l1 & (1 << 2)) << 3) +
-	    ((l1 & (1 << 1)) << 2) +
-	    ((l1 & (1 << 0)) << 1);
+	  a |= line[i + 1] << 8;
+	  b |= line[single_length + i + 1] << 8;
+	  c |= line[2 * single_length + i + 1] << 8;
 	}
-      line++;
-      outbuf += 2;
+      if (i + 2 < single_length)
+	{
+	  a |= line[i + 2];
+	  b |= line[single_length + i + 2];
+	  c |= line[2 * single_length + i + 2];
+	}
+      if (a | b | c)
+	for (m = 0; m < 8; m++)
+	  {
+	    int shift = 21 - 3 * m;
+	    outbuf[m] = fold_323[((a >> shift) & 7) | (((b >> shift) & 7) << 3) |
+				 (((c >> shift) & 7) << 6)];
+	  }
+      outbuf += 8;
+    }
+}
+
+static void
+fold_4_from(const unsigned char *line, int single_length, int start,
+	    unsigned char *outbuf)
+{
+  const unsigned char *l1 = line + single_length;
+  const unsigned char *l2 = l1 + single_length;
+  const unsigned char *l3 = l2 + single_length;
+  int i;
+  outbuf += start * 4;
+  for (i = start; i < single_length; i++)
+    {
+      unsigned out = spread_4[line[i]] | (spread_4[l1[i]] << 1) |
+	(spread_4[l2[i]] << 2) | (spread_4[l3[i]] << 3);
+      outbuf[0] = out >> 24;	/* D7 C7 B7 A7 D6 C6 B6 A6 */
+      outbuf[1] = out >> 16;	/* D5 C5 B5 A5 D4 C4 B4 A4 */
+      outbuf[2] = out >> 8;	/* D3 C3 B3 A3 D2 C2 B2 A2 */
+      outbuf[3] = out;		/* D1 C1 B1 A1 D0 C0 B0 A0 */
+      outbuf += 4;
+    }
+}
+
+static void
+fold_4_c(const unsigned char *line, int single_length, unsigned char *outbuf)
+{
+  fold_4_from(line, single_length, 0, outbuf);
+}
+
+static void
+fold_8_from(const unsigned char *line, int single_length, int start,
+	    unsigned char *outbuf)
+{
+  int i, j;
+  outbuf += start * 8;
+  for (i = start; i < single_length; i++)
+    {
+      unsigned hi = 0, lo = 0;
+      for (j = 0; j < 8; j++)
+	{
+	  unsigned char l = line[j * single_length + i];
+	  hi |= spread_8_hi[l] << j;
+	  lo |= spread_8_lo[l] << j;
+	}
+      outbuf[0] = hi >> 24;	/* H7 G7 F7 E7 D7 C7 B7 A7 */
+      outbuf[1] = hi >> 16;
+      outbuf[2] = hi >> 8;
+      outbuf[3] = hi;
+      outbuf[4] = lo >> 24;
+      outbuf[5] = lo >> 16;
+      outbuf[6] = lo >> 8;
+      outbuf[7] = lo;		/* H0 G0 F0 E0 D0 C0 B0 A0 */
+      outbuf += 8;
+    }
+}
+
+static void
+fold_8_c(const unsigned char *line, int single_length, unsigned char *outbuf)
+{
+  fold_8_from(line, single_length, 0, outbuf);
+}
+
+/*
+ * The unpackers gather the bits for each output plane into one byte of
+ * an accumulator, shifting it left as input bytes arrive.  A short last
+ * group is left justified, as the printers expect.
+ */
+
+static void
+unpack_2_1_c(int length, const unsigned char *in, unsigned char **outs)
+{
+  unsigned char *out0 = outs[0], *out1 = outs[1];
+  for (; length >= 2; length -= 2)
+    {
+      unsigned char b0 = unpack_2_1_bits[in[0]];
+      unsigned char b1 = unpack_2_1_bits[in[1]];
+      *out0++ = (b0 & 0xf0) | (b1 >> 4);
+      *out1++ = (b0 << 4) | (b1 & 0x0f);
+      in += 2;
+    }
+  if (length > 0)
+    {
+      unsigned char b0 = unpack_2_1_bits[in[0]];
+      *out0++ = b0 & 0xf0;
+      *out1++ = b0 << 4;
+    }
+  outs[0] = out0;
+  outs[1] = out1;
+}
+
+static void
+unpack_2_2_c(int length, const unsigned char *in, unsigned char **outs)
+{
+  unsigned char *out0 = outs[0], *out1 = outs[1];
+  for (; length > 0; length--)
+    {
+      unsigned char b0 = unpack_2_2_bits[in[0]];
+      unsigned char b1 = unpack_2_2_bits[in[1]];
+      *out0++ = (b0 & 0xf0) | (b1 >> 4);
+      *out1++ = (b0 << 4) | (b1 & 0x0f);
+      in += 2;
+    }
+  outs[0] = out0;
+  outs[1] = out1;
+}
+
+static void
+unpack_4_c(int length, const unsigned char *in, unsigned char **outs,
+	   const unsigned *bits)
+{
+  unsigned acc;
+  int j, k;
+  for (; length > 0; length -= 4)
+    {
+      int count = length < 4 ? length : 4;
+      acc = 0;
+      for (k = 0; k < count; k++)
+	acc = (acc << 2) | bits[*in++];
+      acc <<= 2 * (4 - count);
+      for (j = 0; j < 4; j++)
+	*outs[j]++ = acc >> (8 * j);
+    }
+}
+
+static void
+unpack_4_1_c(int length, const unsigned char *in, unsigned char **outs)
+{
+  unpack_4_c(length, in, outs, unpack_4_1_bits);
+}
+
+static void
+unpack_4_2_c(int length, const unsigned char *in, unsigned char **outs)
+{
+  unpack_4_c(length * 2, in, outs, unpack_4_2_bits);
+}
+
+static void
+unpack_8_1_c(int length, const unsigned char *in, unsigned char **outs)
+{
+  unsigned hi, lo;
+  int j, k;
+  for (; length > 0; length -= 8)
+    {
+      int count = length < 8 ? length : 8;
+      hi = 0;
+      lo = 0;
+      for (k = 0; k < count; k++)
+	{
+	  hi = (hi << 1) | unpack_8_1_hi[*in];
+	  lo = (lo << 1) | unpack_8_1_lo[*in++];
+	}
+      hi <<= 8 - count;
+      lo <<= 8 - count;
+      for (j = 0; j < 4; j++)
+	{
+	  *outs[j]++ = hi >> (8 * j);
+	  *outs[j + 4]++ = lo >> (8 * j);
+	}
+    }
+}
+
+static void
+unpack_8_2_c(int length, const unsigned char *in, unsigned char **outs)
+{
+  unsigned acc0, acc1;
+  int j, k;
+  for (; length > 0; length -= 4)
+    {
+      int count = length < 4 ? length : 4;
+      acc0 = 0;
+      acc1 = 0;
+      for (k = 0; k < count; k++)
+	{
+	  acc0 = (acc0 << 2) | unpack_4_2_bits[in[0]];
+	  acc1 = (acc1 << 2) | unpack_4_2_bits[in[1]];
+	  in += 2;
+	}
+      acc0 <<= 2 * (4 - count);
+      acc1 <<= 2 * (4 - count);
+      for (j = 0; j < 4; j++)
+	{
+	  *outs[j]++ = acc0 >> (8 * j);
+	  *outs[j + 4]++ = acc1 >> (8 * j);
+	}
+    }
+}
+
+static void
+unpack_16_1_c(int length, const unsigned char *in, unsigned char **outs)
+{
+  unsigned acc[4];
+  int j, k;
+  for (; length > 0; length -= 8)
+    {
+      int count = length < 8 ? length : 8;
+      memset(acc, 0, sizeof(acc));
+      for (k = 0; k < count; k++)
+	{
+	  acc[0] = (acc[0] << 1) | unpack_8_1_hi[in[0]];
+	  acc[1] = (acc[1] << 1) | unpack_8_1_lo[in[0]];
+	  acc[2] = (acc[2] << 1) | unpack_8_1_hi[in[1]];
+	  acc[3] = (acc[3] << 1) | unpack_8_1_lo[in[1]];
+	  in += 2;
+	}
+      for (j = 0; j < 16; j++)
+	*outs[j]++ = (acc[j / 4] << (8 - count)) >> (8 * (j & 3));
+    }
+}
+
+/*
+ * Each step takes four bytes, two for planes 0-7 and two for planes
+ * 8-15, but counts as two against length.
+ */
+static void
+unpack_16_2_c(int length, const unsigned char *in, unsigned char **outs)
+{
+  unsigned acc[4];
+  int j, k;
+  for (; length > 0; length -= 8)
+    {
+      int count = length < 8 ? (length + 1) / 2 : 4;
+      memset(acc, 0, sizeof(acc));
+      for (k = 0; k < count; k++)
+	{
+	  for (j = 0; j < 4; j++)
+	    acc[j] = (acc[j] << 2) | unpack_4_2_bits[in[j]];
+	  in += 4;
+	}
+      for (j = 0; j < 16; j++)
+	*outs[j]++ = (acc[j / 4] << (2 * (4 - count))) >> (8 * (j & 3));
+    }
+}
+
+static const bit_kernels_t bit_kernels_c =
+{
+  fold_2_c, fold_3_c, fold_3_323_c, fold_4_c, fold_8_c,
+  {
+    { unpack_2_1_c, unpack_4_1_c, unpack_8_1_c, unpack_16_1_c },
+    { unpack_2_2_c, unpack_4_2_c, unpack_8_2_c, unpack_16_2_c }
+  }
+};
+
+#ifdef USE_X86_SIMD
+/*
+ * Bit k of each 16 bit lane moved to bit 2k, and back.
+ */
+#define SPREAD_2_SSE2(x)						\
+  do									\
+    {									\
+      x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi16(x, 4)),		\
+			_mm_set1_epi16(0x0f0f));			\
+      x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi16(x, 2)),		\
+			_mm_set1_epi16(0x3333));			\
+      x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi16(x, 1)),		\
+			_mm_set1_epi16(0x5555));			\
+    } while (0)
+
+#define SWAP_BYTES_16_SSE2(x)						\
+  _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8))
+
+#define SWAP_BYTES_32_SSE2(x)						\
+  SWAP_BYTES_16_SSE2(_mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xb1), 0xb1))
+
+/* Bits 0, 4, 8...28 of each 32 bit lane packed into its low byte */
+#define GATHER_4_SSE2(x)						\
+  do									\
+    {									\
+      x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi32(x, 3)),		\
+			_mm_set1_epi32(0x03030303));			\
+      x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi32(x, 6)),		\
+			_mm_set1_epi32(0x000f000f));			\
+      x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi32(x, 12)),	\
+			_mm_set1_epi32(0xff));				\
+    } while (0)
+
+/* Pixels 0, 4, 8, 12 (2 bits each) of each 32 bit lane into its low byte */
+#define GATHER_4_2_SSE2(x)						\
+  do									\
+    {									\
+      x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi32(x, 6)),		\
+			_mm_set1_epi32(0x000f000f));			\
+      x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi32(x, 12)),	\
+			_mm_set1_epi32(0xff));				\
+    } while (0)
+
+__attribute__((target("sse2")))
+static void
+fold_2_sse2(const unsigned char *line, int single_length,
+	    unsigned char *outbuf)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i;
+  for (i = 0; i + 16 <= single_length; i += 16)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i *) (line + i));
+      __m128i b = _mm_loadu_si128((const __m128i *)
+				  (line + single_length + i));
+      __m128i a0 = _mm_unpacklo_epi8(a, zero);
+      __m128i a1 = _mm_unpackhi_epi8(a, zero);
+      __m128i b0 = _mm_unpacklo_epi8(b, zero);
+      __m128i b1 = _mm_unpackhi_epi8(b, zero);
+      SPREAD_2_SSE2(a0);
+      SPREAD_2_SSE2(a1);
+      SPREAD_2_SSE2(b0);
+      SPREAD_2_SSE2(b1);
+      a0 = _mm_or_si128(a0, _mm_slli_epi16(b0, 1));
+      a1 = _mm_or_si128(a1, _mm_slli_epi16(b1, 1));
+      _mm_storeu_si128((__m128i *) (outbuf + 2 * i), SWAP_BYTES_16_SSE2(a0));
+      _mm_storeu_si128((__m128i *) (outbuf + 2 * i + 16),
+		       SWAP_BYTES_16_SSE2(a1));
+    }
+  if (i < single_length)
+    {
+      const unsigned char *l1 = line + single_length;
+      for (; i < single_length; i++)
+	{
+	  unsigned out = spread_2[line[i]] | (spread_2[l1[i]] << 1);
+	  outbuf[2 * i] = out >> 8;
+	  outbuf[2 * i + 1] = out;
+	}
+    }
+}
+
+/*
+ * Transpose 16 bytes from each of 8 planes so that each vector holds the
+ * 8 plane bytes for two positions, then peel off one output byte for
+ * every position per movemask.
+ */
+__attribute__((target("sse2")))
+static void
+fold_8_sse2(const unsigned char *line, int single_length,
+	    unsigned char *outbuf)
+{
+  int i, j, k;
+  for (i = 0; i + 16 <= single_length; i += 16)
+    {
+      __m128i r[8], a[8], b[8], c[8];
+      for (j = 0; j < 8; j++)
+	r[j] = _mm_loadu_si128((const __m128i *)
+			       (line + j * single_length + i));
+      for (j = 0; j < 4; j++)
+	{
+	  a[2 * j] = _mm_unpacklo_epi8(r[2 * j], r[2 * j + 1]);
+	  a[2 * j + 1] = _mm_unpackhi_epi8(r[2 * j], r[2 * j + 1]);
+	}
+      for (j = 0; j < 2; j++)
+	{
+	  b[4 * j] = _mm_unpacklo_epi16(a[j], a[j + 2]);
+	  b[4 * j + 1] = _mm_unpackhi_epi16(a[j], a[j + 2]);
+	  b[4 * j + 2] = _mm_unpacklo_epi16(a[j + 4], a[j + 6]);
+	  b[4 * j + 3] = _mm_unpackhi_epi16(a[j + 4], a[j + 6]);
+	}
+      for (j = 0; j < 2; j++)
+	{
+	  c[4 * j] = _mm_unpacklo_epi32(b[4 * j], b[4 * j + 2]);
+	  c[4 * j + 1] = _mm_unpackhi_epi32(b[4 * j], b[4 * j + 2]);
+	  c[4 * j + 2] = _mm_unpacklo_epi32(b[4 * j + 1], b[4 * j + 3]);
+	  c[4 * j + 3] = _mm_unpackhi_epi32(b[4 * j + 1], b[4 * j + 3]);
+	}
+      for (j = 0; j < 8; j++)
+	{
+	  __m128i x = c[j];
+	  unsigned long long out0 = 0, out1 = 0;
+	  for (k = 0; k < 8; k++)
+	    {
+	      unsigned mask = _mm_movemask_epi8(x);
+	      out0 |= (unsigned long long) (mask & 0xff) << (8 * k);
+	      out1 |= (unsigned long long) (mask >> 8) << (8 * k);
+	      x = _mm_add_epi8(x, x);
+	    }
+	  memcpy(outbuf + 8 * (i + 2 * j), &out0, 8);
+	  memcpy(outbuf + 8 * (i + 2 * j + 1), &out1, 8);
+	}
+    }
+  if (i < single_length)
+    fold_8_from(line, single_length, i, outbuf);
+}
+
+__attribute__((target("sse2")))
+static void
+unpack_2_1_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  const __m128i m5 = _mm_set1_epi16(0x5555);
+  unsigned char *out0 = outs[0], *out1 = outs[1];
+  int i;
+  for (i = 0; i + 32 <= length; i += 32)
+    {
+      __m128i e[2], o[2];
+      int h;
+      for (h = 0; h < 2; h++)
+	{
+	  __m128i w = _mm_loadu_si128((const __m128i *) (in + i + 16 * h));
+	  __m128i x, y;
+	  w = SWAP_BYTES_16_SSE2(w);
+	  x = _mm_and_si128(_mm_srli_epi16(w, 1), m5);
+	  y = _mm_and_si128(w, m5);
+	  x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi16(x, 1)),
+			    _mm_set1_epi16(0x3333));
+	  y = _mm_and_si128(_mm_or_si128(y, _mm_srli_epi16(y, 1)),
+			    _mm_set1_epi16(0x3333));
+	  x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi16(x, 2)),
+			    _mm_set1_epi16(0x0f0f));
+	  y = _mm_and_si128(_mm_or_si128(y, _mm_srli_epi16(y, 2)),
+			    _mm_set1_epi16(0x0f0f));
+	  x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi16(x, 4)),
+			    _mm_set1_epi16(0xff));
+	  y = _mm_and_si128(_mm_or_si128(y, _mm_srli_epi16(y, 4)),
+			    _mm_set1_epi16(0xff));
+	  e[h] = x;
+	  o[h] = y;
+	}
+      _mm_storeu_si128((__m128i *) out0, _mm_packus_epi16(e[0], e[1]));
+      _mm_storeu_si128((__m128i *) out1, _mm_packus_epi16(o[0], o[1]));
+      out0 += 16;
+      out1 += 16;
+    }
+  outs[0] = out0;
+  outs[1] = out1;
+  unpack_2_1_c(length - i, in + i, outs);
+}
+
+__attribute__((target("sse2")))
+static void
+unpack_2_2_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  const __m128i m3 = _mm_set1_epi16(0x3333);
+  unsigned char *out0 = outs[0], *out1 = outs[1];
+  int i;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i e[2], o[2];
+      int h;
+      for (h = 0; h < 2; h++)
+	{
+	  __m128i w = _mm_loadu_si128((const __m128i *)
+				      (in + 2 * i + 16 * h));
+	  __m128i x, y;
+	  w = SWAP_BYTES_16_SSE2(w);
+	  x = _mm_and_si128(_mm_srli_epi16(w, 2), m3);
+	  y = _mm_and_si128(w, m3);
+	  x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi16(x, 2)),
+			    _mm_set1_epi16(0x0f0f));
+	  y = _mm_and_si128(_mm_or_si128(y, _mm_srli_epi16(y, 2)),
+			    _mm_set1_epi16(0x0f0f));
+	  x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi16(x, 4)),
+			    _mm_set1_epi16(0xff));
+	  y = _mm_and_si128(_mm_or_si128(y, _mm_srli_epi16(y, 4)),
+			    _mm_set1_epi16(0xff));
+	  e[h] = x;
+	  o[h] = y;
+	}
+      _mm_storeu_si128((__m128i *) out0, _mm_packus_epi16(e[0], e[1]));
+      _mm_storeu_si128((__m128i *) out1, _mm_packus_epi16(o[0], o[1]));
+      out0 += 16;
+      out1 += 16;
+    }
+  outs[0] = out0;
+  outs[1] = out1;
+  unpack_2_2_c(length - i, in + 2 * i, outs);
+}
+
+/*
+ * 64 input bytes to 16 output bytes for each of four planes.  Plane j
+ * takes bits 7-j and 3-j of every input byte (bits == 1) or pixel j
+ * (bits == 2).
+ */
+__attribute__((target("sse2")))
+static void
+unpack_4_sse2(int length, const unsigned char *in, unsigned char **outs,
+	      int bits)
+{
+  int i, j, q;
+  for (i = 0; i + 64 <= length; i += 64)
+    {
+      __m128i w[4];
+      for (q = 0; q < 4; q++)
+	w[q] = SWAP_BYTES_32_SSE2(_mm_loadu_si128((const __m128i *)
+						  (in + i + 16 * q)));
+      for (j = 0; j < 4; j++)
+	{
+	  __m128i x[4];
+	  for (q = 0; q < 4; q++)
+	    {
+	      if (bits == 1)
+		{
+		  x[q] = _mm_and_si128(_mm_srli_epi32(w[q], 3 - j),
+				       _mm_set1_epi32(0x11111111));
+		  GATHER_4_SSE2(x[q]);
+		}
+	      else
+		{
+		  x[q] = _mm_and_si128(_mm_srli_epi32(w[q], 6 - 2 * j),
+				       _mm_set1_epi32(0x03030303));
+		  GATHER_4_2_SSE2(x[q]);
+		}
+	    }
+	  _mm_storeu_si128((__m128i *) outs[j],
+			   _mm_packus_epi16(_mm_packs_epi32(x[0], x[1]),
+					    _mm_packs_epi32(x[2], x[3])));
+	  outs[j] += 16;
+	}
+    }
+  unpack_4_c(length - i, in + i, outs,
+	     bits == 1 ? unpack_4_1_bits : unpack_4_2_bits);
+}
+
+__attribute__((target("sse2")))
+static void
+unpack_4_1_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  unpack_4_sse2(length, in, outs, 1);
+}
+
+__attribute__((target("sse2")))
+static void
+unpack_4_2_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  unpack_4_sse2(length * 2, in, outs, 2);
+}
+
+/*
+ * Reverse each group of 8 input bytes, then each movemask gives one
+ * byte of a plane for two groups.
+ */
+__attribute__((target("sse2")))
+static void
+unpack_8_1_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  int i, j;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i *) (in + i));
+      x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0x1b), 0x1b);
+      x = SWAP_BYTES_16_SSE2(x);
+      for (j = 0; j < 8; j++)
+	{
+	  unsigned mask = _mm_movemask_epi8(x);
+	  outs[j][0] = mask;
+	  outs[j][1] = mask >> 8;
+	  outs[j] += 2;
+	  x = _mm_add_epi8(x, x);
+	}
+    }
+  unpack_8_1_c(length - i, in + i, outs);
+}
+
+/*
+ * Even input bytes hold planes 0-3 and odd ones planes 4-7; separate
+ * them and unpack each as four planes of 2 bit pixels.
+ */
+__attribute__((target("sse2")))
+static void
+unpack_8_2_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  const __m128i low = _mm_set1_epi16(0xff);
+  int i, j, h;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i v0 = _mm_loadu_si128((const __m128i *) (in + 2 * i));
+      __m128i v1 = _mm_loadu_si128((const __m128i *) (in + 2 * i + 16));
+      __m128i half[2];
+      half[0] = _mm_packus_epi16(_mm_and_si128(v0, low),
+				 _mm_and_si128(v1, low));
+      half[1] = _mm_packus_epi16(_mm_srli_epi16(v0, 8),
+				 _mm_srli_epi16(v1, 8));
+      for (h = 0; h < 2; h++)
+	{
+	  __m128i w = SWAP_BYTES_32_SSE2(half[h]);
+	  for (j = 0; j < 4; j++)
+	    {
+	      __m128i x = _mm_and_si128(_mm_srli_epi32(w, 6 - 2 * j),
+					_mm_set1_epi32(0x03030303));
+	      int out;
+	      GATHER_4_2_SSE2(x);
+	      x = _mm_packs_epi32(x, x);
+	      out = _mm_cvtsi128_si32(_mm_packus_epi16(x, x));
+	      memcpy(outs[4 * h + j], &out, 4);
+	      outs[4 * h + j] += 4;
+	    }
+	}
+    }
+  unpack_8_2_c(length - i, in + 2 * i, outs);
+}
+
+static const bit_kernels_t bit_kernels_sse2 =
+{
+  fold_2_sse2, fold_3_c, fold_3_323_c, fold_4_c, fold_8_sse2,
+  {
+    { unpack_2_1_sse2, unpack_4_1_sse2, unpack_8_1_sse2, unpack_16_1_c },
+    { unpack_2_2_sse2, unpack_4_2_sse2, unpack_8_2_sse2, unpack_16_2_c }
+  }
+};
+
+__attribute__((target("avx2")))
+static void
+fold_2_avx2(const unsigned char *line, int single_length,
+	    unsigned char *outbuf)
+{
+  const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+					9, 8, 11, 10, 13, 12, 15, 14,
+					1, 0, 3, 2, 5, 4, 7, 6,
+					9, 8, 11, 10, 13, 12, 15, 14);
+  int i;
+  for (i = 0; i + 16 <= single_length; i += 16)
+    {
+      __m256i a = _mm256_cvtepu8_epi16
+	(_mm_loadu_si128((const __m128i *) (line + i)));
+      __m256i b = _mm256_cvtepu8_epi16
+	(_mm_loadu_si128((const __m128i *) (line + single_length + i)));
+      a = _mm256_and_si256(_mm256_or_si256(a, _mm256_slli_epi16(a, 4)),
+			   _mm256_set1_epi16(0x0f0f));
+      b = _mm256_and_si256(_mm256_or_si256(b, _mm256_slli_epi16(b, 4)),
+			   _mm256_set1_epi16(0x0f0f));
+      a = _mm256_and_si256(_mm256_or_si256(a, _mm256_slli_epi16(a, 2)),
+			   _mm256_set1_epi16(0x3333));
+      b = _mm256_and_si256(_mm256_or_si256(b, _mm256_slli_epi16(b, 2)),
+			   _mm256_set1_epi16(0x3333));
+      a = _mm256_and_si256(_mm256_or_si256(a, _mm256_slli_epi16(a, 1)),
+			   _mm256_set1_epi16(0x5555));
+      b = _mm256_and_si256(_mm256_or_si256(b, _mm256_slli_epi16(b, 1)),
+			   _mm256_set1_epi16(0x5555));
+      a = _mm256_or_si256(a, _mm256_slli_epi16(b, 1));
+      _mm256_storeu_si256((__m256i *) (outbuf + 2 * i),
+			  _mm256_shuffle_epi8(a, swap));
+    }
+  if (i < single_length)
+    {
+      const unsigned char *l1 = line + single_length;
+      for (; i < single_length; i++)
+	{
+	  unsigned out = spread_2[line[i]] | (spread_2[l1[i]] << 1);
+	  outbuf[2 * i] = out >> 8;
+	  outbuf[2 * i + 1] = out;
+	}
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+fold_4_avx2(const unsigned char *line, int single_length,
+	    unsigned char *outbuf)
+{
+  const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+					11, 10, 9, 8, 15, 14, 13, 12,
+					3, 2, 1, 0, 7, 6, 5, 4,
+					11, 10, 9, 8, 15, 14, 13, 12);
+  int i, j;
+  for (i = 0; i + 8 <= single_length; i += 8)
+    {
+      __m256i out = _mm256_setzero_si256();
+      for (j = 0; j < 4; j++)
+	{
+	  __m256i x = _mm256_cvtepu8_epi32
+	    (_mm_loadl_epi64((const __m128i *) (line + j * single_length + i)));
+	  x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 12)),
+			       _mm256_set1_epi32(0x000f000f));
+	  x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 6)),
+			       _mm256_set1_epi32(0x03030303));
+	  x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 3)),
+			       _mm256_set1_epi32(0x11111111));
+	  out = _mm256_or_si256(out, _mm256_slli_epi32(x, j));
+	}
+      _mm256_storeu_si256((__m256i *) (outbuf + 4 * i),
+			  _mm256_shuffle_epi8(out, swap));
+    }
+  if (i < single_length)
+    fold_4_from(line, single_length, i, outbuf);
+}
+
+/*
+ * As fold_8_sse2, but each 128 bit lane works on its own 16 positions.
+ */
+__attribute__((target("avx2")))
+static void
+fold_8_avx2(const unsigned char *line, int single_length,
+	    unsigned char *outbuf)
+{
+  int i, j, k;
+  for (i = 0; i + 32 <= single_length; i += 32)
+    {
+      __m256i r[8], a[8], b[8], c[8];
+      for (j = 0; j < 8; j++)
+	r[j] = _mm256_loadu_si256((const __m256i *)
+				  (line + j * single_length + i));
+      for (j = 0; j < 4; j++)
+	{
+	  a[2 * j] = _mm256_unpacklo_epi8(r[2 * j], r[2 * j + 1]);
+	  a[2 * j + 1] = _mm256_unpackhi_epi8(r[2 * j], r[2 * j + 1]);
+	}
+      for (j = 0; j < 2; j++)
+	{
+	  b[4 * j] = _mm256_unpacklo_epi16(a[j], a[j + 2]);
+	  b[4 * j + 1] = _mm256_unpackhi_epi16(a[j], a[j + 2]);
+	  b[4 * j + 2] = _mm256_unpacklo_epi16(a[j + 4], a[j + 6]);
+	  b[4 * j + 3] = _mm256_unpackhi_epi16(a[j + 4], a[j + 6]);
+	}
+      for (j = 0; j < 2; j++)
+	{
+	  c[4 * j] = _mm256_unpacklo_epi32(b[4 * j], b[4 * j + 2]);
+	  c[4 * j + 1] = _mm256_unpackhi_epi32(b[4 * j], b[4 * j + 2]);
+	  c[4 * j + 2] = _mm256_unpacklo_epi32(b[4 * j + 1], b[4 * j + 3]);
+	  c[4 * j + 3] = _mm256_unpackhi_epi32(b[4 * j + 1], b[4 * j + 3]);
+	}
+      for (j = 0; j < 8; j++)
+	{
+	  __m256i x = c[j];
+	  unsigned long long out[4] = { 0, 0, 0, 0 };
+	  for (k = 0; k < 8; k++)
+	    {
+	      unsigned mask = _mm256_movemask_epi8(x);
+	      out[0] |= (unsigned long long) (mask & 0xff) << (8 * k);
+	      out[1] |= (unsigned long long) ((mask >> 8) & 0xff) << (8 * k);
+	      out[2] |= (unsigned long long) ((mask >> 16) & 0xff) << (8 * k);
+	      out[3] |= (unsigned long long) (mask >> 24) << (8 * k);
+	      x = _mm256_add_epi8(x, x);
+	    }
+	  memcpy(outbuf + 8 * (i + 2 * j), &out[0], 8);
+	  memcpy(outbuf + 8 * (i + 2 * j + 1), &out[1], 8);
+	  memcpy(outbuf + 8 * (i + 16 + 2 * j), &out[2], 8);
+	  memcpy(outbuf + 8 * (i + 16 + 2 * j + 1), &out[3], 8);
+	}
+    }
+  if (i < single_length)
+    fold_8_from(line, single_length, i, outbuf);
+}
+
+__attribute__((target("avx2")))
+static void
+unpack_8_1_avx2(int length, const unsigned char *in, unsigned char **outs)
+{
+  const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+					   15, 14, 13, 12, 11, 10, 9, 8,
+					   7, 6, 5, 4, 3, 2, 1, 0,
+					   15, 14, 13, 12, 11, 10, 9, 8);
+  int i, j;
+  for (i = 0; i + 32 <= length; i += 32)
+    {
+      __m256i x = _mm256_loadu_si256((const __m256i *) (in + i));
+      x = _mm256_shuffle_epi8(x, reverse);
+      for (j = 0; j < 8; j++)
+	{
+	  unsigned mask = _mm256_movemask_epi8(x);
+	  memcpy(outs[j], &mask, 4);
+	  outs[j] += 4;
+	  x = _mm256_add_epi8(x, x);
+	}
+    }
+  unpack_8_1_c(length - i, in + i, outs);
+}
+
+/*
+ * The 3 bit layouts deposit each plane's bits straight into place.
+ */
+#define FOLD_3_MASK 0x249249249249ull	/* Every third bit of 48 */
+#define FOLD_323_A_MASK 0x2929292929292929ull
+#define FOLD_323_C_MASK 0x8484848484848484ull
+#define FOLD_323_C_PIXELS 0xb6db6du	/* Pixels with a C bit */
+
+__attribute__((target("bmi2")))
+static void
+fold_3_bmi2(const unsigned char *line, int single_length,
+	    unsigned char *outbuf)
+{
+  const unsigned char *l1 = line + single_length;
+  const unsigned char *l2 = l1 + single_length;
+  int i;
+  for (i = 0; i + 2 <= single_length; i += 2)
+    {
+      unsigned long long out =
+	_pdep_u64((line[i] << 8) | line[i + 1], FOLD_3_MASK) |
+	_pdep_u64((l1[i] << 8) | l1[i + 1], FOLD_3_MASK << 1) |
+	_pdep_u64((l2[i] << 8) | l2[i + 1], FOLD_3_MASK << 2);
+      out = __builtin_bswap64(out << 16);
+      memcpy(outbuf, &out, 6);
+      outbuf += 6;
+    }
+  if (i < single_length)
+    fold_3_from(line, single_length, i, outbuf - 3 * i);
+}
+
+__attribute__((target("bmi2")))
+static void
+fold_3_323_bmi2(const unsigned char *line, int single_length,
+		unsigned char *outbuf)
+{
+  int i;
+  memset(outbuf, 0, single_length * 3);
+  for (i = 0; i < single_length; i += 3)
+    {
+      unsigned a = line[i] << 16;
+      unsigned b = line[single_length + i] << 16;
+      unsigned c = line[2 * single_length + i] << 16;
+      if (i + 1 < single_length)
+	{
+	  a |= line[i + 1] << 8;
+	  b |= line[single_length + i + 1] << 8;
+	  c |= line[2 * single_length + i + 1] << 8;
+	}
+      if (i + 2 < single_length)
+	{
+	  a |= line[i + 2];
+	  b |= line[single_length + i + 2];
+	  c |= line[2 * single_length + i + 2];
+	}
+      if (a | b | c)
+	{
+	  unsigned long long out =
+	    _pdep_u64(a, FOLD_323_A_MASK) |
+	    _pdep_u64(b, FOLD_323_A_MASK << 1) |
+	    _pdep_u64(_pext_u32(c, FOLD_323_C_PIXELS), FOLD_323_C_MASK);
+	  out = __builtin_bswap64(out);
+	  memcpy(outbuf, &out, 8);
+	}
+      outbuf += 8;
     }
 }
 
+static const bit_kernels_t bit_kernels_avx2 =
+{
+  fold_2_avx2, fold_3_bmi2, fold_3_323_bmi2, fold_4_avx2, fold_8_avx2,
+  {
+    { unpack_2_1_sse2, unpack_4_1_sse2, unpack_8_1_avx2, unpack_16_1_c },
+    { unpack_2_2_sse2, unpack_4_2_sse2, unpack_8_2_sse2, unpack_16_2_c }
+  }
+};
+#endif
+
+static const bit_kernels_t *bit_kernels = &bit_kernels_c;
+
+int
+stpi_bit_kernels_set_level(int level)
+{
+  int available = STPI_BIT_KERNELS_PORTABLE;
+  build_bit_tables();
+#ifdef USE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+    available = STPI_BIT_KERNELS_AVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    available = STPI_BIT_KERNELS_SSE2;
+#endif
+  if (level < 0 || level > available)
+    level = available;
+  switch (level)
+    {
+#ifdef USE_X86_SIMD
+    case STPI_BIT_KERNELS_AVX2:
+      bit_kernels = &bit_kernels_avx2;
+      break;
+    case STPI_BIT_KERNELS_SSE2:
+      bit_kernels = &bit_kernels_sse2;
+      break;
+#endif
+    default:
+      bit_kernels = &bit_kernels_c;
+      level = STPI_BIT_KERNELS_PORTABLE;
+    }
+  return level;
+}
+
+void
+stpi_init_bit_kernels(void)
+{
+  (void) stpi_bit_kernels_set_level(-1);
+}
+
+void
+stp_fold(const unsigned char *line,
+	 int single_length,
+	 unsigned char *outbuf)
+{
+  (bit_kernels->fold_2)(line, single_length, outbuf);
+}
+
 void
 stp_fold_3bit(const unsigned char *line,
                 int single_length,
                 unsigned char *outbuf)
 {
-  int i;
-  memset(outbuf, 0, single_length * 3);
-  for (i = 0; i < single_length; i++)
-    {
-      unsigned char l0 = line[0];
-      unsigned char l1 = line[single_length];
-      unsigned char l2 = line[single_length * 2];
-      if (l0 || l1 || l2)
-	{
-	  outbuf[0] =		/* C7 B7 A7 C6 B6 A6 C5 B5  */
-	    ((l0 & (1 << 7)) >> 2) |
-	    ((l0 & (1 << 6)) >> 4) |
-	    ((l1 & (1 << 7)) >> 1) |
-	    ((l1 & (1 << 6)) >> 3) |
-	    ((l1 & (1 << 5)) >> 5) |
-	    ((l2 & (1 << 7)) << 0) |
-	    ((l2 & (1 << 6)) >> 2) |
-	    ((l2 & (1 << 5)) >> 4);
-	  outbuf[1] =		/* A5 C4 B4 A4 C3 B3 A3 C2 */
-	    ((l0 & (1 << 5)) << 2) |
-	    ((l0 & (1 << 4)) << 0) |
-	    ((l0 & (1 << 3)) >> 2) |
-	    ((l1 & (1 << 4)) << 1) |
-	    ((l1 & (1 << 3)) >> 1) |
-	    ((l2 & (1 << 4)) << 2) |
-	    ((l2 & (1 << 3)) << 0) |
-	    ((l2 & (1 << 2)) >> 2);
-	  outbuf[2] =		/* B2 A2 C1 B1 A1 C0 B0 A0 */
-	    ((l0 & (1 << 2)) << 4) |
-	    ((l0 & (1 << 1)) << 2) |
-	    ((l0 & (1 << 0)) << 0) |
-	    ((l1 & (1 << 2)) << 5) |
-	    ((l1 & (1 << 1)) << 3) |
-	    ((l1 & (1 << 0)) << 1) |
-	    ((l2 & (1 << 1)) << 4) |
-	    ((l2 & (1 << 0)) << 2);
-	}
-    line++;
-    outbuf += 3;
-  }
+  (bit_kernels->fold_3)(line, single_length, outbuf);
 }
 
 void
@@ -125,98 +1133,7 @@ stp_fold_3bit_323(const unsigned char *line,
 		  int single_length,
 		  unsigned char *outbuf)
 {
-  const unsigned char *last= line + single_length;
-  memset(outbuf, 0, single_length * 3);
-  for (; line < last; line += 3)
-    {
-      unsigned char A0 = line[0];
-      unsigned char B0 = line[single_length];
-      unsigned char C0 = line[2*single_length];
-      unsigned char A1 = (line < last - 2) ? line[1] : 0;
-      unsigned char B1 = (line < last - 2) ? line[single_length + 1] : 0;
-      unsigned char C1 = (line < last - 2) ? line[(single_length * 2) + 1] : 0;
-      unsigned char A2 = (line < last - 1) ? line[2] : 0;
-      unsigned char B2 = (line < last - 1) ? line[single_length + 2] : 0;
-      unsigned char C2 = (line < last - 1) ? line[(single_length * 2) + 2] : 0;
-
-      if (A0 || A1 || A2 || B0 || B1 || B2 || C0 || C1 || C2)
-	{
-	  /* Missing: C0_6, C0_3, C0_0, C1_5, C1_2, C2_7, C2_4, C2_1 ??? */
-	  outbuf[0] =		/* C0_7 B0_7 A0_7 B0_6 A0_6 C0_5 B0_5 A0_5 */
-	    ((C0 & (1 << 7)) >> 0) |
-	    ((B0 & (1 << 7)) >> 1) |
-	    ((A0 & (1 << 7)) >> 2) |
-	    ((B0 & (1 << 6)) >> 2) |
-	    ((A0 & (1 << 6)) >> 3) |
-	    ((C0 & (1 << 5)) >> 3) |
-	    ((B0 & (1 << 5)) >> 4) |
-	    ((A0 & (1 << 5)) >> 5);
-	  outbuf[1] =		/* C0_4 B0_4 A0_4 B0_3 A0_3 C0_2 B0_2 A0_2 */
-	    ((C0 & (1 << 4)) << 3) |
-	    ((B0 & (1 << 4)) << 2) |
-	    ((A0 & (1 << 4)) << 1) |
-	    ((B0 & (1 << 3)) << 1) |
-	    ((A0 & (1 << 3)) << 0) |
-	    ((C0 & (1 << 2)) >> 0) |
-	    ((B0 & (1 << 2)) >> 1) |
-	    ((A0 & (1 << 2)) >> 2);
-	  outbuf[2] =		/* C0_1 B0_1 A0_1 B0_0 A0_0 C1_7 B1_7 A1_7 */
-	    ((C0 & (1 << 1)) << 6) |
-	    ((B0 & (1 << 1)) << 5) |
-	    ((A0 & (1 << 1)) << 4) |
-	    ((B0 & (1 << 0)) << 4) |
-	    ((A0 & (1 << 0)) << 3) |
-	    ((C1 & (1 << 7)) >> 5) |
-	    ((B1 & (1 << 7)) >> 6) |
-	    ((A1 & (1 << 7)) >> 7);
-	  outbuf[3] =		/* C1_6 B1_6 A1_6 B1_5 A1_5 C1_4 B1_4 A1_4 */
-	    ((C1 & (1 << 6)) << 1) |
-	    ((B1 & (1 << 6)) << 0) |
-	    ((A1 & (1 << 6)) >> 1) |
-	    ((B1 & (1 << 5)) >> 1) |
-	    ((A1 & (1 << 5)) >> 2) |
-	    ((C1 & (1 << 4)) >> 2) |
-	    ((B1 & (1 << 4)) >> 3) |
-	    ((A1 & (1 << 4)) >> 4);
-	  outbuf[4] =		/* C1_3 B1_3 A1_3 B1_2 A1_2 C1_1 B1_1 A1_1 */
-	    ((C1 & (1 << 3)) << 4) |
-	    ((B1 & (1 << 3)) << 3) |
-	    ((A1 & (1 << 3)) << 2) |
-	    ((B1 & (1 << 2)) << 2) |
-	    ((A1 & (1 << 2)) << 1) |
-	    ((C1 & (1 << 1)) << 1) |
-	    ((B1 & (1 << 1)) >> 0) |
-	    ((A1 & (1 << 1)) >> 1);
-	  outbuf[5] =		/* C1_0 B1_0 A1_0 B2_7 A2_7 C2_6 B2_6 A2_6 */
-	    ((C1 & (1 << 0)) << 7) |
-	    ((B1 & (1 << 0)) << 6) |
-	    ((A1 & (1 << 0)) << 5) |
-	    ((B2 & (1 << 7)) >> 3) |
-	    ((A2 & (1 << 7)) >> 4) |
-	    ((C2 & (1 << 6)) >> 4) |
-	    ((B2 & (1 << 6)) >> 5) |
-	    ((A2 & (1 << 6)) >> 6);
-	  outbuf[6] =		/* C2_5 B2_5 A2_5 B2_4 A2_4 C2_3 B2_3 A2_3 */
-	    ((C2 & (1 << 5)) << 2) |
-	    ((B2 & (1 << 5)) << 1) |
-	    ((A2 & (1 << 5)) << 0) |
-	    ((B2 & (1 << 4)) >> 0) |
-	    ((A2 & (1 << 4)) >> 1) |
-	    ((C2 & (1 << 3)) >> 1) |
-	    ((B2 & (1 << 3)) >> 2) |
-	    ((A2 & (1 << 3)) >> 3);
-	  outbuf[7] =		/* C2_2 B2_2 A2_2 B2_1 A2_1 C2_0 B2_0 A2_0 */
-	    ((C2 & (1 << 2)) << 5) |
-	    ((B2 & (1 << 2)) << 4) |
-	    ((A2 & (1 << 2)) << 3) |
-	    ((B2 & (1 << 1)) << 3) |
-	    ((A2 & (1 << 1)) << 2) |
-	    ((C2 & (1 << 0)) << 2) |
-	    ((B2 & (1 << 0)) << 1) |
-	    ((A2 & (1 << 0)) << 0);
-	}
-      outbuf += 8;
-    }
+  (bit_kernels->fold_3_323)(line, single_length, outbuf);
 }
 
 void
@@ -224,59 +1141,7 @@ stp_fold_4bit(const unsigned char *line,
                 int single_length,
                 unsigned char *outbuf)
 {
-  int i;
-  memset(outbuf, 0, single_length * 4);
-  for (i = 0; i < single_length; i++)
-    {
-      unsigned char l0 = line[0];
-      unsigned char l1 = line[single_length];
-      unsigned char l2 = line[single_length*2];
-      unsigned char l3 = line[single_length*3];
-      if (l0 || l1 || l2 || l3)
-	{
-	  outbuf[0] =		/* D7 C7 B7 A7 D6 C6 B6 A6 */
-            ((l3 & (1 << 7)) >> 0)|
-            ((l2 & (1 << 7)) >> 1)|
-            ((l1 & (1 << 7)) >> 2)|
-            ((l0 & (1 << 7)) >> 3)|
-            ((l3 & (1 << 6)) >> 3)|
-            ((l2 & (1 << 6)) >> 4)|
-            ((l1 & (1 << 6)) >> 5)|
-            ((l0 & (1 << 6)) >> 6);
-
-	  outbuf[1] =		/* D5 C5 B5 A5 D4 C4 B4 A4 */
-            ((l3 & (1 << 5)) << 2)|
-            ((l2 & (1 << 5)) << 1)|
-            ((l1 & (1 << 5)) << 0)|
-            ((l0 & (1 << 5)) >> 1)|
-            ((l3 & (1 << 4)) >> 1)|
-            ((l2 & (1 << 4)) >> 2)|
-            ((l1 & (1 << 4)) >> 3)|
-            ((l0 & (1 << 4)) >> 4);
-
-	  outbuf[2] =		/* D3 C3 B3 A3 D2 C2 B2 A2 */
-            ((l3 & (1 << 3)) << 4)|
-            ((l2 & (1 << 3)) << 3)|
-            ((l1 & (1 << 3)) << 2)|
-            ((l0 & (1 << 3)) << 1)|
-            ((l3 & (1 << 2)) << 1)|
-            ((l2 & (1 << 2)) << 0)|
-            ((l1 & (1 << 2)) >> 1)|
-            ((l0 & (1 << 2)) >> 2);
-
-	  outbuf[3] =		/* D1 C1 B1 A1 D0 C0 B0 A0 */
-            ((l3 & (1 << 1)) << 6)|
-            ((l2 & (1 << 1)) << 5)|
-            ((l1 & (1 << 1)) << 4)|
-            ((l0 & (1 << 1)) << 3)|
-            ((l3 & (1 << 0)) << 3)|
-            ((l2 & (1 << 0)) << 2)|
-            ((l1 & (1 << 0)) << 1)|
-            ((l0 & (1 << 0)) << 0);
-	}
-      line++;
-      outbuf += 4;
-    }
+  (bit_kernels->fold_4)(line, single_length, outbuf);
 }
 
 void
@@ -284,118 +1149,14 @@ stp_fold_8bit(const unsigned char *line,
                 int single_length,
                 unsigned char *outbuf)
 {
-  int i;
-  memset(outbuf, 0, single_length * 8);
-  for (i = 0; i < single_length; i++)
-    {
-      unsigned char l0 = line[0];
-      unsigned char l1 = line[single_length];
-      unsigned char l2 = line[single_length*2];
-      unsigned char l3 = line[single_length*3];
-      unsigned char l4 = line[single_length*4];
-      unsigned char l5 = line[single_length*5];
-      unsigned char l6 = line[single_length*6];
-      unsigned char l7 = line[single_length*7];
-      if (l0 || l1 || l2 || l3 || l4 || l5 || l6 || l7)
-	{
-	  outbuf[0] =		/* H7 G7 F7 E7 D7 C7 B7 A7 */
-            ((l7 & (1 << 7)) >> 0)|
-            ((l6 & (1 << 7)) >> 1)|
-            ((l5 & (1 << 7)) >> 2)|
-            ((l4 & (1 << 7)) >> 3)|
-            ((l3 & (1 << 7)) >> 4)|
-            ((l2 & (1 << 7)) >> 5)|
-            ((l1 & (1 << 7)) >> 6)|
-            ((l0 & (1 << 7)) >> 7);
-
-	  outbuf[1] =		/* H6 G6 F6 E6 D6 C6 B6 A6 */
-            ((l7 & (1 << 6)) << 1)|
-            ((l6 & (1 << 6)) >> 0)|
-            ((l5 & (1 << 6)) >> 1)|
-            ((l4 & (1 << 6)) >> 2)|
-            ((l3 & (1 << 6)) >> 3)|
-            ((l2 & (1 << 6)) >> 4)|
-            ((l1 & (1 << 6)) >> 5)|
-            ((l0 & (1 << 6)) >> 6);
-
-	  outbuf[2] =		/* H5 G5 F5 E5 D5 C5 B5 A5 */
-            ((l7 & (1 << 5)) << 2)|
-            ((l6 & (1 << 5)) << 1)|
-            ((l5 & (1 << 5)) >> 0)|
-            ((l4 & (1 << 5)) >> 1)|
-            ((l3 & (1 << 5)) >> 2)|
-            ((l2 & (1 << 5)) >> 3)|
-            ((l1 & (1 << 5)) >> 4)|
-            ((l0 & (1 << 5)) >> 5);
-
-	  outbuf[3] =		/* H4 G4 F4 E4 D4 C4 B4 A4 */
-            ((l7 & (1 << 4)) << 3)|
-            ((l6 & (1 << 4)) << 2)|
-            ((l5 & (1 << 4)) << 1)|
-            ((l4 & (1 << 4)) >> 0)|
-            ((l3 & (1 << 4)) >> 1)|
-            ((l2 & (1 << 4)) >> 2)|
-            ((l1 & (1 << 4)) >> 3)|
-            ((l0 & (1 << 4)) >> 4);
-	  outbuf[4] =		/* H3 G3 F3 E3 D3 C3 B3 A3 */
-            ((l7 & (1 << 3)) << 4)|
-            ((l6 & (1 << 3)) << 3)|
-            ((l5 & (1 << 3)) << 2)|
-            ((l4 & (1 << 3)) << 1)|
-            ((l3 & (1 << 3)) >> 0)|
-            ((l2 & (1 << 3)) >> 1)|
-            ((l1 & (1 << 3)) >> 2)|
-            ((l0 & (1 << 3)) >> 3);
-
-	  outbuf[5] =		/* H2 G2 F2 E2 D2 C2 B2 A2 */
-            ((l7 & (1 << 2)) << 5)|
-            ((l6 & (1 << 2)) << 4)|
-            ((l5 & (1 << 2)) << 3)|
-            ((l4 & (1 << 2)) << 2)|
-            ((l3 & (1 << 2)) << 1)|
-            ((l2 & (1 << 2)) >> 0)|
-            ((l1 & (1 << 2)) >> 1)|
-            ((l0 & (1 << 2)) >> 2);
-
-	  outbuf[6] =		/* H1 G1 F1 E1 D1 C1 B1 A1 */
-            ((l7 & (1 << 1)) << 6)|
-            ((l6 & (1 << 1)) << 5)|
-            ((l5 & (1 << 1)) << 4)|
-            ((l4 & (1 << 1)) << 3)|
-            ((l3 & (1 << 1)) << 2)|
-            ((l2 & (1 << 1)) << 1)|
-            ((l1 & (1 << 1)) >> 0)|
-            ((l0 & (1 << 1)) >> 1);
-
-	  outbuf[7] =		/* H0 G0 F0 E0 D0 C0 B0 A0 */
-            ((l7 & (1 << 0)) << 7)|
-            ((l6 & (1 << 0)) << 6)|
-            ((l5 & (1 << 0)) << 5)|
-            ((l4 & (1 << 0)) << 4)|
-            ((l3 & (1 << 0)) << 3)|
-            ((l2 & (1 << 0)) << 2)|
-            ((l1 & (1 << 0)) << 1)|
-            ((l0 & (1 << 0)) >> 0);
-	}
-      line++;
-      outbuf += 8;
-    }
+  (bit_kernels->fold_8)(line, single_length, outbuf);
 }
 
-#define SPLIT_MASK(k, b) (((1 << (b)) - 1) << ((k) * (b)))
-
-#define SPLIT_STEP(k, b, i, o, in, r, inc, rl)	\
-do						\
-  {						\
-    if (in & SPLIT_MASK(k, b))			\
-      {						\
-	o[r][i] |= SPLIT_MASK(k, b) & in;	\
-	r += inc;				\
-	if (r >= rl)				\
-	  r = 0;				\
-      }						\
-  } while (0)
-
+/*
+ * Nonzero pixels are dealt out to the n rows in turn.  With two rows,
+ * the pixels of even rank go to the current row and the rest to the
+ * other.  Otherwise each set pixel is found by clearing the lowest.
+ */
 void
 stp_split(int length,
 	  int bits,
@@ -407,42 +1168,37 @@ stp_split(int length,
   int row = 0;
   int limit = length * bits;
   int rlimit = n * increment;
+  const unsigned short *split_2 = split_2_bits[bits == 1 ? 0 : 1];
   int i;
   for (i = 1; i < n; i++)
     memset(outs[i * increment], 0, limit);
 
-  if (bits == 1)
+  for (i = 0; i < limit; i++)
     {
-      for (i = 0; i < limit; i++)
+      unsigned inbyte = in[i];
+      outs[0][i] = 0;
+      if (inbyte == 0)
+	continue;
+      if (n == 2)
 	{
-	  unsigned char inbyte = in[i];
-	  outs[0][i] = 0;
-	  if (inbyte == 0)
-	    continue;
-	  /* For some reason gcc isn't unrolling this, even with -funroll-loops */
-	  SPLIT_STEP(0, 1, i, outs, inbyte, row, increment, rlimit);
-	  SPLIT_STEP(1, 1, i, outs, inbyte, row, increment, rlimit);
-	  SPLIT_STEP(2, 1, i, outs, inbyte, row, increment, rlimit);
-	  SPLIT_STEP(3, 1, i, outs, inbyte, row, increment, rlimit);
-	  SPLIT_STEP(4, 1, i, outs, inbyte, row, increment, rlimit);
-	  SPLIT_STEP(5, 1, i, outs, inbyte, row, increment, rlimit);
-	  SPLIT_STEP(6, 1, i, outs, inbyte, row, increment, rlimit);
-	  SPLIT_STEP(7, 1, i, outs, inbyte, row, increment, rlimit);
+	  unsigned even = split_2[inbyte];
+	  outs[row][i] |= even & 0xff;
+	  outs[increment - row][i] |= (inbyte & ~even) & 0xff;
+	  if (even & 0x100)
+	    row = increment - row;
 	}
-    }
-  else
-    {
-      for (i = 0; i < limit; i++)
+      else
 	{
-	  unsigned char inbyte = in[i];
-	  outs[0][i] = 0;
-	  if (inbyte == 0)
-	    continue;
-	  /* For some reason gcc isn't unrolling this, even with -funroll-loops */
-	  SPLIT_STEP(0, 2, i, outs, inbyte, row, increment, rlimit);
-	  SPLIT_STEP(1, 2, i, outs, inbyte, row, increment, rlimit);
-	  SPLIT_STEP(2, 2, i, outs, inbyte, row, increment, rlimit);
-	  SPLIT_STEP(3, 2, i, outs, inbyte, row, increment, rlimit);
+	  unsigned pixels = bits == 1 ? inbyte : (inbyte | (inbyte >> 1)) & 0x55;
+	  while (pixels)
+	    {
+	      unsigned lowest = pixels & -pixels;
+	      outs[row][i] |= bits == 1 ? lowest : (lowest * 3) & inbyte;
+	      row += increment;
+	      if (row >= rlimit)
+		row = 0;
+	      pixels &= pixels - 1;
+	    }
 	}
     }
 }
@@ -477,523 +1233,6 @@ stp_split_4(int length,
   stp_split(length, bits, 4, in, 1, outs);
 }
 
-
-static void
-stpi_unpack_2_1(int length,
-		const unsigned char *in,
-		unsigned char **outs)
-{
-  unsigned char	tempin, bit, temp0, temp1;
-
-  if (length <= 0)
-    return;
-  for (bit = 128, temp0 = 0, temp1 = 0;
-       length > 0;
-       length --)
-    {
-      tempin = *in++;
-
-      if (tempin & 128)
-        temp0 |= bit;
-      if (tempin & 64)
-        temp1 |= bit;
-      bit >>= 1;
-      if (tempin & 32)
-        temp0 |= bit;
-      if (tempin & 16)
-        temp1 |= bit;
-      bit >>= 1;
-      if (tempin & 8)
-        temp0 |= bit;
-      if (tempin & 4)
-        temp1 |= bit;
-      bit >>= 1;
-      if (tempin & 2)
-        temp0 |= bit;
-      if (tempin & 1)
-        temp1 |= bit;
-
-      if (bit > 1)
-        bit >>= 1;
-      else
-      {
-        bit     = 128;
-	*outs[0]++ = temp0;
-	*outs[1]++ = temp1;
-
-	temp0   = 0;
-	temp1   = 0;
-      }
-    }
-
-  if (bit < 128)
-    {
-      *outs[0]++ = temp0;
-      *outs[1]++ = temp1;
-    }
-}
-
-static void
-stpi_unpack_2_2(int length,
-		const unsigned char *in,
-		unsigned char **outs)
-{
-  if (length <= 0)
-    return;
-
-  for (;length;length --)
-    {
-      unsigned char ti0, ti1;
-      ti0 = in[0];
-      ti1 = in[1];
-
-      *outs[0]++  = (ti0 & 0xc0) << 0
-	| (ti0 & 0x0c) << 2
-	| (ti1 & 0xc0) >> 4
-	| (ti1 & 0x0c) >> 2;
-      *outs[1]++  = (ti0 & 0x30) << 2
-	| (ti0 & 0x03) << 4
-	| (ti1 & 0x30) >> 2
-	| (ti1 & 0x03) >> 0;
-      in += 2;
-    }
-}
-
-static void
-stpi_unpack_4_1(int length,
-		 const unsigned char *in,
-		 unsigned char **outs)
-{
-  unsigned char	tempin, bit, temp0, temp1, temp2, temp3;
-
-  if (length <= 0)
-    return;
-  for (bit = 128, temp0 = 0, temp1 = 0, temp2 = 0, temp3 = 0;
-       length > 0;
-       length --)
-    {
-      tempin = *in++;
-
-      if (tempin & 128)
-        temp0 |= bit;
-      if (tempin & 64)
-        temp1 |= bit;
-      if (tempin & 32)
-        temp2 |= bit;
-      if (tempin & 16)
-        temp3 |= bit;
-      bit >>= 1;
-      if (tempin & 8)
-        temp0 |= bit;
-      if (tempin & 4)
-        temp1 |= bit;
-      if (tempin & 2)
-        temp2 |= bit;
-      if (tempin & 1)
-        temp3 |= bit;
-
-      if (bit > 1)
-        bit >>= 1;
-      else
-      {
-        bit     = 128;
-	*outs[0]++ = temp0;
-	*outs[1]++ = temp1;
-	*outs[2]++ = temp2;
-	*outs[3]++ = temp3;
-
-	temp0   = 0;
-	temp1   = 0;
-	temp2   = 0;
-	temp3   = 0;
-      }
-    }
-
-  if (bit < 128)
-    {
-      *outs[0]++ = temp0;
-      *outs[1]++ = temp1;
-      *outs[2]++ = temp2;
-      *outs[3]++ = temp3;
-    }
-}
-
-static void
-stpi_unpack_4_2(int length,
-		 const unsigned char *in,
-		 unsigned char **outs)
-{
-  unsigned char	tempin,
-		shift,
-		temp0,
-		temp1,
-		temp2,
-		temp3;
-
-  length *= 2;
-
-  for (shift = 0, temp0 = 0, temp1 = 0, temp2 = 0, temp3 = 0;
-       length > 0;
-       length --)
-    {
-     /*
-      * Note - we can't use (tempin & N) >> (shift - M) since negative
-      * right-shifts are not always implemented.
-      */
-
-      tempin = *in++;
-
-      if (tempin & 192)
-        temp0 |= (tempin & 192) >> shift;
-      if (tempin & 48)
-        temp1 |= ((tempin & 48) << 2) >> shift;
-      if (tempin & 12)
-        temp2 |= ((tempin & 12) << 4) >> shift;
-      if (tempin & 3)
-        temp3 |= ((tempin & 3) << 6) >> shift;
-
-      if (shift < 6)
-        shift += 2;
-      else
-      {
-        shift   = 0;
-	*outs[0]++ = temp0;
-	*outs[1]++ = temp1;
-	*outs[2]++ = temp2;
-	*outs[3]++ = temp3;
-
-	temp0   = 0;
-	temp1   = 0;
-	temp2   = 0;
-	temp3   = 0;
-      }
-    }
-
-  if (shift)
-    {
-      *outs[0]++ = temp0;
-      *outs[1]++ = temp1;
-      *outs[2]++ = temp2;
-      *outs[3]++ = temp3;
-    }
-}
-
-static void
-stpi_unpack_8_1(int length,
-		const unsigned char *in,
-		unsigned char **outs)
-{
-  unsigned char	tempin, bit, temp0, temp1, temp2, temp3, temp4, temp5, temp6,
-    temp7;
-
-  if (length <= 0)
-    return;
-
-  for (bit = 128, temp0 = 0, temp1 = 0, temp2 = 0,
-       temp3 = 0, temp4 = 0, temp5 = 0, temp6 = 0, temp7 = 0;
-       length > 0;
-       length --)
-    {
-      tempin = *in++;
-
-      if (tempin & 128)
-        temp0 |= bit;
-      if (tempin & 64)
-        temp1 |= bit;
-      if (tempin & 32)
-        temp2 |= bit;
-      if (tempin & 16)
-        temp3 |= bit;
-      if (tempin & 8)
-        temp4 |= bit;
-      if (tempin & 4)
-        temp5 |= bit;
-      if (tempin & 2)
-        temp6 |= bit;
-      if (tempin & 1)
-        temp7 |= bit;
-
-      if (bit > 1)
-        bit >>= 1;
-      else
-      {
-        bit     = 128;
-	*outs[0]++ = temp0;
-	*outs[1]++ = temp1;
-	*outs[2]++ = temp2;
-	*outs[3]++ = temp3;
-	*outs[4]++ = temp4;
-	*outs[5]++ = temp5;
-	*outs[6]++ = temp6;
-	*outs[7]++ = temp7;
-
-	temp0   = 0;
-	temp1   = 0;
-	temp2   = 0;
-	temp3   = 0;
-	temp4   = 0;
-	temp5   = 0;
-	temp6   = 0;
-	temp7   = 0;
-      }
-    }
-
-  if (bit < 128)
-    {
-      *outs[0]++ = temp0;
-      *outs[1]++ = temp1;
-      *outs[2]++ = temp2;
-      *outs[3]++ = temp3;
-      *outs[4]++ = temp4;
-      *outs[5]++ = temp5;
-      *outs[6]++ = temp6;
-      *outs[7]++ = temp7;
-    }
-}
-
-static void
-stpi_unpack_8_2(int length,
-		const unsigned char *in,
-		unsigned char **outs)
-{
-  unsigned char	tempin,
-		shift,
-		temp0,
-		temp1,
-		temp2,
-		temp3,
-		temp4,
-		temp5,
-		temp6,
-		temp7;
-
-
-  for (shift = 0, temp0 = 0, temp1 = 0,
-       temp2 = 0, temp3 = 0, temp4 = 0, temp5 = 0, temp6 = 0, temp7 = 0;
-       length > 0;
-       length --)
-    {
-     /*
-      * Note - we can't use (tempin & N) >> (shift - M) since negative
-      * right-shifts are not always implemented.
-      */
-
-      tempin = *in++;
-
-      if (tempin & 192)
-        temp0 |= (tempin & 192) >> shift;
-      if (tempin & 48)
-        temp1 |= ((tempin & 48) << 2) >> shift;
-      if (tempin & 12)
-        temp2 |= ((tempin & 12) << 4) >> shift;
-      if (tempin & 3)
-        temp3 |= ((tempin & 3) << 6) >> shift;
-
-      tempin = *in++;
-
-      if (tempin & 192)
-        temp4 |= (tempin & 192) >> shift;
-      if (tempin & 48)
-        temp5 |= ((tempin & 48) << 2) >> shift;
-      if (tempin & 12)
-        temp6 |= ((tempin & 12) << 4) >> shift;
-      if (tempin & 3)
-        temp7 |= ((tempin & 3) << 6) >> shift;
-
-      if (shift < 6)
-        shift += 2;
-      else
-      {
-        shift   = 0;
-	*outs[0]++ = temp0;
-	*outs[1]++ = temp1;
-	*outs[2]++ = temp2;
-	*outs[3]++ = temp3;
-	*outs[4]++ = temp4;
-	*outs[5]++ = temp5;
-	*outs[6]++ = temp6;
-	*outs[7]++ = temp7;
-
-	temp0   = 0;
-	temp1   = 0;
-	temp2   = 0;
-	temp3   = 0;
-	temp4   = 0;
-	temp5   = 0;
-	temp6   = 0;
-	temp7   = 0;
-      }
-    }
-
-  if (shift)
-    {
-      *outs[0]++ = temp0;
-      *outs[1]++ = temp1;
-      *outs[2]++ = temp2;
-      *outs[3]++ = temp3;
-      *outs[4]++ = temp4;
-      *outs[5]++ = temp5;
-      *outs[6]++ = temp6;
-      *outs[7]++ = temp7;
-    }
-}
-
-static void
-stpi_unpack_16_1(int length,
-		 const unsigned char *in,
-		 unsigned char **outs)
-{
-  unsigned char	tempin, bit;
-  unsigned char temp[16];
-  int j;
-
-  if (length <= 0)
-    return;
-
-  memset(temp, 0, 16);
-
-  for (bit = 128; length > 0; length--)
-    {
-      tempin = *in++;
-
-      if (tempin & 128)
-        temp[0] |= bit;
-      if (tempin & 64)
-        temp[1] |= bit;
-      if (tempin & 32)
-        temp[2] |= bit;
-      if (tempin & 16)
-        temp[3] |= bit;
-      if (tempin & 8)
-        temp[4] |= bit;
-      if (tempin & 4)
-        temp[5] |= bit;
-      if (tempin & 2)
-        temp[6] |= bit;
-      if (tempin & 1)
-        temp[7] |= bit;
-
-      tempin = *in++;
-
-      if (tempin & 128)
-	temp[8] |= bit;
-      if (tempin & 64)
-	temp[9] |= bit;
-      if (tempin & 32)
-	temp[10] |= bit;
-      if (tempin & 16)
-	temp[11] |= bit;
-      if (tempin & 8)
-	temp[12] |= bit;
-      if (tempin & 4)
-	temp[13] |= bit;
-      if (tempin & 2)
-	temp[14] |= bit;
-      if (tempin & 1)
-	temp[15] |= bit;
-
-      if (bit > 1)
-        bit >>= 1;
-      else
-	{
-	  bit     = 128;
-	  for (j = 0; j < 16; j++)
-	    *outs[j]++ = temp[j];
-
-	  memset(temp, 0, 16);
-	}
-    }
-
-  if (bit < 128)
-    for (j = 0; j < 16; j++)
-      *outs[j]++ = temp[j];
-}
-
-static void
-stpi_unpack_16_2(int length,
-		 const unsigned char *in,
-		 unsigned char **outs)
-{
-  unsigned char	tempin, shift;
-  unsigned char temp[16];
-  int j;
-
-  if (length <= 0)
-    return;
-
-  memset(temp, 0, 16);
-
-  for (shift = 0; length > 0; length--)
-    {
-      /*
-       * Note - we can't use (tempin & N) >> (shift - M) since negative
-       * right-shifts are not always implemented.
-       */
-
-      tempin = *in++;
-
-      if (tempin & 192)
-        temp[0] |= (tempin & 192) >> shift;
-      if (tempin & 48)
-        temp[1] |= ((tempin & 48) << 2) >> shift;
-      if (tempin & 12)
-        temp[2] |= ((tempin & 12) << 4) >> shift;
-      if (tempin & 3)
-        temp[3] |= ((tempin & 3) << 6) >> shift;
-
-      tempin = *in++;
-
-      if (tempin & 192)
-        temp[4] |= (tempin & 192) >> shift;
-      if (tempin & 48)
-        temp[5] |= ((tempin & 48) << 2) >> shift;
-      if (tempin & 12)
-        temp[6] |= ((tempin & 12) << 4) >> shift;
-      if (tempin & 3)
-        temp[7] |= ((tempin & 3) << 6) >> shift;
-
-      if (length-- > 0)
-	{
-	  tempin = *in++;
-
-	  if (tempin & 192)
-	    temp[8] |= (tempin & 192) >> shift;
-	  if (tempin & 48)
-	    temp[9] |= ((tempin & 48) << 2) >> shift;
-	  if (tempin & 12)
-	    temp[10] |= ((tempin & 12) << 4) >> shift;
-	  if (tempin & 3)
-	    temp[11] |= ((tempin & 3) << 6) >> shift;
-
-	  tempin = *in++;
-
-	  if (tempin & 192)
-	    temp[12] |= (tempin & 192) >> shift;
-	  if (tempin & 48)
-	    temp[13] |= ((tempin & 48) << 2) >> shift;
-	  if (tempin & 12)
-	    temp[14] |= ((tempin & 12) << 4) >> shift;
-	  if (tempin & 3)
-	    temp[15] |= ((tempin & 3) << 6) >> shift;
-	}
-
-      if (shift < 6)
-        shift += 2;
-      else
-	{
-	  shift   = 0;
-	  for (j = 0; j < 16; j++)
-	    *outs[j]++ = temp[j];
-
-	  memset(temp, 0, 16);
-	}
-    }
-
-  if (shift)
-    for (j = 0; j < 16; j++)
-      *outs[j]++ = temp[j];
-}
-
 void
 stp_unpack(int length,
 	   int bits,
@@ -1001,46 +1240,29 @@ stp_unpack(int length,
 	   const unsigned char *in,
 	   unsigned char **outs)
 {
-  unsigned char **touts;
+  unsigned char *touts[16];
+  int kernel;
   int i;
-  if (n < 2)
-    return;
-  touts = stp_malloc(sizeof(unsigned char *) * n);
+  switch (n)
+    {
+    case 2:
+      kernel = 0;
+      break;
+    case 4:
+      kernel = 1;
+      break;
+    case 8:
+      kernel = 2;
+      break;
+    case 16:
+      kernel = 3;
+      break;
+    default:
+      return;
+    }
   for (i = 0; i < n; i++)
     touts[i] = outs[i];
-  if (bits == 1)
-    switch (n)
-      {
-      case 2:
-	stpi_unpack_2_1(length, in, touts);
-	break;
-      case 4:
-	stpi_unpack_4_1(length, in, touts);
-	break;
-      case 8:
-	stpi_unpack_8_1(length, in, touts);
-	break;
-      case 16:
-	stpi_unpack_16_1(length, in, touts);
-	break;
-      }
-  else
-    switch (n)
-      {
-      case 2:
-	stpi_unpack_2_2(length, in, touts);
-	break;
-      case 4:
-	stpi_unpack_4_2(length, in, touts);
-	break;
-      case 8:
-	stpi_unpack_8_2(length, in, touts);
-	break;
-      case 16:
-	stpi_unpack_16_2(length, in, touts);
-	break;
-      }
-  stp_free(touts);
+  (bit_kernels->unpack[bits == 1 ? 0 : 1][kernel])(length, in, touts);
 }
 
 void
@@ -1139,29 +1361,229 @@ stp_unpack_16(int length,
   stp_unpack(length, bits, 16, in, outs);
 }
 
-static void
+/*
+ * Scanning kernels for the run-length packers.  Each has a portable
+ * version and, on x86 with a suitable compiler, SSE2 and AVX2 versions
+ * selected at run time that look at 16 or 32 bytes per step.  All of
+ * them return exactly the same results.
+ */
+
+typedef struct
+{
+  /* Number of bytes at the start of line equal to value */
+  int (*run_length)(const unsigned char *line, int length,
+		    unsigned char value);
+  /* Index of the last nonzero byte, or -1 */
+  int (*last_nonzero)(const unsigned char *line, int length);
+  /* First index i with line[i] == line[i + 1] == line[i + 2], or -1 */
+  int (*find_triple)(const unsigned char *line, int length);
+} pack_kernels_t;
+
+static int
+run_length_c(const unsigned char *line, int length, unsigned char value)
+{
+  int i = 0;
+  while (i < length && line[i] == value)
+    i++;
+  return i;
+}
+
+static int
+last_nonzero_c(const unsigned char *line, int length)
+{
+  int i = length - 1;
+  while (i >= 0 && line[i] == 0)
+    i--;
+  return i;
+}
+
+static int
+find_triple_c(const unsigned char *line, int length)
+{
+  int i;
+  for (i = 0; i + 2 < length; i++)
+    if (line[i] == line[i + 1] && line[i + 1] == line[i + 2])
+      return i;
+  return -1;
+}
+
+static const pack_kernels_t pack_kernels_c =
+{
+  run_length_c, last_nonzero_c, find_triple_c
+};
+
+#ifdef USE_X86_SIMD
+__attribute__((target("sse2")))
+static int
+run_length_sse2(const unsigned char *line, int length, unsigned char value)
+{
+  const __m128i v = _mm_set1_epi8(value);
+  int i;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i *) (line + i));
+      unsigned differ = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, v)) & 0xffff;
+      if (differ)
+	return i + __builtin_ctz(differ);
+    }
+  return i + run_length_c(line + i, length - i, value);
+}
+
+__attribute__((target("sse2")))
+static int
+last_nonzero_sse2(const unsigned char *line, int length)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i;
+  for (i = length; i >= 16; i -= 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i *) (line + i - 16));
+      unsigned nonzero = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) & 0xffff;
+      if (nonzero)
+	return i - 16 + 31 - __builtin_clz(nonzero);
+    }
+  return last_nonzero_c(line, i);
+}
+
+__attribute__((target("sse2")))
+static int
+find_triple_sse2(const unsigned char *line, int length)
+{
+  int i, tail;
+  for (i = 0; i + 18 <= length; i += 16)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i *) (line + i));
+      __m128i b = _mm_loadu_si128((const __m128i *) (line + i + 1));
+      __m128i c = _mm_loadu_si128((const __m128i *) (line + i + 2));
+      unsigned same = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, b),
+						      _mm_cmpeq_epi8(b, c)));
+      if (same)
+	return i + __builtin_ctz(same);
+    }
+  tail = find_triple_c(line + i, length - i);
+  return tail < 0 ? -1 : i + tail;
+}
+
+static const pack_kernels_t pack_kernels_sse2 =
+{
+  run_length_sse2, last_nonzero_sse2, find_triple_sse2
+};
+
+__attribute__((target("avx2")))
+static int
+run_length_avx2(const unsigned char *line, int length, unsigned char value)
+{
+  const __m256i v = _mm256_set1_epi8(value);
+  int i;
+  for (i = 0; i + 32 <= length; i += 32)
+    {
+      __m256i x = _mm256_loadu_si256((const __m256i *) (line + i));
+      unsigned differ = ~(unsigned) _mm256_movemask_epi8
+	(_mm256_cmpeq_epi8(x, v));
+      if (differ)
+	return i + __builtin_ctz(differ);
+    }
+  return i + run_length_c(line + i, length - i, value);
+}
+
+__attribute__((target("avx2")))
+static int
+last_nonzero_avx2(const unsigned char *line, int length)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  int i;
+  for (i = length; i >= 32; i -= 32)
+    {
+      __m256i x = _mm256_loadu_si256((const __m256i *) (line + i - 32));
+      unsigned nonzero = ~(unsigned) _mm256_movemask_epi8
+	(_mm256_cmpeq_epi8(x, zero));
+      if (nonzero)
+	return i - 32 + 31 - __builtin_clz(nonzero);
+    }
+  return last_nonzero_c(line, i);
+}
+
+__attribute__((target("avx2")))
+static int
+find_triple_avx2(const unsigned char *line, int length)
+{
+  int i, tail;
+  for (i = 0; i + 34 <= length; i += 32)
+    {
+      __m256i a = _mm256_loadu_si256((const __m256i *) (line + i));
+      __m256i b = _mm256_loadu_si256((const __m256i *) (line + i + 1));
+      __m256i c = _mm256_loadu_si256((const __m256i *) (line + i + 2));
+      unsigned same = _mm256_movemask_epi8
+	(_mm256_and_si256(_mm256_cmpeq_epi8(a, b), _mm256_cmpeq_epi8(b, c)));
+      if (same)
+	return i + __builtin_ctz(same);
+    }
+  tail = find_triple_c(line + i, length - i);
+  return tail < 0 ? -1 : i + tail;
+}
+
+static const pack_kernels_t pack_kernels_avx2 =
+{
+  run_length_avx2, last_nonzero_avx2, find_triple_avx2
+};
+#endif
+
+static const pack_kernels_t *pack_kernels = &pack_kernels_c;
+
+int
+stpi_pack_kernels_set_level(int level)
+{
+  int available = STPI_PACK_KERNELS_PORTABLE;
+#ifdef USE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    available = STPI_PACK_KERNELS_AVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    available = STPI_PACK_KERNELS_SSE2;
+#endif
+  if (level < 0 || level > available)
+    level = available;
+  switch (level)
+    {
+#ifdef USE_X86_SIMD
+    case STPI_PACK_KERNELS_AVX2:
+      pack_kernels = &pack_kernels_avx2;
+      break;
+    case STPI_PACK_KERNELS_SSE2:
+      pack_kernels = &pack_kernels_sse2;
+      break;
+#endif
+    default:
+      pack_kernels = &pack_kernels_c;
+      level = STPI_PACK_KERNELS_PORTABLE;
+    }
+  return level;
+}
+
+void
+stpi_init_pack_kernels(void)
+{
+  (void) stpi_pack_kernels_set_level(-1);
+}
+
+/*
+ * Returns the number of leading zero bytes.  Only the zero margins at
+ * each end of the line are looked at.
+ */
+static int
 find_first_and_last(const unsigned char *line, int length,
 		    int *first, int *last)
 {
-  int i;
-  int found_first = 0;
-  if (!first || !last)
-    return;
-  *first = 0;
-  *last = 0;
-  for (i = 0; i < length; i++)
+  int leading = (pack_kernels->run_length)(line, length, 0);
+  if (first && last)
     {
-      if (line[i] == 0)
-	{
-	  if (!found_first)
-	    (*first)++;
-	}
+      *first = leading;
+      if (leading == length)
+	*last = 0;
       else
-	{
-	  *last = i;
-	  found_first = 1;
-	}
+	*last = (pack_kernels->last_nonzero)(line, length);
     }
+  return leading;
 }
 
 int
@@ -1182,6 +1604,27 @@ stp_pack_uncompressed(stp_vars_t *v,
     return 1;
 }
 
+static unsigned char *
+pack_tiff_repeat(unsigned char *out, unsigned char repeat, int count)
+{
+  while (count > 0)
+    {
+      int tcount = count > 128 ? 128 : count;
+      out[0] = 1 - tcount;
+      out[1] = repeat;
+      out += 2;
+      count -= tcount;
+    }
+  return out;
+}
+
+/*
+ * Compress using TIFF "packbits" run-length encoding.  A repeated run
+ * starts at the first byte that begins three equal bytes, or failing
+ * that two bytes before the end of the line; everything before it is
+ * sent as literal bytes.  The run of leading zeros found by
+ * find_first_and_last() is sent without being scanned again.
+ */
 int
 stp_pack_tiff(stp_vars_t *v,
 	      const unsigned char *line,
@@ -1191,95 +1634,56 @@ stp_pack_tiff(stp_vars_t *v,
 	      int *first,
 	      int *last)
 {
-  const unsigned char *start;		/* Start of compressed data */
-  unsigned char repeat;			/* Repeating char */
-  int count;			/* Count of compressed bytes */
-  int tcount;			/* Temporary count < 128 */
-  register const unsigned char *xline = line;
-  register int xlength = length;
-  find_first_and_last(line, length, first, last);
-
-  /*
-   * Compress using TIFF "packbits" run-length encoding...
-   */
+  int pos = 0;
+  int leading = find_first_and_last(line, length, first, last);
 
   (*comp_ptr) = comp_buf;
 
-  while (xlength > 0)
+  if (leading >= 3)
+    {
+      (*comp_ptr) = pack_tiff_repeat(*comp_ptr, 0, leading);
+      pos = leading;
+    }
+
+  while (pos < length)
     {
+      int remaining = length - pos;
+      int literal_end = pos;
+      int count;
+      unsigned char repeat;
+
       /*
        * Get a run of non-repeated chars...
        */
 
-      start  = xline;
-      xline   += 2;
-      xlength -= 2;
-
-      while (xlength > 0 && (xline[-2] != xline[-1] || xline[-1] != xline[0]))
+      if (remaining >= 3)
 	{
-	  xline ++;
-	  xlength --;
+	  int triple = (pack_kernels->find_triple)(line + pos, remaining);
+	  literal_end = triple < 0 ? length - 2 : pos + triple;
 	}
 
-      xline   -= 2;
-      xlength += 2;
-
       /*
        * Output the non-repeated sequences (max 128 at a time).
        */
 
-      count = xline - start;
-      while (count > 0)
+      while (pos < literal_end)
 	{
-	  tcount = count > 128 ? 128 : count;
-
+	  int tcount = literal_end - pos > 128 ? 128 : literal_end - pos;
 	  (*comp_ptr)[0] = tcount - 1;
-	  memcpy((*comp_ptr) + 1, start, tcount);
-
+	  memcpy((*comp_ptr) + 1, line + pos, tcount);
 	  (*comp_ptr) += tcount + 1;
-	  start    += tcount;
-	  count    -= tcount;
-	}
-
-      if (xlength <= 0)
-	break;
-
-      /*
-       * Find the repeated sequences...
-       */
-
-      start  = xline;
-      repeat = xline[0];
-
-      xline ++;
-      xlength --;
-
-      if (xlength > 0)
-	{
-	  int ylength = xlength;
-	  while (ylength && *xline == repeat)
-	    {
-	      xline ++;
-	      ylength --;
-	    }
-	  xlength = ylength;
+	  pos += tcount;
 	}
 
       /*
-       * Output the repeated sequences (max 128 at a time).
+       * Find and output the repeated sequences (max 128 at a time).
        */
 
-      count = xline - start;
-      while (count > 0)
-	{
-	  tcount = count > 128 ? 128 : count;
-
-	  (*comp_ptr)[0] = 1 - tcount;
-	  (*comp_ptr)[1] = repeat;
-
-	  (*comp_ptr) += 2;
-	  count    -= tcount;
-	}
+      repeat = line[pos];
+      count = 1 + (pack_kernels->run_length)(line + pos + 1,
+					     length - pos - 1, repeat);
+      (*comp_ptr) = pack_tiff_repeat(*comp_ptr, repeat, count);
+      pos += count;
     }
   if (first && last && *first > *last)
     return 0;
@@ -23,14 +23,126 @@
 #endif
 #include <gutenprint/gutenprint.h>
 #include "gutenprint-internal.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+/*
+ * The whole image is held in one buffer, row after row.  Images at least
+ * this big are mapped rather than allocated, backed by a temporary file
+ * where possible so that a huge poster need not fit in memory.  The
+ * file's blocks are allocated up front: writing to a hole in a mapped
+ * file when the disk is full raises SIGBUS rather than failing.
+ */
+#define BUFFER_MAP_THRESHOLD	(64 * 1024 * 1024)
 
 struct buffered_image_priv
 {
 	stp_image_t* image;
-	unsigned char** buf;
+	unsigned char* buf;
+	size_t row_bytes;
+	size_t size;
+	int mapped;
+	FILE* file;
+	int rows_read;
 	unsigned int flags;
 };
 
+/*
+ * Reverse the order of the pixels in a row, a whole pixel at a time
+ * for the common pixel sizes.
+ */
+typedef struct { unsigned char c[3]; } pixel3_t;
+typedef struct { unsigned short s[3]; } pixel6_t;
+typedef struct { unsigned int i[2]; } pixel8_t;
+
+#define DEFINE_REVERSE(bytes, type)			\
+static void						\
+reverse_##bytes(unsigned char* row, int width)		\
+{							\
+	type* lo = (type*) row;				\
+	type* hi = lo + width - 1;			\
+	while(lo < hi){					\
+		type tmp = *lo;				\
+		*lo++ = *hi;				\
+		*hi-- = tmp;				\
+	}						\
+}
+
+DEFINE_REVERSE(1, unsigned char)
+DEFINE_REVERSE(2, unsigned short)
+DEFINE_REVERSE(3, pixel3_t)
+DEFINE_REVERSE(4, unsigned int)
+DEFINE_REVERSE(6, pixel6_t)
+DEFINE_REVERSE(8, pixel8_t)
+
+static void
+reverse_any(unsigned char* row, int width, int bytes_per_pixel)
+{
+	unsigned char* lo = row;
+	unsigned char* hi = row + (width - 1) * bytes_per_pixel;
+	int i;
+	while(lo < hi){
+		for(i = 0; i < bytes_per_pixel; i++){
+			unsigned char tmp = lo[i];
+			lo[i] = hi[i];
+			hi[i] = tmp;
+		}
+		lo += bytes_per_pixel;
+		hi -= bytes_per_pixel;
+	}
+}
+
+/*
+ * Mirror a row in place.  Bytes past the last whole pixel are padding;
+ * the pixels are moved to the start of the row first, as the last pixel
+ * of the mirrored row is the first one.
+ */
+static void
+flip_row(unsigned char* row, size_t row_bytes, int width)
+{
+	int bytes_per_pixel = row_bytes / width;
+	size_t padding = row_bytes - (size_t) width * bytes_per_pixel;
+	if(bytes_per_pixel <= 0)
+		return;
+	if(padding){
+		memmove(row, row + padding, (size_t) width * bytes_per_pixel);
+		reverse_any(row, width, bytes_per_pixel);
+		return;
+	}
+	switch(bytes_per_pixel){
+	case 1:
+		reverse_1(row, width);
+		break;
+	case 2:
+		reverse_2(row, width);
+		break;
+	case 3:
+		reverse_3(row, width);
+		break;
+	case 4:
+		reverse_4(row, width);
+		break;
+	case 6:
+		reverse_6(row, width);
+		break;
+	case 8:
+		reverse_8(row, width);
+		break;
+	default:
+		reverse_any(row, width, bytes_per_pixel);
+		break;
+	}
+}
+
 static void
 buffered_image_init(stp_image_t* image)
 {
@@ -61,46 +173,96 @@ buffered_image_get_appname(stp_image_t *image)
 	return priv->image->get_appname(priv->image);
 }
 
+static int
+buffered_image_map(struct buffered_image_priv *priv)
+{
+#ifdef HAVE_SYS_MMAN_H
+	void* map;
+	if(priv->size < BUFFER_MAP_THRESHOLD)
+		return 0;
+#if defined(HAVE_UNISTD_H) && defined(HAVE_POSIX_FALLOCATE)
+	priv->file = tmpfile();
+	if(priv->file){
+		int fd = fileno(priv->file);
+		if(posix_fallocate(fd, 0, priv->size) == 0){
+			map = mmap(NULL, priv->size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED, fd, 0);
+			if(map != MAP_FAILED){
+				priv->buf = map;
+				priv->mapped = 1;
+				return 1;
+			}
+		}
+		fclose(priv->file);
+		priv->file = NULL;
+	}
+#endif
+#ifdef MAP_ANONYMOUS
+	map = mmap(NULL, priv->size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(map != MAP_FAILED){
+		priv->buf = map;
+		priv->mapped = 1;
+		return 1;
+	}
+#endif
+#endif
+	return 0;
+}
 
-static stp_image_status_t
-buffered_image_get_row(stp_image_t* image,unsigned char *data, size_t byte_limit, int row)
+/*
+ * Return the buffered copy of an output row, reading source rows up to
+ * it first.  Rows are mirrored once, as they are read.
+ */
+static unsigned char*
+buffered_image_row(stp_image_t* image, size_t byte_limit, int row)
 {
 	struct buffered_image_priv *priv = image->rep;
 	int width = buffered_image_width(image);
 	int height = buffered_image_height(image);
-	/* FIXME this will break with padding bytes */
-	int bytes_per_pixel = byte_limit / width;
-	int inc = bytes_per_pixel;
-	unsigned char* src;
-	int i;
-	/* fill buffer */
+	if(row < 0 || row >= height)
+		return NULL;
 	if(!priv->buf){
-		priv->buf = stp_zalloc((sizeof(unsigned short*) + 1) * height);
-		if(!priv->buf){
-			return STP_IMAGE_STATUS_ABORT;
-		}
-		for(i=0;i<height;i++){
-			priv->buf[i] = stp_malloc(byte_limit);
-			if(STP_IMAGE_STATUS_OK != priv->image->get_row(priv->image,priv->buf[i],byte_limit,i))
-				return STP_IMAGE_STATUS_ABORT;
-		}
+		priv->row_bytes = byte_limit;
+		priv->size = byte_limit * height;
+		if(!buffered_image_map(priv))
+			priv->buf = stp_malloc(priv->size);
 	}
 	if(priv->flags & BUFFER_FLAG_FLIP_Y)
 		row = height - row - 1;
-
-	src = priv->buf[row];
-
-	if(priv->flags & BUFFER_FLAG_FLIP_X){
-		src += byte_limit - bytes_per_pixel;
-		inc = -bytes_per_pixel;
+	while(priv->rows_read <= row){
+		unsigned char* dst = priv->buf + priv->row_bytes * priv->rows_read;
+		if(STP_IMAGE_STATUS_OK != priv->image->get_row(priv->image,dst,priv->row_bytes,priv->rows_read))
+			return NULL;
+		if(priv->flags & BUFFER_FLAG_FLIP_X)
+			flip_row(dst, priv->row_bytes, width);
+		priv->rows_read++;
 	}
+	return priv->buf + priv->row_bytes * row;
+}
 
-	/* copy data */
-	for( i = 0 ; i < width ; i++){
-		memcpy(data,src,bytes_per_pixel);
-		src += inc;
-		data += bytes_per_pixel;
-	}
+/* Rows are already flipped in the buffer, so they are always lent */
+static stp_image_status_t
+buffered_image_get_row_ptr(stp_image_t* image, const unsigned char **data, size_t byte_limit, int row)
+{
+	struct buffered_image_priv *priv = image->rep;
+	unsigned char* src = buffered_image_row(image, byte_limit, row);
+	*data = NULL;
+	if(!src)
+		return STP_IMAGE_STATUS_ABORT;
+	if(byte_limit <= priv->row_bytes)
+		*data = src;
+	return STP_IMAGE_STATUS_OK;
+}
+
+static stp_image_status_t
+buffered_image_get_row(stp_image_t* image,unsigned char *data, size_t byte_limit, int row)
+{
+	struct buffered_image_priv *priv = image->rep;
+	unsigned char* src = buffered_image_row(image, byte_limit, row);
+	if(!src)
+		return STP_IMAGE_STATUS_ABORT;
+	memcpy(data,src,byte_limit < priv->row_bytes ? byte_limit : priv->row_bytes);
 	return STP_IMAGE_STATUS_OK;
 }
 
@@ -109,14 +271,18 @@ buffered_image_conclude(stp_image_t * image)
 {
 	struct buffered_image_priv *priv = image->rep;
 	if(priv->buf){
-		int i = 0;
-		while(priv->buf[i]){
-			stp_free(priv->buf[i]);
-			++i;
-		}
-		stp_free(priv->buf);
+#ifdef HAVE_SYS_MMAN_H
+		if(priv->mapped)
+			(void) munmap(priv->buf, priv->size);
+		else
+#endif
+			stp_free(priv->buf);
 		priv->buf = NULL;
 	}
+	if(priv->file){
+		fclose(priv->file);
+		priv->file = NULL;
+	}
 	if(priv->image->conclude)
 		priv->image->conclude(priv->image);
 
@@ -143,6 +309,7 @@ stpi_buffer_image(stp_image_t* image, unsigned int flags)
 	buffered_image->width = buffered_image_width;
 	buffered_image->height = buffered_image_height;
 	buffered_image->get_row = buffered_image_get_row;
+	buffered_image->get_row_ptr = buffered_image_get_row_ptr;
 	buffered_image->conclude = buffered_image_conclude;
 	priv->image = image;
 	priv->flags = flags;
@@ -38,6 +38,9 @@
 
 #ifdef __GNUC__
 #define inline __inline__
+#define ALWAYS_INLINE __inline__ __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
 #endif
 
 #define FMAX(a, b) ((a) > (b) ? (a) : (b))
@@ -62,7 +65,12 @@ typedef struct
   stp_curve_t *curve;
 } stpi_channel_t;
 
-typedef struct
+typedef struct stpi_channel_group stpi_channel_group_t;
+
+typedef void (*stpi_convert_row_func_t)(stpi_channel_group_t *cg,
+					unsigned *zero_mask);
+
+struct stpi_channel_group
 {
   unsigned channel_count;
   unsigned total_channels;
@@ -88,10 +96,24 @@ typedef struct
   int black_channel;
   int gloss_channel;
   int gloss_physical_channel;
+  int ink_first;		/* First and last pixels of the converted */
+  int ink_last;			/* row with any ink, or -1 if it's blank */
   double cyan_balance;
   double magenta_balance;
   double yellow_balance;
-} stpi_channel_group_t;
+  const unsigned short *gcr_lookup;
+  stpi_convert_row_func_t convert; /* Fused row converter, or NULL */
+  int copy_input;		/* Copy the input around the gloss channel */
+  unsigned gloss_channels;	/* Subchannels of the gloss channel */
+  unsigned short density[STP_CHANNEL_LIMIT]; /* By physical channel */
+  unsigned char is_gloss[STP_CHANNEL_LIMIT];
+  unsigned char scaled[STP_CHANNEL_LIMIT]; /* Channels with density < 1 */
+  unsigned scaled_channels;
+  int planar;			/* Also write the output a plane per channel */
+  unsigned short *planar_output;
+  int planar_first;		/* Span of the planes that may not be */
+  int planar_last;		/* zero, or -1 */
+};
 
 
 static stpi_channel_group_t *
@@ -130,6 +152,7 @@ stpi_channel_clear(void *vc)
   STP_SAFE_FREE(cg->alloc_data_1);
   STP_SAFE_FREE(cg->alloc_data_2);
   STP_SAFE_FREE(cg->alloc_data_3);
+  STP_SAFE_FREE(cg->planar_output);
   STP_SAFE_FREE(cg->c);
   if (cg->gcr_curve)
     {
@@ -142,6 +165,7 @@ stpi_channel_clear(void *vc)
   cg->total_channels = 0;
   cg->input_channels = 0;
   cg->initialized = 0;
+  cg->convert = NULL;
 }
 
 void
@@ -167,6 +191,17 @@ stpi_channel_free(void *vc)
   stp_free(vc);
 }
 
+static stpi_channel_group_t *
+create_channel_group(stp_vars_t *v)
+{
+  stpi_channel_group_t *cg = stp_zalloc(sizeof(stpi_channel_group_t));
+  cg->black_channel = -1;
+  cg->gloss_channel = -1;
+  stp_allocate_component_data(v, "Channel", NULL, stpi_channel_free, cg);
+  stp_dprintf(STP_DBG_INK, v, "*** Set up channel data ***\n");
+  return cg;
+}
+
 static stpi_subchannel_t *
 get_channel(stp_vars_t *v, unsigned channel, unsigned subchannel)
 {
@@ -189,13 +224,7 @@ stp_channel_add(stp_vars_t *v, unsigned channel, unsigned subchannel,
   stp_dprintf(STP_DBG_INK, v, "Add channel %d, %d, %f\n",
 	      channel, subchannel, value);
   if (!cg)
-    {
-      cg = stp_zalloc(sizeof(stpi_channel_group_t));
-      cg->black_channel = -1;
-      cg->gloss_channel = -1;
-      stp_allocate_component_data(v, "Channel", NULL, stpi_channel_free, cg);
-      stp_dprintf(STP_DBG_INK, v, "*** Set up channel data ***\n");
-    }
+    cg = create_channel_group(v);
   if (channel >= cg->channel_count)
     {
       unsigned oc = cg->channel_count;
@@ -224,6 +253,7 @@ stp_channel_add(stp_vars_t *v, unsigned channel, unsigned subchannel,
   chan->sc[subchannel].value = value;
   chan->sc[subchannel].s_density = 65535;
   chan->sc[subchannel].cutoff = 0.75;
+  cg->convert = NULL;
 }
 
 double
@@ -256,7 +286,10 @@ stp_channel_set_density_adjustment(stp_vars_t *v, int color, int subchannel,
 		  "channel_density channel %d subchannel %d adjustment %f\n",
 		  color, subchannel, adjustment);
       if (sch && adjustment >= 0 && adjustment <= 1)
-	sch->s_density = adjustment * 65535;
+	{
+	  sch->s_density = adjustment * 65535;
+	  get_channel_group(v)->convert = NULL;
+	}
     }
 }
 
@@ -276,7 +309,10 @@ stp_channel_set_ink_limit(stp_vars_t *v, double limit)
   stpi_channel_group_t *cg = get_channel_group(v);
   stp_dprintf(STP_DBG_INK, v, "ink_limit %f\n", limit);
   if (cg && limit > 0)
-    cg->ink_limit = 65535 * limit;
+    {
+      cg->ink_limit = 65535 * limit;
+      cg->convert = NULL;
+    }
 }
 
 double
@@ -294,7 +330,10 @@ stp_channel_set_black_channel(stp_vars_t *v, int channel)
   stpi_channel_group_t *cg = get_channel_group(v);
   stp_dprintf(STP_DBG_INK, v, "black_channel %d\n", channel);
   if (cg)
-    cg->black_channel = channel;
+    {
+      cg->black_channel = channel;
+      cg->convert = NULL;
+    }
 }
 
 int
@@ -313,7 +352,10 @@ stp_channel_set_gloss_channel(stp_vars_t *v, int channel)
   stpi_channel_group_t *cg = get_channel_group(v);
   stp_dprintf(STP_DBG_INK, v, "gloss_channel %d\n", channel);
   if (cg)
-    cg->gloss_channel = channel;
+    {
+      cg->gloss_channel = channel;
+      cg->convert = NULL;
+    }
 }
 
 int
@@ -332,7 +374,10 @@ stp_channel_set_gloss_limit(stp_vars_t *v, double limit)
   stpi_channel_group_t *cg = get_channel_group(v);
   stp_dprintf(STP_DBG_INK, v, "gloss_limit %f\n", limit);
   if (cg && limit > 0)
-    cg->gloss_limit = 65535 * limit;
+    {
+      cg->gloss_limit = 65535 * limit;
+      cg->convert = NULL;
+    }
 }
 
 double
@@ -378,6 +423,7 @@ stp_channel_set_gcr_curve(stp_vars_t *v, const stp_curve_t *curve)
     cg->gcr_curve = stp_curve_create_copy(curve);
   else
     cg->gcr_curve = NULL;
+  cg->convert = NULL;
 }  
 
 const stp_curve_t *
@@ -563,9 +609,18 @@ stp_channel_initialize(stp_vars_t *v, stp_image_t *image,
 	  
   cg->input_channels = input_channel_count;
   cg->width = width;
+  cg->ink_first = 0;
+  cg->ink_last = width - 1;
   cg->alloc_data_1 =
-    stp_malloc(sizeof(unsigned short) * cg->total_channels * width);
+    stp_zalloc(sizeof(unsigned short) * cg->total_channels * width);
   cg->output_data = cg->alloc_data_1;
+  if (cg->planar)
+    {
+      cg->planar_output =
+	stp_zalloc(sizeof(unsigned short) * cg->total_channels * width);
+      cg->planar_first = -1;
+      cg->planar_last = -1;
+    }
   if (curve_count == 0)
     {
       cg->gcr_channels = cg->input_channels;
@@ -649,6 +704,8 @@ stp_channel_initialize(stp_vars_t *v, stp_image_t *image,
 	      (void *) cg->alloc_data_2);
   stp_dprintf(STP_DBG_INK, v, "   alloc_data_3   %p\n",
 	      (void *) cg->alloc_data_3);
+  stp_dprintf(STP_DBG_INK, v, "   planar_output  %p\n",
+	      (void *) cg->planar_output);
   stp_dprintf(STP_DBG_INK, v, "   gcr_curve      %p\n",
 	      (void *) cg->gcr_curve);
   for (i = 0; i < cg->channel_count; i++)
@@ -667,59 +724,6 @@ stp_channel_initialize(stp_vars_t *v, stp_image_t *image,
     }
 }
 
-static void
-clear_channel(unsigned short *data, unsigned width, unsigned depth)
-{
-  int i;
-  width *= depth;
-  for (i = 0; i < width; i += depth)
-    data[i] = 0;
-}
-
-static int
-scale_channel(unsigned short *data, unsigned width, unsigned depth,
-	      unsigned short density)
-{
-  int i;
-  int retval = 0;
-  unsigned short previous_data = 0;
-  unsigned short previous_value = 0;
-  width *= depth;
-  for (i = 0; i < width; i += depth)
-    {
-      if (data[i] == previous_data)
-	data[i] = previous_value;
-      else if (data[i] == (unsigned short) 65535)
-	{
-	  data[i] = density;
-	  retval = 1;
-	}
-      else if (data[i] > 0)
-	{
-	  unsigned short tval = (32767u + data[i] * density) / 65535u;
-	  previous_data = data[i];
-	  if (tval)
-	    retval = 1;
-	  previous_value = (unsigned short) tval;
-	  data[i] = (unsigned short) tval;
-	}
-    }
-  return retval;
-}
-
-static int
-scan_channel(unsigned short *data, unsigned width, unsigned depth)
-{
-  int i;
-  width *= depth;
-  for (i = 0; i < width; i += depth)
-    {
-      if (data[i])
-	return 1;
-    }
-  return 0;
-}
-
 static inline unsigned
 ink_sum(const unsigned short *data, int total_channels)
 {
@@ -730,35 +734,6 @@ ink_sum(const unsigned short *data, int total_channels)
   return total_ink;
 }
 
-static int
-limit_ink(const stp_vars_t *v)
-{
-  int i;
-  int retval = 0;
-  stpi_channel_group_t *cg = get_channel_group(v);
-  unsigned short *ptr;
-  if (!cg || cg->ink_limit == 0 || cg->ink_limit >= cg->max_density)
-    return 0;
-  ptr = cg->output_data;
-  for (i = 0; i < cg->width; i++)
-    {
-      int total_ink = ink_sum(ptr, cg->total_channels);
-      if (total_ink > cg->ink_limit) /* Need to limit ink? */
-	{
-	  int j;
-	  /*
-	   * FIXME we probably should first try to convert light ink to dark
-	   */
-	  double ratio = (double) cg->ink_limit / (double) total_ink;
-	  for (j = 0; j < cg->total_channels; j++)
-	    ptr[j] *= ratio;
-	  retval = 1;
-	}
-      ptr += cg->total_channels;
-   }
-  return retval;
-}
-
 static inline int
 short_eq(const unsigned short *i1, const unsigned short *i2, size_t count)
 {
@@ -785,34 +760,6 @@ short_copy(unsigned short *out, const unsigned short *in, size_t count)
 #endif
 }
 
-static void
-copy_channels(const stp_vars_t *v)
-{
-  stpi_channel_group_t *cg = get_channel_group(v);
-  int i, j, k;
-  const unsigned short *input;
-  unsigned short *output;
-  if (!cg)
-    return;
-  input = cg->input_data;
-  output = cg->output_data;
-  for (i = 0; i < cg->width; i++)
-    {
-      for (j = 0; j < cg->channel_count; j++)
-	{
-	  stpi_channel_t *ch = &(cg->c[j]);
-	  for (k = 0; k < ch->subchannel_count; k++)
-	    {
-	      if (cg->gloss_channel != j)
-		{
-		  *output = *input++;
-		}
-	      output++;
-	    }
-	}	  
-    }
-}
-
 static inline double
 compute_hue(int c, int m, int y, int max)
 {
@@ -917,244 +864,431 @@ generate_special_channels(const stp_vars_t *v)
     }
 }
 
-static void
-split_channels(const stp_vars_t *v, unsigned *zero_mask)
+/*
+ * Everything after the special channels is done in a single pass over the
+ * row: GCR, splitting into light and dark inks (or scaling by density),
+ * ink limiting and gloss generation, one pixel at a time.  With ten or
+ * more channels the row no longer fits in L1, so running each step over
+ * the whole row in turn costs a trip to L2 per step.  Which steps a job
+ * needs is settled when the channels are set up, and convert_row is
+ * instantiated for each combination so that a step a job doesn't use
+ * costs nothing.
+ */
+
+#define CONVERT_SPLIT	8
+#define CONVERT_GCR	4
+#define CONVERT_LIMIT	2
+#define CONVERT_GLOSS	1
+
+static ALWAYS_INLINE void
+gcr_pixel(const stpi_channel_group_t *cg, unsigned short *pixel)
 {
-  stpi_channel_group_t *cg = get_channel_group(v);
-  int i, j, k;
-  int nz[STP_CHANNEL_LIMIT];
-  int outbytes;
-  const unsigned short *input_cache = NULL;
-  const unsigned short *output_cache = NULL;
-  const unsigned short *input;
-  unsigned short *output;
-  if (!cg)
-    return;
-  outbytes = cg->total_channels * sizeof(unsigned short);
-  input = cg->split_input;
-  output = cg->output_data;
+  unsigned k = pixel[0];
+  if (k > 0)
+    {
+      int kk = cg->gcr_lookup[k];
+      int ck;
+      if (kk > k)
+	kk = k;
+      ck = k - kk;
+      pixel[0] = kk;
+      pixel[1] += ck * cg->cyan_balance;
+      pixel[2] += ck * cg->magenta_balance;
+      pixel[3] += ck * cg->yellow_balance;
+    }
+}
+
+static ALWAYS_INLINE void
+copy_pixel(const stpi_channel_group_t *cg, const unsigned short *input,
+	   unsigned short *output)
+{
+  int i;
   for (i = 0; i < cg->total_channels; i++)
-    nz[i] = 0;
-  for (i = 0; i < cg->width; i++)
+    if (!cg->is_gloss[i])
+      output[i] = *input++;
+}
+
+static ALWAYS_INLINE void
+scale_pixel(const stpi_channel_group_t *cg, unsigned short *output)
+{
+  int i;
+  /* This rounds 65535 to the density and leaves 0 alone */
+  for (i = 0; i < cg->scaled_channels; i++)
     {
-      int zero_ptr = 0;
-      if (input_cache && short_eq(input_cache, input, cg->aux_output_channels))
-	{
-	  memcpy(output, output_cache, outbytes);
-	  input += cg->aux_output_channels;
-	  output += cg->total_channels;
-	}
-      else
+      int channel = cg->scaled[i];
+      output[channel] =
+	(32767u + output[channel] * (unsigned) cg->density[channel]) / 65535u;
+    }
+}
+
+static ALWAYS_INLINE void
+split_pixel(const stpi_channel_group_t *cg, const unsigned short *input,
+	    unsigned short *output)
+{
+  unsigned black_value = 0;
+  unsigned virtual_black = 65535;
+  int j, k;
+  if (cg->black_channel >= 0)
+    black_value = input[cg->black_channel];
+  for (j = 0; j < cg->aux_output_channels; j++)
+    {
+      if (input[j] < virtual_black && j != cg->black_channel)
+	virtual_black = input[j];
+    }
+  black_value += virtual_black / 4;
+  for (j = 0; j < cg->channel_count; j++)
+    {
+      const stpi_channel_t *c = &(cg->c[j]);
+      int s_count = c->subchannel_count;
+      if (s_count >= 1)
 	{
-	  unsigned black_value = 0;
-	  unsigned virtual_black = 65535;
-	  input_cache = input;
-	  output_cache = output;
-	  if (cg->black_channel >= 0)
-	    black_value = input[cg->black_channel];
-	  for (j = 0; j < cg->aux_output_channels; j++)
+	  unsigned i_val = *input++;
+	  if (i_val == 0)
 	    {
-	      if (input[j] < virtual_black && j != cg->black_channel)
-		virtual_black = input[j];
+	      for (k = 0; k < s_count; k++)
+		*(output++) = 0;
 	    }
-	  black_value += virtual_black / 4;
-	  for (j = 0; j < cg->channel_count; j++)
+	  else if (s_count == 1)
 	    {
-	      stpi_channel_t *c = &(cg->c[j]);
-	      int s_count = c->subchannel_count;
-	      if (s_count >= 1)
+	      if (c->sc[0].s_density < 65535)
+		i_val = i_val * c->sc[0].s_density / 65535;
+	      *(output++) = i_val;
+	    }
+	  else
+	    {
+	      unsigned l_val = i_val;
+	      unsigned offset;
+	      if (black_value && j != cg->black_channel)
 		{
-		  unsigned i_val = *input++;
-		  if (i_val == 0)
-		    {
-		      for (k = 0; k < s_count; k++)
-			*(output++) = 0;
-		    }
-		  else if (s_count == 1)
+		  l_val += black_value;
+		  if (l_val > 65535)
+		    l_val = 65535;
+		}
+	      offset = l_val * s_count;
+	      for (k = 0; k < s_count; k++)
+		{
+		  unsigned o_val;
+		  if (c->sc[k].s_density > 0)
 		    {
-		      if (c->sc[0].s_density < 65535)
-			i_val = i_val * c->sc[0].s_density / 65535;
-		      nz[zero_ptr++] |= *(output++) = i_val;
+		      o_val = c->lut[offset + k];
+		      if (i_val != l_val)
+			o_val = o_val * i_val / l_val;
+		      if (c->sc[k].s_density < 65535)
+			o_val = o_val * c->sc[k].s_density / 65535;
 		    }
 		  else
-		    {
-		      unsigned l_val = i_val;
-		      unsigned offset;
-		      if (i_val > 0 && black_value && j != cg->black_channel)
-			{
-			  l_val += black_value;
-			  if (l_val > 65535)
-			    l_val = 65535;
-			}
-		      offset = l_val * s_count;
-		      for (k = 0; k < s_count; k++)
-			{
-			  unsigned o_val;
-			  if (c->sc[k].s_density > 0)
-			    {
-			      o_val = c->lut[offset + k];
-			      if (i_val != l_val)
-				o_val = o_val * i_val / l_val;
-			      if (c->sc[k].s_density < 65535)
-				o_val = o_val * c->sc[k].s_density / 65535;
-			    }
-			  else
-			    o_val = 0;
-			  *output++ = o_val;
-			  nz[zero_ptr++] |= o_val;
-			}
-		    }
+		    o_val = 0;
+		  *output++ = o_val;
 		}
 	    }
 	}
     }
-  if (zero_mask)
+}
+
+static ALWAYS_INLINE void
+limit_pixel(const stpi_channel_group_t *cg, unsigned short *output)
+{
+  int total_ink = ink_sum(output, cg->total_channels);
+  if (total_ink > cg->ink_limit) /* Need to limit ink? */
     {
-      *zero_mask = 0;
-      for (i = 0; i < cg->total_channels; i++)
-	if (!nz[i])
-	  *zero_mask |= 1 << i;
+      int j;
+      /*
+       * FIXME we probably should first try to convert light ink to dark
+       */
+      double ratio = (double) cg->ink_limit / (double) total_ink;
+      for (j = 0; j < cg->total_channels; j++)
+	output[j] *= ratio;
+    }
+}
+
+static ALWAYS_INLINE int
+gloss_pixel(const stpi_channel_group_t *cg, unsigned short *output)
+{
+  unsigned channel_sum = 0;
+  int i;
+  output[cg->gloss_physical_channel] = 0;
+  for (i = 0; i < cg->total_channels; i++)
+    {
+      if (!cg->is_gloss[i])
+	{
+	  channel_sum += (unsigned) output[i];
+	  if (channel_sum >= cg->gloss_limit)
+	    return 0;
+	}
+    }
+  if (channel_sum < cg->gloss_limit)
+    {
+      unsigned gloss_required = cg->gloss_limit - channel_sum;
+      if (gloss_required > 65535)
+	gloss_required = 65535;
+      output[cg->gloss_physical_channel] = gloss_required;
+      return 1;
     }
+  return 0;
 }
 
+/*
+ * The inked span and the empty channels are cheaper to find after the
+ * row is converted than to track pixel by pixel: the scans start from
+ * the ends of the row and stop at the first ink they find.
+ */
 static void
-scale_channels(const stp_vars_t *v, unsigned *zero_mask)
+scan_output(stpi_channel_group_t *cg, unsigned short *nz)
 {
-  stpi_channel_group_t *cg = get_channel_group(v);
-  int i, j;
-  int physical_channel = 0;
-  if (!cg)
+  const unsigned short *output = cg->output_data;
+  size_t total = cg->total_channels;
+  size_t count = cg->width * total;
+  size_t first = 0;
+  size_t last;
+  int i;
+  cg->ink_first = -1;
+  cg->ink_last = -1;
+  while (first + 4 <= count)
+    {
+      unsigned long long quad;
+      memcpy(&quad, output + first, sizeof(quad));
+      if (quad)
+	break;
+      first += 4;
+    }
+  while (first < count && !output[first])
+    first++;
+  if (first == count)
     return;
-  if (zero_mask)
-    *zero_mask = 0;
-  for (i = 0; i < cg->channel_count; i++)
+  last = count - 1;
+  while (last >= first + 4)
     {
-      stpi_channel_t *ch = &(cg->c[i]);
-      if (ch->subchannel_count > 0)
-	for (j = 0; j < ch->subchannel_count; j++)
+      unsigned long long quad;
+      memcpy(&quad, output + last - 3, sizeof(quad));
+      if (quad)
+	break;
+      last -= 4;
+    }
+  while (!output[last])
+    last--;
+  cg->ink_first = first / total;
+  cg->ink_last = last / total;
+  for (i = 0; i < total; i++)
+    {
+      const unsigned short *data = output + cg->ink_first * total + i;
+      const unsigned short *end = output + cg->ink_last * total + i;
+      for (; data <= end; data += total)
+	if (*data)
 	  {
-	    if (cg->gloss_channel != i)
-	      {
-		stpi_subchannel_t *sch = &(ch->sc[j]);
-		unsigned density = sch->s_density;
-		unsigned short *output = cg->output_data + physical_channel;
-		if (density == 0)
-		  {
-		    clear_channel(output, cg->width, cg->total_channels);
-		    if (zero_mask)
-		      *zero_mask |= 1 << physical_channel;
-		  }
-		else if (density != 65535)
-		  {
-		    if (scale_channel(output, cg->width, cg->total_channels,
-				      density) == 0)
-		      if (zero_mask)
-			*zero_mask |= 1 << physical_channel;
-		  }
-		else if (zero_mask)
-		  {
-		    if (scan_channel(output, cg->width, cg->total_channels)==0)
-		      *zero_mask |= 1 << physical_channel;
-		  }
-	      }
-	    physical_channel++;
+	    nz[i] = 1;
+	    break;
 	  }
     }
 }
 
+/*
+ * Copy the inked span of the row into the planes, and clear whatever
+ * the last row left outside it.  Only the span is copied, so a mostly
+ * white page costs little more than it does interleaved.
+ */
 static void
-generate_gloss(const stp_vars_t *v, unsigned *zero_mask)
+write_planes(stpi_channel_group_t *cg)
 {
-  stpi_channel_group_t *cg = get_channel_group(v);
-  unsigned short *output;
-  unsigned gloss_mask;
-  int i, j, k;
-  if (!cg || cg->gloss_channel == -1 || cg->gloss_limit <= 0)
-    return;
-  output = cg->output_data;
-  gloss_mask = ~(1 << cg->gloss_physical_channel);
-  for (i = 0; i < cg->width; i++)
+  const unsigned short *output = cg->output_data;
+  size_t width = cg->width;
+  int total = cg->total_channels;
+  int first = cg->ink_first;
+  int last = cg->ink_last;
+  int x, i;
+  for (i = 0; i < total; i++)
     {
-      int physical_channel = 0;
-      unsigned channel_sum = 0;
-      output[cg->gloss_physical_channel] = 0;
-      for (j = 0; j < cg->channel_count; j++)
+      unsigned short *plane = cg->planar_output + i * width;
+      const unsigned short *in = output + i;
+      if (first < 0)
 	{
-	  stpi_channel_t *ch = &(cg->c[j]);
-	  for (k = 0; k < ch->subchannel_count; k++)
+	  if (cg->planar_first >= 0)
+	    memset(plane + cg->planar_first, 0, sizeof(unsigned short) *
+		   (cg->planar_last - cg->planar_first + 1));
+	  continue;
+	}
+      if (cg->planar_first >= 0 && cg->planar_first < first)
+	memset(plane + cg->planar_first, 0, sizeof(unsigned short) *
+	       (first - cg->planar_first));
+      if (cg->planar_last > last)
+	memset(plane + last + 1, 0, sizeof(unsigned short) *
+	       (cg->planar_last - last));
+      for (x = first; x <= last; x++)
+	plane[x] = in[x * total];
+    }
+  cg->planar_first = first;
+  cg->planar_last = last;
+}
+
+static ALWAYS_INLINE void
+convert_row(stpi_channel_group_t *cg, unsigned *zero_mask, int flags)
+{
+  unsigned short nz[STP_CHANNEL_LIMIT];
+  const unsigned short *last_output = NULL;
+  int gloss_generated = 0;
+  unsigned short *input = cg->input_data;
+  unsigned short *output = cg->output_data;
+  unsigned input_step = 0;
+  const int total = cg->total_channels;
+  unsigned key_count = total;
+  int i, j;
+
+  if (flags & CONVERT_SPLIT)
+    {
+      input = cg->split_input;
+      input_step = key_count = cg->aux_output_channels;
+    }
+  else if (cg->copy_input)
+    input_step = total - cg->gloss_channels;
+  for (i = 0; i < cg->width;
+       i++, input += input_step, output += total)
+    {
+      if (flags & CONVERT_SPLIT)
+	{
+	  if (!(flags & CONVERT_GLOSS))
 	    {
-	      if (cg->gloss_channel != j)
+	      /*
+	       * White splits to white, and stays white through every
+	       * step but gloss.  Most of a page is usually white.
+	       */
+	      unsigned any = 0;
+	      for (j = 0; j < key_count; j++)
+		any |= input[j];
+	      if (!any)
 		{
-		  channel_sum += (unsigned) output[physical_channel];
-		  if (channel_sum >= cg->gloss_limit)
-		    goto next;
+		  memset(output, 0, total * sizeof(unsigned short));
+		  last_output = output;
+		  continue;
 		}
-	      physical_channel++;
 	    }
+	  /*
+	   * Splitting is the expensive step, so runs of the same color
+	   * are split only once.
+	   */
+	  if (flags & CONVERT_GCR)
+	    gcr_pixel(cg, input);
+	  if (last_output && short_eq(input - input_step, input, key_count))
+	    {
+	      memcpy(output, last_output, total * sizeof(unsigned short));
+	      continue;
+	    }
+	  split_pixel(cg, input, output);
 	}
-      if (channel_sum < cg->gloss_limit)
+      else
 	{
-	  unsigned gloss_required = cg->gloss_limit - channel_sum;
-	  if (gloss_required > 65535)
-	    gloss_required = 65535;
-	  output[cg->gloss_physical_channel] = gloss_required;
-	  if (zero_mask)
-	    *zero_mask &= gloss_mask;
+	  if (cg->copy_input)
+	    copy_pixel(cg, input, output);
+	  if (flags & CONVERT_GCR)
+	    gcr_pixel(cg, output);
+	  scale_pixel(cg, output);
 	}
-    next:
-      output += cg->total_channels;
+      if (flags & CONVERT_LIMIT)
+	limit_pixel(cg, output);
+      if ((flags & CONVERT_GLOSS) && gloss_pixel(cg, output))
+	gloss_generated = 1;
+      last_output = output;
+    }
+  memset(nz, 0, sizeof(unsigned short) * total);
+  scan_output(cg, nz);
+  if (zero_mask)
+    {
+      *zero_mask = 0;
+      for (i = 0; i < total; i++)
+	if (!nz[i] && ((flags & CONVERT_SPLIT) || !cg->is_gloss[i]))
+	  *zero_mask |= 1 << i;
+      if (gloss_generated)
+	*zero_mask &= ~(1 << cg->gloss_physical_channel);
     }
 }
 
-static void
-do_gcr(const stp_vars_t *v)
-{
-  stpi_channel_group_t *cg = get_channel_group(v);
-  const unsigned short *gcr_lookup;
-  unsigned short *output;
-  size_t count;
-  int i;
+#define CONVERT_ROW_FUNC(flags)						\
+static void								\
+convert_row_##flags(stpi_channel_group_t *cg, unsigned *zero_mask)	\
+{									\
+  convert_row(cg, zero_mask, flags);					\
+}
 
-  if (!cg)
-    return;
+CONVERT_ROW_FUNC(0)
+CONVERT_ROW_FUNC(1)
+CONVERT_ROW_FUNC(2)
+CONVERT_ROW_FUNC(3)
+CONVERT_ROW_FUNC(4)
+CONVERT_ROW_FUNC(5)
+CONVERT_ROW_FUNC(6)
+CONVERT_ROW_FUNC(7)
+CONVERT_ROW_FUNC(8)
+CONVERT_ROW_FUNC(9)
+CONVERT_ROW_FUNC(10)
+CONVERT_ROW_FUNC(11)
+CONVERT_ROW_FUNC(12)
+CONVERT_ROW_FUNC(13)
+CONVERT_ROW_FUNC(14)
+CONVERT_ROW_FUNC(15)
+
+static const stpi_convert_row_func_t convert_row_funcs[16] =
+{
+  convert_row_0, convert_row_1, convert_row_2, convert_row_3,
+  convert_row_4, convert_row_5, convert_row_6, convert_row_7,
+  convert_row_8, convert_row_9, convert_row_10, convert_row_11,
+  convert_row_12, convert_row_13, convert_row_14, convert_row_15
+};
 
-  output = cg->gcr_data;
-  stp_curve_resample(cg->gcr_curve, 65536);
-  gcr_lookup = stp_curve_get_ushort_data(cg->gcr_curve, &count);
-  for (i = 0; i < cg->width; i++)
+/*
+ * Pick the row converter for the steps this job needs.  This is redone
+ * if any of the settings it depends on change after initialization.
+ */
+static void
+setup_convert(const stp_vars_t *v, stpi_channel_group_t *cg)
+{
+  int flags = 0;
+  int i, j;
+  int physical_channel = 0;
+  cg->gloss_channels = 0;
+  cg->scaled_channels = 0;
+  for (i = 0; i < cg->channel_count; i++)
     {
-      unsigned k = output[0];
-      if (k > 0)
+      stpi_channel_t *ch = &(cg->c[i]);
+      for (j = 0; j < ch->subchannel_count; j++)
 	{
-	  int kk = gcr_lookup[k];
-	  int ck;
-	  if (kk > k)
-	    kk = k;
-	  ck = k - kk;
-	  output[0] = kk;
-	  output[1] += ck * cg->cyan_balance;
-	  output[2] += ck * cg->magenta_balance;
-	  output[3] += ck * cg->yellow_balance;
+	  cg->density[physical_channel] = ch->sc[j].s_density;
+	  cg->is_gloss[physical_channel] = (cg->gloss_channel == i);
+	  if (cg->gloss_channel == i)
+	    cg->gloss_channels++;
+	  else if (ch->sc[j].s_density != 65535)
+	    cg->scaled[cg->scaled_channels++] = physical_channel;
+	  physical_channel++;
 	}
-      output += cg->gcr_channels;
     }
+  if (input_needs_splitting(v))
+    flags |= CONVERT_SPLIT;
+  if (output_needs_gcr(v))
+    {
+      size_t count;
+      stp_curve_resample(cg->gcr_curve, 65536);
+      cg->gcr_lookup = stp_curve_get_ushort_data(cg->gcr_curve, &count);
+      flags |= CONVERT_GCR;
+    }
+  if (cg->ink_limit > 0 && cg->ink_limit < cg->max_density)
+    flags |= CONVERT_LIMIT;
+  if (cg->gloss_channel != -1 && cg->gloss_limit > 0)
+    flags |= CONVERT_GLOSS;
+  cg->copy_input = (!input_has_special_channels(v) &&
+		    output_has_gloss(v) && !input_needs_splitting(v));
+  cg->convert = convert_row_funcs[flags];
 }
 
 void
 stp_channel_convert(const stp_vars_t *v, unsigned *zero_mask)
 {
+  stpi_channel_group_t *cg = get_channel_group(v);
+  if (!cg)
+    return;
+  if (!cg->convert)
+    setup_convert(v, cg);
   if (input_has_special_channels(v))
     generate_special_channels(v);
-  else if (output_has_gloss(v) && !input_needs_splitting(v))
-    copy_channels(v);
-  if (output_needs_gcr(v))
-    do_gcr(v);
-  if (input_needs_splitting(v))
-    split_channels(v, zero_mask);
-  else
-    scale_channels(v, zero_mask);
-  (void) limit_ink(v);
-  (void) generate_gloss(v, zero_mask);
+  (cg->convert)(cg, zero_mask);
+  if (cg->planar_output)
+    write_planes(cg);
 }
 
 unsigned short *
@@ -1174,3 +1308,55 @@ stp_channel_get_output(const stp_vars_t *v)
     return NULL;
   return cg->output_data;
 }
+
+int
+stpi_channel_get_ink_extent(const stp_vars_t *v, int *first, int *last)
+{
+  stpi_channel_group_t *cg = get_channel_group(v);
+  if (!cg)
+    return 0;
+  *first = cg->ink_first;
+  *last = cg->ink_last;
+  return 1;
+}
+
+/*
+ * Ask for the converted rows to be written a plane per channel as well,
+ * each plane the width of the image.  This must be done before the
+ * channels are initialized.
+ */
+void
+stpi_channel_set_planar(stp_vars_t *v, int planar)
+{
+  stpi_channel_group_t *cg = get_channel_group(v);
+  if (!cg)
+    cg = create_channel_group(v);
+  cg->planar = planar;
+}
+
+const unsigned short *
+stpi_channel_get_planar_output(const stp_vars_t *v)
+{
+  stpi_channel_group_t *cg = get_channel_group(v);
+  if (!cg)
+    return NULL;
+  return cg->planar_output;
+}
+
+/*
+ * Samples in a row of input to the conversion (as written by the color
+ * code) and in a row of its output, planar or not.
+ */
+void
+stpi_channel_get_row_sizes(const stp_vars_t *v, size_t *input, size_t *output)
+{
+  stpi_channel_group_t *cg = get_channel_group(v);
+  if (!cg)
+    {
+      *input = 0;
+      *output = 0;
+      return;
+    }
+  *input = cg->input_channels * cg->width;
+  *output = cg->total_channels * cg->width;
+}
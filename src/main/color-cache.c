@@ -0,0 +1,543 @@
+/*
+ *   Gutenprint color management module - settings hashes and the
+ *   on-disk curve cache.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * The curves that stpi_compute_lut() builds depend only on the color
+ * parameters, so a spooler printing many jobs with the same settings
+ * can keep them on disk instead of computing them for every job.  The
+ * cache is off unless STP_LUT_CACHE is set in the environment: to an
+ * absolute directory name, or to any other value (except 0) to use
+ * $XDG_CACHE_HOME/gutenprint, which defaults to ~/.cache/gutenprint.
+ *
+ * Each file holds the curves for one set of settings and is named after
+ * the hash of those settings and the library version.  Files are written
+ * under a temporary name and renamed into place, so a reader never sees
+ * a partial file; a file whose header or checksum does not match is
+ * removed and recomputed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#include <gutenprint/curve-cache.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#include "color-conversion.h"
+
+#define CACHE_MAGIC "STPLUT\0\1"
+#define CACHE_VERSION_SIZE 24
+
+/* Curve slots in a cache file; the channel curves follow */
+#define SLOT_USER		0
+#define SLOT_BRIGHTNESS		1
+#define SLOT_CONTRAST		2
+#define SLOT_GCR		3
+#define SLOT_CHANNEL		4
+#define SLOT_COUNT		(SLOT_CHANNEL + STP_CHANNEL_LIMIT)
+
+typedef struct
+{
+  char magic[8];
+  char version[CACHE_VERSION_SIZE];
+  stpi_color_hash_t key;
+  unsigned checksum[2];		/* Of everything after the header */
+  unsigned curve_count;
+  unsigned payload_size;
+} cache_header_t;
+
+typedef struct
+{
+  unsigned slot;
+  unsigned wrap_mode;
+  unsigned interpolation;
+  unsigned count;
+  double low;
+  double high;
+} curve_record_t;		/* Followed by count doubles */
+
+/*
+ * Both structures are a multiple of 8 bytes long, so the curve data in
+ * a mapped file is suitably aligned to be read as doubles when the
+ * curves are built from it.
+ */
+
+void
+stpi_color_hash_init(stpi_color_hash_t *hash)
+{
+  hash->fnv = 2166136261u;
+  hash->sum = 0;
+}
+
+/*
+ * Two different 32-bit hashes of the same data, so that an accidental
+ * match between different settings is vanishingly unlikely.
+ */
+void
+stpi_color_hash_add(stpi_color_hash_t *hash, const void *data, size_t bytes)
+{
+  const unsigned char *p = (const unsigned char *) data;
+  unsigned fnv = hash->fnv;
+  unsigned sum = hash->sum;
+  size_t i;
+  for (i = 0; i < bytes; i++)
+    {
+      fnv = (fnv ^ p[i]) * 16777619u;
+      sum = sum * 65599u + p[i];
+    }
+  hash->fnv = fnv & 0xffffffffu;
+  hash->sum = sum & 0xffffffffu;
+}
+
+static void
+hash_string(stpi_color_hash_t *hash, const char *s)
+{
+  if (s)
+    stpi_color_hash_add(hash, s, strlen(s) + 1);
+  else
+    stpi_color_hash_add(hash, "", 1);
+}
+
+/*
+ * Fletcher-style checksum over 32-bit words; the files are several
+ * megabytes, which is too much to run through the settings hash.
+ */
+static void
+checksum_payload(const char *payload, size_t bytes, unsigned checksum[2])
+{
+  const unsigned *words = (const unsigned *) payload;
+  unsigned a = 0;
+  unsigned b = 0;
+  size_t i;
+  for (i = 0; i < bytes / sizeof(unsigned); i++)
+    {
+      a += words[i];
+      b += a;
+    }
+  checksum[0] = a;
+  checksum[1] = b;
+}
+
+static void
+hash_parameter(stpi_color_hash_t *hash, const stp_vars_t *v,
+	       const stp_parameter_t *desc)
+{
+  const char *name = desc->name;
+  stp_parameter_activity_t active;
+  int ival;
+  double dval;
+  char *curve;
+
+  hash_string(hash, name);
+  switch (desc->p_type)
+    {
+    case STP_PARAMETER_TYPE_STRING_LIST:
+      if (!stp_check_string_parameter(v, name, STP_PARAMETER_INACTIVE))
+	return;
+      active = stp_get_string_parameter_active(v, name);
+      hash_string(hash, stp_get_string_parameter(v, name));
+      break;
+    case STP_PARAMETER_TYPE_INT:
+      if (!stp_check_int_parameter(v, name, STP_PARAMETER_INACTIVE))
+	return;
+      active = stp_get_int_parameter_active(v, name);
+      ival = stp_get_int_parameter(v, name);
+      stpi_color_hash_add(hash, &ival, sizeof(ival));
+      break;
+    case STP_PARAMETER_TYPE_BOOLEAN:
+      if (!stp_check_boolean_parameter(v, name, STP_PARAMETER_INACTIVE))
+	return;
+      active = stp_get_boolean_parameter_active(v, name);
+      ival = stp_get_boolean_parameter(v, name);
+      stpi_color_hash_add(hash, &ival, sizeof(ival));
+      break;
+    case STP_PARAMETER_TYPE_DOUBLE:
+      if (!stp_check_float_parameter(v, name, STP_PARAMETER_INACTIVE))
+	return;
+      active = stp_get_float_parameter_active(v, name);
+      dval = stp_get_float_parameter(v, name);
+      stpi_color_hash_add(hash, &dval, sizeof(dval));
+      break;
+    case STP_PARAMETER_TYPE_CURVE:
+      if (!stp_check_curve_parameter(v, name, STP_PARAMETER_INACTIVE))
+	return;
+      active = stp_get_curve_parameter_active(v, name);
+      curve = stp_curve_write_string(stp_get_curve_parameter(v, name));
+      hash_string(hash, curve);
+      STP_SAFE_FREE(curve);
+      break;
+    default:
+      /* Files (LUTDumpFile) don't affect the curves */
+      return;
+    }
+  stpi_color_hash_add(hash, &active, sizeof(active));
+}
+
+/*
+ * The hash of everything the lut's curves and plan are computed from.
+ */
+void
+stpi_color_cache_key(stp_vars_t *v, const lut_t *lut, int gcr,
+		     stpi_color_hash_t *key)
+{
+  stp_parameter_list_t params = stp_color_list_parameters(v);
+  size_t count = stp_parameter_list_count(params);
+  int values[5];
+  size_t i;
+  stpi_color_hash_init(key);
+  hash_string(key, VERSION);
+  hash_string(key, lut->input_color_description->name);
+  hash_string(key, lut->output_color_description->name);
+  hash_string(key, lut->color_correction->name);
+  values[0] = lut->steps;
+  values[1] = lut->channel_depth;
+  values[2] = lut->out_channels;
+  values[3] = lut->invert_output;
+  values[4] = gcr;
+  stpi_color_hash_add(key, values, sizeof(values));
+  for (i = 0; i < count; i++)
+    hash_parameter(key, v, stp_parameter_list_param(params, i));
+  stp_parameter_list_destroy(params);
+}
+
+/*
+ * Returns the cache directory, or NULL if caching is off.
+ */
+static char *
+cache_directory(void)
+{
+  const char *setting = getenv("STP_LUT_CACHE");
+  char *dir = NULL;
+  if (!setting || !setting[0] || strcmp(setting, "0") == 0)
+    return NULL;
+  if (setting[0] == '/')
+    dir = stp_strdup(setting);
+  else if (getenv("XDG_CACHE_HOME") && getenv("XDG_CACHE_HOME")[0] == '/')
+    stp_asprintf(&dir, "%s/gutenprint", getenv("XDG_CACHE_HOME"));
+  else if (getenv("HOME"))
+    stp_asprintf(&dir, "%s/.cache/gutenprint", getenv("HOME"));
+  return dir;
+}
+
+static char *
+cache_file_name(const stpi_color_hash_t *key)
+{
+  char *dir = cache_directory();
+  char *name = NULL;
+  if (dir)
+    {
+      stp_asprintf(&name, "%s/lut-%08x%08x", dir, key->fnv, key->sum);
+      stp_free(dir);
+    }
+  return name;
+}
+
+static void
+make_directories(const char *file_name)
+{
+  char *dir = stp_strdup(file_name);
+  char *p;
+  for (p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/'))
+    {
+      *p = '\0';
+      (void) mkdir(dir, 0700);
+      *p = '/';
+    }
+  stp_free(dir);
+}
+
+static stp_cached_curve_t *
+lut_curve_slot(lut_t *lut, int slot)
+{
+  switch (slot)
+    {
+    case SLOT_USER:
+      return &(lut->user_color_correction);
+    case SLOT_BRIGHTNESS:
+      return &(lut->brightness_correction);
+    case SLOT_CONTRAST:
+      return &(lut->contrast_correction);
+    case SLOT_GCR:
+      return NULL;
+    default:
+      return &(lut->channel_curves[slot - SLOT_CHANNEL]);
+    }
+}
+
+static stp_curve_t *
+curve_from_record(const curve_record_t *record, const double *data)
+{
+  stp_curve_t *curve = stp_curve_create(record->wrap_mode);
+  if (stp_curve_set_bounds(curve, record->low, record->high) &&
+      stp_curve_set_interpolation_type(curve, record->interpolation) &&
+      stp_curve_set_data(curve, record->count, data))
+    return curve;
+  stp_curve_destroy(curve);
+  return NULL;
+}
+
+/*
+ * Install the curves in a cache file image into the lut.  Everything is
+ * checked before anything is installed.
+ */
+static int
+install_curves(stp_vars_t *v, lut_t *lut, int gcr, const char *image,
+	       size_t size, const stpi_color_hash_t *key)
+{
+  cache_header_t header;
+  unsigned checksum[2];
+  stp_curve_t *curves[SLOT_COUNT];
+  const char *p;
+  unsigned i;
+  int ok = 1;
+
+  if (size < sizeof(header))
+    return 0;
+  memcpy(&header, image, sizeof(header));
+  if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      strncmp(header.version, VERSION, CACHE_VERSION_SIZE) != 0 ||
+      header.key.fnv != key->fnv || header.key.sum != key->sum ||
+      header.payload_size != size - sizeof(header) ||
+      header.payload_size % sizeof(double) != 0)
+    return 0;
+  checksum_payload(image + sizeof(header), header.payload_size, checksum);
+  if (checksum[0] != header.checksum[0] || checksum[1] != header.checksum[1])
+    return 0;
+
+  memset(curves, 0, sizeof(curves));
+  p = image + sizeof(header);
+  for (i = 0; ok && i < header.curve_count; i++)
+    {
+      curve_record_t record;
+      if (p + sizeof(record) > image + size)
+	{
+	  ok = 0;
+	  break;
+	}
+      memcpy(&record, p, sizeof(record));
+      p += sizeof(record);
+      if (record.slot >= SLOT_COUNT || curves[record.slot] ||
+	  record.count > (image + size - p) / sizeof(double))
+	{
+	  ok = 0;
+	  break;
+	}
+      curves[record.slot] =
+	curve_from_record(&record, (const double *) p);
+      p += record.count * sizeof(double);
+      if (!curves[record.slot])
+	ok = 0;
+    }
+  if (ok && (!curves[SLOT_USER] || !curves[SLOT_BRIGHTNESS] ||
+	     !curves[SLOT_CONTRAST] || (gcr && !curves[SLOT_GCR])))
+    ok = 0;
+  for (i = 0; i < SLOT_COUNT; i++)
+    {
+      if (!curves[i])
+	continue;
+      if (!ok)
+	stp_curve_destroy(curves[i]);
+      else if (i == SLOT_GCR)
+	{
+	  stp_channel_set_gcr_curve(v, curves[i]);
+	  stp_curve_destroy(curves[i]);
+	}
+      else
+	stp_curve_cache_set_curve(lut_curve_slot(lut, i), curves[i]);
+    }
+  return ok;
+}
+
+/*
+ * Look the lut's curves up in the on-disk cache.  Returns 1 and installs
+ * the curves if they are there, 0 if they are not (with key set for
+ * stpi_color_cache_save()), or -1 if the cache is off.
+ */
+int
+stpi_color_cache_load(stp_vars_t *v, lut_t *lut, int gcr,
+		      stpi_color_hash_t *key)
+{
+  char *file_name;
+  struct stat sbuf;
+  char *image;
+  int fd;
+  int ok = 0;
+#ifdef HAVE_SYS_MMAN_H
+  int mapped = 0;
+#endif
+
+  if (!getenv("STP_LUT_CACHE"))
+    return -1;
+  stpi_color_cache_key(v, lut, gcr, key);
+  file_name = cache_file_name(key);
+  if (!file_name)
+    return -1;
+  fd = open(file_name, O_RDONLY);
+  if (fd < 0)
+    {
+      stp_dprintf(STP_DBG_LUT, v, "LUT cache miss %s\n", file_name);
+      stp_free(file_name);
+      return 0;
+    }
+  if (fstat(fd, &sbuf) == 0 && sbuf.st_size > 0)
+    {
+      size_t size = sbuf.st_size;
+#ifdef HAVE_SYS_MMAN_H
+      image = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (image != MAP_FAILED)
+	mapped = 1;
+      else
+#endif
+	{
+	  image = stp_malloc(size);
+	  if (read(fd, image, size) != (ssize_t) size)
+	    size = 0;
+	}
+      ok = install_curves(v, lut, gcr, image, size, key);
+#ifdef HAVE_SYS_MMAN_H
+      if (mapped)
+	(void) munmap(image, size);
+      else
+#endif
+	stp_free(image);
+    }
+  (void) close(fd);
+  if (ok)
+    stp_dprintf(STP_DBG_LUT, v, "LUT cache hit %s\n", file_name);
+  else
+    {
+      stp_dprintf(STP_DBG_LUT, v, "LUT cache file %s is invalid\n",
+		  file_name);
+      (void) unlink(file_name);
+    }
+  stp_free(file_name);
+  return ok;
+}
+
+/*
+ * Curves that are not plain sampled data (gamma or piecewise curves)
+ * cannot be stored; in that case nothing is written.
+ */
+static int
+add_curve(char **buffer, size_t *size, unsigned *count, int slot,
+	  const stp_curve_t *curve)
+{
+  curve_record_t record;
+  const double *data;
+  size_t points;
+  if (!curve)
+    return 1;
+  if (stp_curve_get_gamma(curve) != 0 || stp_curve_is_piecewise(curve))
+    return 0;
+  data = stp_curve_get_data(curve, &points);
+  if (!data)
+    return 0;
+  memset(&record, 0, sizeof(record));
+  record.slot = slot;
+  record.wrap_mode = stp_curve_get_wrap(curve);
+  record.interpolation = stp_curve_get_interpolation_type(curve);
+  record.count = points;
+  stp_curve_get_bounds(curve, &(record.low), &(record.high));
+  *buffer = stp_realloc(*buffer, *size + sizeof(record) +
+			points * sizeof(double));
+  memcpy(*buffer + *size, &record, sizeof(record));
+  memcpy(*buffer + *size + sizeof(record), data, points * sizeof(double));
+  *size += sizeof(record) + points * sizeof(double);
+  (*count)++;
+  return 1;
+}
+
+void
+stpi_color_cache_save(stp_vars_t *v, lut_t *lut, int gcr,
+		      const stpi_color_hash_t *key)
+{
+  cache_header_t header;
+  char *buffer = stp_malloc(sizeof(header));
+  size_t size = sizeof(header);
+  char *file_name;
+  char *temp_name = NULL;
+  int ok = 1;
+  int fd;
+  int i;
+
+  memset(&header, 0, sizeof(header));
+  ok &= add_curve(&buffer, &size, &(header.curve_count), SLOT_USER,
+		  stp_curve_cache_get_curve(&(lut->user_color_correction)));
+  ok &= add_curve(&buffer, &size, &(header.curve_count), SLOT_BRIGHTNESS,
+		  stp_curve_cache_get_curve(&(lut->brightness_correction)));
+  ok &= add_curve(&buffer, &size, &(header.curve_count), SLOT_CONTRAST,
+		  stp_curve_cache_get_curve(&(lut->contrast_correction)));
+  if (gcr)
+    ok &= add_curve(&buffer, &size, &(header.curve_count), SLOT_GCR,
+		    stp_channel_get_gcr_curve(v));
+  for (i = 0; i < STP_CHANNEL_LIMIT; i++)
+    ok &= add_curve(&buffer, &size, &(header.curve_count), SLOT_CHANNEL + i,
+		    stp_curve_cache_get_curve(&(lut->channel_curves[i])));
+  file_name = cache_file_name(key);
+  if (!ok || !file_name)
+    {
+      stp_free(buffer);
+      STP_SAFE_FREE(file_name);
+      return;
+    }
+
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  strncpy(header.version, VERSION, CACHE_VERSION_SIZE);
+  header.key = *key;
+  header.payload_size = size - sizeof(header);
+  checksum_payload(buffer + sizeof(header), header.payload_size,
+		   header.checksum);
+  memcpy(buffer, &header, sizeof(header));
+
+  make_directories(file_name);
+  /*
+   * mkstemp() makes a new file with a name nobody can guess, so a link
+   * planted in the cache directory can't redirect the write.
+   */
+  stp_asprintf(&temp_name, "%s.XXXXXX", file_name);
+  fd = mkstemp(temp_name);
+  if (fd >= 0)
+    {
+      ok = write(fd, buffer, size) == (ssize_t) size;
+      if (close(fd) != 0)
+	ok = 0;
+      if (ok && rename(temp_name, file_name) == 0)
+	stp_dprintf(STP_DBG_LUT, v, "LUT cache wrote %s\n", file_name);
+      else
+	(void) unlink(temp_name);
+    }
+  stp_free(temp_name);
+  stp_free(file_name);
+  stp_free(buffer);
+}
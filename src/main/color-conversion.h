@@ -134,6 +134,51 @@ typedef struct
   size_t bits;
 } channel_depth_t;
 
+/*
+ * Hash of the settings that a cached table or set of curves was built
+ * from; see color-cache.c.
+ */
+typedef struct
+{
+  unsigned fnv;
+  unsigned sum;
+} stpi_color_hash_t;
+
+/*
+ * A 3D LUT bakes an RGB to RGB conversion into a grid of samples; see
+ * color-lut3d.c.  Tables built from identical settings are shared.
+ */
+typedef struct stpi_color_lut3d stpi_color_lut3d_t;
+
+typedef void (*stpi_color_lut3d_fill_t)(void *data, unsigned short *rgb);
+
+/*
+ * Settings and curve data that the row converters need and that do not
+ * change during a job.  stpi_compute_lut() looks up the parameters once.
+ * The curves are resampled and fetched by the first row that each
+ * converter family handles, since only the converter knows what size it
+ * needs them in; "prepared" records which families have done that.
+ */
+typedef struct
+{
+  double saturation;
+  double ssat;			/* Saturation for HSL adjustment */
+  double isat;			/* 1 / ssat, if ssat > 1 */
+  double fast_isat;		/* 1 / saturation, if saturation > 1 */
+  int compute_saturation;
+  int split_saturation;
+  int do_user_adjustment;
+  int bright_color_adjustment;
+  int hue_only_color_adjustment;
+  int lut3d_size;		/* ColorLUTSize; 0 disables the 3D LUT */
+  unsigned prepared;
+  stpi_color_lut3d_t *lut3d;
+  const unsigned short *channel[STP_CHANNEL_LIMIT];
+  const unsigned short *brightness;
+  const unsigned short *contrast;
+  const unsigned short *user;
+} color_plan_t;
+
 typedef struct
 {
   unsigned steps;
@@ -165,6 +210,8 @@ typedef struct
   unsigned short *gray_tmp;	/* Color -> Gray */
   unsigned short *cmy_tmp;	/* CMY -> CMYK */
   unsigned char *in_data;
+  color_plan_t plan;
+  int refcount;			/* Vars and render sessions using the lut */
 } lut_t;
 
 extern unsigned stpi_color_convert_to_gray(const stp_vars_t *v,
@@ -180,6 +227,23 @@ extern unsigned stpi_color_convert_raw(const stp_vars_t *v,
 				       const unsigned char *,
 				       unsigned short *);
 
+extern void stpi_color_hash_init(stpi_color_hash_t *hash);
+extern void stpi_color_hash_add(stpi_color_hash_t *hash, const void *data,
+				size_t bytes);
+extern void stpi_color_cache_key(stp_vars_t *v, const lut_t *lut, int gcr,
+				 stpi_color_hash_t *key);
+extern int stpi_color_cache_load(stp_vars_t *v, lut_t *lut, int gcr,
+				 stpi_color_hash_t *key);
+extern void stpi_color_cache_save(stp_vars_t *v, lut_t *lut, int gcr,
+				  const stpi_color_hash_t *key);
+
+extern stpi_color_lut3d_t *
+stpi_color_lut3d_acquire(const stpi_color_hash_t *key, int grid,
+			 stpi_color_lut3d_fill_t fill, void *data);
+extern void stpi_color_lut3d_release(stpi_color_lut3d_t *lut);
+extern void stpi_color_lut3d_apply(const stpi_color_lut3d_t *lut,
+				   unsigned short *rgb, size_t pixels);
+
 #ifdef __cplusplus
   }
 #endif
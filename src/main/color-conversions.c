@@ -414,6 +414,140 @@ raw_cmy_to_kcmy(const stp_vars_t *vars, const unsigned short *in,
   return retval;
 }
 
+/*
+ * Converter families, for recording which have fetched their curves
+ * into the color plan.  The 16-bit variants use the same bits shifted
+ * up by PLAN_16_BIT_SHIFT.
+ */
+#define PLAN_COLOR		(1 << 0)
+#define PLAN_COLOR_FAST		(1 << 1)
+#define PLAN_GRAY_TO_COLOR	(1 << 2)
+#define PLAN_TO_KCMY		(1 << 3)
+#define PLAN_TO_GRAY		(1 << 4)
+#define PLAN_RAW		(1 << 5)
+#define PLAN_16_BIT_SHIFT	8
+
+/*
+ * Return true the first time a converter family runs in a job, when it
+ * must resample and fetch its curves into the plan.  Only the first
+ * resample of a curve matters: once the curve cache holds data, later
+ * fetches return that same data.
+ */
+static inline int
+plan_needs_curves(lut_t *lut, unsigned family, int bits)
+{
+  unsigned flag = family << (bits == 16 ? PLAN_16_BIT_SHIFT : 0);
+  if (lut->plan.prepared & flag)
+    return 0;
+  lut->plan.prepared |= flag;
+  return 1;
+}
+
+static inline const unsigned short *
+plan_curve(stp_cached_curve_t *cache, size_t points)
+{
+  stp_curve_resample(stp_curve_cache_get_curve(cache), points);
+  return stp_curve_cache_get_ushort_data(cache);
+}
+
+/*
+ * Optional 3D LUT for color_N_to_color: the contrast curve, saturation
+ * and HSL adjustments, and the channel curves are sampled once per set
+ * of settings and then interpolated for every pixel.
+ */
+typedef struct
+{
+  lut_t *lut;
+  int bits;
+} color_lut3d_fill_t;
+
+/*
+ * Sample a curve of 1 << bits points at a 16-bit value.  8-bit curves
+ * are interpolated between points so that the table is smooth.
+ */
+static inline unsigned short
+sample_curve(const unsigned short *curve, unsigned value, int bits)
+{
+  unsigned point, remainder;
+  if (bits == 16)
+    return curve[value];
+  point = value / 257;
+  remainder = value - point * 257;
+  if (remainder == 0)
+    return curve[point];
+  return (curve[point] * (257 - remainder) + curve[point + 1] * remainder +
+	  128) / 257;
+}
+
+static void
+fill_color_lut3d(void *data, unsigned short *rgb)
+{
+  const color_lut3d_fill_t *fill = (const color_lut3d_fill_t *) data;
+  lut_t *lut = fill->lut;
+  const color_plan_t *plan = &(lut->plan);
+  int i;
+  for (i = 0; i < 3; i++)
+    rgb[i] = sample_curve(plan->contrast, rgb[i], fill->bits);
+  if (plan->compute_saturation)
+    update_saturation_from_rgb(rgb, plan->brightness, plan->ssat,
+			       plan->isat, plan->do_user_adjustment);
+  adjust_hsl(rgb, lut, plan->ssat, plan->isat, plan->split_saturation,
+	     plan->hue_only_color_adjustment, plan->bright_color_adjustment);
+  for (i = 0; i < 3; i++)
+    rgb[i] = sample_curve(plan->channel[CHANNEL_C + i], rgb[i], fill->bits);
+}
+
+static void
+add_map_to_key(stpi_color_hash_t *key, stp_cached_curve_t *cache)
+{
+  size_t count = CURVE_CACHE_FAST_COUNT(cache);
+  const double *data = CURVE_CACHE_FAST_DOUBLE(cache);
+  if (!data)
+    count = 0;
+  stpi_color_hash_add(key, &count, sizeof(count));
+  if (data)
+    stpi_color_hash_add(key, data, count * sizeof(double));
+}
+
+/*
+ * Called once the plan holds the curves; the key covers everything
+ * fill_color_lut3d() reads.
+ */
+static stpi_color_lut3d_t *
+acquire_color_lut3d(lut_t *lut, int bits)
+{
+  const color_plan_t *plan = &(lut->plan);
+  size_t points = (size_t) 1 << bits;
+  stpi_color_hash_t key;
+  color_lut3d_fill_t fill;
+  int flags[5];
+  int i;
+  flags[0] = plan->compute_saturation;
+  flags[1] = plan->split_saturation;
+  flags[2] = plan->do_user_adjustment;
+  flags[3] = plan->bright_color_adjustment;
+  flags[4] = plan->hue_only_color_adjustment;
+  stpi_color_hash_init(&key);
+  stpi_color_hash_add(&key, &bits, sizeof(bits));
+  stpi_color_hash_add(&key, flags, sizeof(flags));
+  stpi_color_hash_add(&key, &(plan->ssat), sizeof(double));
+  stpi_color_hash_add(&key, &(plan->isat), sizeof(double));
+  stpi_color_hash_add(&key, plan->contrast,
+			   points * sizeof(unsigned short));
+  stpi_color_hash_add(&key, plan->brightness,
+			   65536 * sizeof(unsigned short));
+  for (i = CHANNEL_C; i <= CHANNEL_Y; i++)
+    stpi_color_hash_add(&key, plan->channel[i],
+			     points * sizeof(unsigned short));
+  add_map_to_key(&key, &(lut->hue_map));
+  add_map_to_key(&key, &(lut->lum_map));
+  add_map_to_key(&key, &(lut->sat_map));
+  fill.lut = lut;
+  fill.bits = bits;
+  return stpi_color_lut3d_acquire(&key, plan->lut3d_size, fill_color_lut3d,
+				  &fill);
+}
+
 #define GENERIC_COLOR_FUNC(fromname, toname)				\
 static unsigned								\
 fromname##_to_##toname(const stp_vars_t *vars, const unsigned char *in,	\
@@ -442,97 +576,76 @@ color_##bits##_to_color(const stp_vars_t *vars, const unsigned char *in,     \
 			unsigned short *out)				     \
 {									     \
   int i;								     \
-  double isat = 1.0;							     \
-  double ssat = stp_get_float_parameter(vars, "Saturation");		     \
-  double sbright = stp_get_float_parameter(vars, "Brightness");		     \
   int i0 = -1;								     \
   int i1 = -1;								     \
   int i2 = -1;								     \
   unsigned short o0 = 0;						     \
   unsigned short o1 = 0;						     \
   unsigned short o2 = 0;						     \
-  unsigned short nz0 = 0;						     \
-  unsigned short nz1 = 0;						     \
-  unsigned short nz2 = 0;						     \
-  const unsigned short *red;						     \
-  const unsigned short *green;						     \
-  const unsigned short *blue;						     \
-  const unsigned short *brightness;					     \
-  const unsigned short *contrast;					     \
-  const T *s_in = (const T *) in;					     \
+  const unsigned short *tables[3];					     \
+  unsigned short *rgb = out;						     \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	     \
-  int compute_saturation = ssat <= .99999 || ssat >= 1.00001;		     \
-  int split_saturation = ssat > 1.4;					     \
-  int bright_color_adjustment = 0;					     \
-  int hue_only_color_adjustment = 0;					     \
-  int do_user_adjustment = 0;						     \
-  if (lut->color_correction->correction == COLOR_CORRECTION_BRIGHT)	     \
-    bright_color_adjustment = 1;					     \
-  if (lut->color_correction->correction == COLOR_CORRECTION_HUE)	     \
-    hue_only_color_adjustment = 1;					     \
-  if (sbright != 1)							     \
-    do_user_adjustment = 1;						     \
-  compute_saturation |= do_user_adjustment;				     \
-									     \
-  for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				     \
-    stp_curve_resample(stp_curve_cache_get_curve(&(lut->channel_curves[i])), \
-		       1 << bits);					     \
-  stp_curve_resample							     \
-    (stp_curve_cache_get_curve(&(lut->brightness_correction)), 65536);	     \
-  stp_curve_resample							     \
-    (stp_curve_cache_get_curve(&(lut->contrast_correction)), 1 << bits);     \
-  red =									     \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_C]));	     \
-  green =								     \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_M]));	     \
-  blue =								     \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_Y]));	     \
-  brightness=								     \
-    stp_curve_cache_get_ushort_data(&(lut->brightness_correction));	     \
-  contrast =								     \
-    stp_curve_cache_get_ushort_data(&(lut->contrast_correction));	     \
-  (void) stp_curve_cache_get_double_data(&(lut->hue_map));		     \
-  (void) stp_curve_cache_get_double_data(&(lut->lum_map));		     \
-  (void) stp_curve_cache_get_double_data(&(lut->sat_map));		     \
+  const color_plan_t *plan = &(lut->plan);				     \
 									     \
-  if (split_saturation)							     \
-    ssat = sqrt(ssat);							     \
-  if (ssat > 1)								     \
-    isat = 1.0 / ssat;							     \
-  for (i = 0; i < lut->image_width; i++)				     \
+  if (plan_needs_curves(lut, PLAN_COLOR, bits))				     \
     {									     \
-      if (i0 == s_in[0] && i1 == s_in[1] && i2 == s_in[2])		     \
+      for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				     \
+	lut->plan.channel[i] =						     \
+	  plan_curve(&(lut->channel_curves[i]), 1 << bits);		     \
+      lut->plan.brightness =						     \
+	plan_curve(&(lut->brightness_correction), 65536);		     \
+      lut->plan.contrast =						     \
+	plan_curve(&(lut->contrast_correction), 1 << bits);		     \
+      (void) stp_curve_cache_get_double_data(&(lut->hue_map));		     \
+      (void) stp_curve_cache_get_double_data(&(lut->lum_map));		     \
+      (void) stp_curve_cache_get_double_data(&(lut->sat_map));		     \
+      if (plan->lut3d_size >= 2)					     \
+	lut->plan.lut3d = acquire_color_lut3d(lut, bits);		     \
+    }									     \
+  if (plan->lut3d)							     \
+    {									     \
+      stpi_color_scale_row(in, bits, 65535 / ((1 << bits) - 1), 0,	     \
+			   lut->image_width * 3, out);			     \
+      stpi_color_lut3d_apply(plan->lut3d, out, lut->image_width);	     \
+      return 7 & ~stpi_color_nonzero_channels(out, lut->image_width, 3);     \
+    }									     \
+  /*									     \
+   * The contrast and channel curve lookups are done a row at a time;	     \
+   * only the HSL adjustment in between is done per pixel, and then	     \
+   * only once per run of identical pixels.				     \
+   */									     \
+  tables[0] = plan->contrast;						     \
+  tables[1] = plan->contrast;						     \
+  tables[2] = plan->contrast;						     \
+  stpi_color_scale_row(in, bits, 1, 0, lut->image_width * 3, out);	     \
+  stpi_color_lookup_row(out, lut->image_width, 3, tables, 0);		     \
+  for (i = 0; i < lut->image_width; i++, rgb += 3)			     \
+    {									     \
+      if (i0 == rgb[0] && i1 == rgb[1] && i2 == rgb[2])			     \
 	{								     \
-	  out[0] = o0;							     \
-	  out[1] = o1;							     \
-	  out[2] = o2;							     \
+	  rgb[0] = o0;							     \
+	  rgb[1] = o1;							     \
+	  rgb[2] = o2;							     \
 	}								     \
       else								     \
 	{								     \
-	  i0 = s_in[0];							     \
-	  i1 = s_in[1];							     \
-	  i2 = s_in[2];							     \
-	  out[0] = i0 * (65535u / (unsigned) ((1 << bits) - 1));	     \
-	  out[1] = i1 * (65535u / (unsigned) ((1 << bits) - 1));	     \
-	  out[2] = i2 * (65535u / (unsigned) ((1 << bits) - 1));	     \
-	  lookup_rgb(lut, out, contrast, contrast, contrast, 1 << bits);     \
-	  if ((compute_saturation))					     \
-	    update_saturation_from_rgb(out, brightness, ssat, isat,	     \
-				       do_user_adjustment);		     \
-	  adjust_hsl(out, lut, ssat, isat, split_saturation,		     \
-		     hue_only_color_adjustment, bright_color_adjustment);    \
-	  lookup_rgb(lut, out, red, green, blue, 1 << bits);		     \
-	  o0 = out[0];							     \
-	  o1 = out[1];							     \
-	  o2 = out[2];							     \
-	  nz0 |= o0;							     \
-	  nz1 |= o1;							     \
-	  nz2 |= o2;							     \
+	  i0 = rgb[0];							     \
+	  i1 = rgb[1];							     \
+	  i2 = rgb[2];							     \
+	  if (plan->compute_saturation)					     \
+	    update_saturation_from_rgb(rgb, plan->brightness, plan->ssat,    \
+				       plan->isat, plan->do_user_adjustment); \
+	  adjust_hsl(rgb, lut, plan->ssat, plan->isat,			     \
+		     plan->split_saturation, plan->hue_only_color_adjustment, \
+		     plan->bright_color_adjustment);			     \
+	  o0 = rgb[0];							     \
+	  o1 = rgb[1];							     \
+	  o2 = rgb[2];							     \
 	}								     \
-      s_in += 3;							     \
-      out += 3;								     \
     }									     \
-  return (nz0 ? 0 : 1) +  (nz1 ? 0 : 2) +  (nz2 ? 0 : 4);		     \
+  stpi_color_lookup_row(out, lut->image_width, 3, plan->channel + CHANNEL_C, \
+			bits != 16);					     \
+  return 7 & ~stpi_color_nonzero_channels(out, lut->image_width, 3);	     \
 }
 
 COLOR_TO_COLOR_FUNC(unsigned char, 8)
@@ -555,76 +668,49 @@ color_##bits##_to_color_fast(const stp_vars_t *vars, const unsigned char *in, \
   int o0 = 0;								      \
   int o1 = 0;								      \
   int o2 = 0;								      \
-  int nz0 = 0;								      \
-  int nz1 = 0;								      \
-  int nz2 = 0;								      \
-  const T *s_in = (const T *) in;					      \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	      \
-  const unsigned short *red;						      \
-  const unsigned short *green;						      \
-  const unsigned short *blue;						      \
-  const unsigned short *brightness;					      \
-  const unsigned short *contrast;					      \
-  double isat = 1.0;							      \
-  double saturation = stp_get_float_parameter(vars, "Saturation");	      \
-  double sbright = stp_get_float_parameter(vars, "Brightness");		      \
-  int compute_saturation = saturation <= .99999 || saturation >= 1.00001;     \
-  int do_user_adjustment = 0;						      \
-  if (sbright != 1)							      \
-    do_user_adjustment = 1;						      \
-  compute_saturation |= do_user_adjustment;				      \
+  const color_plan_t *plan = &(lut->plan);				      \
+  const unsigned short *tables[3];					      \
+  unsigned short *rgb = out;						      \
 									      \
-  for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				      \
-    stp_curve_resample(lut->channel_curves[i].curve, 65536);		      \
-  stp_curve_resample							      \
-    (stp_curve_cache_get_curve(&(lut->brightness_correction)), 65536);	      \
-  stp_curve_resample							      \
-    (stp_curve_cache_get_curve(&(lut->contrast_correction)), 1 << bits);      \
-  red =									      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_C]));	      \
-  green =								      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_M]));	      \
-  blue =								      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_Y]));	      \
-  brightness=								      \
-    stp_curve_cache_get_ushort_data(&(lut->brightness_correction));	      \
-  contrast =								      \
-    stp_curve_cache_get_ushort_data(&(lut->contrast_correction));	      \
-									      \
-  if (saturation > 1)							      \
-    isat = 1.0 / saturation;						      \
-  for (i = 0; i < lut->image_width; i++)				      \
+  if (plan_needs_curves(lut, PLAN_COLOR_FAST, bits))			      \
     {									      \
-      if (i0 == s_in[0] && i1 == s_in[1] && i2 == s_in[2])		      \
-	{								      \
-	  out[0] = o0;							      \
-	  out[1] = o1;							      \
-	  out[2] = o2;							      \
-	}								      \
-      else								      \
-	{								      \
-	  i0 = s_in[0];							      \
-	  i1 = s_in[1];							      \
-	  i2 = s_in[2];							      \
-	  out[0] = contrast[s_in[0]];					      \
-	  out[1] = contrast[s_in[1]];					      \
-	  out[2] = contrast[s_in[2]];					      \
-	  if ((compute_saturation))					      \
-	    update_saturation_from_rgb(out, brightness, saturation, isat, 1); \
-	  out[0] = red[out[0]];						      \
-	  out[1] = green[out[1]];					      \
-	  out[2] = blue[out[2]];					      \
-	  o0 = out[0];							      \
-	  o1 = out[1];							      \
-	  o2 = out[2];							      \
-	  nz0 |= o0;							      \
-	  nz1 |= o1;							      \
-	  nz2 |= o2;							      \
-	}								      \
-      s_in += 3;							      \
-      out += 3;								      \
+      for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				      \
+	lut->plan.channel[i] = plan_curve(&(lut->channel_curves[i]), 65536);  \
+      lut->plan.brightness =						      \
+	plan_curve(&(lut->brightness_correction), 65536);		      \
+      lut->plan.contrast =						      \
+	plan_curve(&(lut->contrast_correction), 1 << bits);		      \
     }									      \
-  return (nz0 ? 0 : 1) +  (nz1 ? 0 : 2) +  (nz2 ? 0 : 4);		      \
+  tables[0] = plan->contrast;						      \
+  tables[1] = plan->contrast;						      \
+  tables[2] = plan->contrast;						      \
+  stpi_color_scale_row(in, bits, 1, 0, lut->image_width * 3, out);	      \
+  stpi_color_lookup_row(out, lut->image_width, 3, tables, 0);		      \
+  if (plan->compute_saturation)						      \
+    for (i = 0; i < lut->image_width; i++, rgb += 3)			      \
+      {									      \
+	if (i0 == rgb[0] && i1 == rgb[1] && i2 == rgb[2])		      \
+	  {								      \
+	    rgb[0] = o0;						      \
+	    rgb[1] = o1;						      \
+	    rgb[2] = o2;						      \
+	  }								      \
+	else								      \
+	  {								      \
+	    i0 = rgb[0];						      \
+	    i1 = rgb[1];						      \
+	    i2 = rgb[2];						      \
+	    update_saturation_from_rgb(rgb, plan->brightness,		      \
+				       plan->saturation, plan->fast_isat, 1); \
+	    o0 = rgb[0];						      \
+	    o1 = rgb[1];						      \
+	    o2 = rgb[2];						      \
+	  }								      \
+      }									      \
+  stpi_color_lookup_row(out, lut->image_width, 3, plan->channel + CHANNEL_C,  \
+			0);						      \
+  return 7 & ~stpi_color_nonzero_channels(out, lut->image_width, 3);	      \
 }
 
 FAST_COLOR_TO_COLOR_FUNC(unsigned char, 8)
@@ -636,28 +722,14 @@ static unsigned								    \
 color_##bits##_to_color_raw(const stp_vars_t *vars, const unsigned char *in,\
 			    unsigned short *out)			    \
 {									    \
-  int i;								    \
-  int j;								    \
-  int nz = 0;								    \
-  const T *s_in = (const T *) in;					    \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
   unsigned mask = 0;							    \
   if (lut->invert_output)						    \
     mask = 0xffff;							    \
 									    \
-  for (i = 0; i < lut->image_width; i++)				    \
-    {									    \
-      unsigned bit = 1;							    \
-      for (j = 0; j < 3; j++, bit += bit)				    \
-	{								    \
-	  out[j] = (s_in[j] * (65535 / ((1 << bits) - 1))) ^ mask;	    \
-	  if (out[j])							    \
-	    nz |= bit;							    \
-	}								    \
-      s_in += 3;							    \
-      out += 3;								    \
-    }									    \
-  return nz;								    \
+  stpi_color_scale_row(in, bits, 65535 / ((1 << bits) - 1), mask,	    \
+		       lut->image_width * 3, out);			    \
+  return stpi_color_nonzero_channels(out, lut->image_width, 3);		    \
 }
 
 RAW_COLOR_TO_COLOR_FUNC(unsigned char, 8)
@@ -674,58 +746,31 @@ gray_##bits##_to_color(const stp_vars_t *vars, const unsigned char *in,	    \
 		   unsigned short *out)					    \
 {									    \
   int i;								    \
-  int i0 = -1;								    \
-  int o0 = 0;								    \
-  int o1 = 0;								    \
-  int o2 = 0;								    \
-  int nz0 = 0;								    \
-  int nz1 = 0;								    \
-  int nz2 = 0;								    \
-  const T *s_in = (const T *) in;					    \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
-  const unsigned short *red;						    \
-  const unsigned short *green;						    \
-  const unsigned short *blue;						    \
-  const unsigned short *user;						    \
+  const color_plan_t *plan = &(lut->plan);				    \
 									    \
-  for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				    \
-    stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-  stp_curve_resample							    \
-    (stp_curve_cache_get_curve(&(lut->user_color_correction)), 1 << bits);  \
-  red =									    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_C]));	    \
-  green =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_M]));	    \
-  blue =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_Y]));	    \
-  user =								    \
-    stp_curve_cache_get_ushort_data(&(lut->user_color_correction));	    \
+  if (plan_needs_curves(lut, PLAN_GRAY_TO_COLOR, bits))			    \
+    {									    \
+      for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				    \
+	lut->plan.channel[i] = plan_curve(&(lut->channel_curves[i]), 65536); \
+      lut->plan.user = plan_curve(&(lut->user_color_correction), 1 << bits); \
+    }									    \
 									    \
-  for (i = 0; i < lut->image_width; i++)				    \
+  /*									    \
+   * Apply the user curve to the gray row at the front of the output,	    \
+   * then spread it out to three channels from the end backwards.	    \
+   */									    \
+  stpi_color_scale_row(in, bits, 1, 0, lut->image_width, out);		    \
+  stpi_color_lookup_row(out, lut->image_width, 1, &(plan->user), 0);	    \
+  for (i = lut->image_width - 1; i >= 0; i--)				    \
     {									    \
-      if (i0 == s_in[0])						    \
-	{								    \
-	  out[0] = o0;							    \
-	  out[1] = o1;							    \
-	  out[2] = o2;							    \
-	}								    \
-      else								    \
-	{								    \
-	  i0 = s_in[0];							    \
-	  out[0] = red[user[s_in[0]]];					    \
-	  out[1] = green[user[s_in[0]]];				    \
-	  out[2] = blue[user[s_in[0]]];					    \
-	  o0 = out[0];							    \
-	  o1 = out[1];							    \
-	  o2 = out[2];							    \
-	  nz0 |= o0;							    \
-	  nz1 |= o1;							    \
-	  nz2 |= o2;							    \
-	}								    \
-      s_in += 1;							    \
-      out += 3;								    \
+      out[i * 3 + 2] = out[i];						    \
+      out[i * 3 + 1] = out[i];						    \
+      out[i * 3] = out[i];						    \
     }									    \
-  return (nz0 ? 0 : 1) +  (nz1 ? 0 : 2) +  (nz2 ? 0 : 4);		    \
+  stpi_color_lookup_row(out, lut->image_width, 3, plan->channel + CHANNEL_C, \
+			0);						    \
+  return 7 & ~stpi_color_nonzero_channels(out, lut->image_width, 3);	    \
 }
 
 GRAY_TO_COLOR_FUNC(unsigned char, 8)
@@ -911,34 +956,11 @@ name##_to_kcmy_threshold(const stp_vars_t *vars,			\
 			 const unsigned char *in,			\
 			 unsigned short *out)				\
 {									\
-  int i;								\
-  int j;								\
-  unsigned nz[4];							\
-  unsigned z = 0xf;							\
-  const T *s_in = (const T *) in;					\
-  unsigned desired_high_bit = 0;					\
-  unsigned high_bit = 1 << ((sizeof(T) * 8) - 1);			\
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
   int width = lut->image_width;						\
-  memset(out, 0, width * 4 * sizeof(unsigned short));			\
-  if (!lut->invert_output)						\
-    desired_high_bit = high_bit;					\
-  for (i = 0; i < 4; i++)						\
-    nz[i] = z & ~(1 << i);						\
-									\
-  for (i = 0; i < width; i++)						\
-    {									\
-      for (j = 0; j < 4; j++)						\
-	{								\
-	  if ((*s_in++ & high_bit) == desired_high_bit)			\
-	    {								\
-	      z &= nz[j];						\
-	      *out = 65535;						\
-	    }								\
-	  out++;							\
-	}								\
-    }									\
-  return z;								\
+  stpi_color_threshold_row(in, sizeof(T) * 8, lut->invert_output,	\
+			   width * 4, out);				\
+  return 0xf & ~stpi_color_nonzero_channels(out, width, 4);		\
 }
 
 KCMY_TO_KCMY_THRESHOLD_FUNC(unsigned char, kcmy_8)
@@ -1072,8 +1094,21 @@ COLOR_TO_GRAY_THRESHOLD_FUNC(unsigned char, color_8, 3, 3)
 COLOR_TO_GRAY_THRESHOLD_FUNC(unsigned short, color_16, 3, 3)
 GENERIC_COLOR_FUNC(color, gray_threshold)
 
-COLOR_TO_GRAY_THRESHOLD_FUNC(unsigned char, gray_8, 1, 1)
-COLOR_TO_GRAY_THRESHOLD_FUNC(unsigned short, gray_16, 1, 1)
+#define GRAY_TO_GRAY_THRESHOLD_FUNC(T, name)				\
+static unsigned								\
+name##_to_gray_threshold(const stp_vars_t *vars,			\
+			const unsigned char *in,			\
+			unsigned short *out)				\
+{									\
+  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
+  int width = lut->image_width;						\
+  stpi_color_threshold_row(in, sizeof(T) * 8, lut->invert_output,	\
+			   width, out);					\
+  return 1 & ~stpi_color_nonzero_channels(out, width, 1);		\
+}
+
+GRAY_TO_GRAY_THRESHOLD_FUNC(unsigned char, gray_8)
+GRAY_TO_GRAY_THRESHOLD_FUNC(unsigned short, gray_16)
 GENERIC_COLOR_FUNC(gray, gray_threshold)
 
 #define CMYK_TO_COLOR_FUNC(namein, name2, T, bits, offset)		      \
@@ -1154,37 +1189,32 @@ cmyk_##size##_to_kcmy(const stp_vars_t *vars,				    \
 		      unsigned short *out)				    \
 {									    \
   int i;								    \
-  unsigned retval = 0;							    \
-  int j;								    \
-  int nz[4];								    \
-  const T *s_in = (const T *) in;					    \
+  unsigned retval;							    \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
-  const unsigned short *user;						    \
-  const unsigned short *maps[4];					    \
+  const unsigned short *user[4];					    \
 									    \
-  for (i = 0; i < 4; i++)						    \
+  if (plan_needs_curves(lut, PLAN_TO_KCMY, size))			    \
     {									    \
-      stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-      maps[i] = stp_curve_cache_get_ushort_data(&(lut->channel_curves[i])); \
+      for (i = 0; i < 4; i++)						    \
+	lut->plan.channel[i] = plan_curve(&(lut->channel_curves[i]), 65536); \
+      lut->plan.user = plan_curve(&(lut->user_color_correction), 1 << size); \
     }									    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << size);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
-									    \
-  memset(nz, 0, sizeof(nz));						    \
+  for (i = 0; i < 4; i++)						    \
+    user[i] = lut->plan.user;						    \
 									    \
-  for (i = 0; i < lut->image_width; i++, out += 4)			    \
+  stpi_color_scale_row(in, size, 1, 0, lut->image_width * 4, out);	    \
+  for (i = 0; i < lut->image_width; i++)				    \
     {									    \
-      for (j = 0; j < 4; j++)						    \
-	{								    \
-	  int outpos = (j + 1) & 3;					    \
-	  int inval = *s_in++;						    \
-	  nz[outpos] |= inval;						    \
-	  out[outpos] = maps[outpos][user[inval]];			    \
-	}								    \
+      unsigned short *pixel = out + i * 4;				    \
+      unsigned short k = pixel[3];					    \
+      pixel[3] = pixel[2];						    \
+      pixel[2] = pixel[1];						    \
+      pixel[1] = pixel[0];						    \
+      pixel[0] = k;							    \
     }									    \
-  for (j = 0; j < 4; j++)						    \
-    if (nz[j] == 0)							    \
-      retval |= (1 << j);						    \
+  retval = 0xf & ~stpi_color_nonzero_channels(out, lut->image_width, 4);    \
+  stpi_color_lookup_row(out, lut->image_width, 4, user, 0);		    \
+  stpi_color_lookup_row(out, lut->image_width, 4, lut->plan.channel, 0);    \
   return retval;							    \
 }
 
@@ -1199,36 +1229,23 @@ kcmy_##size##_to_kcmy(const stp_vars_t *vars,				    \
 		      unsigned short *out)				    \
 {									    \
   int i;								    \
-  unsigned retval = 0;							    \
-  int j;								    \
-  int nz[4];								    \
-  const T *s_in = (const T *) in;					    \
+  unsigned retval;							    \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
-  const unsigned short *user;						    \
-  const unsigned short *maps[4];					    \
+  const unsigned short *user[4];					    \
 									    \
-  for (i = 0; i < 4; i++)						    \
+  if (plan_needs_curves(lut, PLAN_TO_KCMY, size))			    \
     {									    \
-      stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-      maps[i] = stp_curve_cache_get_ushort_data(&(lut->channel_curves[i])); \
+      for (i = 0; i < 4; i++)						    \
+	lut->plan.channel[i] = plan_curve(&(lut->channel_curves[i]), 65536); \
+      lut->plan.user = plan_curve(&(lut->user_color_correction), 1 << size); \
     }									    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << size);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
-									    \
-  memset(nz, 0, sizeof(nz));						    \
+  for (i = 0; i < 4; i++)						    \
+    user[i] = lut->plan.user;						    \
 									    \
-  for (i = 0; i < lut->image_width; i++, out += 4)			    \
-    {									    \
-      for (j = 0; j < 4; j++)						    \
-	{								    \
-	  int inval = *s_in++;						    \
-	  nz[j] |= inval;						    \
-	  out[j] = maps[j][user[inval]];				    \
-	}								    \
-    }									    \
-  for (j = 0; j < 4; j++)						    \
-    if (nz[j] == 0)							    \
-      retval |= (1 << j);						    \
+  stpi_color_scale_row(in, size, 1, 0, lut->image_width * 4, out);	    \
+  retval = 0xf & ~stpi_color_nonzero_channels(out, lut->image_width, 4);    \
+  stpi_color_lookup_row(out, lut->image_width, 4, user, 0);		    \
+  stpi_color_lookup_row(out, lut->image_width, 4, lut->plan.channel, 0);    \
   return retval;							    \
 }
 
@@ -1253,12 +1270,14 @@ gray_##bits##_to_gray(const stp_vars_t *vars,				   \
   const unsigned short *composite;					   \
   const unsigned short *user;						   \
 									   \
-  stp_curve_resample							   \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536); \
-  composite =								   \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	   \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	   \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));   \
+  if (plan_needs_curves(lut, PLAN_TO_GRAY, bits))			   \
+    {									   \
+      lut->plan.channel[CHANNEL_K] =					   \
+	plan_curve(&(lut->channel_curves[CHANNEL_K]), 65536);		   \
+      lut->plan.user = plan_curve(&(lut->user_color_correction), 1 << bits); \
+    }									   \
+  composite = lut->plan.channel[CHANNEL_K];				   \
+  user = lut->plan.user;						   \
 									   \
   memset(out, 0, width * sizeof(unsigned short));			   \
 									   \
@@ -1301,12 +1320,14 @@ color_##bits##_to_gray(const stp_vars_t *vars,				      \
   const unsigned short *composite;					      \
   const unsigned short *user;						      \
 									      \
-  stp_curve_resample							      \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536);    \
-  composite =								      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	      \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	      \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));      \
+  if (plan_needs_curves(lut, PLAN_TO_GRAY, bits))			      \
+    {									      \
+      lut->plan.channel[CHANNEL_K] =					      \
+	plan_curve(&(lut->channel_curves[CHANNEL_K]), 65536);		      \
+      lut->plan.user = plan_curve(&(lut->user_color_correction), 1 << bits);  \
+    }									      \
+  composite = lut->plan.channel[CHANNEL_K];				      \
+  user = lut->plan.user;						      \
 									      \
   if (lut->input_color_description->color_model == COLOR_BLACK)		      \
     {									      \
@@ -1360,12 +1381,14 @@ cmyk_##bits##_to_gray(const stp_vars_t *vars,				    \
   const unsigned short *composite;					    \
   const unsigned short *user;						    \
 									    \
-  stp_curve_resample							    \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536);  \
-  composite =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+  if (plan_needs_curves(lut, PLAN_TO_GRAY, bits))			    \
+    {									    \
+      lut->plan.channel[CHANNEL_K] =					    \
+	plan_curve(&(lut->channel_curves[CHANNEL_K]), 65536);		    \
+      lut->plan.user = plan_curve(&(lut->user_color_correction), 1 << bits); \
+    }									    \
+  composite = lut->plan.channel[CHANNEL_K];				    \
+  user = lut->plan.user;						    \
 									    \
   if (lut->input_color_description->color_model == COLOR_BLACK)		    \
     {									    \
@@ -1420,12 +1443,14 @@ kcmy_##bits##_to_gray(const stp_vars_t *vars,				    \
   const unsigned short *composite;					    \
   const unsigned short *user;						    \
 									    \
-  stp_curve_resample							    \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536);  \
-  composite =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+  if (plan_needs_curves(lut, PLAN_TO_GRAY, bits))			    \
+    {									    \
+      lut->plan.channel[CHANNEL_K] =					    \
+	plan_curve(&(lut->channel_curves[CHANNEL_K]), 65536);		    \
+      lut->plan.user = plan_curve(&(lut->user_color_correction), 1 << bits); \
+    }									    \
+  composite = lut->plan.channel[CHANNEL_K];				    \
+  user = lut->plan.user;						    \
 									    \
   if (lut->input_color_description->color_model == COLOR_BLACK)		    \
     {									    \
@@ -1853,16 +1878,16 @@ raw_##size##_to_raw(const stp_vars_t *vars,				    \
   int nz[STP_CHANNEL_LIMIT];						    \
   const T *s_in = (const T *) in;					    \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
-  const unsigned short *maps[STP_CHANNEL_LIMIT];			    \
+  const unsigned short *const *maps = lut->plan.channel;		    \
   const unsigned short *user;						    \
 									    \
-  for (i = 0; i < lut->out_channels; i++)				    \
+  if (plan_needs_curves(lut, PLAN_RAW, size))				    \
     {									    \
-      stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-      maps[i] = stp_curve_cache_get_ushort_data(&(lut->channel_curves[i])); \
+      for (i = 0; i < lut->out_channels; i++)				    \
+	lut->plan.channel[i] = plan_curve(&(lut->channel_curves[i]), 65536); \
+      lut->plan.user = plan_curve(&(lut->user_color_correction), 1 << size); \
     }									    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << size);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+  user = lut->plan.user;						    \
 									    \
   memset(nz, 0, sizeof(nz));						    \
 									    \
@@ -0,0 +1,484 @@
+/*
+ *   Row kernels for color conversion
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * These kernels do the per-sample work of the raw, fast and threshold
+ * color converters a whole row at a time, so that they can be done
+ * several samples per instruction.  Each kernel has a portable
+ * implementation and, on x86 with a suitable compiler, SSE2 and AVX2
+ * implementations selected at run time.  All implementations of a
+ * kernel produce exactly the same output; test/color-kernels checks
+ * that.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+
+#if defined(HAVE_X86_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#define USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+typedef struct
+{
+  void (*scale_8)(const unsigned char *in, unsigned multiplier,
+		  unsigned short mask, size_t count, unsigned short *out);
+  void (*scale_16)(const unsigned short *in, unsigned multiplier,
+		   unsigned short mask, size_t count, unsigned short *out);
+  void (*lookup)(unsigned short *data, size_t pixels, int channels,
+		 const unsigned short *const *tables, int divide);
+  void (*threshold_8)(const unsigned char *in, int invert, size_t count,
+		      unsigned short *out);
+  void (*threshold_16)(const unsigned short *in, int invert, size_t count,
+		       unsigned short *out);
+  unsigned (*nonzero)(const unsigned short *data, size_t pixels,
+		      int channels);
+} color_kernels_t;
+
+/*
+ * Portable implementations.  The SIMD implementations use these for
+ * whatever is left over at the end of a row.
+ */
+
+static void
+scale_8_c(const unsigned char *in, unsigned multiplier, unsigned short mask,
+	  size_t count, unsigned short *out)
+{
+  size_t i;
+  for (i = 0; i < count; i++)
+    out[i] = (in[i] * multiplier) ^ mask;
+}
+
+static void
+scale_16_c(const unsigned short *in, unsigned multiplier, unsigned short mask,
+	   size_t count, unsigned short *out)
+{
+  size_t i;
+  for (i = 0; i < count; i++)
+    out[i] = (in[i] * multiplier) ^ mask;
+}
+
+static void
+lookup_c(unsigned short *data, size_t pixels, int channels,
+	 const unsigned short *const *tables, int divide)
+{
+  size_t i;
+  int j;
+  for (i = 0; i < pixels; i++)
+    for (j = 0; j < channels; j++, data++)
+      *data = tables[j][divide ? *data / 257 : *data];
+}
+
+static void
+threshold_8_c(const unsigned char *in, int invert, size_t count,
+	      unsigned short *out)
+{
+  unsigned char flip = invert ? 0x80 : 0;
+  size_t i;
+  for (i = 0; i < count; i++)
+    out[i] = ((in[i] ^ flip) & 0x80) ? 65535 : 0;
+}
+
+static void
+threshold_16_c(const unsigned short *in, int invert, size_t count,
+	       unsigned short *out)
+{
+  unsigned short flip = invert ? 0x8000 : 0;
+  size_t i;
+  for (i = 0; i < count; i++)
+    out[i] = ((in[i] ^ flip) & 0x8000) ? 65535 : 0;
+}
+
+static unsigned
+nonzero_c(const unsigned short *data, size_t pixels, int channels)
+{
+  unsigned answer = 0;
+  size_t i;
+  int j;
+  for (i = 0; i < pixels; i++)
+    for (j = 0; j < channels; j++)
+      if (*data++)
+	answer |= 1 << j;
+  return answer;
+}
+
+static const color_kernels_t kernels_c =
+{
+  scale_8_c, scale_16_c, lookup_c, threshold_8_c, threshold_16_c, nonzero_c
+};
+
+#ifdef USE_X86_SIMD
+/*
+ * Kernels that need to know the channel of each sample work in blocks
+ * of (vector width) pixels, which is exactly (channels) vectors.  Vector
+ * j of every block then has the same channel in each lane, so the
+ * channel pattern only needs to be worked out once.
+ */
+#define SIMD_MAX_CHANNELS 4
+
+static unsigned
+nonzero_lanes(const unsigned short *lanes, int count, int channels)
+{
+  unsigned answer = 0;
+  int i;
+  for (i = 0; i < count; i++)
+    if (lanes[i])
+      answer |= 1 << (i % channels);
+  return answer;
+}
+
+__attribute__((target("sse2")))
+static void
+scale_8_sse2(const unsigned char *in, unsigned multiplier, unsigned short mask,
+	     size_t count, unsigned short *out)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i m = _mm_set1_epi16((short) multiplier);
+  const __m128i x = _mm_set1_epi16((short) mask);
+  size_t i;
+  for (i = 0; i + 16 <= count; i += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+      __m128i lo = _mm_unpacklo_epi8(v, zero);
+      __m128i hi = _mm_unpackhi_epi8(v, zero);
+      _mm_storeu_si128((__m128i *) (out + i),
+		       _mm_xor_si128(_mm_mullo_epi16(lo, m), x));
+      _mm_storeu_si128((__m128i *) (out + i + 8),
+		       _mm_xor_si128(_mm_mullo_epi16(hi, m), x));
+    }
+  scale_8_c(in + i, multiplier, mask, count - i, out + i);
+}
+
+__attribute__((target("sse2")))
+static void
+scale_16_sse2(const unsigned short *in, unsigned multiplier,
+	      unsigned short mask, size_t count, unsigned short *out)
+{
+  const __m128i m = _mm_set1_epi16((short) multiplier);
+  const __m128i x = _mm_set1_epi16((short) mask);
+  size_t i;
+  for (i = 0; i + 8 <= count; i += 8)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+      _mm_storeu_si128((__m128i *) (out + i),
+		       _mm_xor_si128(_mm_mullo_epi16(v, m), x));
+    }
+  scale_16_c(in + i, multiplier, mask, count - i, out + i);
+}
+
+__attribute__((target("sse2")))
+static void
+threshold_8_sse2(const unsigned char *in, int invert, size_t count,
+		 unsigned short *out)
+{
+  const __m128i flip = _mm_set1_epi8(invert ? (char) 0x80 : 0);
+  size_t i;
+  for (i = 0; i + 16 <= count; i += 16)
+    {
+      __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (in + i)),
+				flip);
+      /* Placing each byte in the high half lets the sign fill the word */
+      __m128i lo = _mm_unpacklo_epi8(_mm_setzero_si128(), v);
+      __m128i hi = _mm_unpackhi_epi8(_mm_setzero_si128(), v);
+      _mm_storeu_si128((__m128i *) (out + i), _mm_srai_epi16(lo, 15));
+      _mm_storeu_si128((__m128i *) (out + i + 8), _mm_srai_epi16(hi, 15));
+    }
+  threshold_8_c(in + i, invert, count - i, out + i);
+}
+
+__attribute__((target("sse2")))
+static void
+threshold_16_sse2(const unsigned short *in, int invert, size_t count,
+		  unsigned short *out)
+{
+  const __m128i flip = _mm_set1_epi16(invert ? (short) 0x8000 : 0);
+  size_t i;
+  for (i = 0; i + 8 <= count; i += 8)
+    {
+      __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (in + i)),
+				flip);
+      _mm_storeu_si128((__m128i *) (out + i), _mm_srai_epi16(v, 15));
+    }
+  threshold_16_c(in + i, invert, count - i, out + i);
+}
+
+__attribute__((target("sse2")))
+static unsigned
+nonzero_sse2(const unsigned short *data, size_t pixels, int channels)
+{
+  __m128i acc[SIMD_MAX_CHANNELS];
+  unsigned short lanes[8 * SIMD_MAX_CHANNELS];
+  size_t blocks = pixels / 8;
+  size_t i;
+  int j;
+  if (channels > SIMD_MAX_CHANNELS)
+    return nonzero_c(data, pixels, channels);
+  for (j = 0; j < channels; j++)
+    acc[j] = _mm_setzero_si128();
+  for (i = 0; i < blocks; i++)
+    for (j = 0; j < channels; j++, data += 8)
+      acc[j] = _mm_or_si128(acc[j],
+			    _mm_loadu_si128((const __m128i *) data));
+  for (j = 0; j < channels; j++)
+    _mm_storeu_si128((__m128i *) (lanes + 8 * j), acc[j]);
+  return nonzero_lanes(lanes, 8 * channels, channels) |
+    nonzero_c(data, pixels - blocks * 8, channels);
+}
+
+static const color_kernels_t kernels_sse2 =
+{
+  scale_8_sse2, scale_16_sse2, lookup_c, threshold_8_sse2,
+  threshold_16_sse2, nonzero_sse2
+};
+
+__attribute__((target("avx2")))
+static void
+scale_8_avx2(const unsigned char *in, unsigned multiplier, unsigned short mask,
+	     size_t count, unsigned short *out)
+{
+  const __m256i m = _mm256_set1_epi16((short) multiplier);
+  const __m256i x = _mm256_set1_epi16((short) mask);
+  size_t i;
+  for (i = 0; i + 16 <= count; i += 16)
+    {
+      __m256i v =
+	_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (in + i)));
+      _mm256_storeu_si256((__m256i *) (out + i),
+			  _mm256_xor_si256(_mm256_mullo_epi16(v, m), x));
+    }
+  scale_8_c(in + i, multiplier, mask, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void
+scale_16_avx2(const unsigned short *in, unsigned multiplier,
+	      unsigned short mask, size_t count, unsigned short *out)
+{
+  const __m256i m = _mm256_set1_epi16((short) multiplier);
+  const __m256i x = _mm256_set1_epi16((short) mask);
+  size_t i;
+  for (i = 0; i + 16 <= count; i += 16)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i *) (in + i));
+      _mm256_storeu_si256((__m256i *) (out + i),
+			  _mm256_xor_si256(_mm256_mullo_epi16(v, m), x));
+    }
+  scale_16_c(in + i, multiplier, mask, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void
+lookup_avx2(unsigned short *data, size_t pixels, int channels,
+	    const unsigned short *const *tables, int divide)
+{
+  /*
+   * One gather serves every channel: lanes index 16-bit units relative
+   * to the first table, so the tables must lie within 2GB of each other.
+   * Each lane fetches the aligned pair of entries holding its index,
+   * which never reads outside a table with an even number of entries,
+   * and then shifts the wanted half down.  v / 257 == (v - (v >> 8)) >> 8
+   * for all 16-bit v.
+   */
+  const __m256i low_half = _mm256_set1_epi32(0xffff);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i even = _mm256_set1_epi32(~1);
+  __m256i base[SIMD_MAX_CHANNELS];
+  size_t blocks = pixels / 8;
+  size_t i;
+  int j, k;
+  if (channels > SIMD_MAX_CHANNELS)
+    {
+      lookup_c(data, pixels, channels, tables, divide);
+      return;
+    }
+  for (j = 0; j < channels; j++)
+    {
+      int offsets[8];
+      for (k = 0; k < 8; k++)
+	{
+	  long distance = ((long) (size_t) tables[(j * 8 + k) % channels] -
+			   (long) (size_t) tables[0]) / 2;
+	  if (distance > 0x3fff0000L || distance < -0x3fff0000L)
+	    {
+	      lookup_c(data, pixels, channels, tables, divide);
+	      return;
+	    }
+	  offsets[k] = distance;
+	}
+      base[j] = _mm256_loadu_si256((const __m256i *) offsets);
+    }
+  for (i = 0; i < blocks; i++)
+    for (j = 0; j < channels; j++, data += 8)
+      {
+	__m256i v =
+	  _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) data));
+	__m256i pair, shift;
+	if (divide)
+	  v = _mm256_srli_epi32(_mm256_sub_epi32(v, _mm256_srli_epi32(v, 8)),
+				8);
+	shift = _mm256_slli_epi32(_mm256_and_si256(v, one), 4);
+	v = _mm256_add_epi32(_mm256_and_si256(v, even), base[j]);
+	pair = _mm256_i32gather_epi32((const int *) tables[0], v, 2);
+	v = _mm256_and_si256(_mm256_srlv_epi32(pair, shift), low_half);
+	_mm_storeu_si128((__m128i *) data,
+			 _mm_packus_epi32(_mm256_castsi256_si128(v),
+					  _mm256_extracti128_si256(v, 1)));
+      }
+  lookup_c(data, pixels - blocks * 8, channels, tables, divide);
+}
+
+__attribute__((target("avx2")))
+static void
+threshold_8_avx2(const unsigned char *in, int invert, size_t count,
+		 unsigned short *out)
+{
+  const __m256i flip = _mm256_set1_epi16(invert ? 0x80 : 0);
+  size_t i;
+  for (i = 0; i + 16 <= count; i += 16)
+    {
+      __m256i v =
+	_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (in + i)));
+      v = _mm256_slli_epi16(_mm256_xor_si256(v, flip), 8);
+      _mm256_storeu_si256((__m256i *) (out + i), _mm256_srai_epi16(v, 15));
+    }
+  threshold_8_c(in + i, invert, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void
+threshold_16_avx2(const unsigned short *in, int invert, size_t count,
+		  unsigned short *out)
+{
+  const __m256i flip = _mm256_set1_epi16(invert ? (short) 0x8000 : 0);
+  size_t i;
+  for (i = 0; i + 16 <= count; i += 16)
+    {
+      __m256i v = _mm256_xor_si256
+	(_mm256_loadu_si256((const __m256i *) (in + i)), flip);
+      _mm256_storeu_si256((__m256i *) (out + i), _mm256_srai_epi16(v, 15));
+    }
+  threshold_16_c(in + i, invert, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static unsigned
+nonzero_avx2(const unsigned short *data, size_t pixels, int channels)
+{
+  __m256i acc[SIMD_MAX_CHANNELS];
+  unsigned short lanes[16 * SIMD_MAX_CHANNELS];
+  size_t blocks = pixels / 16;
+  size_t i;
+  int j;
+  if (channels > SIMD_MAX_CHANNELS)
+    return nonzero_c(data, pixels, channels);
+  for (j = 0; j < channels; j++)
+    acc[j] = _mm256_setzero_si256();
+  for (i = 0; i < blocks; i++)
+    for (j = 0; j < channels; j++, data += 16)
+      acc[j] = _mm256_or_si256(acc[j],
+			       _mm256_loadu_si256((const __m256i *) data));
+  for (j = 0; j < channels; j++)
+    _mm256_storeu_si256((__m256i *) (lanes + 16 * j), acc[j]);
+  return nonzero_lanes(lanes, 16 * channels, channels) |
+    nonzero_c(data, pixels - blocks * 16, channels);
+}
+
+static const color_kernels_t kernels_avx2 =
+{
+  scale_8_avx2, scale_16_avx2, lookup_avx2, threshold_8_avx2,
+  threshold_16_avx2, nonzero_avx2
+};
+#endif
+
+static const color_kernels_t *kernels = &kernels_c;
+
+int
+stpi_color_kernels_set_level(int level)
+{
+  int available = STPI_COLOR_KERNELS_PORTABLE;
+#ifdef USE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    available = STPI_COLOR_KERNELS_AVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    available = STPI_COLOR_KERNELS_SSE2;
+#endif
+  if (level < 0 || level > available)
+    level = available;
+  switch (level)
+    {
+#ifdef USE_X86_SIMD
+    case STPI_COLOR_KERNELS_AVX2:
+      kernels = &kernels_avx2;
+      break;
+    case STPI_COLOR_KERNELS_SSE2:
+      kernels = &kernels_sse2;
+      break;
+#endif
+    default:
+      kernels = &kernels_c;
+      level = STPI_COLOR_KERNELS_PORTABLE;
+    }
+  return level;
+}
+
+void
+stpi_init_color_kernels(void)
+{
+  (void) stpi_color_kernels_set_level(-1);
+}
+
+void
+stpi_color_scale_row(const void *in, int bits, unsigned multiplier,
+		     unsigned short mask, size_t count, unsigned short *out)
+{
+  if (bits == 8)
+    (kernels->scale_8)((const unsigned char *) in, multiplier, mask, count,
+		       out);
+  else
+    (kernels->scale_16)((const unsigned short *) in, multiplier, mask, count,
+			out);
+}
+
+void
+stpi_color_lookup_row(unsigned short *data, size_t pixels, int channels,
+		      const unsigned short *const *tables, int divide)
+{
+  (kernels->lookup)(data, pixels, channels, tables, divide);
+}
+
+void
+stpi_color_threshold_row(const void *in, int bits, int invert, size_t count,
+			 unsigned short *out)
+{
+  if (bits == 8)
+    (kernels->threshold_8)((const unsigned char *) in, invert, count, out);
+  else
+    (kernels->threshold_16)((const unsigned short *) in, invert, count, out);
+}
+
+unsigned
+stpi_color_nonzero_channels(const unsigned short *data, size_t pixels,
+			    int channels)
+{
+  return (kernels->nonzero)(data, pixels, channels);
+}
@@ -0,0 +1,226 @@
+/*
+ *   Gutenprint color management module - 3D lookup tables.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * A 3D LUT samples an RGB to RGB conversion at the nodes of an NxNxN
+ * grid spanning the 16-bit input cube, and reproduces it elsewhere by
+ * tetrahedral interpolation between the four nodes surrounding each
+ * input.  Tables are kept in a small cache keyed by a hash of everything
+ * that went into them, so that pages and jobs with identical color
+ * settings build their table only once.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#include "color-conversion.h"
+
+#define LUT3D_CACHE_SIZE 4
+#define FRACTION_BITS 15
+#define FRACTION_ONE (1 << FRACTION_BITS)
+
+struct stpi_color_lut3d
+{
+  stpi_color_hash_t key;
+  int grid;
+  int refcount;
+  int cached;
+  unsigned last_used;
+  unsigned short *table;	/* grid^3 RGB nodes, red varying slowest */
+};
+
+static stpi_color_lut3d_t *lut3d_cache[LUT3D_CACHE_SIZE];
+static unsigned lut3d_clock;
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t lut3d_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_CACHE() pthread_mutex_lock(&lut3d_lock)
+#define UNLOCK_CACHE() pthread_mutex_unlock(&lut3d_lock)
+#else
+#define LOCK_CACHE()
+#define UNLOCK_CACHE()
+#endif
+
+static stpi_color_lut3d_t *
+build_lut3d(const stpi_color_hash_t *key, int grid,
+	    stpi_color_lut3d_fill_t fill, void *data)
+{
+  stpi_color_lut3d_t *lut = stp_zalloc(sizeof(stpi_color_lut3d_t));
+  unsigned short *node;
+  int last = grid - 1;
+  int r, g, b;
+  lut->key = *key;
+  lut->grid = grid;
+  lut->table = stp_malloc(sizeof(unsigned short) * 3 * grid * grid * grid);
+  node = lut->table;
+  for (r = 0; r < grid; r++)
+    for (g = 0; g < grid; g++)
+      for (b = 0; b < grid; b++, node += 3)
+	{
+	  node[0] = (r * 65535 + last / 2) / last;
+	  node[1] = (g * 65535 + last / 2) / last;
+	  node[2] = (b * 65535 + last / 2) / last;
+	  (*fill)(data, node);
+	}
+  return lut;
+}
+
+static void
+free_lut3d(stpi_color_lut3d_t *lut)
+{
+  stp_free(lut->table);
+  stp_free(lut);
+}
+
+stpi_color_lut3d_t *
+stpi_color_lut3d_acquire(const stpi_color_hash_t *key, int grid,
+			 stpi_color_lut3d_fill_t fill, void *data)
+{
+  stpi_color_lut3d_t *lut = NULL;
+  int victim = -1;
+  int i;
+  if (grid < 2)
+    return NULL;
+  /*
+   * Building under the lock keeps two jobs with the same settings from
+   * building the same table at once.
+   */
+  LOCK_CACHE();
+  for (i = 0; i < LUT3D_CACHE_SIZE; i++)
+    {
+      stpi_color_lut3d_t *entry = lut3d_cache[i];
+      if (entry && entry->grid == grid && entry->key.fnv == key->fnv &&
+	  entry->key.sum == key->sum)
+	{
+	  lut = entry;
+	  break;
+	}
+      if (!entry)
+	{
+	  if (victim < 0 || lut3d_cache[victim])
+	    victim = i;
+	}
+      else if (entry->refcount == 0 &&
+	       (victim < 0 || (lut3d_cache[victim] &&
+			       entry->last_used <
+			       lut3d_cache[victim]->last_used)))
+	victim = i;
+    }
+  if (!lut)
+    {
+      lut = build_lut3d(key, grid, fill, data);
+      if (victim >= 0)
+	{
+	  if (lut3d_cache[victim])
+	    free_lut3d(lut3d_cache[victim]);
+	  lut3d_cache[victim] = lut;
+	  lut->cached = 1;
+	}
+    }
+  lut->refcount++;
+  lut->last_used = ++lut3d_clock;
+  UNLOCK_CACHE();
+  return lut;
+}
+
+void
+stpi_color_lut3d_release(stpi_color_lut3d_t *lut)
+{
+  if (!lut)
+    return;
+  LOCK_CACHE();
+  if (--lut->refcount == 0 && !lut->cached)
+    free_lut3d(lut);
+  UNLOCK_CACHE();
+}
+
+void
+stpi_color_lut3d_apply(const stpi_color_lut3d_t *lut, unsigned short *rgb,
+		       size_t pixels)
+{
+  int last = lut->grid - 1;
+  int strides[3];
+  size_t i;
+  strides[0] = lut->grid * lut->grid * 3;
+  strides[1] = lut->grid * 3;
+  strides[2] = 3;
+  for (i = 0; i < pixels; i++, rgb += 3)
+    {
+      const unsigned short *c0 = lut->table;
+      const unsigned short *c1, *c2, *c3;
+      int frac[3];
+      int order[3];
+      int j;
+      for (j = 0; j < 3; j++)
+	{
+	  unsigned position = rgb[j] * (unsigned) last;
+	  int cell = position / 65535;
+	  if (cell == last)
+	    {
+	      cell--;
+	      frac[j] = FRACTION_ONE;
+	    }
+	  else
+	    frac[j] = ((position - cell * 65535u) * FRACTION_ONE + 32767) /
+	      65535;
+	  c0 += cell * strides[j];
+	}
+      /* Sort the axes by descending fraction to pick the tetrahedron */
+      order[0] = 0;
+      order[1] = 1;
+      order[2] = 2;
+      if (frac[order[1]] > frac[order[0]])
+	{
+	  order[0] = 1;
+	  order[1] = 0;
+	}
+      if (frac[order[2]] > frac[order[1]])
+	{
+	  int tmp = order[1];
+	  order[1] = order[2];
+	  order[2] = tmp;
+	  if (frac[order[1]] > frac[order[0]])
+	    {
+	      tmp = order[0];
+	      order[0] = order[1];
+	      order[1] = tmp;
+	    }
+	}
+      c1 = c0 + strides[order[0]];
+      c2 = c1 + strides[order[1]];
+      c3 = c2 + strides[order[2]];
+      /*
+       * Every partial sum is a convex combination of node values, so
+       * none of them exceeds 65535 << FRACTION_BITS.
+       */
+      for (j = 0; j < 3; j++)
+	{
+	  int value = (c0[j] << FRACTION_BITS) +
+	    frac[order[0]] * (c1[j] - c0[j]) +
+	    frac[order[1]] * (c2[j] - c1[j]) +
+	    frac[order[2]] * (c3[j] - c2[j]);
+	  rgb[j] = (value + (FRACTION_ONE / 2)) >> FRACTION_BITS;
+	}
+    }
+}
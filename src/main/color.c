@@ -193,6 +193,14 @@ stp_color_get_row(stp_vars_t *v,
   return colorfuncs->get_row(v, image, row, zero_mask);
 }
 
+stpi_color_convert_row_func_t
+stpi_color_get_convert_row(const stp_vars_t *v)
+{
+  const stp_colorfuncs_t *colorfuncs =
+    stpi_get_colorfuncs(stp_get_color_by_name(stp_get_color_conversion(v)));
+  return colorfuncs->convert_row;
+}
+
 stp_parameter_list_t
 stp_color_list_parameters(const stp_vars_t *v)
 {
@@ -52,11 +52,11 @@
  */
 
 static inline int
-update_dither(stpi_dither_t *d, int channel, int width,
+update_dither(stpi_dither_channel_t *dc, int width,
 	      int direction, int *error0, int *error1)
 {
-  int r = CHANNEL(d, channel).v;
-  int o = CHANNEL(d, channel).o;
+  int r = dc->v;
+  int o = dc->o;
   int tmp = r;
   int i, dist, dist1;
   int delta, delta1;
@@ -65,7 +65,7 @@ update_dither(stpi_dither_t *d, int channel, int width,
     return error0[direction];
   if (tmp > 65535)
     tmp = 65535;
-  if (d->spread >= 16 || o >= 2048)
+  if (dc->spread >= 16 || o >= 2048)
     {
       tmp += tmp;
       tmp += tmp;
@@ -75,8 +75,8 @@ update_dither(stpi_dither_t *d, int channel, int width,
   else
     {
       int tmpo = o << 5;
-      offset = ((65535 - tmpo) >> d->spread) +
-	((tmp & d->spread_mask) > (tmpo & d->spread_mask));
+      offset = ((65535 - tmpo) >> dc->spread) +
+	((tmp & dc->spread_mask) > (tmpo & dc->spread_mask));
     }
   switch (offset)
     {
@@ -95,8 +95,8 @@ update_dither(stpi_dither_t *d, int channel, int width,
     default:
       tmp += tmp;
       tmp += tmp;
-      dist = tmp / d->offset0_table[offset];
-      dist1 = tmp / d->offset1_table[offset];
+      dist = tmp / dc->offset0_table[offset];
+      dist1 = tmp / dc->offset1_table[offset];
       delta = dist;
       delta1 = dist1;
       for (i = -offset; i; i++)
@@ -121,8 +121,8 @@ update_dither(stpi_dither_t *d, int channel, int width,
 
 static inline int
 print_color(const stpi_dither_t *d, stpi_dither_channel_t *dc, int x, int y,
-	    unsigned char bit, int length, int dontprint, int stpi_dither_type,
-	    const unsigned char *mask)
+	    unsigned char bit, int ptr_offset, int length, int dontprint,
+	    int stpi_dither_type, const unsigned char *mask)
 {
   int base = dc->b;
   int density = dc->o;
@@ -172,7 +172,7 @@ print_color(const stpi_dither_t *d, stpi_dither_channel_t *dc, int x, int y,
 	{
 	  stpi_dither_type -= D_ADAPTIVE_BASE;
 
-	  if (i < levels || base <= d->adaptive_limit)
+	  if (i < levels || base <= dc->adaptive_limit)
 	    {
 	      stpi_dither_type = D_ORDERED;
 	      dither_value = base;
@@ -293,11 +293,11 @@ print_color(const stpi_dither_t *d, stpi_dither_channel_t *dc, int x, int y,
 		subc = lower;
 	    }
 	  v = subc->value;
-	  if (!mask || (*(mask + d->ptr_offset) & bit))
+	  if (!mask || (*(mask + ptr_offset) & bit))
 	    {
 	      if (dc->ptr)
 		{
-		  tptr = dc->ptr + d->ptr_offset;
+		  tptr = dc->ptr + ptr_offset;
 
 		  /*
 		   * Lay down all of the bits in the pixel.
@@ -398,38 +398,39 @@ shared_ed_deinitializer(stpi_dither_t *d,
   STP_SAFE_FREE(ndither);
 }
 
-void
-stpi_dither_ed(stp_vars_t *v,
-	       int row,
-	       const unsigned short *raw,
-	       int duplicate_line,
-	       int zero_mask,
-	       const unsigned char *mask)
+typedef struct
 {
-  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
-  int		x,
-    		length;
-  unsigned char	bit;
-  int		i;
-  int		*ndither;
-  int		***error;
+  stpi_dither_t *d;
+  int row;
+  const unsigned short *raw;
+  const unsigned char *mask;
+  int direction;
+  int length;
+  int ***error;
+  int *ndither;
+} ed_row_t;
 
-  int		terminate;
-  int		direction = row & 1 ? 1 : -1;
+/*
+ * Error diffusion never carries anything from one channel to another,
+ * so each band of channels can be dithered across the whole row
+ * independently of the others.
+ */
+static void
+ed_dither_channels(const ed_row_t *r, int first, int last)
+{
+  stpi_dither_t *d = r->d;
+  stpi_dither_cursor_t cursor;
+  const unsigned short *raw = r->raw;
+  int direction = r->direction;
+  int ***error = r->error;
+  int *ndither = r->ndither;
+  int x, i, j;
+  unsigned char bit;
+  int terminate;
   int xerror, xstep, xmod;
 
-  length = (d->dst_width + 7) / 8;
-  if (d->stpi_dither_type & D_ADAPTIVE_BASE)
-    for (i = 0; i < CHANNEL_COUNT(d); i++)
-      if (CHANNEL(d, i).nlevels > 1)
-	{
-	  stpi_dither_ordered(v, row, raw, duplicate_line, zero_mask, mask);
-	  return;
-	}
-  if (!shared_ed_initializer(d, row, duplicate_line, zero_mask, length,
-			     direction, &error, &ndither))
-    return;
-
+  cursor.ptr_offset = (direction == 1) ? 0 : r->length - 1;
+  cursor.dst_width = d->dst_width;
   x = (direction == 1) ? 0 : d->dst_width - 1;
   bit = 1 << (7 - (x & 7));
   xstep  = CHANNEL_COUNT(d) * (d->src_width / d->dst_width);
@@ -442,7 +443,7 @@ stpi_dither_ed(stp_vars_t *v,
 
   for (; x != terminate; x += direction)
     {
-      for (i = 0; i < CHANNEL_COUNT(d); i++)
+      for (i = first; i < last; i++)
 	{
 	  if (CHANNEL(d, i).ptr)
 	    {
@@ -450,16 +451,75 @@ stpi_dither_ed(stp_vars_t *v,
 	      CHANNEL(d, i).o = CHANNEL(d, i).v;
 	      CHANNEL(d, i).b = CHANNEL(d, i).v;
 	      CHANNEL(d, i).v = UPDATE_COLOR(CHANNEL(d, i).v, ndither[i]);
-	      CHANNEL(d, i).v = print_color(d, &(CHANNEL(d, i)), x, row, bit,
-					    length, 0, d->stpi_dither_type,
-					    mask);
-	      ndither[i] = update_dither(d, i, d->src_width,
+	      CHANNEL(d, i).v = print_color(d, &(CHANNEL(d, i)), x, r->row,
+					    bit, cursor.ptr_offset, r->length,
+					    0, d->stpi_dither_type, r->mask);
+	      ndither[i] = update_dither(&(CHANNEL(d, i)), d->src_width,
 					 direction, error[i][0], error[i][1]);
 	    }
 	}
-      ADVANCE_BIDIRECTIONAL(d, bit, raw, direction, CHANNEL_COUNT(d), xerror,
-			    xstep, xmod, error, d->error_rows);
+      for (i = first; i < last; i++)
+	for (j = 0; j < d->error_rows; j++)
+	  error[i][j] += direction;
+      if (direction == 1)
+	ADVANCE_UNIDIRECTIONAL(&cursor, bit, raw, CHANNEL_COUNT(d), xerror,
+			       xstep, xmod);
+      else
+	ADVANCE_REVERSE(&cursor, bit, raw, CHANNEL_COUNT(d), xerror,
+			xstep, xmod);
     }
+}
+
+static void
+ed_dither_band(void *data, int band)
+{
+  const ed_row_t *r = (const ed_row_t *) data;
+  ed_dither_channels(r, r->d->band_start[band], r->d->band_start[band + 1]);
+}
+
+void
+stpi_dither_ed(stp_vars_t *v,
+	       int row,
+	       const unsigned short *raw,
+	       int duplicate_line,
+	       int zero_mask,
+	       const unsigned char *mask)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  int		length;
+  int		i;
+  int		bands;
+  int		*ndither;
+  int		***error;
+  ed_row_t	r;
+  int		direction = row & 1 ? 1 : -1;
+
+  length = (d->dst_width + 7) / 8;
+  if (d->stpi_dither_type & D_ADAPTIVE_BASE)
+    for (i = 0; i < CHANNEL_COUNT(d); i++)
+      if (CHANNEL(d, i).nlevels > 1)
+	{
+	  stpi_dither_ordered(v, row, raw, duplicate_line, zero_mask, mask);
+	  return;
+	}
+  if (!shared_ed_initializer(d, row, duplicate_line, zero_mask, length,
+			     direction, &error, &ndither))
+    return;
+
+  r.d = d;
+  r.row = row;
+  r.raw = raw;
+  r.mask = mask;
+  r.direction = direction;
+  r.length = length;
+  r.error = error;
+  r.ndither = ndither;
+  bands = stpi_dither_channel_bands(d);
+  if (bands > 1)
+    stpi_worker_pool_run(d->pool, ed_dither_band, &r, bands);
+  else
+    ed_dither_channels(&r, 0, CHANNEL_COUNT(d));
+
   shared_ed_deinitializer(d, error, ndither);
   if (direction == -1)
     stpi_dither_reverse_row_ends(d);
@@ -57,8 +57,17 @@ typedef struct
   stpi_dither_channel_t *dummy_channel;
   double transition;		/* Exponential scaling for transition region */
   stp_dither_matrix_impl_t transition_matrix;
+  int *point_error;		/* Carried between worker bands, per pixel */
+  int *comparison;		/* Precomputed threshold, per pixel */
+  int *progress;		/* Blocks completed by each worker band */
 } eventone_t;
 
+/*
+ * When EvenTone is run on the worker pool, each band of channels follows
+ * the previous one across the row, ET_BLOCK pixels at a time.
+ */
+#define ET_BLOCK (256)
+
 typedef struct shade_segment
 {
   distance_t dis;
@@ -99,6 +108,9 @@ free_eventone_data(stpi_dither_t *d)
     }
   if (d->stpi_dither_type & D_UNITONE)
     stp_dither_matrix_destroy(&(et->transition_matrix));
+  STP_SAFE_FREE(et->point_error);
+  STP_SAFE_FREE(et->comparison);
+  STP_SAFE_FREE(et->progress);
   STP_SAFE_FREE(et);
 }
 
@@ -181,6 +193,14 @@ et_setup(stpi_dither_t *d)
 
   et->diff_factor = diff_factors[et->physical_aspect];
 
+  if (d->pool)
+    {
+      et->point_error = stp_malloc(sizeof(int) * d->dst_width);
+      et->comparison = stp_malloc(sizeof(int) * d->dst_width);
+      et->progress =
+	stp_malloc(sizeof(int) * stpi_worker_pool_get_threads(d->pool));
+    }
+
   d->aux_data = et;
   d->aux_freefunc = free_eventone_data;
 }
@@ -367,14 +387,14 @@ find_segment_and_ditherpoint(stpi_dither_channel_t *dc, unsigned inkval,
 }
 
 static inline void
-print_ink(stpi_dither_t *d, unsigned char *tptr, const stpi_ink_defn_t *ink,
-	  unsigned char bit, int length)
+print_ink(unsigned char *tptr, const stpi_ink_defn_t *ink,
+	  unsigned char bit, int ptr_offset, int length)
 {
   int j;
 
   if (tptr != 0)
     {
-      tptr += d->ptr_offset;
+      tptr += ptr_offset;
       switch(ink->bits)
 	{
 	case 1:
@@ -398,49 +418,58 @@ print_ink(stpi_dither_t *d, unsigned char *tptr, const stpi_ink_defn_t *ink,
     }
 }
 
-void
-stpi_dither_et(stp_vars_t *v,
-	       int row,
-	       const unsigned short *raw,
-	       int duplicate_line,
-	       int zero_mask,
-	       const unsigned char *mask)
+typedef struct
 {
-  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  stpi_dither_t *d;
   eventone_t *et;
+  int row;
+  const unsigned short *raw;
+  const unsigned char *mask;
+  int bands;
+} et_row_t;
 
+/*
+ * Unlike error diffusion, EvenTone carries point_error from one channel
+ * to the next within each pixel, so the bands can't run independently.
+ * Instead, band N picks up each block of pixels after band N-1 has
+ * finished it, taking the accumulated point error from r->et->point_error.
+ * With band < 0 the whole row is done here, on the calling thread.
+ */
+static void
+et_dither_channels(const et_row_t *r, int band, int first, int last)
+{
+  stpi_dither_t *d = r->d;
+  eventone_t *et = r->et;
+  const unsigned short *raw = r->raw;
+  const unsigned char *mask = r->mask;
+  stpi_dither_cursor_t cursor;
   int		x;
   int	        length;
   unsigned char	bit;
   int		i;
+  int		n;
 
   int		terminate;
   int		direction;
   int		xerror, xstep, xmod;
   int		channel_count = CHANNEL_COUNT(d);
 
-  if (!et_initializer(d, duplicate_line, zero_mask))
-    return;
-
-  et = (eventone_t *) d->aux_data;
-  if (d->stpi_dither_type & D_UNITONE)
-    stp_dither_matrix_set_row(&(et->transition_matrix), row);
-
   length = (d->dst_width + 7) / 8;
+  cursor.dst_width = d->dst_width;
 
-  if (row & 1)
+  if (r->row & 1)
     {
       direction = 1;
       x = 0;
       terminate = d->dst_width;
-      d->ptr_offset = 0;
+      cursor.ptr_offset = 0;
     }
   else
     {
       direction = -1;
       x = d->dst_width - 1;
       terminate = -1;
-      d->ptr_offset = length - 1;
+      cursor.ptr_offset = length - 1;
       raw += channel_count * (d->src_width - 1);
     }
   bit = 1 << (7 - (x & 7));
@@ -448,16 +477,28 @@ stpi_dither_et(stp_vars_t *v,
   xmod   = d->src_width % d->dst_width;
   xerror = (xmod * x) % d->dst_width;
 
-  for (; x != terminate; x += direction)
+  for (n = 0; x != terminate; x += direction, n++)
     {
 
       int point_error = 0;
       int comparison = 32768;
 
-      if (d->stpi_dither_type & D_ORDERED_BASE)
-	comparison += (ditherpoint(d, &(d->dither_matrix), x) / 16) - 2048;
+      if (band < 0)
+	{
+	  if (d->stpi_dither_type & D_ORDERED_BASE)
+	    comparison += (ditherpoint(d, &(d->dither_matrix), x) / 16) - 2048;
+	}
+      else
+	{
+	  if (band > 0 && n % ET_BLOCK == 0)
+	    stpi_worker_pool_wait(d->pool, &(et->progress[band - 1]),
+				  n / ET_BLOCK + 1);
+	  comparison = et->comparison[x];
+	  if (band > 0)
+	    point_error = et->point_error[x];
+	}
 
-      for (i=0; i < channel_count; i++)
+      for (i = first; i < last; i++)
 	{
 	  if (CHANNEL(d, i).ptr)
 	    {
@@ -498,12 +539,12 @@ stpi_dither_et(stp_vars_t *v,
 	      /* Adjust the error to reflect the dot choice */
 	      if (inkp->bits)
 		{
-		  if (!mask || (*(mask + d->ptr_offset) & bit))
+		  if (!mask || (*(mask + cursor.ptr_offset) & bit))
 		    {
 		      set_row_ends(dc, x);
 
 		      /* Do the printing */
-		      print_ink(d, dc->ptr, inkp, bit, length);
+		      print_ink(dc->ptr, inkp, bit, cursor.ptr_offset, length);
 		    }
 		}
 
@@ -512,12 +553,83 @@ stpi_dither_et(stp_vars_t *v,
 	      diffuse_error(dc, et, x, direction);
 	    }
 	}
+      if (band >= 0 && band < r->bands - 1)
+	{
+	  et->point_error[x] = point_error;
+	  if (n % ET_BLOCK == ET_BLOCK - 1 || x + direction == terminate)
+	    stpi_worker_pool_post(d->pool, &(et->progress[band]),
+				  n / ET_BLOCK + 1);
+	}
       if (direction == 1)
-	ADVANCE_UNIDIRECTIONAL(d, bit, raw, channel_count, xerror, xstep, xmod);
+	ADVANCE_UNIDIRECTIONAL(&cursor, bit, raw, channel_count, xerror,
+			       xstep, xmod);
       else
-	ADVANCE_REVERSE(d, bit, raw, channel_count, xerror, xstep, xmod);
+	ADVANCE_REVERSE(&cursor, bit, raw, channel_count, xerror,
+			xstep, xmod);
     }
-  if (direction == -1)
+}
+
+static void
+et_dither_band(void *data, int band)
+{
+  const et_row_t *r = (const et_row_t *) data;
+  et_dither_channels(r, band, r->d->band_start[band],
+		     r->d->band_start[band + 1]);
+}
+
+void
+stpi_dither_et(stp_vars_t *v,
+	       int row,
+	       const unsigned short *raw,
+	       int duplicate_line,
+	       int zero_mask,
+	       const unsigned char *mask)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  eventone_t *et;
+  et_row_t r;
+
+  if (!et_initializer(d, duplicate_line, zero_mask))
+    return;
+
+  et = (eventone_t *) d->aux_data;
+  if (d->stpi_dither_type & D_UNITONE)
+    stp_dither_matrix_set_row(&(et->transition_matrix), row);
+
+  r.d = d;
+  r.et = et;
+  r.row = row;
+  r.raw = raw;
+  r.mask = mask;
+  r.bands = et->progress ? stpi_dither_channel_bands(d) : 1;
+  if (r.bands > 1)
+    {
+      /*
+       * The ordered threshold must be computed in scan order, since
+       * ditherpoint() caches its position in the matrix.
+       */
+      int x;
+      int i;
+      for (x = 0; x < d->dst_width; x++)
+	et->comparison[x] = 32768;
+      if (d->stpi_dither_type & D_ORDERED_BASE)
+	{
+	  if (row & 1)
+	    for (x = 0; x < d->dst_width; x++)
+	      et->comparison[x] +=
+		(ditherpoint(d, &(d->dither_matrix), x) / 16) - 2048;
+	  else
+	    for (x = d->dst_width - 1; x >= 0; x--)
+	      et->comparison[x] +=
+		(ditherpoint(d, &(d->dither_matrix), x) / 16) - 2048;
+	}
+      for (i = 0; i < r.bands; i++)
+	et->progress[i] = 0;
+      stpi_worker_pool_run(d->pool, et_dither_band, &r, r.bands);
+    }
+  else
+    et_dither_channels(&r, -1, 0, CHANNEL_COUNT(d));
+  if (!(row & 1))
     stpi_dither_reverse_row_ends(d);
 }
 
@@ -723,7 +835,7 @@ stpi_dither_ut(stp_vars_t *v,
 		      set_row_ends(dc, x);
 
 		      /* Do the printing */
-		      print_ink(d, dc->ptr, inkp, bit, length);
+		      print_ink(dc->ptr, inkp, bit, d->ptr_offset, length);
 		    }
 		}
 	    }
@@ -65,6 +65,11 @@ extern "C" {
 
 #define DITHER_FAST_STEPS (6)
 
+/*
+ * Rows narrower than this are not worth handing to the worker pool.
+ */
+#define DITHER_THREAD_MIN_WIDTH (256)
+
 typedef struct
 {
   const char *name;
@@ -109,6 +114,16 @@ typedef struct dither_channel
   unsigned randomizer;		/* With Floyd-Steinberg dithering, control */
 				/* how much randomness is applied to the */
 				/* threshold values (0-65535). */
+  /*
+   * Per-channel copies of the dither-wide settings, so that kernels
+   * working on several channels concurrently only touch their own
+   * channels' state.  See stpi_dither_share_settings().
+   */
+  int adaptive_limit;
+  int spread;
+  int spread_mask;
+  const int *offset0_table;
+  const int *offset1_table;
   unsigned bit_max;
   unsigned signif_bits;
   unsigned density;
@@ -130,6 +145,7 @@ typedef struct dither_channel
   stp_dither_matrix_impl_t pick;
   stp_dither_matrix_impl_t dithermat;
   int row_ends[2];
+  unsigned char *threshold_out;	/* Scratch row for the threshold kernel */
   unsigned char *ptr;
   void *aux_data;		/* aux_freefunc for dither should free this */
 } stpi_dither_channel_t;
@@ -174,8 +190,35 @@ typedef struct dither
   stpi_ditherfunc_t *ditherfunc;
   void *aux_data;
   void (*aux_freefunc)(struct dither *);
+
+  stpi_worker_pool_t *pool;	/* NULL unless DitherThreads > 1 */
+  int *band_start;		/* First channel of each worker band */
+
+  int span_start;		/* Output columns of the current row that */
+  int span_end;			/* may have ink; the rest are known white */
+
+  int planar;			/* DitherPlanar: input rows are planar */
+  int pixel_step;		/* Layout of the row being dithered: */
+  int channel_step;		/* samples between pixels and channels */
+  unsigned short *interleaved;	/* Planar row, for kernels that can't */
+				/* take it as it is */
+  int *threshold_tiles;		/* Threshold kernel tiles for each row */
+  const unsigned *threshold_matrix; /* of this matrix */
 } stpi_dither_t;
 
+/*
+ * Position of a dither kernel within the output row.  The ADVANCE_*
+ * macros only touch ptr_offset and dst_width, so kernels that run
+ * several bands of channels concurrently keep one of these per band
+ * rather than sharing the one in stpi_dither_t.
+ */
+
+typedef struct
+{
+  int ptr_offset;
+  int dst_width;
+} stpi_dither_cursor_t;
+
 #define CHANNEL(d, c) ((d)->channel[(c)])
 #define CHANNEL_COUNT(d) ((d)->total_channel_count)
 
@@ -195,6 +238,21 @@ extern int stpi_dither_translate_channel(stp_vars_t *v, unsigned channel,
 extern void stpi_dither_channel_destroy(stpi_dither_channel_t *channel);
 extern void stpi_dither_finalize(stp_vars_t *v);
 extern int *stpi_dither_get_errline(stpi_dither_t *d, int row, int color);
+extern int stpi_dither_channel_bands(stpi_dither_t *d);
+extern void stpi_dither_share_settings(stpi_dither_t *d);
+extern void stpi_dither_threshold_init(void);
+extern void stpi_dither_threshold_setup(stpi_dither_t *d);
+extern void stpi_dither_threshold_free(stpi_dither_t *d);
+extern int stpi_dither_threshold_usable(const stpi_dither_t *d,
+					const unsigned char *mask,
+					int first, int last);
+extern void stpi_dither_threshold_channel(stpi_dither_t *d, int channel,
+					  const unsigned short *raw,
+					  unsigned bits, int length);
+extern const unsigned short *
+stpi_dither_seek(const stpi_dither_t *d, int x, const unsigned short *raw,
+		 stpi_dither_cursor_t *cursor, unsigned char *bit,
+		 int *xerror);
 
 
 #define ADVANCE_UNIDIRECTIONAL(d, bit, input, width, xerror, xstep, xmod) \
@@ -203,16 +261,16 @@ do									  \
   bit >>= 1;								  \
   if (bit == 0)								  \
     {									  \
-      d->ptr_offset++;							  \
+      (d)->ptr_offset++;						  \
       bit = 128;							  \
     }									  \
   input += xstep;							  \
   if (xmod)								  \
     {									  \
       xerror += xmod;							  \
-      if (xerror >= d->dst_width)					  \
+      if (xerror >= (d)->dst_width)					  \
 	{								  \
-	  xerror -= d->dst_width;					  \
+	  xerror -= (d)->dst_width;					  \
 	  input += (width);						  \
 	}								  \
     }									  \
@@ -223,7 +281,7 @@ do									\
 {									\
   if (bit == 128)							\
     {									\
-      d->ptr_offset--;							\
+      (d)->ptr_offset--;						\
       bit = 1;								\
     }									\
   else									\
@@ -234,7 +292,7 @@ do									\
       xerror -= xmod;							\
       if (xerror < 0)							\
 	{								\
-	  xerror += d->dst_width;					\
+	  xerror += (d)->dst_width;					\
 	  input -= (width);						\
 	}								\
     }									\
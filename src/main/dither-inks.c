@@ -158,6 +158,7 @@ insert_subchannel(stp_vars_t *v, stpi_dither_t *d, int channel, int subchannel)
   d->total_channel_count += increment;
   for (i = oc; i < oc + increment; i++)
     initialize_channel(v, channel, i);
+  stpi_dither_share_settings(d);
 }
 
 void
@@ -178,6 +179,8 @@ stpi_dither_finalize(stp_vars_t *v)
 	  stp_dither_matrix_clone(&(d->dither_matrix), &(dc->pick),
 				   x_n * (i % rc), y_n * (i / rc));
 	}
+      stpi_dither_share_settings(d);
+      stpi_dither_threshold_setup(d);
       d->finalized = 1;
     }
 }
@@ -239,6 +242,7 @@ stpi_dither_finalize_ranges(stp_vars_t *v, stpi_dither_channel_t *dc)
 	    d->adaptive_limit = 65535;
 	  stp_dprintf(STP_DBG_INK, v, "Setting adaptive limit to %d\n",
 		      d->adaptive_limit);
+	  stpi_dither_share_settings(d);
 	}
     }
   for (i = 0; i <= dc->nlevels; i++)
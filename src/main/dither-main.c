@@ -107,6 +107,21 @@ static const stp_parameter_t dither_parameters[] =
     STP_PARAMETER_TYPE_STRING_LIST, STP_PARAMETER_CLASS_OUTPUT,
     STP_PARAMETER_LEVEL_ADVANCED, 1, 1, STP_CHANNEL_NONE, 1, 0
   },
+  {
+    "DitherThreads", N_("Dither Threads"), "Color=No,Category=Screening Adjustment",
+    N_("Number of threads to use for dithering each row.  "
+       "The output is identical regardless of the number of threads."),
+    STP_PARAMETER_TYPE_INT, STP_PARAMETER_CLASS_OUTPUT,
+    STP_PARAMETER_LEVEL_INTERNAL, 0, 1, STP_CHANNEL_NONE, 1, 0
+  },
+  {
+    "DitherPlanar", N_("Planar Dither Input"), "Color=No,Category=Screening Adjustment",
+    N_("Pass each row to the dither as one run of samples per channel "
+       "rather than as interleaved pixels.  "
+       "The output is identical either way."),
+    STP_PARAMETER_TYPE_BOOLEAN, STP_PARAMETER_CLASS_OUTPUT,
+    STP_PARAMETER_LEVEL_INTERNAL, 0, 1, STP_CHANNEL_NONE, 1, 0
+  },
 };
 
 static const int dither_parameter_count =
@@ -152,6 +167,18 @@ stp_dither_describe_parameter(const stp_vars_t *v, const char *name,
       description->deflt.str =
 	stp_string_list_param(description->bounds.str, 0)->name;
     }
+  else if (strcmp(name, "DitherThreads") == 0)
+    {
+      stp_fill_parameter_settings(description, &(dither_parameters[2]));
+      description->deflt.integer = 1;
+      description->bounds.integer.lower = 1;
+      description->bounds.integer.upper = 64;
+    }
+  else if (strcmp(name, "DitherPlanar") == 0)
+    {
+      stp_fill_parameter_settings(description, &(dither_parameters[3]));
+      description->deflt.boolean = 0;
+    }
   else
     return;
 }
@@ -284,6 +311,7 @@ stp_dither_set_adaptive_limit(stp_vars_t *v, double limit)
 {
   stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
   d->adaptive_limit = limit;
+  stpi_dither_share_settings(d);
 }
 
 void
@@ -311,6 +339,22 @@ stp_dither_set_ink_spread(stp_vars_t *v, int spread)
 	}
     }
   d->spread_mask = (1 << d->spread) - 1;
+  stpi_dither_share_settings(d);
+}
+
+void
+stpi_dither_share_settings(stpi_dither_t *d)
+{
+  int i;
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    {
+      stpi_dither_channel_t *dc = &(CHANNEL(d, i));
+      dc->adaptive_limit = d->adaptive_limit;
+      dc->spread = d->spread;
+      dc->spread_mask = d->spread_mask;
+      dc->offset0_table = d->offset0_table;
+      dc->offset1_table = d->offset1_table;
+    }
 }
 
 void
@@ -327,6 +371,10 @@ stpi_dither_free(void *vd)
 {
   stpi_dither_t *d = (stpi_dither_t *) vd;
   int j;
+  stpi_worker_pool_destroy(d->pool);
+  STP_SAFE_FREE(d->band_start);
+  STP_SAFE_FREE(d->interleaved);
+  stpi_dither_threshold_free(d);
   if (d->aux_freefunc)
     (d->aux_freefunc)(d);
   for (j = 0; j < CHANNEL_COUNT(d); j++)
@@ -340,6 +388,70 @@ stpi_dither_free(void *vd)
   stp_free(d);
 }
 
+/*
+ * The ordered, very fast and predithered kernels read each channel on
+ * its own, so they can take a row with each channel's samples contiguous.
+ * The error diffusion kernels carry state across all channels of a pixel
+ * and want it interleaved.
+ */
+static int
+takes_planar_input(const stpi_dither_t *d)
+{
+  return (d->ditherfunc == stpi_dither_ordered ||
+	  d->ditherfunc == stpi_dither_very_fast ||
+	  d->ditherfunc == stpi_dither_predithered);
+}
+
+/*
+ * The dither matrix depends only on the algorithm, the number of steps
+ * of an iterated matrix and the aspect ratio, so a render session keeps
+ * it for the pages after the first.  A matrix given in the DitherMatrix
+ * parameter is cheap to set up and is not kept.
+ */
+typedef struct
+{
+  int steps;			/* Of an iterated matrix; 0 if standard */
+  int x_aspect;
+  int y_aspect;
+  stp_dither_matrix_impl_t matrix;
+} kept_matrix_t;
+
+static void
+free_kept_matrix(void *vkept)
+{
+  kept_matrix_t *kept = (kept_matrix_t *) vkept;
+  stp_dither_matrix_destroy(&(kept->matrix));
+  stp_free(kept);
+}
+
+static void
+keep_matrix(stp_vars_t *v, const stpi_dither_t *d, int steps)
+{
+  kept_matrix_t *kept;
+  if (!stpi_get_session(v))
+    return;
+  kept = stp_zalloc(sizeof(kept_matrix_t));
+  kept->steps = steps;
+  kept->x_aspect = d->x_aspect;
+  kept->y_aspect = d->y_aspect;
+  stp_dither_matrix_copy(&(d->dither_matrix), &(kept->matrix));
+  stpi_session_set_data(v, "Dither", kept, free_kept_matrix);
+}
+
+static int
+reuse_kept_matrix(stp_vars_t *v, stpi_dither_t *d, int steps)
+{
+  const kept_matrix_t *kept =
+    (const kept_matrix_t *) stpi_session_get_data(v, "Dither");
+  if (!kept || kept->steps != steps || kept->x_aspect != d->x_aspect ||
+      kept->y_aspect != d->y_aspect)
+    return 0;
+  stp_dprintf(STP_DBG_INK, v, "Reusing dither matrix from the session\n");
+  stp_dither_matrix_destroy(&(d->dither_matrix));
+  stp_dither_matrix_copy(&(kept->matrix), &(d->dither_matrix));
+  return 1;
+}
+
 void
 stp_dither_init(stp_vars_t *v, stp_image_t *image, int out_width,
 		int xdpi, int ydpi)
@@ -376,12 +488,15 @@ stp_dither_init(stp_vars_t *v, stp_image_t *image, int out_width,
   if (d->stpi_dither_type == D_VERY_FAST || d->stpi_dither_type ==D_EVENTONE ||
       d->stpi_dither_type == D_FAST || d->stpi_dither_type == D_PREDITHERED)
     {
+      int steps = DITHER_FAST_STEPS;
       if (stp_check_int_parameter(v, "DitherVeryFastSteps",
 				  STP_PARAMETER_ACTIVE))
-	stp_dither_set_iterated_matrix
-	  (v, 2, stp_get_int_parameter(v, "DitherVeryFastSteps"), sq2, 0, 2,4);
-      else
-	stp_dither_set_iterated_matrix(v, 2, DITHER_FAST_STEPS, sq2, 0, 2, 4);
+	steps = stp_get_int_parameter(v, "DitherVeryFastSteps");
+      if (!reuse_kept_matrix(v, d, steps))
+	{
+	  stp_dither_set_iterated_matrix(v, 2, steps, sq2, 0, 2, 4);
+	  keep_matrix(v, d, steps);
+	}
     }
   else if (stp_check_array_parameter(v, "DitherMatrix",
 				     STP_PARAMETER_ACTIVE) &&
@@ -391,7 +506,7 @@ stp_dither_init(stp_vars_t *v, stp_image_t *image, int out_width,
       stp_dither_set_matrix_from_dither_array
 	(v, stp_get_array_parameter(v, "DitherMatrix"), 0);
     }
-  else
+  else if (!reuse_kept_matrix(v, d, 0))
     {
       stp_array_t *array =
 	stp_find_standard_dither_array(d->y_aspect, d->x_aspect);
@@ -399,6 +514,7 @@ stp_dither_init(stp_vars_t *v, stp_image_t *image, int out_width,
       STPI_ASSERT(array, v);
       stp_dither_set_matrix_from_dither_array(v, array, transposed);
       stp_array_destroy(array);
+      keep_matrix(v, d, 0);
     }
 
   d->src_width = in_width;
@@ -406,6 +522,58 @@ stp_dither_init(stp_vars_t *v, stp_image_t *image, int out_width,
 
   stp_dither_set_ink_spread(v, 13);
   d->channel_count = 0;
+
+  if (stp_check_int_parameter(v, "DitherThreads", STP_PARAMETER_ACTIVE))
+    d->pool = stpi_worker_pool_create(stp_get_int_parameter(v, "DitherThreads"));
+  d->band_start =
+    stp_malloc(sizeof(int) * (stpi_worker_pool_get_threads(d->pool) + 1));
+
+  /*
+   * The channel code produces planar rows only if asked before its first
+   * row, and only the kernels that can use them ask.
+   */
+  if (stp_check_boolean_parameter(v, "DitherPlanar", STP_PARAMETER_ACTIVE) &&
+      stp_get_boolean_parameter(v, "DitherPlanar"))
+    {
+      d->planar = 1;
+      if (takes_planar_input(d))
+	stpi_channel_set_planar(v, 1);
+    }
+}
+
+/*
+ * Divide the channels into contiguous bands, one per worker, so that
+ * each band has about the same number of channels that actually print.
+ * Returns the number of bands; if it's 1, the row should be dithered
+ * on the calling thread.
+ */
+int
+stpi_dither_channel_bands(stpi_dither_t *d)
+{
+  int threads = stpi_worker_pool_get_threads(d->pool);
+  int active = 0;
+  int bands;
+  int band;
+  int seen;
+  int i;
+  if (threads <= 1 || d->dst_width < DITHER_THREAD_MIN_WIDTH)
+    return 1;
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    if (CHANNEL(d, i).ptr)
+      active++;
+  bands = threads < active ? threads : active;
+  if (bands <= 1)
+    return 1;
+  for (i = 0, seen = 0, band = 0; i < CHANNEL_COUNT(d); i++)
+    if (CHANNEL(d, i).ptr)
+      {
+	if (band < bands && seen == band * active / bands)
+	  d->band_start[band++] = i;
+	seen++;
+      }
+  d->band_start[0] = 0;
+  d->band_start[bands] = CHANNEL_COUNT(d);
+  return bands;
 }
 
 void
@@ -458,14 +626,92 @@ stpi_dither_get_errline(stpi_dither_t *d, int row, int color)
   return dc->errs[row % dc->error_rows] + MAX_SPREAD;
 }
 
-void
-stp_dither_internal(stp_vars_t *v, int row, const unsigned short *input,
-		    int duplicate_line, int zero_mask,
-		    const unsigned char *mask)
+/*
+ * Set up the state that ADVANCE_UNIDIRECTIONAL keeps for output column
+ * x, as if it had stepped there from column 0, and return the input
+ * pixel for that column.
+ */
+const unsigned short *
+stpi_dither_seek(const stpi_dither_t *d, int x, const unsigned short *raw,
+		 stpi_dither_cursor_t *cursor, unsigned char *bit, int *xerror)
+{
+  cursor->ptr_offset = x / 8;
+  cursor->dst_width = d->dst_width;
+  *bit = 128 >> (x & 7);
+  *xerror = (long long) x * (d->src_width % d->dst_width) % d->dst_width;
+  return raw + d->pixel_step *
+    ((long long) x * d->src_width / d->dst_width);
+}
+
+/*
+ * Input pixels first through last are the only ones with ink; find the
+ * output columns that are drawn from them.  Output column x comes from
+ * input pixel x * src_width / dst_width (rounded down).
+ */
+static void
+set_span(stpi_dither_t *d, int first, int last)
+{
+  if (first < 0 || last < first)
+    {
+      d->span_start = 0;
+      d->span_end = 0;
+      return;
+    }
+  d->span_start =
+    ((long long) first * d->dst_width + d->src_width - 1) / d->src_width;
+  d->span_end =
+    ((long long) (last + 1) * d->dst_width + d->src_width - 1) / d->src_width;
+  if (d->span_end > d->dst_width)
+    d->span_end = d->dst_width;
+}
+
+/*
+ * Interleave a planar row for a kernel that walks the row a pixel at a
+ * time across all channels.
+ */
+static const unsigned short *
+interleave_row(stpi_dither_t *d, const unsigned short *input)
+{
+  int channels = CHANNEL_COUNT(d);
+  int width = d->src_width;
+  int x, i;
+  if (!d->interleaved)
+    d->interleaved =
+      stp_malloc(sizeof(unsigned short) * channels * width);
+  for (i = 0; i < channels; i++)
+    {
+      const unsigned short *plane = input + i * width;
+      unsigned short *out = d->interleaved + i;
+      for (x = 0; x < width; x++)
+	out[x * channels] = plane[x];
+    }
+  return d->interleaved;
+}
+
+static void
+dither_row(stp_vars_t *v, int row, const unsigned short *input, int planar,
+	   int duplicate_line, int zero_mask, const unsigned char *mask,
+	   int first, int last)
 {
   int i;
   stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
   stpi_dither_finalize(v);
+  if (planar && !takes_planar_input(d))
+    {
+      input = interleave_row(d, input);
+      planar = 0;
+    }
+  if (planar)
+    {
+      d->pixel_step = 1;
+      d->channel_step = d->src_width;
+    }
+  else
+    {
+      d->pixel_step = CHANNEL_COUNT(d);
+      d->channel_step = 1;
+    }
+  set_span(d, first, last);
   stp_dither_matrix_set_row(&(d->dither_matrix), row);
   for (i = 0; i < CHANNEL_COUNT(d); i++)
     {
@@ -483,10 +729,167 @@ stp_dither_internal(stp_vars_t *v, int row, const unsigned short *input,
   (d->ditherfunc)(v, row, input, duplicate_line, zero_mask, mask);
 }
 
+/*
+ * With DitherPlanar set, input holds a row of the input width for each
+ * channel in turn.
+ */
+void
+stp_dither_internal(stp_vars_t *v, int row, const unsigned short *input,
+		    int duplicate_line, int zero_mask,
+		    const unsigned char *mask)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  dither_row(v, row, input, d->planar, duplicate_line, zero_mask, mask,
+	     0, INT_MAX - 1);
+}
+
+/*
+ * The channel output carries the extent of the ink in the row, so the
+ * dither can leave the white space on either side alone.
+ */
 void
 stp_dither(stp_vars_t *v, int row, int duplicate_line, int zero_mask,
 	   const unsigned char *mask)
 {
-  const unsigned short *input = stp_channel_get_output(v);
-  stp_dither_internal(v, row, input, duplicate_line, zero_mask, mask);
+  int planar;
+  const unsigned short *input = stpi_dither_get_input(v, &planar);
+  int first = 0;
+  int last = INT_MAX - 1;
+  stpi_channel_get_ink_extent(v, &first, &last);
+  dither_row(v, row, input, planar, duplicate_line, zero_mask, mask,
+	     first, last);
+}
+
+/*
+ * The converted row that stp_dither() works from.
+ */
+const unsigned short *
+stpi_dither_get_input(const stp_vars_t *v, int *planar)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  const unsigned short *input = NULL;
+  if (d->planar)
+    input = stpi_channel_get_planar_output(v);
+  *planar = input ? 1 : 0;
+  if (!input)
+    input = stp_channel_get_output(v);
+  return input;
+}
+
+/*
+ * stp_dither() on a converted row held elsewhere; first and last are
+ * the extent of the ink in it.
+ */
+void
+stpi_dither_row(stp_vars_t *v, int row, const unsigned short *input,
+		int planar, int first, int last, int duplicate_line,
+		int zero_mask, const unsigned char *mask)
+{
+  dither_row(v, row, input, planar, duplicate_line, zero_mask, mask,
+	     first, last);
+}
+
+/*
+ * Dithering the next row and writing out the last one at the same time
+ * needs two sets of channel buffers.  Diverting the output gives output
+ * (a vars object sharing v's component data) a dither of its own that
+ * refers to the buffers the driver registered, and gives the dither in
+ * v new buffers; dithered rows are moved from one to the other with
+ * stpi_dither_save_row() and stpi_dither_load_row().
+ */
+static size_t
+channel_bytes(const stpi_dither_t *d, int channel)
+{
+  return (d->dst_width + 7) / 8 * CHANNEL(d, channel).signif_bits;
+}
+
+static void
+free_output_dither(void *vd)
+{
+  stpi_dither_t *d = (stpi_dither_t *) vd;
+  stp_free(d->channel);
+  stp_free(d);
+}
+
+void
+stpi_dither_divert_output(stp_vars_t *v, stp_vars_t *output)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  stpi_dither_t *od = stp_malloc(sizeof(stpi_dither_t));
+  int i;
+  memcpy(od, d, sizeof(stpi_dither_t));
+  od->channel = stp_malloc(sizeof(stpi_dither_channel_t) * CHANNEL_COUNT(d));
+  memcpy(od->channel, d->channel,
+	 sizeof(stpi_dither_channel_t) * CHANNEL_COUNT(d));
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    if (CHANNEL(d, i).ptr)
+      CHANNEL(d, i).ptr = stp_zalloc(channel_bytes(d, i));
+  stp_allocate_component_data(output, "Dither", NULL, free_output_dither, od);
+}
+
+void
+stpi_dither_restore_output(stp_vars_t *v, stp_vars_t *output)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  stpi_dither_t *od =
+    (stpi_dither_t *) stp_get_component_data(output, "Dither");
+  int i;
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    {
+      STP_SAFE_FREE(CHANNEL(d, i).ptr);
+      CHANNEL(d, i).ptr = CHANNEL(od, i).ptr;
+      CHANNEL(d, i).row_ends[0] = CHANNEL(od, i).row_ends[0];
+      CHANNEL(d, i).row_ends[1] = CHANNEL(od, i).row_ends[1];
+    }
+  stp_destroy_component_data(output, "Dither");
+}
+
+size_t
+stpi_dither_get_row_size(const stp_vars_t *v)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  size_t bytes = sizeof(int) * 2 * CHANNEL_COUNT(d);
+  int i;
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    if (CHANNEL(d, i).ptr)
+      bytes += channel_bytes(d, i);
+  return bytes;
+}
+
+void
+stpi_dither_save_row(const stp_vars_t *v, unsigned char *row)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  int *ends = (int *) row;
+  int i;
+  row += sizeof(int) * 2 * CHANNEL_COUNT(d);
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    {
+      ends[2 * i] = CHANNEL(d, i).row_ends[0];
+      ends[2 * i + 1] = CHANNEL(d, i).row_ends[1];
+      if (CHANNEL(d, i).ptr)
+	{
+	  memcpy(row, CHANNEL(d, i).ptr, channel_bytes(d, i));
+	  row += channel_bytes(d, i);
+	}
+    }
+}
+
+void
+stpi_dither_load_row(const stp_vars_t *v, const unsigned char *row)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  const int *ends = (const int *) row;
+  int i;
+  row += sizeof(int) * 2 * CHANNEL_COUNT(d);
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    {
+      CHANNEL(d, i).row_ends[0] = ends[2 * i];
+      CHANNEL(d, i).row_ends[1] = ends[2 * i + 1];
+      if (CHANNEL(d, i).ptr)
+	{
+	  memcpy(CHANNEL(d, i).ptr, row, channel_bytes(d, i));
+	  row += channel_bytes(d, i);
+	}
+    }
 }
@@ -166,7 +166,8 @@ init_dither_channel_new(stpi_dither_channel_t *dc, stp_vars_t *v)
 
 static inline void
 print_color_ordered_new(const stpi_dither_t *d, stpi_dither_channel_t *dc,
-			int val, int x, int y, unsigned char bit, int length)
+			int val, int x, int y, unsigned char bit,
+			int ptr_offset, int length)
 {
   int i;
   int j;
@@ -188,7 +189,7 @@ print_color_ordered_new(const stpi_dither_t *d, stpi_dither_channel_t *dc,
 	  bits = dd->upper->bits;
 	  if (bits)
 	    {
-	      unsigned char *tptr = dc->ptr + d->ptr_offset;
+	      unsigned char *tptr = dc->ptr + ptr_offset;
 
 	      /*
 	       * Lay down all of the bits in the pixel.
@@ -208,7 +209,7 @@ print_color_ordered_new(const stpi_dither_t *d, stpi_dither_channel_t *dc,
 
 static inline void
 print_color_ordered(const stpi_dither_t *d, stpi_dither_channel_t *dc, int val,
-		    int x, int y, unsigned char bit, int length)
+		    int x, int y, unsigned char bit, int ptr_offset, int length)
 {
   int i;
   int j;
@@ -239,7 +240,7 @@ print_color_ordered(const stpi_dither_t *d, stpi_dither_channel_t *dc, int val,
 
 	  if (bits)
 	    {
-	      unsigned char *tptr = dc->ptr + d->ptr_offset;
+	      unsigned char *tptr = dc->ptr + ptr_offset;
 
 	      /*
 	       * Lay down all of the bits in the pixel.
@@ -328,79 +329,103 @@ init_dither_ordered(stpi_dither_t *d, stp_vars_t *v)
     }
 }
 
-void
-stpi_dither_ordered(stp_vars_t *v,
-		    int row,
-		    const unsigned short *raw,
-		    int duplicate_line,
-		    int zero_mask,
-		    const unsigned char *mask)
+typedef struct
 {
-  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
-  int		x,
-		length;
+  stpi_dither_t *d;
+  int row;
+  const unsigned short *raw;
+  const unsigned char *mask;
+  int length;
+  int one_bit_only;
+  int one_level_only;
+} ordered_row_t;
+
+/*
+ * A single level channel whose lower ink is "no ink" at value 0 prints
+ * exactly when its value reaches the matrix threshold, which is what
+ * stpi_dither_threshold_channel() computes.
+ */
+static int
+plain_threshold_channels(const stpi_dither_t *d, int first, int last)
+{
+  int i;
+  for (i = first; i < last; i++)
+    {
+      const stpi_dither_segment_t *dd = &(CHANNEL(d, i).ranges[0]);
+      if (CHANNEL(d, i).nlevels != 1 || dd->lower->value != 0 ||
+	  dd->lower->bits != 0 || dd->value_span < 65535)
+	return 0;
+    }
+  return 1;
+}
+
+/*
+ * Each channel has its own dither matrix, so bands of channels can be
+ * dithered independently of each other.
+ */
+static void
+ordered_dither_channels(const ordered_row_t *r, int first, int last)
+{
+  stpi_dither_t *d = r->d;
+  const unsigned short *raw;
+  const unsigned char *mask = r->mask;
+  int row = r->row;
+  int length = r->length;
+  stpi_dither_cursor_t cursor;
+  int		x;
   unsigned char	bit;
   int i;
-  int one_bit_only = 1;
-  int one_level_only = 1;
 
   int xerror, xstep, xmod;
+  const int cstep = d->channel_step;
 
-  if ((zero_mask & ((1 << CHANNEL_COUNT(d)) - 1)) ==
-      ((1 << CHANNEL_COUNT(d)) - 1))
-    return;
-
-  length = (d->dst_width + 7) / 8;
-
-  bit = 128;
-  xstep  = CHANNEL_COUNT(d) * (d->src_width / d->dst_width);
+  xstep  = d->pixel_step * (d->src_width / d->dst_width);
   xmod   = d->src_width % d->dst_width;
-  xerror = 0;
+  raw = stpi_dither_seek(d, d->span_start, r->raw, &cursor, &bit, &xerror);
 
-  for (i = 0; i < CHANNEL_COUNT(d); i++)
+  if (stpi_dither_threshold_usable(d, mask, first, last) &&
+      (r->one_bit_only ||
+       (r->one_level_only && !(d->stpi_dither_type & D_ORDERED_SEGMENTED) &&
+	plain_threshold_channels(d, first, last))))
     {
-      stpi_dither_channel_t *dc = &(CHANNEL(d, i));
-      if (dc->nlevels != 1)
-	one_level_only = 0;
-      if (dc->nlevels != 1 || dc->ranges[0].upper->bits != 1)
-	one_bit_only = 0;
+      for (i = first; i < last; i++)
+	stpi_dither_threshold_channel(d, i, r->raw,
+				      CHANNEL(d, i).ranges[0].upper->bits,
+				      length);
     }
-  if (! one_bit_only && ! d->aux_data &&
-      (d->stpi_dither_type & (D_ORDERED_SEGMENTED | D_ORDERED_NEW)))
-    init_dither_ordered(d, v);
-
-  if (one_bit_only)
+  else if (r->one_bit_only)
     {
-      for (x = 0; x < d->dst_width; x ++)
+      for (x = d->span_start; x < d->span_end; x ++)
 	{
-	  if (!mask || (*(mask + d->ptr_offset) & bit))
+	  if (!mask || (*(mask + cursor.ptr_offset) & bit))
 	    {
-	      for (i = 0; i < CHANNEL_COUNT(d); i++)
+	      for (i = first; i < last; i++)
 		{
-		  if (raw[i] &&
-		      raw[i] >= ditherpoint(d, &(CHANNEL(d, i).dithermat), x))
+		  if (raw[i * cstep] &&
+		      raw[i * cstep] >= ditherpoint(d, &(CHANNEL(d, i).dithermat),
+						    x))
 		    {
 		      set_row_ends(&(CHANNEL(d, i)), x);
-		      CHANNEL(d, i).ptr[d->ptr_offset] |= bit;
+		      CHANNEL(d, i).ptr[cursor.ptr_offset] |= bit;
 		    }
 		}
 	    }
-	  ADVANCE_UNIDIRECTIONAL(d, bit, raw, CHANNEL_COUNT(d),
+	  ADVANCE_UNIDIRECTIONAL(&cursor, bit, raw, d->pixel_step,
 				 xerror, xstep, xmod);
 	}
     }
   else if (d->stpi_dither_type & D_ORDERED_SEGMENTED)
     {
-      for (x = 0; x < d->dst_width; x ++)
+      for (x = d->span_start; x < d->span_end; x ++)
 	{
-	  if (!mask || (*(mask + d->ptr_offset) & bit))
+	  if (!mask || (*(mask + cursor.ptr_offset) & bit))
 	    {
-	      for (i = 0; i < CHANNEL_COUNT(d); i++)
+	      for (i = first; i < last; i++)
 		{
 		  stpi_dither_channel_t *dc = &CHANNEL(d, i);
 		  stpi_ordered_t *s = (stpi_ordered_t *) dc->aux_data;
-		  unsigned short bits = raw[i] >> s->shift;
-		  unsigned short val = raw[i] << dc->signif_bits;
+		  unsigned short bits = raw[i * cstep] >> s->shift;
+		  unsigned short val = raw[i * cstep] << dc->signif_bits;
 		  val |= val >> s->shift;
 
 		  if (bits)
@@ -409,7 +434,7 @@ stpi_dither_ordered(stp_vars_t *v,
 			  val >= ditherpoint(d, &(CHANNEL(d, i).dithermat), x))
 			{
 			  int j;
-			  unsigned char *tptr = dc->ptr + d->ptr_offset;
+			  unsigned char *tptr = dc->ptr + cursor.ptr_offset;
 			  set_row_ends(dc, x);
 			  for (j = 1; j <= bits; j += j, tptr += length)
 			    {
@@ -422,49 +447,104 @@ stpi_dither_ordered(stp_vars_t *v,
 		    {
 		      if (d->stpi_dither_type & D_ORDERED_NEW)
 			print_color_ordered_new(d, &(CHANNEL(d, i)), val, x,
-						row, bit, length);
+						row, bit, cursor.ptr_offset,
+						length);
 		      else
 			print_color_ordered(d, &(CHANNEL(d, i)), val, x,
-					    row, bit, length);
+					    row, bit, cursor.ptr_offset,
+					    length);
 		    }
 		}
 	    }
-	  ADVANCE_UNIDIRECTIONAL(d, bit, raw, CHANNEL_COUNT(d),
+	  ADVANCE_UNIDIRECTIONAL(&cursor, bit, raw, d->pixel_step,
 				 xerror, xstep, xmod);
 	}
     }
-  else if (one_level_only || !(d->stpi_dither_type == D_ORDERED_NEW))
+  else if (r->one_level_only || !(d->stpi_dither_type == D_ORDERED_NEW))
     {
-      for (x = 0; x != d->dst_width; x ++)
+      for (x = d->span_start; x < d->span_end; x ++)
 	{
-	  if (!mask || (*(mask + d->ptr_offset) & bit))
+	  if (!mask || (*(mask + cursor.ptr_offset) & bit))
 	    {
-	      for (i = 0; i < CHANNEL_COUNT(d); i++)
+	      for (i = first; i < last; i++)
 		{
-		  if (CHANNEL(d, i).ptr && raw[i])
-		    print_color_ordered(d, &(CHANNEL(d, i)), raw[i], x, row,
-					bit, length);
+		  if (CHANNEL(d, i).ptr && raw[i * cstep])
+		    print_color_ordered(d, &(CHANNEL(d, i)), raw[i * cstep], x,
+					row, bit, cursor.ptr_offset, length);
 		}
 	    }
-	  ADVANCE_UNIDIRECTIONAL(d, bit, raw, CHANNEL_COUNT(d), xerror,
+	  ADVANCE_UNIDIRECTIONAL(&cursor, bit, raw, d->pixel_step, xerror,
 				 xstep, xmod);
 	}
     }
   else
     {
-      for (x = 0; x != d->dst_width; x ++)
+      for (x = d->span_start; x < d->span_end; x ++)
 	{
-	  if (!mask || (*(mask + d->ptr_offset) & bit))
+	  if (!mask || (*(mask + cursor.ptr_offset) & bit))
 	    {
-	      for (i = 0; i < CHANNEL_COUNT(d); i++)
+	      for (i = first; i < last; i++)
 		{
-		  if (CHANNEL(d, i).ptr && raw[i])
-		    print_color_ordered_new(d, &(CHANNEL(d, i)), raw[i], x,
-					    row, bit, length);
+		  if (CHANNEL(d, i).ptr && raw[i * cstep])
+		    print_color_ordered_new(d, &(CHANNEL(d, i)), raw[i * cstep],
+					    x, row, bit, cursor.ptr_offset,
+					    length);
 		}
 	    }
-	  ADVANCE_UNIDIRECTIONAL(d, bit, raw, CHANNEL_COUNT(d), xerror,
+	  ADVANCE_UNIDIRECTIONAL(&cursor, bit, raw, d->pixel_step, xerror,
 				 xstep, xmod);
 	}
     }
 }
+
+static void
+ordered_dither_band(void *data, int band)
+{
+  const ordered_row_t *r = (const ordered_row_t *) data;
+  ordered_dither_channels(r, r->d->band_start[band],
+			  r->d->band_start[band + 1]);
+}
+
+void
+stpi_dither_ordered(stp_vars_t *v,
+		    int row,
+		    const unsigned short *raw,
+		    int duplicate_line,
+		    int zero_mask,
+		    const unsigned char *mask)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  ordered_row_t r;
+  int i;
+  int bands;
+
+  if ((zero_mask & ((1 << CHANNEL_COUNT(d)) - 1)) ==
+      ((1 << CHANNEL_COUNT(d)) - 1))
+    return;
+
+  r.d = d;
+  r.row = row;
+  r.raw = raw;
+  r.mask = mask;
+  r.length = (d->dst_width + 7) / 8;
+  r.one_bit_only = 1;
+  r.one_level_only = 1;
+
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    {
+      stpi_dither_channel_t *dc = &(CHANNEL(d, i));
+      if (dc->nlevels != 1)
+	r.one_level_only = 0;
+      if (dc->nlevels != 1 || dc->ranges[0].upper->bits != 1)
+	r.one_bit_only = 0;
+    }
+  if (! r.one_bit_only && ! d->aux_data &&
+      (d->stpi_dither_type & (D_ORDERED_SEGMENTED | D_ORDERED_NEW)))
+    init_dither_ordered(d, v);
+
+  bands = stpi_dither_channel_bands(d);
+  if (bands > 1)
+    stpi_worker_pool_run(d->pool, ordered_dither_band, &r, bands);
+  else
+    ordered_dither_channels(&r, 0, CHANNEL_COUNT(d));
+}
@@ -36,10 +36,11 @@
 
 static inline void
 print_color_very_fast(const stpi_dither_t *d, stpi_dither_channel_t *dc,
-		      int val, int x, int y, unsigned bit, int length)
+		      int val, int x, int y, unsigned bit, int ptr_offset,
+		      int length)
 {
   int i, j;
-  unsigned char *tptr = dc->ptr + d->ptr_offset;
+  unsigned char *tptr = dc->ptr + ptr_offset;
 
   /*
    * Lay down all of the bits in the pixel.
@@ -52,77 +53,118 @@ print_color_very_fast(const stpi_dither_t *d, stpi_dither_channel_t *dc,
     }
 }
 
-void
-stpi_dither_predithered(stp_vars_t *v,
-			int row,
-			const unsigned short *raw,
-			int duplicate_line,
-			int zero_mask,
-			const unsigned char *mask)
+typedef struct
 {
-  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
-  int		x,
-		length;
+  stpi_dither_t *d;
+  int row;
+  const unsigned short *raw;
+  const unsigned char *mask;
+  int length;
+  int one_bit_only;
+} predithered_row_t;
+
+static void
+predithered_dither_channels(const predithered_row_t *r, int first, int last)
+{
+  stpi_dither_t *d = r->d;
+  const unsigned short *raw;
+  const unsigned char *mask = r->mask;
+  stpi_dither_cursor_t cursor;
+  int		x;
   unsigned char	bit;
   int i;
-  int one_bit_only = 1;
 
   int xerror, xstep, xmod;
+  const int cstep = d->channel_step;
 
-  if ((zero_mask & ((1 << CHANNEL_COUNT(d)) - 1)) ==
-      ((1 << CHANNEL_COUNT(d)) - 1))
-    return;
-
-  length = (d->dst_width + 7) / 8;
-
-  bit = 128;
-  xstep  = CHANNEL_COUNT(d) * (d->src_width / d->dst_width);
+  xstep  = d->pixel_step * (d->src_width / d->dst_width);
   xmod   = d->src_width % d->dst_width;
-  xerror = 0;
+  raw = stpi_dither_seek(d, d->span_start, r->raw, &cursor, &bit, &xerror);
 
-  for (i = 0; i < CHANNEL_COUNT(d); i++)
+  if (r->one_bit_only)
     {
-      stpi_dither_channel_t *dc = &(CHANNEL(d, i));
-      if (dc->signif_bits > 1)
+      for (x = d->span_start; x < d->span_end; x ++)
 	{
-	  one_bit_only = 0;
-	  break;
-	}
-    }
-  if (one_bit_only)
-    {
-      for (x = 0; x < d->dst_width; x ++)
-	{
-	  if (!mask || (*(mask + d->ptr_offset) & bit))
+	  if (!mask || (*(mask + cursor.ptr_offset) & bit))
 	    {
-	      for (i = 0; i < CHANNEL_COUNT(d); i++)
+	      for (i = first; i < last; i++)
 		{
-		  if (raw[i] & 1)
+		  if (raw[i * cstep] & 1)
 		    {
 		      set_row_ends(&(CHANNEL(d, i)), x);
-		      CHANNEL(d, i).ptr[d->ptr_offset] |= bit;
+		      CHANNEL(d, i).ptr[cursor.ptr_offset] |= bit;
 		    }
 		}
 	    }
-	  ADVANCE_UNIDIRECTIONAL(d, bit, raw, CHANNEL_COUNT(d),
+	  ADVANCE_UNIDIRECTIONAL(&cursor, bit, raw, d->pixel_step,
 				 xerror, xstep, xmod);
 	}
     }
   else
     {
-      for (x = 0; x < d->dst_width; x ++)
+      for (x = d->span_start; x < d->span_end; x ++)
 	{
-	  if (!mask || (*(mask + d->ptr_offset) & bit))
+	  if (!mask || (*(mask + cursor.ptr_offset) & bit))
 	    {
-	      for (i = 0; i < CHANNEL_COUNT(d); i++)
+	      for (i = first; i < last; i++)
 		{
-		  if (CHANNEL(d, i).ptr && raw[i])
-		    print_color_very_fast(d, &(CHANNEL(d, i)), raw[i], x, row,
-					  bit, length);
+		  if (CHANNEL(d, i).ptr && raw[i * cstep])
+		    print_color_very_fast(d, &(CHANNEL(d, i)), raw[i * cstep],
+					  x, r->row, bit, cursor.ptr_offset,
+					  r->length);
 		}
 	    }
-	  ADVANCE_UNIDIRECTIONAL(d, bit, raw, CHANNEL_COUNT(d),
+	  ADVANCE_UNIDIRECTIONAL(&cursor, bit, raw, d->pixel_step,
 				 xerror, xstep, xmod);
 	}
     }
 }
+
+static void
+predithered_dither_band(void *data, int band)
+{
+  const predithered_row_t *r = (const predithered_row_t *) data;
+  predithered_dither_channels(r, r->d->band_start[band],
+			      r->d->band_start[band + 1]);
+}
+
+void
+stpi_dither_predithered(stp_vars_t *v,
+			int row,
+			const unsigned short *raw,
+			int duplicate_line,
+			int zero_mask,
+			const unsigned char *mask)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  predithered_row_t r;
+  int i;
+  int bands;
+
+  if ((zero_mask & ((1 << CHANNEL_COUNT(d)) - 1)) ==
+      ((1 << CHANNEL_COUNT(d)) - 1))
+    return;
+
+  r.d = d;
+  r.row = row;
+  r.raw = raw;
+  r.mask = mask;
+  r.length = (d->dst_width + 7) / 8;
+  r.one_bit_only = 1;
+
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    {
+      stpi_dither_channel_t *dc = &(CHANNEL(d, i));
+      if (dc->signif_bits > 1)
+	{
+	  r.one_bit_only = 0;
+	  break;
+	}
+    }
+
+  bands = stpi_dither_channel_bands(d);
+  if (bands > 1)
+    stpi_worker_pool_run(d->pool, predithered_dither_band, &r, bands);
+  else
+    predithered_dither_channels(&r, 0, CHANNEL_COUNT(d));
+}
@@ -0,0 +1,392 @@
+/*
+ *   Row-at-a-time threshold kernel for the ordered and very fast dithers
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * When the input is not being scaled, every output byte of a channel is
+ * produced by comparing 8 consecutive input values against 8
+ * consecutive entries of the current dither matrix row (wrapping around
+ * at the end of the row).  This lets us threshold a whole row at once, 8
+ * pixels per step, rather than going through ditherpoint() and the
+ * ADVANCE macros one pixel at a time.
+ *
+ * Each matrix row is copied into a "tile" of thresholds, extended by 7
+ * entries so that any 8 consecutive thresholds are contiguous, and
+ * stored in reverse so that lane k of a group holds the threshold for
+ * output bit k.  A threshold of 0 is raised to 1, which folds the "value
+ * is nonzero" test of the scalar code into the comparison.  The tiles
+ * for every row of the matrix are built once, when the dither is
+ * finalized; all the channels use the same matrix at different offsets,
+ * so they share them.
+ *
+ * The comparison loop has a portable implementation and, on x86 with a
+ * suitable compiler, SSE2 and AVX2 implementations selected at run
+ * time.  All of them produce exactly the same bits.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#include "dither-impl.h"
+#include <string.h>
+
+#if defined(HAVE_X86_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#define USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Threshold the first groups * 8 pixels of a row: bit (7 - k) of out[g]
+ * is set if pixel g * 8 + k is at least its threshold.  Pixel 0 is at
+ * position start of a matrix row tile_width wide.
+ */
+typedef void (*threshold_func_t)(const unsigned short *raw, int stride,
+				 const int *tile, int tile_width, int start,
+				 int groups, unsigned char *out);
+
+#define GROUP_THRESHOLDS(tile, tile_width, p) ((tile) + (tile_width) - 1 - (p))
+
+#define NEXT_GROUP(p, tile_width)		\
+do {						\
+  (p) += 8;					\
+  if ((p) >= (tile_width))			\
+    (p) -= (tile_width);			\
+} while (0)
+
+static void
+threshold_row_c(const unsigned short *raw, int stride, const int *tile,
+		int tile_width, int start, int groups, unsigned char *out)
+{
+  int p = start;
+  int g, k;
+  for (g = 0; g < groups; g++)
+    {
+      const int *t = GROUP_THRESHOLDS(tile, tile_width, p);
+      const unsigned short *r = raw + g * 8 * stride;
+      unsigned char byte = 0;
+      for (k = 0; k < 8; k++)
+	if ((int) r[(7 - k) * stride] >= t[k])
+	  byte |= 1 << k;
+      out[g] = byte;
+      NEXT_GROUP(p, tile_width);
+    }
+}
+
+#ifdef USE_X86_SIMD
+__attribute__((target("sse2")))
+static void
+threshold_row_sse2(const unsigned short *raw, int stride, const int *tile,
+		   int tile_width, int start, int groups, unsigned char *out)
+{
+  int p = start;
+  int g;
+  for (g = 0; g < groups; g++)
+    {
+      const int *t = GROUP_THRESHOLDS(tile, tile_width, p);
+      const unsigned short *r = raw + g * 8 * stride;
+      __m128i lo = _mm_set_epi32(r[4 * stride], r[5 * stride],
+				 r[6 * stride], r[7 * stride]);
+      __m128i hi = _mm_set_epi32(r[0], r[stride], r[2 * stride],
+				 r[3 * stride]);
+      __m128i lo_t = _mm_loadu_si128((const __m128i *) t);
+      __m128i hi_t = _mm_loadu_si128((const __m128i *) (t + 4));
+      /* Lanes where the threshold exceeds the value are not printed */
+      int skip =
+	_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(lo_t, lo))) |
+	(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(hi_t, hi))) << 4);
+      out[g] = ~skip;
+      NEXT_GROUP(p, tile_width);
+    }
+}
+
+/*
+ * With planar input the 8 samples of a group are contiguous: one load,
+ * then reversed so that lane k holds the sample for output bit k.
+ */
+__attribute__((target("sse2")))
+static void
+threshold_row_unit_sse2(const unsigned short *raw, int stride,
+			const int *tile, int tile_width, int start, int groups,
+			unsigned char *out)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int p = start;
+  int g;
+  for (g = 0; g < groups; g++)
+    {
+      const int *t = GROUP_THRESHOLDS(tile, tile_width, p);
+      __m128i v = _mm_loadu_si128((const __m128i *) (raw + g * 8));
+      __m128i lo, hi;
+      __m128i lo_t = _mm_loadu_si128((const __m128i *) t);
+      __m128i hi_t = _mm_loadu_si128((const __m128i *) (t + 4));
+      int skip;
+      v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+      v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+      v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+      lo = _mm_unpacklo_epi16(v, zero);
+      hi = _mm_unpackhi_epi16(v, zero);
+      skip =
+	_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(lo_t, lo))) |
+	(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(hi_t, hi))) << 4);
+      out[g] = ~skip;
+      NEXT_GROUP(p, tile_width);
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+threshold_row_unit_avx2(const unsigned short *raw, int stride,
+			const int *tile, int tile_width, int start, int groups,
+			unsigned char *out)
+{
+  int p = start;
+  int g;
+  for (g = 0; g < groups; g++)
+    {
+      const int *t = GROUP_THRESHOLDS(tile, tile_width, p);
+      __m128i v = _mm_loadu_si128((const __m128i *) (raw + g * 8));
+      __m256i th = _mm256_loadu_si256((const __m256i *) t);
+      v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+      v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+      v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+      out[g] = ~_mm256_movemask_ps(_mm256_castsi256_ps
+				   (_mm256_cmpgt_epi32
+				    (th, _mm256_cvtepu16_epi32(v))));
+      NEXT_GROUP(p, tile_width);
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+threshold_row_avx2(const unsigned short *raw, int stride, const int *tile,
+		   int tile_width, int start, int groups, unsigned char *out)
+{
+  const __m256i low_half = _mm256_set1_epi32(0xffff);
+  const __m256i offsets =
+    _mm256_set_epi32(0, stride, 2 * stride, 3 * stride, 4 * stride,
+		     5 * stride, 6 * stride, 7 * stride);
+  int p = start;
+  int g;
+  /*
+   * The gather loads 32 bits per 16-bit sample, so it reads 2 bytes
+   * past the last sample of a group.  That is only safe if another
+   * group follows; the last group goes through the SSE2 code.
+   */
+  for (g = 0; g < groups - 1; g++)
+    {
+      const int *t = GROUP_THRESHOLDS(tile, tile_width, p);
+      __m256i v = _mm256_i32gather_epi32((const int *) (raw + g * 8 * stride),
+					 offsets, 2);
+      __m256i th = _mm256_loadu_si256((const __m256i *) t);
+      v = _mm256_and_si256(v, low_half);
+      out[g] = ~_mm256_movemask_ps(_mm256_castsi256_ps
+				   (_mm256_cmpgt_epi32(th, v)));
+      NEXT_GROUP(p, tile_width);
+    }
+  if (groups > 0)
+    threshold_row_sse2(raw + g * 8 * stride, stride, tile, tile_width, p, 1,
+		       out + g);
+}
+#endif
+
+static threshold_func_t threshold_row = threshold_row_c;
+static threshold_func_t threshold_row_unit = threshold_row_c;
+
+int
+stpi_dither_threshold_set_level(int level)
+{
+  int available = STPI_DITHER_THRESHOLD_PORTABLE;
+#ifdef USE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    available = STPI_DITHER_THRESHOLD_AVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    available = STPI_DITHER_THRESHOLD_SSE2;
+#endif
+  if (level < 0 || level > available)
+    level = available;
+  switch (level)
+    {
+#ifdef USE_X86_SIMD
+    case STPI_DITHER_THRESHOLD_AVX2:
+      threshold_row = threshold_row_avx2;
+      threshold_row_unit = threshold_row_unit_avx2;
+      break;
+    case STPI_DITHER_THRESHOLD_SSE2:
+      threshold_row = threshold_row_sse2;
+      threshold_row_unit = threshold_row_unit_sse2;
+      break;
+#endif
+    default:
+      threshold_row = threshold_row_c;
+      threshold_row_unit = threshold_row_c;
+      level = STPI_DITHER_THRESHOLD_PORTABLE;
+    }
+  return level;
+}
+
+void
+stpi_dither_threshold_init(void)
+{
+  (void) stpi_dither_threshold_set_level(-1);
+}
+
+void
+stpi_dither_threshold_free(stpi_dither_t *d)
+{
+  int i;
+  STP_SAFE_FREE(d->threshold_tiles);
+  d->threshold_matrix = NULL;
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    STP_SAFE_FREE(CHANNEL(d, i).threshold_out);
+}
+
+/*
+ * Build the tiles for every row of the dither matrix, and each
+ * channel's output scratch row.  Only the ordered and very fast dithers
+ * use them.
+ */
+void
+stpi_dither_threshold_setup(stpi_dither_t *d)
+{
+  const stp_dither_matrix_impl_t *mat = &(d->dither_matrix);
+  int x_size = mat->x_size;
+  int i, x, y;
+
+  stpi_dither_threshold_free(d);
+  if ((d->ditherfunc != stpi_dither_ordered &&
+       d->ditherfunc != stpi_dither_very_fast) ||
+      !mat->matrix || x_size < 8 || d->src_width != d->dst_width)
+    return;
+  d->threshold_tiles = stp_malloc(sizeof(int) * (x_size + 7) * mat->y_size);
+  for (y = 0; y < mat->y_size; y++)
+    {
+      const unsigned *row = mat->matrix + y * x_size;
+      int *tile = d->threshold_tiles + y * (x_size + 7);
+      for (x = 0; x < x_size + 7; x++)
+	{
+	  int where = x_size + 6 - x;
+	  unsigned point = row[where >= x_size ? where - x_size : where];
+	  tile[x] = point == 0 ? 1 : (point > 65536 ? 65536 : point);
+	}
+    }
+  d->threshold_matrix = mat->matrix;
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    CHANNEL(d, i).threshold_out = stp_malloc((d->dst_width + 7) / 8);
+}
+
+int
+stpi_dither_threshold_usable(const stpi_dither_t *d,
+			     const unsigned char *mask, int first, int last)
+{
+  int i;
+  if (mask || d->src_width != d->dst_width || !d->threshold_tiles)
+    return 0;
+  for (i = first; i < last; i++)
+    {
+      const stp_dither_matrix_impl_t *mat = &(CHANNEL(d, i).dithermat);
+      if (!CHANNEL(d, i).threshold_out ||
+	  mat->matrix != d->threshold_matrix ||
+	  mat->x_size != d->dither_matrix.x_size ||
+	  mat->y_size != d->dither_matrix.y_size)
+	return 0;
+    }
+  return 1;
+}
+
+void
+stpi_dither_threshold_channel(stpi_dither_t *d, int channel,
+			      const unsigned short *raw, unsigned bits,
+			      int length)
+{
+  stpi_dither_channel_t *dc = &(CHANNEL(d, channel));
+  const stp_dither_matrix_impl_t *mat = &(dc->dithermat);
+  int x_size = mat->x_size;
+  const int *tile =
+    d->threshold_tiles + mat->last_y_mod / x_size * (x_size + 7);
+  int width = d->dst_width;
+  int stride = d->pixel_step;
+  int groups = width / 8;
+  int g_start = d->span_start / 8;
+  int g_end = (d->span_end + 7) / 8;
+  int first = -1;
+  int last = -1;
+  unsigned char *out = dc->threshold_out;
+  int start;
+  int x, g, j;
+
+  if (!dc->ptr || !bits)
+    return;
+  raw += channel * d->channel_step;
+
+  /* Only the groups that the span of the row with ink touches */
+  start = (mat->x_offset + g_start * 8) % x_size;
+  if (g_start < groups)
+    (stride == 1 ? threshold_row_unit : threshold_row)
+      (raw + g_start * 8 * stride, stride, tile, x_size, start,
+       (g_end < groups ? g_end : groups) - g_start, out + g_start);
+  if (groups < g_end)
+    {
+      const int *t =
+	GROUP_THRESHOLDS(tile, x_size, (mat->x_offset + groups * 8) % x_size);
+      unsigned char byte = 0;
+      for (x = groups * 8; x < width; x++)
+	if ((int) raw[x * stride] >= t[7 - (x & 7)])
+	  byte |= 128 >> (x & 7);
+      out[groups] = byte;
+    }
+
+  for (g = g_start; g < g_end; g++)
+    {
+      if (out[g])
+	{
+	  unsigned char *tptr = dc->ptr + g;
+	  if (first < 0)
+	    first = g;
+	  last = g;
+	  for (j = 1; j <= bits; j += j, tptr += length)
+	    {
+	      if (j & bits)
+		tptr[0] |= out[g];
+	    }
+	}
+    }
+
+  if (first >= 0)
+    {
+      unsigned char byte = out[first];
+      x = first * 8;
+      while (!(byte & 128))
+	{
+	  byte <<= 1;
+	  x++;
+	}
+      if (dc->row_ends[0] == -1)
+	dc->row_ends[0] = x;
+      byte = out[last];
+      x = last * 8 + 7;
+      while (!(byte & 1))
+	{
+	  byte >>= 1;
+	  x--;
+	}
+      dc->row_ends[1] = x;
+    }
+}
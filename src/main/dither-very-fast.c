@@ -37,12 +37,12 @@
 static inline void
 print_color_very_fast(const stpi_dither_t *d, stpi_dither_channel_t *dc,
 		      int val, int x, int y, unsigned char bit,
-		      unsigned bits, int length)
+		      unsigned bits, int ptr_offset, int length)
 {
   int j;
   if (bits && val >= ditherpoint(d, &(dc->dithermat), x))
     {
-      unsigned char *tptr = dc->ptr + d->ptr_offset;
+      unsigned char *tptr = dc->ptr + ptr_offset;
 
       /*
        * Lay down all of the bits in the pixel.
@@ -56,80 +56,129 @@ print_color_very_fast(const stpi_dither_t *d, stpi_dither_channel_t *dc,
     }
 }
 
-void
-stpi_dither_very_fast(stp_vars_t *v,
-		      int row,
-		      const unsigned short *raw,
-		      int duplicate_line,
-		      int zero_mask,
-		      const unsigned char *mask)
+typedef struct
 {
-  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
-  int		x,
-		length;
-  unsigned char *bit_patterns;
+  stpi_dither_t *d;
+  int row;
+  const unsigned short *raw;
+  const unsigned char *mask;
+  int length;
+  const unsigned char *bit_patterns;
+  int one_bit_only;
+} very_fast_row_t;
+
+static void
+very_fast_dither_channels(const very_fast_row_t *r, int first, int last)
+{
+  stpi_dither_t *d = r->d;
+  const unsigned short *raw;
+  const unsigned char *mask = r->mask;
+  stpi_dither_cursor_t cursor;
+  int		x;
   unsigned char	bit;
   int i;
-  int one_bit_only = 1;
 
   int xerror, xstep, xmod;
+  const int cstep = d->channel_step;
 
-  if ((zero_mask & ((1 << CHANNEL_COUNT(d)) - 1)) ==
-      ((1 << CHANNEL_COUNT(d)) - 1))
-    return;
-
-  length = (d->dst_width + 7) / 8;
-
-  bit = 128;
-  xstep  = CHANNEL_COUNT(d) * (d->src_width / d->dst_width);
+  xstep  = d->pixel_step * (d->src_width / d->dst_width);
   xmod   = d->src_width % d->dst_width;
-  xerror = 0;
+  raw = stpi_dither_seek(d, d->span_start, r->raw, &cursor, &bit, &xerror);
 
-  bit_patterns = stp_zalloc(sizeof(unsigned char) * CHANNEL_COUNT(d));
-  for (i = 0; i < CHANNEL_COUNT(d); i++)
+  if (stpi_dither_threshold_usable(d, mask, first, last))
     {
-      stpi_dither_channel_t *dc = &(CHANNEL(d, i));
-      if (dc->nlevels > 0)
-	bit_patterns[i] = dc->ranges[dc->nlevels - 1].upper->bits;
-      if (bit_patterns[i] != 1)
-	one_bit_only = 0;
+      for (i = first; i < last; i++)
+	stpi_dither_threshold_channel(d, i, r->raw, r->bit_patterns[i],
+				      r->length);
     }
-  if (one_bit_only)
+  else if (r->one_bit_only)
     {
-      for (x = 0; x < d->dst_width; x ++)
+      for (x = d->span_start; x < d->span_end; x ++)
 	{
-	  if (!mask || (*(mask + d->ptr_offset) & bit))
+	  if (!mask || (*(mask + cursor.ptr_offset) & bit))
 	    {
-	      for (i = 0; i < CHANNEL_COUNT(d); i++)
+	      for (i = first; i < last; i++)
 		{
-		  if (raw[i] &&
-		      raw[i] >= ditherpoint(d, &(CHANNEL(d, i).dithermat), x))
+		  if (raw[i * cstep] &&
+		      raw[i * cstep] >= ditherpoint(d, &(CHANNEL(d, i).dithermat),
+						    x))
 		    {
 		      set_row_ends(&(CHANNEL(d, i)), x);
-		      CHANNEL(d, i).ptr[d->ptr_offset] |= bit;
+		      CHANNEL(d, i).ptr[cursor.ptr_offset] |= bit;
 		    }
 		}
 	    }
-	  ADVANCE_UNIDIRECTIONAL(d, bit, raw, CHANNEL_COUNT(d),
+	  ADVANCE_UNIDIRECTIONAL(&cursor, bit, raw, d->pixel_step,
 				 xerror, xstep, xmod);
 	}
     }
   else
     {
-      for (x = 0; x < d->dst_width; x ++)
+      for (x = d->span_start; x < d->span_end; x ++)
 	{
-	  if (!mask || (*(mask + d->ptr_offset) & bit))
+	  if (!mask || (*(mask + cursor.ptr_offset) & bit))
 	    {
-	      for (i = 0; i < CHANNEL_COUNT(d); i++)
+	      for (i = first; i < last; i++)
 		{
-		  if (CHANNEL(d, i).ptr && raw[i])
-		    print_color_very_fast(d, &(CHANNEL(d, i)), raw[i], x, row,
-					  bit, bit_patterns[i], length);
+		  if (CHANNEL(d, i).ptr && raw[i * cstep])
+		    print_color_very_fast(d, &(CHANNEL(d, i)), raw[i * cstep],
+					  x, r->row, bit, r->bit_patterns[i],
+					  cursor.ptr_offset, r->length);
 		}
 	    }
-	  ADVANCE_UNIDIRECTIONAL(d, bit, raw, CHANNEL_COUNT(d),
+	  ADVANCE_UNIDIRECTIONAL(&cursor, bit, raw, d->pixel_step,
 				 xerror, xstep, xmod);
 	}
     }
+}
+
+static void
+very_fast_dither_band(void *data, int band)
+{
+  const very_fast_row_t *r = (const very_fast_row_t *) data;
+  very_fast_dither_channels(r, r->d->band_start[band],
+			    r->d->band_start[band + 1]);
+}
+
+void
+stpi_dither_very_fast(stp_vars_t *v,
+		      int row,
+		      const unsigned short *raw,
+		      int duplicate_line,
+		      int zero_mask,
+		      const unsigned char *mask)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  unsigned char *bit_patterns;
+  very_fast_row_t r;
+  int i;
+  int bands;
+
+  if ((zero_mask & ((1 << CHANNEL_COUNT(d)) - 1)) ==
+      ((1 << CHANNEL_COUNT(d)) - 1))
+    return;
+
+  r.one_bit_only = 1;
+  bit_patterns = stp_zalloc(sizeof(unsigned char) * CHANNEL_COUNT(d));
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    {
+      stpi_dither_channel_t *dc = &(CHANNEL(d, i));
+      if (dc->nlevels > 0)
+	bit_patterns[i] = dc->ranges[dc->nlevels - 1].upper->bits;
+      if (bit_patterns[i] != 1)
+	r.one_bit_only = 0;
+    }
+
+  r.d = d;
+  r.row = row;
+  r.raw = raw;
+  r.mask = mask;
+  r.length = (d->dst_width + 7) / 8;
+  r.bit_patterns = bit_patterns;
+  bands = stpi_dither_channel_bands(d);
+  if (bands > 1)
+    stpi_worker_pool_run(d->pool, very_fast_dither_band, &r, bands);
+  else
+    very_fast_dither_channels(&r, 0, CHANNEL_COUNT(d));
   stp_free(bit_patterns);
 }
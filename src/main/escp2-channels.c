@@ -408,8 +408,7 @@ load_inkgroup(const char *name)
     {
       const char *dn = (const char *) stp_list_item_get_data(item);
       char *ffn = stpi_path_merge(dn, name);
-      stp_mxml_node_t *inkgroup =
-	stp_mxmlLoadFromFile(NULL, ffn, STP_MXML_NO_CALLBACK);
+      stp_mxml_node_t *inkgroup = stpi_xml_load_file(ffn);
       stp_free(ffn);
       if (inkgroup)
 	{
@@ -82,6 +82,14 @@ static const stp_parameter_t the_parameters[] =
     STP_PARAMETER_TYPE_INT, STP_PARAMETER_CLASS_CORE,
     STP_PARAMETER_LEVEL_BASIC, 0, 1, STP_CHANNEL_NONE, 1, 0
   },
+  {
+    "RenderPipeline", N_("Pipelined Rendering"), "Color=No,Category=Job Mode",
+    N_("Convert, dither, and write out successive rows at the same time, "
+       "each step on a thread of its own.  "
+       "The output is identical either way."),
+    STP_PARAMETER_TYPE_BOOLEAN, STP_PARAMETER_CLASS_OUTPUT,
+    STP_PARAMETER_LEVEL_INTERNAL, 0, 1, STP_CHANNEL_NONE, 1, 0
+  },
 };
 
 static const int the_parameter_count =
@@ -253,5 +261,9 @@ stpi_describe_generic_parameter(const stp_vars_t *v, const char *name,
       description->bounds.integer.lower = 0;
       description->bounds.integer.upper = INT_MAX;
     }
+  else if (strcmp(name, "RenderPipeline") == 0)
+    {
+      description->deflt.boolean = 0;
+    }
 }
 
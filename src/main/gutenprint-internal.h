@@ -52,8 +52,21 @@ extern "C" {
 
 extern void stpi_init_paper(void);
 extern void stpi_init_dither(void);
+extern void stpi_init_color_kernels(void);
+extern void stpi_init_pack_kernels(void);
+extern void stpi_init_bit_kernels(void);
 extern void stpi_init_printer(void);
 extern void stpi_vars_print_error(const stp_vars_t *v, const char *prefix);
+extern void stpi_vars_output(const stp_vars_t *v, const char *data,
+			     size_t bytes);
+extern int stpi_vars_settings_equal(const stp_vars_t *a, const stp_vars_t *b,
+				    const char *ignore);
+extern stp_vars_t *stpi_vars_create_shared_copy(const stp_vars_t *vs);
+extern int stpi_verify_settings(stp_vars_t *v);
+extern stp_session_t *stpi_get_session(const stp_vars_t *v);
+extern void *stpi_session_get_data(const stp_vars_t *v, const char *name);
+extern void stpi_session_set_data(const stp_vars_t *v, const char *name,
+				  void *data, stp_free_data_func_t freefunc);
 #define BUFFER_FLAG_FLIP_X	0x1
 #define BUFFER_FLAG_FLIP_Y	0x2
 extern stp_image_t* stpi_buffer_image(stp_image_t* image, unsigned int flags);
@@ -76,6 +89,170 @@ do									\
 
 /** @} */
 
+/**
+ * Worker thread pool (internal).
+ *
+ * @defgroup worker_pool_internal worker-pool-internal
+ * @{
+ */
+
+typedef struct stpi_worker_pool stpi_worker_pool_t;
+typedef void (*stpi_worker_func_t)(void *data, int task);
+
+extern stpi_worker_pool_t *stpi_worker_pool_create(int threads);
+extern void stpi_worker_pool_destroy(stpi_worker_pool_t *pool);
+extern int stpi_worker_pool_get_threads(const stpi_worker_pool_t *pool);
+extern void stpi_worker_pool_run(stpi_worker_pool_t *pool,
+				 stpi_worker_func_t func, void *data,
+				 int tasks);
+extern void stpi_worker_pool_post(stpi_worker_pool_t *pool, int *counter,
+				  int value);
+extern void stpi_worker_pool_wait(stpi_worker_pool_t *pool,
+				  const int *counter, int value);
+
+/** @} */
+
+/**
+ * Channel conversion (internal).
+ *
+ * @defgroup channel_internal channel-internal
+ * @{
+ */
+
+extern int stpi_channel_get_ink_extent(const stp_vars_t *v,
+				       int *first, int *last);
+extern void stpi_channel_set_planar(stp_vars_t *v, int planar);
+extern const unsigned short *
+stpi_channel_get_planar_output(const stp_vars_t *v);
+extern void stpi_channel_get_row_sizes(const stp_vars_t *v,
+				       size_t *input, size_t *output);
+
+/** @} */
+
+/**
+ * Stages of row rendering (internal).
+ *
+ * @defgroup render_internal render-internal
+ * @{
+ */
+
+typedef int (*stpi_color_convert_row_func_t)(stp_vars_t *v,
+					     stp_image_t *image, int row,
+					     unsigned short *out,
+					     unsigned *zero_mask);
+
+extern stpi_color_convert_row_func_t
+stpi_color_get_convert_row(const stp_vars_t *v);
+extern const unsigned short *stpi_dither_get_input(const stp_vars_t *v,
+						   int *planar);
+extern void stpi_dither_row(stp_vars_t *v, int row,
+			    const unsigned short *input, int planar,
+			    int first, int last, int duplicate_line,
+			    int zero_mask, const unsigned char *mask);
+extern void stpi_dither_divert_output(stp_vars_t *v, stp_vars_t *output);
+extern void stpi_dither_restore_output(stp_vars_t *v, stp_vars_t *output);
+extern size_t stpi_dither_get_row_size(const stp_vars_t *v);
+extern void stpi_dither_save_row(const stp_vars_t *v, unsigned char *row);
+extern void stpi_dither_load_row(const stp_vars_t *v,
+				 const unsigned char *row);
+
+typedef const unsigned char *(*stpi_render_mask_func_t)(stp_vars_t *v,
+							 int row, void *data);
+typedef void (*stpi_render_output_func_t)(stp_vars_t *v, int row,
+					  void *data);
+
+extern int stpi_render_rows(stp_vars_t *v, stp_image_t *image, int rows,
+			    stpi_render_mask_func_t mask,
+			    stpi_render_output_func_t output, void *data);
+
+/** @} */
+
+/**
+ * Color conversion row kernels (internal).
+ *
+ * @defgroup color_kernels_internal color-kernels-internal
+ * @{
+ */
+
+#define STPI_COLOR_KERNELS_PORTABLE 0
+#define STPI_COLOR_KERNELS_SSE2 1
+#define STPI_COLOR_KERNELS_AVX2 2
+
+extern int stpi_color_kernels_set_level(int level);
+extern void stpi_color_scale_row(const void *in, int bits,
+				 unsigned multiplier, unsigned short mask,
+				 size_t count, unsigned short *out);
+extern void stpi_color_lookup_row(unsigned short *data, size_t pixels,
+				  int channels,
+				  const unsigned short *const *tables,
+				  int divide);
+extern void stpi_color_threshold_row(const void *in, int bits, int invert,
+				     size_t count, unsigned short *out);
+extern unsigned stpi_color_nonzero_channels(const unsigned short *data,
+					    size_t pixels, int channels);
+
+/** @} */
+
+/**
+ * Run-length packing kernels (internal).
+ *
+ * @defgroup pack_kernels_internal pack-kernels-internal
+ * @{
+ */
+
+#define STPI_PACK_KERNELS_PORTABLE 0
+#define STPI_PACK_KERNELS_SSE2 1
+#define STPI_PACK_KERNELS_AVX2 2
+
+extern int stpi_pack_kernels_set_level(int level);
+
+/** @} */
+
+/**
+ * Bit plane fold and unpack kernels (internal).
+ *
+ * @defgroup bit_kernels_internal bit-kernels-internal
+ * @{
+ */
+
+#define STPI_BIT_KERNELS_PORTABLE 0
+#define STPI_BIT_KERNELS_SSE2 1
+#define STPI_BIT_KERNELS_AVX2 2	/* AVX2 and BMI2 */
+
+extern int stpi_bit_kernels_set_level(int level);
+
+/** @} */
+
+/**
+ * Ordered dither threshold kernels (internal).
+ *
+ * @defgroup dither_threshold_internal dither-threshold-internal
+ * @{
+ */
+
+#define STPI_DITHER_THRESHOLD_PORTABLE 0
+#define STPI_DITHER_THRESHOLD_SSE2 1
+#define STPI_DITHER_THRESHOLD_AVX2 2
+
+extern int stpi_dither_threshold_set_level(int level);
+
+/** @} */
+
+/**
+ * Precompiled XML data (internal).
+ *
+ * @defgroup xmldb_internal xmldb-internal
+ * @{
+ */
+
+#define XMLDB_NAME "gutenprint-xml.db"
+
+extern stp_mxml_node_t *stpi_xml_load_file(const char *file);
+extern int stpi_xmldb_write(const char *db_file, const char *directory,
+			    int count, const char **files);
+
+/** @} */
+
 #define CAST_IS_SAFE GCC_DIAG_OFF(cast-qual)
 #define CAST_IS_UNSAFE GCC_DIAG_ON(cast-qual)
 
@@ -60,6 +60,17 @@ stp_image_get_row(stp_image_t *image, unsigned char *data,
   return image->get_row(image, data, byte_limit, row);
 }
 
+stp_image_status_t
+stp_image_get_row_ptr(stp_image_t *image, const unsigned char **data,
+		      size_t byte_limit, int row)
+{
+  *data = NULL;
+  if (image->get_row_ptr)
+    return image->get_row_ptr(image, data, byte_limit, row);
+  else
+    return STP_IMAGE_STATUS_OK;
+}
+
 const char *
 stp_image_get_appname(stp_image_t *image)
 {
@@ -27,6 +27,7 @@
 
 #include <gutenprint/mxml.h>
 #include "config.h"
+#include "mxml-private.h"
 
 
 /*
@@ -107,6 +108,13 @@ stp_mxmlElementSetAttr(stp_mxml_node_t *node,	/* I - Element node */
       * Replace the attribute value and return...
       */
 
+      if (node->arena)
+      {
+        attr->value = stpi_mxml_arena_strdup(node->arena, value,
+					     strlen(value));
+        return;
+      }
+
       free(attr->value);
 
       attr->value = strdup(value);
@@ -115,9 +123,37 @@ stp_mxmlElementSetAttr(stp_mxml_node_t *node,	/* I - Element node */
     }
 
  /*
-  * Attribute not found, so add a new one...
+  * Attribute not found, so add a new one...  Arena nodes cannot free or
+  * grow their attribute array, so it is copied into a bigger one.
   */
 
+  if (node->arena)
+  {
+    if ((attr = stpi_mxml_arena_alloc(node->arena,
+				      (node->value.element.num_attrs + 1) *
+				      sizeof(stp_mxml_attr_t))) == NULL)
+    {
+      fprintf(stderr, "Unable to allocate memory for attribute '%s' in element %s!\n",
+              name, node->value.element.name);
+      return;
+    }
+
+    if (node->value.element.num_attrs)
+      memcpy(attr, node->value.element.attrs,
+             node->value.element.num_attrs * sizeof(stp_mxml_attr_t));
+
+    node->value.element.attrs = attr;
+    attr += node->value.element.num_attrs;
+
+    attr->name  = stpi_mxml_arena_strdup(node->arena, name, strlen(name));
+    attr->value = stpi_mxml_arena_strdup(node->arena, value, strlen(value));
+
+    if (attr->name && attr->value)
+      node->value.element.num_attrs ++;
+
+    return;
+  }
+
   if (node->value.element.num_attrs == 0)
     attr = malloc(sizeof(stp_mxml_attr_t));
   else
@@ -23,11 +23,15 @@
  *   stp_mxmlSaveAllocString() - Save an XML node tree to an allocated string.
  *   stp_mxmlSaveFile()        - Save an XML tree to a file.
  *   stp_mxmlSaveString()      - Save an XML node tree to a string.
+ *   mxml_add_attr()       - Collect an attribute of an arena element.
  *   mxml_add_char()       - Add a character to a buffer, expanding as needed.
- *   mxml_file_getc()      - Get a character from a file.
+ *   mxml_add_span()       - Add several characters to a buffer.
+ *   mxml_intern()         - Find or add a name in the document's arena.
  *   mxml_load_data()      - Load data into an XML node tree.
+ *   mxml_new_element()    - Create an element node while loading.
  *   mxml_parse_element()  - Parse an element for any attributes...
- *   mxml_string_getc()    - Get a character from a string.
+ *   mxml_read_file()      - Read the rest of a file into memory.
+ *   mxml_set_attrs()      - Store the attributes of an arena element.
  *   mxml_write_node()     - Save an XML node to a file.
  *   mxml_write_string()   - Write a string, escaping & and < as needed.
  *   mxml_write_ws()       - Do whitespace callback...
@@ -39,23 +43,63 @@
 
 #include <gutenprint/mxml.h>
 #include "config.h"
+#include "mxml-private.h"
+#include <sys/types.h>
+#include <sys/stat.h>
 #define MXML_BUFSIZE (64)
 #define ENTITY_BUFSIZE (64)
 
+
+/*
+ * Loader state...
+ *
+ * Documents are parsed from memory: files are read in one piece first.
+ * A document loaded without a top node gets its own arena; element and
+ * attribute names are stored in it once and shared between nodes.
+ */
+
+typedef struct mxml_load_s		/**** Document being loaded ****/
+{
+  const unsigned char	*ptr,		/* Next character */
+			*end;		/* End of data */
+  stp_mxml_arena_t	*arena;		/* Arena for new nodes or NULL */
+  char			**names;	/* Hash table of interned names */
+  size_t		num_names,	/* Number of interned names */
+			names_size;	/* Size of hash table */
+  char			*name,		/* Attribute name buffer */
+			*value;		/* Attribute value buffer */
+  int			namesize,	/* Size of name buffer */
+			valsize;	/* Size of value buffer */
+  stp_mxml_attr_t	*attrs;		/* Attributes of an arena element */
+  int			num_attrs,	/* Number of attributes */
+			attrs_size;	/* Size of attribute array */
+} mxml_load_t;
+
+#define mxml_getc(ld)	((ld)->ptr < (ld)->end ? *((ld)->ptr)++ : EOF)
+
+
 /*
  * Local functions...
  */
 
+static int		mxml_add_attr(mxml_load_t *ld, const char *name,
+				      const char *value);
 static int		mxml_add_char(int ch, char **ptr, char **buffer,
 			              int *bufsize);
-static int		mxml_file_getc(void *p);
+static int		mxml_add_span(const unsigned char *s, size_t length,
+				      char **ptr, char **buffer, int *bufsize);
 static int		mxml_file_putc(int ch, void *p);
-static stp_mxml_node_t	*mxml_load_data(stp_mxml_node_t *top, void *p,
-			                stp_mxml_type_t (*cb)(stp_mxml_node_t *),
-			                int (*getc_cb)(void *));
-static int		mxml_parse_element(stp_mxml_node_t *node, void *p,
-			                   int (*getc_cb)(void *));
-static int		mxml_string_getc(void *p);
+static char		*mxml_intern(mxml_load_t *ld, const char *s);
+static stp_mxml_node_t	*mxml_load_data(stp_mxml_node_t *top, const char *data,
+					size_t length,
+			                stp_mxml_type_t (*cb)(stp_mxml_node_t *));
+static stp_mxml_node_t	*mxml_new_element(mxml_load_t *ld,
+					  stp_mxml_node_t *parent,
+					  const char *name, int intern);
+static int		mxml_parse_element(stp_mxml_node_t *node,
+					   mxml_load_t *ld);
+static char		*mxml_read_file(FILE *fp, size_t *length);
+static int		mxml_set_attrs(stp_mxml_node_t *node, mxml_load_t *ld);
 static int		mxml_string_putc(int ch, void *p);
 static int		mxml_write_node(stp_mxml_node_t *node, void *p,
 			                int (*cb)(stp_mxml_node_t *, int),
@@ -85,7 +129,19 @@ stp_mxmlLoadFile(stp_mxml_node_t *top,		/* I - Top node */
              stp_mxml_type_t (*cb)(stp_mxml_node_t *))
 					/* I - Callback function or STP_MXML_NO_CALLBACK */
 {
-  return (mxml_load_data(top, fp, cb, mxml_file_getc));
+  char			*data;		/* Contents of the file */
+  size_t		length;		/* Length of the file */
+  stp_mxml_node_t	*node;		/* Loaded node */
+
+
+  if ((data = mxml_read_file(fp, &length)) == NULL)
+    return (NULL);
+
+  node = mxml_load_data(top, data, length, cb);
+
+  free(data);
+
+  return (node);
 }
 
 /*
@@ -132,7 +188,7 @@ stp_mxmlLoadString(stp_mxml_node_t *top,	/* I - Top node */
                stp_mxml_type_t (*cb)(stp_mxml_node_t *))
 					/* I - Callback function or STP_MXML_NO_CALLBACK */
 {
-  return (mxml_load_data(top, &s, cb, mxml_string_getc));
+  return (mxml_load_data(top, s, strlen(s), cb));
 }
 
 
@@ -298,6 +354,64 @@ stp_mxmlSaveString(stp_mxml_node_t *node,	/* I - Node to write */
 }
 
 
+/*
+ * 'mxml_add_attr()' - Collect an attribute of an arena element.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+mxml_add_attr(mxml_load_t *ld,		/* I - Loader state */
+              const char  *name,	/* I - Attribute name */
+	      const char  *value)	/* I - Attribute value */
+{
+  int			i;		/* Looping var */
+  char			*shared;	/* Interned name */
+  stp_mxml_attr_t	*attr;		/* New attribute */
+
+
+  if ((shared = mxml_intern(ld, name)) == NULL)
+    return (-1);
+
+ /*
+  * A repeated attribute replaces the earlier value, as with
+  * stp_mxmlElementSetAttr()...
+  */
+
+  for (i = 0, attr = ld->attrs; i < ld->num_attrs; i ++, attr ++)
+    if (attr->name == shared)
+      break;
+
+  if (i == ld->num_attrs)
+  {
+    if (ld->num_attrs == ld->attrs_size)
+    {
+      ld->attrs_size = ld->attrs_size ? ld->attrs_size * 2 : 16;
+
+      if ((attr = realloc(ld->attrs, ld->attrs_size *
+				     sizeof(stp_mxml_attr_t))) == NULL)
+      {
+	fprintf(stderr, "Unable to allocate memory for attribute '%s'!\n",
+		name);
+	return (-1);
+      }
+
+      ld->attrs = attr;
+    }
+
+    attr       = ld->attrs + ld->num_attrs;
+    attr->name = shared;
+  }
+
+  if ((attr->value = stpi_mxml_arena_strdup(ld->arena, value,
+					    strlen(value))) == NULL)
+    return (-1);
+
+  if (i == ld->num_attrs)
+    ld->num_attrs ++;
+
+  return (0);
+}
+
+
 /*
  * 'mxml_add_char()' - Add a character to a buffer, expanding as needed.
  */
@@ -324,8 +438,6 @@ mxml_add_char(int  ch,			/* I  - Character to add */
 
     if ((newbuffer = realloc(*buffer, *bufsize)) == NULL)
     {
-      free(*buffer);
-
       fprintf(stderr, "Unable to expand string buffer to %d bytes!\n",
 	      *bufsize);
 
@@ -343,13 +455,47 @@ mxml_add_char(int  ch,			/* I  - Character to add */
 
 
 /*
- * 'mxml_file_getc()' - Get a character from a file.
+ * 'mxml_add_span()' - Add several characters to a buffer.
  */
 
-static int				/* O - Character or EOF */
-mxml_file_getc(void *p)			/* I - Pointer to file */
+static int				/* O  - 0 on success, -1 on error */
+mxml_add_span(const unsigned char *s,	/* I  - Characters to add */
+	      size_t length,		/* I  - Number of characters */
+	      char **bufptr,		/* IO - Current position in buffer */
+	      char **buffer,		/* IO - Current buffer */
+	      int  *bufsize)		/* IO - Current buffer size */
 {
-  return (getc((FILE *)p));
+  char	*newbuffer;			/* New buffer value */
+  int	used;				/* Bytes in use */
+
+
+  used = *bufptr - *buffer;
+
+  if (used + length >= (size_t) *bufsize)
+  {
+   /*
+    * Increase the size of the buffer...
+    */
+
+    while (used + length >= (size_t) *bufsize)
+      (*bufsize) *= 2;
+
+    if ((newbuffer = realloc(*buffer, *bufsize)) == NULL)
+    {
+      fprintf(stderr, "Unable to expand string buffer to %d bytes!\n",
+	      *bufsize);
+
+      return (-1);
+    }
+
+    *bufptr = newbuffer + used;
+    *buffer = newbuffer;
+  }
+
+  memcpy(*bufptr, s, length);
+  *bufptr += length;
+
+  return (0);
 }
 
 
@@ -365,17 +511,86 @@ mxml_file_putc(int  ch,			/* I - Character to write */
 }
 
 
+/*
+ * 'mxml_intern()' - Find or add a name in the document's arena.
+ *
+ * Names are kept in an open hash table, which is doubled whenever it
+ * gets half full.
+ */
+
+static char *				/* O - Shared copy of the name or NULL */
+mxml_intern(mxml_load_t *ld,		/* I - Loader state */
+            const char  *s)		/* I - Name */
+{
+  const unsigned char	*ptr;		/* Pointer into name */
+  unsigned		hash;		/* Hash of name */
+  size_t		i,		/* Looping var */
+			mask;		/* Hash table mask */
+  char			**names;	/* New hash table */
+
+
+  if (ld->num_names >= ld->names_size / 2)
+  {
+    size_t	size = ld->names_size ? ld->names_size * 2 : 256;
+					/* Size of new table */
+
+
+    if ((names = calloc(size, sizeof(char *))) == NULL)
+    {
+      fputs("Unable to allocate name table!\n", stderr);
+      return (NULL);
+    }
+
+    for (i = 0; i < ld->names_size; i ++)
+      if (ld->names[i])
+      {
+        size_t j;			/* Slot in new table */
+
+
+	for (hash = 2166136261u, ptr = (const unsigned char *)ld->names[i];
+	     *ptr; ptr ++)
+	  hash = (hash ^ *ptr) * 16777619u;
+
+	for (j = hash & (size - 1); names[j]; j = (j + 1) & (size - 1));
+
+	names[j] = ld->names[i];
+      }
+
+    free(ld->names);
+
+    ld->names      = names;
+    ld->names_size = size;
+  }
+
+  for (hash = 2166136261u, ptr = (const unsigned char *)s; *ptr; ptr ++)
+    hash = (hash ^ *ptr) * 16777619u;
+
+  mask = ld->names_size - 1;
+
+  for (i = hash & mask; ld->names[i]; i = (i + 1) & mask)
+    if (!strcmp(ld->names[i], s))
+      return (ld->names[i]);
+
+  if ((ld->names[i] = stpi_mxml_arena_strdup(ld->arena, s,
+					     (const char *)ptr - s)) == NULL)
+    return (NULL);
+
+  ld->num_names ++;
+
+  return (ld->names[i]);
+}
+
+
 /*
  * 'mxml_load_data()' - Load data into an XML node tree.
  */
 
 static stp_mxml_node_t *			/* O - First node or NULL if the file could not be read. */
 mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
-               void        *p,		/* I - Pointer to data */
-               stp_mxml_type_t (*cb)(stp_mxml_node_t *),
+               const char  *data,	/* I - Data to load */
+               size_t      length,	/* I - Length of data */
+               stp_mxml_type_t (*cb)(stp_mxml_node_t *))
 					/* I - Callback function or STP_MXML_NO_CALLBACK */
-               int         (*getc_cb)(void *))
-					/* I - Read function */
 {
   stp_mxml_node_t	*node,			/* Current node */
 		*parent;		/* Current parent node */
@@ -385,7 +600,28 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
 		*bufptr;		/* Pointer into buffer */
   int		bufsize;		/* Size of buffer */
   stp_mxml_type_t	type;			/* Current node type */
+  mxml_load_t	load,			/* Loader state */
+		*ld;			/* Pointer to loader state */
+  const unsigned char *start;		/* Start of a run of characters */
+
+
+ /*
+  * Nodes go into the top node's arena, if it has one, or into a new
+  * arena for a new document...
+  */
 
+  ld = &load;
+  memset(ld, 0, sizeof(load));
+  ld->ptr = (const unsigned char *)data;
+  ld->end = ld->ptr + length;
+
+  if (top)
+    ld->arena = top->arena;
+  else if ((ld->arena = stpi_mxml_arena_create(length * 3)) == NULL)
+  {
+    fputs("Unable to allocate document arena!\n", stderr);
+    return (NULL);
+  }
 
  /*
   * Read elements and other nodes from the file...
@@ -394,6 +630,8 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
   if ((buffer = malloc(MXML_BUFSIZE)) == NULL)
   {
     fputs("Unable to allocate string buffer!\n", stderr);
+    if (!top)
+      stpi_mxml_arena_destroy(ld->arena);
     return (NULL);
   }
 
@@ -407,7 +645,7 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
   else
     type = STP_MXML_TEXT;
 
-  while ((ch = (*getc_cb)(p)) != EOF)
+  while ((ch = mxml_getc(ld)) != EOF)
   {
     if ((ch == '<' || (isspace(ch) && type != STP_MXML_OPAQUE)) && bufptr > buffer)
     {
@@ -488,12 +726,12 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
 
       bufptr = buffer;
 
-      while ((ch = (*getc_cb)(p)) != EOF)
+      while ((ch = mxml_getc(ld)) != EOF)
         if (isspace(ch) || ch == '>' || (ch == '/' && bufptr > buffer))
 	  break;
 	else if (mxml_add_char(ch, &bufptr, &buffer, &bufsize))
 	{
-	  return (NULL);
+	  goto error;
 	}
 	else if ((bufptr - buffer) == 3 && !strncmp(buffer, "!--", 3))
 	  break;
@@ -506,14 +744,14 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
         * Gather rest of comment...
 	*/
 
-	while ((ch = (*getc_cb)(p)) != EOF)
+	while ((ch = mxml_getc(ld)) != EOF)
 	{
 	  if (ch == '>' && bufptr > (buffer + 4) &&
 	      !strncmp(bufptr - 2, "--", 2))
 	    break;
 	  else if (mxml_add_char(ch, &bufptr, &buffer, &bufsize))
 	  {
-	    return (NULL);
+	    goto error;
 	  }
 	}
 
@@ -530,7 +768,7 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
 
 	*bufptr = '\0';
 
-	if (!stp_mxmlNewElement(parent, buffer))
+	if (!mxml_new_element(ld, parent, buffer, 0))
 	{
 	 /*
 	  * Just print error for now...
@@ -553,10 +791,10 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
 	    break;
 	  else if (mxml_add_char(ch, &bufptr, &buffer, &bufsize))
 	  {
-	    return (NULL);
+	    goto error;
 	  }
 	}
-        while ((ch = (*getc_cb)(p)) != EOF);
+        while ((ch = mxml_getc(ld)) != EOF);
 
        /*
         * Error out if we didn't get the whole declaration...
@@ -571,7 +809,7 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
 
 	*bufptr = '\0';
 
-	node = stp_mxmlNewElement(parent, buffer);
+	node = mxml_new_element(ld, parent, buffer, 0);
 	if (!node)
 	{
 	 /*
@@ -614,7 +852,7 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
 	*/
 
         while (ch != '>' && ch != EOF)
-	  ch = (*getc_cb)(p);
+	  ch = mxml_getc(ld);
 
        /*
 	* Ascend into the parent and set the value type as needed...
@@ -631,7 +869,7 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
         * Handle open tag...
 	*/
 
-        node = stp_mxmlNewElement(parent, buffer);
+        node = mxml_new_element(ld, parent, buffer, 1);
 
 	if (!node)
 	{
@@ -645,10 +883,10 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
 	}
 
         if (isspace(ch))
-          ch = mxml_parse_element(node, p, getc_cb);
+          ch = mxml_parse_element(node, ld);
         else if (ch == '/')
 	{
-	  if ((ch = (*getc_cb)(p)) != '>')
+	  if ((ch = mxml_getc(ld)) != '>')
 	  {
 	    fprintf(stderr, "Expected > but got '%c' instead for element <%s/>!\n",
 	            ch, buffer);
@@ -690,7 +928,7 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
       entity[0] = ch;
       entptr    = entity + 1;
 
-      while ((ch = (*getc_cb)(p)) != EOF)
+      while ((ch = mxml_getc(ld)) != EOF)
         if (!isalnum(ch) && ch != '#')
 	  break;
 	else if (entptr < (entity + sizeof(entity) - 1))
@@ -743,7 +981,7 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
 
 	if (mxml_add_char(ch, &bufptr, &buffer, &bufsize))
 	{
-	  return (NULL);
+	  goto error;
 	}
       }
       else
@@ -756,45 +994,45 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
 	{
 	  if (mxml_add_char(0xc0 | (ch >> 6), &bufptr, &buffer, &bufsize))
 	  {
-	    return (NULL);
+	    goto error;
 	  }
 	  if (mxml_add_char(0x80 | (ch & 63), &bufptr, &buffer, &bufsize))
 	  {
-	    return (NULL);
+	    goto error;
 	  }
         }
 	else if (ch < 65536)
 	{
 	  if (mxml_add_char(0xe0 | (ch >> 12), &bufptr, &buffer, &bufsize))
 	  {
-	    return (NULL);
+	    goto error;
 	  }
 	  if (mxml_add_char(0x80 | ((ch >> 6) & 63), &bufptr, &buffer, &bufsize))
 	  {
-	    return (NULL);
+	    goto error;
 	  }
 	  if (mxml_add_char(0x80 | (ch & 63), &bufptr, &buffer, &bufsize))
 	  {
-	    return (NULL);
+	    goto error;
 	  }
 	}
 	else
 	{
 	  if (mxml_add_char(0xf0 | (ch >> 18), &bufptr, &buffer, &bufsize))
 	  {
-	    return (NULL);
+	    goto error;
 	  }
 	  if (mxml_add_char(0x80 | ((ch >> 12) & 63), &bufptr, &buffer, &bufsize))
 	  {
-	    return (NULL);
+	    goto error;
 	  }
 	  if (mxml_add_char(0x80 | ((ch >> 6) & 63), &bufptr, &buffer, &bufsize))
 	  {
-	    return (NULL);
+	    goto error;
 	  }
 	  if (mxml_add_char(0x80 | (ch & 63), &bufptr, &buffer, &bufsize))
 	  {
-	    return (NULL);
+	    goto error;
 	  }
 	}
       }
@@ -802,21 +1040,46 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
     else if (type == STP_MXML_OPAQUE || !isspace(ch))
     {
      /*
-      * Add character to current buffer...
+      * Add character to current buffer, along with the rest of the run
+      * of characters that would just be added one by one...
       */
 
-      if (mxml_add_char(ch, &bufptr, &buffer, &bufsize))
+      start = ld->ptr - 1;
+
+      if (type == STP_MXML_OPAQUE)
+        while (ld->ptr < ld->end && *ld->ptr != '<' && *ld->ptr != '&')
+	  ld->ptr ++;
+      else
+        while (ld->ptr < ld->end && *ld->ptr != '<' && *ld->ptr != '&' &&
+	       !isspace(*ld->ptr))
+	  ld->ptr ++;
+
+      if (mxml_add_span(start, ld->ptr - start, &bufptr, &buffer, &bufsize))
       {
-	return (NULL);
+	goto error;
       }
     }
+    else
+    {
+     /*
+      * Skip the rest of a run of whitespace, which would not change
+      * anything...
+      */
+
+      while (ld->ptr < ld->end && isspace(*ld->ptr))
+        ld->ptr ++;
+    }
   }
 
  /*
-  * Free the string buffer - we don't need it anymore...
+  * Free the string buffers - we don't need them anymore...
   */
 
   free(buffer);
+  free(ld->names);
+  free(ld->name);
+  free(ld->value);
+  free(ld->attrs);
 
  /*
   * Find the top element and return it...
@@ -828,7 +1091,76 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
       parent = parent->parent;
   }
 
+ /*
+  * A new document's arena is freed with its top element...
+  */
+
+  if (!top)
+  {
+    if (parent)
+      stpi_mxml_arena_set_owner(ld->arena, parent);
+    else
+      stpi_mxml_arena_destroy(ld->arena);
+  }
+
   return (parent);
+
+ /*
+  * Free everything and return NULL on allocation errors...
+  */
+
+error:
+
+  free(buffer);
+  free(ld->names);
+  free(ld->name);
+  free(ld->value);
+  free(ld->attrs);
+
+  if (!top)
+    stpi_mxml_arena_destroy(ld->arena);
+
+  return (NULL);
+}
+
+
+/*
+ * 'mxml_new_element()' - Create an element node while loading.
+ */
+
+static stp_mxml_node_t *			/* O - New node or NULL */
+mxml_new_element(mxml_load_t     *ld,	/* I - Loader state */
+                 stp_mxml_node_t *parent,	/* I - Parent node */
+		 const char      *name,	/* I - Element name */
+		 int             intern)	/* I - Share the name with other nodes? */
+{
+  stp_mxml_node_t	*node;			/* New node */
+
+
+  if (!ld->arena)
+    return (stp_mxmlNewElement(parent, name));
+
+  if ((node = stpi_mxml_new_node(parent, STP_MXML_ELEMENT, ld->arena)) == NULL)
+    return (NULL);
+
+ /*
+  * Tag names are few and repeat a lot; comments and declarations are
+  * copied as they are...
+  */
+
+  if (intern)
+    node->value.element.name = mxml_intern(ld, name);
+  else
+    node->value.element.name = stpi_mxml_arena_strdup(ld->arena, name,
+						      strlen(name));
+
+  if (!node->value.element.name)
+  {
+    stp_mxmlRemove(node);
+    return (NULL);
+  }
+
+  return (node);
 }
 
 
@@ -838,45 +1170,49 @@ mxml_load_data(stp_mxml_node_t *top,	/* I - Top node */
 
 static int				/* O - Terminating character */
 mxml_parse_element(stp_mxml_node_t *node,	/* I - Element node */
-                   void        *p,	/* I - Data to read from */
-                   int         (*getc_cb)(void *))
-					/* I - Data callback */
+                   mxml_load_t     *ld)	/* I - Loader state */
 {
   int	ch,				/* Current character in file */
 	quote;				/* Quoting character */
-  char	*name,				/* Attribute name */
-	*value,				/* Attribute value */
-	*ptr;				/* Pointer into name/value */
-  int	namesize,			/* Size of name string */
-	valsize;			/* Size of value string */
+  char	*ptr;				/* Pointer into name/value */
+  const unsigned char *start,		/* Start of quoted value */
+	*end;				/* End of quoted value */
 
 
  /*
-  * Initialize the name and value buffers...
+  * Initialize the name and value buffers, which are shared by all
+  * elements of the document...
   */
 
-  if ((name = malloc(MXML_BUFSIZE)) == NULL)
+  if (!ld->name)
   {
-    fputs("Unable to allocate memory for name!\n", stderr);
-    return (EOF);
-  }
+    if ((ld->name = malloc(MXML_BUFSIZE)) == NULL)
+    {
+      fputs("Unable to allocate memory for name!\n", stderr);
+      return (EOF);
+    }
 
-  namesize = MXML_BUFSIZE;
+    ld->namesize = MXML_BUFSIZE;
+  }
 
-  if ((value = malloc(MXML_BUFSIZE)) == NULL)
+  if (!ld->value)
   {
-    free(name);
-    fputs("Unable to allocate memory for value!\n", stderr);
-    return (EOF);
+    if ((ld->value = malloc(MXML_BUFSIZE)) == NULL)
+    {
+      fputs("Unable to allocate memory for value!\n", stderr);
+      return (EOF);
+    }
+
+    ld->valsize = MXML_BUFSIZE;
   }
 
-  valsize = MXML_BUFSIZE;
+  ld->num_attrs = 0;
 
  /*
   * Loop until we hit a >, /, ?, or EOF...
   */
 
-  while ((ch = (*getc_cb)(p)) != EOF)
+  while ((ch = mxml_getc(ld)) != EOF)
   {
 #ifdef DEBUG
     fprintf(stderr, "parse_element: ch='%c'\n", ch);
@@ -899,7 +1235,7 @@ mxml_parse_element(stp_mxml_node_t *node,	/* I - Element node */
       * Grab the > character and print an error if it isn't there...
       */
 
-      quote = (*getc_cb)(p);
+      quote = mxml_getc(ld);
 
       if (quote != '>')
       {
@@ -917,16 +1253,16 @@ mxml_parse_element(stp_mxml_node_t *node,	/* I - Element node */
     * Read the attribute name...
     */
 
-    name[0] = ch;
-    ptr     = name + 1;
+    ld->name[0] = ch;
+    ptr         = ld->name + 1;
 
-    while ((ch = (*getc_cb)(p)) != EOF)
+    while ((ch = mxml_getc(ld)) != EOF)
       if (isspace(ch) || ch == '=' || ch == '/' || ch == '>' || ch == '?')
         break;
-      else if (mxml_add_char(ch, &ptr, &name, &namesize))
+      else if (mxml_add_char(ch, &ptr, &ld->name, &ld->namesize))
       {
-	free(value);
-	return (EOF);
+        ch = EOF;
+	goto done;
       }
 
     *ptr = '\0';
@@ -937,32 +1273,41 @@ mxml_parse_element(stp_mxml_node_t *node,	/* I - Element node */
       * Read the attribute value...
       */
 
-      if ((ch = (*getc_cb)(p)) == EOF)
+      if ((ch = mxml_getc(ld)) == EOF)
       {
         fprintf(stderr, "Missing value for attribute '%s' in element %s!\n",
-	        name, node->value.element.name);
-	free(name);
-	free(value);
-        return (EOF);
+	        ld->name, node->value.element.name);
+        break;
       }
 
       if (ch == '\'' || ch == '\"')
       {
        /*
-        * Read quoted value...
+        * Read quoted value, which runs to the closing quote or the end
+	* of the data...
 	*/
 
         quote = ch;
-	ptr   = value;
+	ptr   = ld->value;
+	start = ld->ptr;
 
-        while ((ch = (*getc_cb)(p)) != EOF)
-	  if (ch == quote)
-	    break;
-	  else if (mxml_add_char(ch, &ptr, &value, &valsize))
-	  {
-            free(name);
-	    return (EOF);
-	  }
+	if ((end = memchr(start, quote, ld->end - start)) != NULL)
+	{
+	  ld->ptr = end + 1;
+	  ch      = quote;
+	}
+	else
+	{
+	  end     = ld->end;
+	  ld->ptr = end;
+	  ch      = EOF;
+	}
+
+	if (mxml_add_span(start, end - start, &ptr, &ld->value, &ld->valsize))
+	{
+	  ch = EOF;
+	  goto done;
+	}
 
         *ptr = '\0';
       }
@@ -972,23 +1317,23 @@ mxml_parse_element(stp_mxml_node_t *node,	/* I - Element node */
         * Read unquoted value...
 	*/
 
-	value[0] = ch;
-	ptr      = value + 1;
+	ld->value[0] = ch;
+	ptr          = ld->value + 1;
 
-	while ((ch = (*getc_cb)(p)) != EOF)
+	while ((ch = mxml_getc(ld)) != EOF)
 	  if (isspace(ch) || ch == '=' || ch == '/' || ch == '>')
             break;
-	  else if (mxml_add_char(ch, &ptr, &value, &valsize))
+	  else if (mxml_add_char(ch, &ptr, &ld->value, &ld->valsize))
 	  {
-            free(name);
-	    return (EOF);
+	    ch = EOF;
+	    goto done;
 	  }
 
         *ptr = '\0';
       }
     }
     else
-      value[0] = '\0';
+      ld->value[0] = '\0';
 
    /*
     * Save last character in case we need it...
@@ -1000,7 +1345,7 @@ mxml_parse_element(stp_mxml_node_t *node,	/* I - Element node */
       * Grab the > character and print an error if it isn't there...
       */
 
-      quote = (*getc_cb)(p);
+      quote = mxml_getc(ld);
 
       if (quote != '>')
       {
@@ -1015,43 +1360,124 @@ mxml_parse_element(stp_mxml_node_t *node,	/* I - Element node */
       break;
 
    /*
-    * Set the attribute...
+    * Set the attribute; the attributes of an arena element are collected
+    * and stored in one piece at the end...
     */
 
-    stp_mxmlElementSetAttr(node, name, value);
+    if (!ld->arena)
+      stp_mxmlElementSetAttr(node, ld->name, ld->value);
+    else if (mxml_add_attr(ld, ld->name, ld->value))
+    {
+      ch = EOF;
+      break;
+    }
   }
 
  /*
-  * Free the name and value buffers and return...
+  * Store the attributes read so far, even after an error...
   */
 
-  free(name);
-  free(value);
+done:
+
+  if (ld->arena && mxml_set_attrs(node, ld))
+    return (EOF);
 
   return (ch);
 }
 
 
 /*
- * 'mxml_string_getc()' - Get a character from a string.
+ * 'mxml_read_file()' - Read the rest of a file into memory.
  */
 
-static int				/* O - Character or EOF */
-mxml_string_getc(void *p)		/* I - Pointer to file */
+static char *				/* O - Allocated data or NULL */
+mxml_read_file(FILE   *fp,		/* I - File to read from */
+               size_t *length)		/* O - Length of data */
 {
-  int		ch;			/* Character */
-  const char	**s;			/* Pointer to string pointer */
+  struct stat	info;			/* File information */
+  char		*data,			/* File data */
+		*newdata;		/* Expanded data */
+  size_t	size,			/* Size of data buffer */
+		bytes;			/* Bytes read */
+
 
+ /*
+  * Size the buffer from the file, if it is a plain file, leaving room to
+  * see the end of the file without expanding it...
+  */
 
-  s = (const char **)p;
+  size = 4096;
 
-  if ((ch = *s[0]) != 0)
+  if (!fstat(fileno(fp), &info) && S_ISREG(info.st_mode) &&
+      (size_t)info.st_size >= size)
+    size = info.st_size + 1;
+
+  if ((data = malloc(size)) == NULL)
   {
-    (*s)++;
-    return (ch);
+    fputs("Unable to allocate file buffer!\n", stderr);
+    return (NULL);
   }
-  else
-    return (EOF);
+
+  *length = 0;
+
+  while ((bytes = fread(data + *length, 1, size - *length, fp)) > 0)
+  {
+    *length += bytes;
+
+    if (*length == size)
+    {
+      size *= 2;
+
+      if ((newdata = realloc(data, size)) == NULL)
+      {
+        fprintf(stderr, "Unable to expand file buffer to %lu bytes!\n",
+	        (unsigned long)size);
+        free(data);
+	return (NULL);
+      }
+
+      data = newdata;
+    }
+  }
+
+  if (ferror(fp))
+  {
+    free(data);
+    return (NULL);
+  }
+
+  return (data);
+}
+
+
+/*
+ * 'mxml_set_attrs()' - Store the attributes of an arena element.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+mxml_set_attrs(stp_mxml_node_t *node,	/* I - Element node */
+               mxml_load_t     *ld)	/* I - Loader state */
+{
+  stp_mxml_attr_t	*attrs;		/* Attributes */
+
+
+  if (ld->num_attrs == 0)
+    return (0);
+
+  if ((attrs = stpi_mxml_arena_alloc(ld->arena, ld->num_attrs *
+				     sizeof(stp_mxml_attr_t))) == NULL)
+  {
+    fprintf(stderr, "Unable to allocate memory for attributes of element %s!\n",
+            node->value.element.name);
+    return (-1);
+  }
+
+  memcpy(attrs, ld->attrs, ld->num_attrs * sizeof(stp_mxml_attr_t));
+
+  node->value.element.attrs     = attrs;
+  node->value.element.num_attrs = ld->num_attrs;
+
+  return (0);
 }
 
 
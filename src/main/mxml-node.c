@@ -25,6 +25,11 @@
  *   stp_mxmlNewReal()    - Create a new real number node.
  *   stp_mxmlNewText()    - Create a new text fragment node.
  *   stp_mxmlRemove()     - Remove a node from its parent.
+ *   stpi_mxml_arena_create()  - Create a document arena.
+ *   stpi_mxml_arena_destroy() - Free a document arena.
+ *   stpi_mxml_arena_alloc()   - Allocate memory from an arena.
+ *   stpi_mxml_arena_strdup()  - Copy a string into an arena.
+ *   stpi_mxml_new_node()  - Create a new node in an arena.
  *   mxml_new()       - Create a new node.
  */
 
@@ -34,6 +39,30 @@
 
 #include <gutenprint/mxml.h>
 #include "config.h"
+#include "mxml-private.h"
+
+#define MXML_ARENA_ALIGN	16	/* Alignment of arena allocations */
+#define MXML_ARENA_MIN		16384	/* Smallest arena block */
+#define MXML_ARENA_MAX		1048576	/* Largest arena block unless needed */
+
+
+/*
+ * Arena data...
+ */
+
+typedef struct stp_mxml_block_s		/**** A block of arena memory. ****/
+{
+  struct stp_mxml_block_s *next;	/* Next older block */
+} stp_mxml_block_t;			/* Data follows at MXML_ARENA_ALIGN */
+
+struct stp_mxml_arena_s			/**** A document arena. ****/
+{
+  stp_mxml_block_t	*blocks;	/* Blocks, newest first */
+  char			*ptr;		/* Free space in the newest block */
+  size_t		left;		/* Bytes free at ptr */
+  size_t		block_size;	/* Size of the next block */
+  stp_mxml_node_t	*owner;		/* Node whose deletion frees the arena */
+};
 
 
 /*
@@ -41,6 +70,7 @@
  */
 
 static stp_mxml_node_t	*mxml_new(stp_mxml_node_t *parent, stp_mxml_type_t type);
+static char		*mxml_strdup(stp_mxml_node_t *node, const char *s);
 
 
 /*
@@ -192,6 +222,18 @@ stp_mxmlDelete(stp_mxml_node_t *node)		/* I - Node to delete */
   while (node->child)
     stp_mxmlDelete(node->child);
 
+ /*
+  * Arena nodes are freed with the arena, by deleting its owner...
+  */
+
+  if (node->arena)
+  {
+    if (node->arena->owner == node)
+      stpi_mxml_arena_destroy(node->arena);
+
+    return;
+  }
+
  /*
   * Now delete any node data...
   */
@@ -266,7 +308,7 @@ stp_mxmlNewElement(stp_mxml_node_t *parent,	/* I - Parent node or STP_MXML_NO_PA
   */
 
   if ((node = mxml_new(parent, STP_MXML_ELEMENT)) != NULL)
-    node->value.element.name = strdup(name);
+    node->value.element.name = mxml_strdup(node, name);
 
   return (node);
 }
@@ -333,7 +375,7 @@ stp_mxmlNewOpaque(stp_mxml_node_t *parent,	/* I - Parent node or STP_MXML_NO_PAR
   */
 
   if ((node = mxml_new(parent, STP_MXML_OPAQUE)) != NULL)
-    node->value.opaque = strdup(opaque);
+    node->value.opaque = mxml_strdup(node, opaque);
 
   return (node);
 }
@@ -404,7 +446,7 @@ stp_mxmlNewText(stp_mxml_node_t *parent,	/* I - Parent node or STP_MXML_NO_PAREN
   if ((node = mxml_new(parent, STP_MXML_TEXT)) != NULL)
   {
     node->value.text.whitespace = whitespace;
-    node->value.text.string     = strdup(string);
+    node->value.text.string     = mxml_strdup(node, string);
   }
 
   return (node);
@@ -451,12 +493,143 @@ stp_mxmlRemove(stp_mxml_node_t *node)		/* I - Node to remove */
 
 
 /*
- * 'mxml_new()' - Create a new node.
+ * 'stpi_mxml_arena_create()' - Create a document arena.
+ *
+ * The size hint is the expected total size of the allocations; the
+ * first block is sized from it.
  */
 
-static stp_mxml_node_t *			/* O - New node */
-mxml_new(stp_mxml_node_t *parent,		/* I - Parent node */
-         stp_mxml_type_t type)		/* I - Node type */
+stp_mxml_arena_t *			/* O - New arena or NULL */
+stpi_mxml_arena_create(size_t size_hint)	/* I - Expected size */
+{
+  stp_mxml_arena_t	*arena;		/* New arena */
+
+
+  if ((arena = calloc(1, sizeof(stp_mxml_arena_t))) == NULL)
+    return (NULL);
+
+  arena->block_size = MXML_ARENA_MIN;
+
+  while (arena->block_size < size_hint && arena->block_size < MXML_ARENA_MAX)
+    arena->block_size *= 2;
+
+  return (arena);
+}
+
+
+/*
+ * 'stpi_mxml_arena_destroy()' - Free a document arena.
+ *
+ * Every node and string allocated from the arena is freed with it.
+ */
+
+void
+stpi_mxml_arena_destroy(stp_mxml_arena_t *arena)	/* I - Arena */
+{
+  stp_mxml_block_t	*block;		/* Current block */
+
+
+  if (!arena)
+    return;
+
+  while ((block = arena->blocks) != NULL)
+  {
+    arena->blocks = block->next;
+    free(block);
+  }
+
+  free(arena);
+}
+
+
+/*
+ * 'stpi_mxml_arena_set_owner()' - Set the node that owns an arena.
+ *
+ * Deleting the owner node frees the arena.
+ */
+
+void
+stpi_mxml_arena_set_owner(stp_mxml_arena_t *arena,	/* I - Arena */
+			  stp_mxml_node_t  *node)	/* I - Owner node */
+{
+  arena->owner = node;
+}
+
+
+/*
+ * 'stpi_mxml_arena_alloc()' - Allocate memory from an arena.
+ */
+
+void *					/* O - Memory or NULL */
+stpi_mxml_arena_alloc(stp_mxml_arena_t *arena,	/* I - Arena */
+		      size_t           size)	/* I - Bytes to allocate */
+{
+  char			*ptr;		/* Allocated memory */
+  stp_mxml_block_t	*block;		/* New block */
+  size_t		block_size;	/* Size of new block */
+
+
+  size = (size + MXML_ARENA_ALIGN - 1) & ~((size_t) MXML_ARENA_ALIGN - 1);
+
+  if (size > arena->left)
+  {
+    block_size = arena->block_size;
+
+    if (block_size < size)
+      block_size = size;
+    else if (arena->block_size < MXML_ARENA_MAX)
+      arena->block_size *= 2;
+
+    if ((block = malloc(MXML_ARENA_ALIGN + block_size)) == NULL)
+      return (NULL);
+
+    block->next   = arena->blocks;
+    arena->blocks = block;
+    arena->ptr    = (char *)block + MXML_ARENA_ALIGN;
+    arena->left   = block_size;
+  }
+
+  ptr         = arena->ptr;
+  arena->ptr  += size;
+  arena->left -= size;
+
+  return (ptr);
+}
+
+
+/*
+ * 'stpi_mxml_arena_strdup()' - Copy a string into an arena.
+ */
+
+char *					/* O - Copy of the string or NULL */
+stpi_mxml_arena_strdup(stp_mxml_arena_t *arena,	/* I - Arena */
+		       const char       *s,	/* I - String */
+		       size_t           length)	/* I - Length of the string */
+{
+  char	*copy;				/* Copy of the string */
+
+
+  if ((copy = stpi_mxml_arena_alloc(arena, length + 1)) != NULL)
+  {
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+  }
+
+  return (copy);
+}
+
+
+/*
+ * 'stpi_mxml_new_node()' - Create a new node in an arena.
+ *
+ * The node is added to the end of the parent's child list, if there is
+ * a parent, and allocated from the arena, if there is one.
+ */
+
+stp_mxml_node_t *				/* O - New node */
+stpi_mxml_new_node(stp_mxml_node_t  *parent,	/* I - Parent node */
+		   stp_mxml_type_t  type,	/* I - Node type */
+		   stp_mxml_arena_t *arena)	/* I - Arena or NULL */
 {
   stp_mxml_node_t	*node;			/* New node */
 
@@ -465,7 +638,15 @@ mxml_new(stp_mxml_node_t *parent,		/* I - Parent node */
   * Allocate memory for the node...
   */
 
-  if ((node = calloc(1, sizeof(stp_mxml_node_t))) == NULL)
+  if (arena)
+  {
+    if ((node = stpi_mxml_arena_alloc(arena, sizeof(stp_mxml_node_t))) == NULL)
+      return (NULL);
+
+    memset(node, 0, sizeof(stp_mxml_node_t));
+    node->arena = arena;
+  }
+  else if ((node = calloc(1, sizeof(stp_mxml_node_t))) == NULL)
     return (NULL);
 
  /*
@@ -489,6 +670,35 @@ mxml_new(stp_mxml_node_t *parent,		/* I - Parent node */
 }
 
 
+/*
+ * 'mxml_new()' - Create a new node.
+ *
+ * A node created under an arena node is allocated from the same arena.
+ */
+
+static stp_mxml_node_t *			/* O - New node */
+mxml_new(stp_mxml_node_t *parent,		/* I - Parent node */
+         stp_mxml_type_t type)		/* I - Node type */
+{
+  return (stpi_mxml_new_node(parent, type, parent ? parent->arena : NULL));
+}
+
+
+/*
+ * 'mxml_strdup()' - Copy a string for a node.
+ */
+
+static char *				/* O - Copy of the string */
+mxml_strdup(stp_mxml_node_t *node,	/* I - Node the string belongs to */
+	    const char      *s)		/* I - String */
+{
+  if (node->arena)
+    return (stpi_mxml_arena_strdup(node->arena, s, strlen(s)));
+  else
+    return (strdup(s));
+}
+
+
 /*
  * End of "$Id: mxml-node.c,v 1.7 2004/09/17 18:38:21 rleigh Exp $".
  */
@@ -0,0 +1,41 @@
+/*
+ * Private definitions shared by the mini-XML source files.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef GUTENPRINT_MXML_PRIVATE_H
+#  define GUTENPRINT_MXML_PRIVATE_H
+
+#  include <gutenprint/mxml.h>
+
+/*
+ * A loaded document allocates its nodes, strings and attribute arrays
+ * from one arena, which is freed as a whole when the document's top node
+ * is deleted.  Nodes created under an arena node come from the same
+ * arena; deleting any other arena node only unlinks it.
+ */
+
+typedef struct stp_mxml_arena_s stp_mxml_arena_t;
+
+extern stp_mxml_arena_t	*stpi_mxml_arena_create(size_t size_hint);
+extern void		stpi_mxml_arena_destroy(stp_mxml_arena_t *arena);
+extern void		stpi_mxml_arena_set_owner(stp_mxml_arena_t *arena,
+						  stp_mxml_node_t *node);
+extern void		*stpi_mxml_arena_alloc(stp_mxml_arena_t *arena,
+					       size_t size);
+extern char		*stpi_mxml_arena_strdup(stp_mxml_arena_t *arena,
+						const char *s, size_t length);
+extern stp_mxml_node_t	*stpi_mxml_new_node(stp_mxml_node_t *parent,
+					    stp_mxml_type_t type,
+					    stp_mxml_arena_t *arena);
+
+#endif /* !GUTENPRINT_MXML_PRIVATE_H */
@@ -275,6 +275,16 @@ static const float_param_t float_parameters[] =
       STP_PARAMETER_LEVEL_ADVANCED3, 1, 1, -1, 1, 0
     }, 0.0, 0.0, 0.0, CMASK_ALL, 0, -1
   },
+  {
+    {
+      "ColorLUTSize", N_("Color Lookup Table Size"), "Color=Yes,Category=Advanced Image Control",
+      N_("Approximate the color adjustments of RGB input with a lookup "
+	 "table of this many points per side (0 to compute every pixel "
+	 "exactly).  Larger tables are more accurate."),
+      STP_PARAMETER_TYPE_INT, STP_PARAMETER_CLASS_OUTPUT,
+      STP_PARAMETER_LEVEL_ADVANCED4, 0, 1, -1, 1, 0
+    }, 0.0, 33.0, 0.0, CMASK_ALL, 0, -1
+  },
   {
     {
       "Gamma", N_("Composite Gamma"), "Color=Yes,Category=Gamma",
@@ -753,24 +763,53 @@ initialize_channels(stp_vars_t *v, stp_image_t *image)
   lut->channels_are_initialized = 1;
 }
 
+/*
+ * Read a row of the image and convert it to the channel input.  The
+ * result goes to out if it is not NULL, and otherwise to the channel
+ * code's input row.
+ */
 static int
-stpi_color_traditional_get_row(stp_vars_t *v,
-			       stp_image_t *image,
-			       int row,
-			       unsigned *zero_mask)
+stpi_color_traditional_convert_row(stp_vars_t *v,
+				   stp_image_t *image,
+				   int row,
+				   unsigned short *out,
+				   unsigned *zero_mask)
 {
   const lut_t *lut = (const lut_t *)(stp_get_component_data(v, "Color"));
+  size_t byte_limit =
+    lut->image_width * lut->in_channels * lut->channel_depth / 8;
+  const unsigned char *in_data;
   unsigned zero;
-  if (stp_image_get_row(image, lut->in_data,
-			lut->image_width * lut->in_channels * lut->channel_depth / 8, row)
+  /* Use the image's own copy of the row if it can lend it */
+  if (stp_image_get_row_ptr(image, &in_data, byte_limit, row)
       != STP_IMAGE_STATUS_OK)
     return 2;
+  if (!in_data)
+    {
+      if (stp_image_get_row(image, lut->in_data, byte_limit, row)
+	  != STP_IMAGE_STATUS_OK)
+	return 2;
+      in_data = lut->in_data;
+    }
   if (!lut->channels_are_initialized)
     initialize_channels(v, image);
   zero = (lut->output_color_description->conversion_function)
-    (v, lut->in_data, stp_channel_get_input(v));
+    (v, in_data, out ? out : stp_channel_get_input(v));
   if (zero_mask)
     *zero_mask = zero;
+  return 0;
+}
+
+static int
+stpi_color_traditional_get_row(stp_vars_t *v,
+			       stp_image_t *image,
+			       int row,
+			       unsigned *zero_mask)
+{
+  int status =
+    stpi_color_traditional_convert_row(v, image, row, NULL, zero_mask);
+  if (status)
+    return status;
   stp_channel_convert(v, zero_mask);
   return 0;
 }
@@ -797,6 +836,7 @@ allocate_lut(void)
   ret->contrast = 1.0;
   ret->brightness = 1.0;
   ret->simple_gamma_correction = 0;
+  ret->refcount = 1;
   return ret;
 }
 
@@ -844,6 +884,10 @@ copy_lut(void *vlut)
   stp_curve_cache_copy(&(dest->sat_map), &(src->sat_map));
   /* Don't copy gray_tmp */
   /* Don't copy cmy_tmp */
+  /* The curve data belongs to src, so the copy must fetch its own */
+  dest->plan = src->plan;
+  dest->plan.prepared = 0;
+  dest->plan.lut3d = NULL;
   if (src->in_data)
     {
       dest->in_data = stp_malloc(src->image_width * src->in_channels);
@@ -856,7 +900,10 @@ static void
 free_lut(void *vlut)
 {
   lut_t *lut = (lut_t *)vlut;
+  if (--lut->refcount > 0)
+    return;
   free_channels(lut);
+  stpi_color_lut3d_release(lut->plan.lut3d);
   stp_curve_free_curve_cache(&(lut->brightness_correction));
   stp_curve_free_curve_cache(&(lut->contrast_correction));
   stp_curve_free_curve_cache(&(lut->user_color_correction));
@@ -1373,6 +1420,29 @@ stpi_do_dump_lut_to_file(stp_vars_t *v, FILE *fp)
     }
 }
 
+static void
+compute_plan(stp_vars_t *v, lut_t *lut)
+{
+  color_plan_t *plan = &(lut->plan);
+  double saturation = stp_get_float_parameter(v, "Saturation");
+  memset(plan, 0, sizeof(color_plan_t));
+  plan->saturation = saturation;
+  plan->do_user_adjustment =
+    stp_get_float_parameter(v, "Brightness") != 1;
+  plan->compute_saturation =
+    saturation <= .99999 || saturation >= 1.00001 || plan->do_user_adjustment;
+  plan->split_saturation = saturation > 1.4;
+  plan->ssat = plan->split_saturation ? sqrt(saturation) : saturation;
+  plan->isat = plan->ssat > 1 ? 1.0 / plan->ssat : 1.0;
+  plan->fast_isat = saturation > 1 ? 1.0 / saturation : 1.0;
+  plan->bright_color_adjustment =
+    lut->color_correction->correction == COLOR_CORRECTION_BRIGHT;
+  plan->hue_only_color_adjustment =
+    lut->color_correction->correction == COLOR_CORRECTION_HUE;
+  if (stp_check_int_parameter(v, "ColorLUTSize", STP_PARAMETER_ACTIVE))
+    plan->lut3d_size = stp_get_int_parameter(v, "ColorLUTSize");
+}
+
 static void
 stpi_dump_lut_to_file(stp_vars_t *v, const char *dump_file)
 {
@@ -1388,21 +1458,63 @@ stpi_dump_lut_to_file(stp_vars_t *v, const char *dump_file)
     }
 }
 
+static int
+lut_needs_gcr(const lut_t *lut)
+{
+  return (((lut->output_color_description->channels & CMASK_CMYK) ==
+	   CMASK_CMYK) &&
+	  (lut->color_correction->correction == COLOR_CORRECTION_DESATURATED ||
+	   lut->input_color_description->color_id == COLOR_ID_GRAY ||
+	   lut->input_color_description->color_id == COLOR_ID_WHITE ||
+	   lut->input_color_description->color_id == COLOR_ID_RGB ||
+	   lut->input_color_description->color_id == COLOR_ID_CMY));
+}
+
+/*
+ * Compute the correction and channel curves, and the GCR curve if needed.
+ * These depend only on the color parameters, so they may come from the
+ * on-disk cache instead.
+ */
 static void
-stpi_compute_lut(stp_vars_t *v)
+compute_lut_curves(stp_vars_t *v, lut_t *lut, int gcr)
 {
   int i;
-  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));
   stp_curve_t *curve;
-  stp_dprintf(STP_DBG_LUT, v, "stpi_compute_lut\n");
+  curve = stp_curve_create_copy(color_curve_bounds);
+  stp_curve_rescale(curve, 65535.0, STP_CURVE_COMPOSE_MULTIPLY,
+		    STP_CURVE_BOUNDS_RESCALE);
+  stp_curve_cache_set_curve(&(lut->user_color_correction), curve);
+  curve = stp_curve_create_copy(color_curve_bounds);
+  stp_curve_rescale(curve, 65535.0, STP_CURVE_COMPOSE_MULTIPLY,
+		    STP_CURVE_BOUNDS_RESCALE);
+  stp_curve_cache_set_curve(&(lut->brightness_correction), curve);
+  curve = stp_curve_create_copy(color_curve_bounds);
+  stp_curve_rescale(curve, 65535.0, STP_CURVE_COMPOSE_MULTIPLY,
+		    STP_CURVE_BOUNDS_RESCALE);
+  stp_curve_cache_set_curve(&(lut->contrast_correction), curve);
+  compute_user_correction(lut);
 
-  if (lut->input_color_description->color_model == COLOR_UNKNOWN ||
-      lut->output_color_description->color_model == COLOR_UNKNOWN ||
-      lut->input_color_description->color_model ==
-      lut->output_color_description->color_model)
-    lut->invert_output = 0;
-  else
-    lut->invert_output = 1;
+  for (i = 0; i < STP_CHANNEL_LIMIT; i++)
+    {
+      if (lut->output_color_description->channel_count < 1 &&
+	  i < lut->out_channels)
+	setup_channel(v, i, &(raw_channel_params[i]));
+      else if (i < channel_param_count &&
+	       lut->output_color_description->channels & (1 << i))
+	setup_channel(v, i, &(channel_params[i]));
+    }
+  if (gcr)
+    initialize_gcr_curve(v);
+}
+
+static void
+stpi_compute_lut(stp_vars_t *v)
+{
+  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));
+  stpi_color_hash_t cache_key;
+  int cache_status;
+  int gcr;
+  stp_dprintf(STP_DBG_LUT, v, "stpi_compute_lut\n");
 
   lut->linear_contrast_adjustment = 0;
   lut->print_gamma = 1.0;
@@ -1426,19 +1538,6 @@ stpi_compute_lut(stp_vars_t *v)
   if (stp_check_boolean_parameter(v, "SimpleGamma", STP_PARAMETER_ACTIVE))
     lut->simple_gamma_correction = stp_get_boolean_parameter(v, "SimpleGamma");
   lut->screen_gamma = lut->app_gamma / 4.0; /* "Empirical" */
-  curve = stp_curve_create_copy(color_curve_bounds);
-  stp_curve_rescale(curve, 65535.0, STP_CURVE_COMPOSE_MULTIPLY,
-		    STP_CURVE_BOUNDS_RESCALE);
-  stp_curve_cache_set_curve(&(lut->user_color_correction), curve);
-  curve = stp_curve_create_copy(color_curve_bounds);
-  stp_curve_rescale(curve, 65535.0, STP_CURVE_COMPOSE_MULTIPLY,
-		    STP_CURVE_BOUNDS_RESCALE);
-  stp_curve_cache_set_curve(&(lut->brightness_correction), curve);
-  curve = stp_curve_create_copy(color_curve_bounds);
-  stp_curve_rescale(curve, 65535.0, STP_CURVE_COMPOSE_MULTIPLY,
-		    STP_CURVE_BOUNDS_RESCALE);
-  stp_curve_cache_set_curve(&(lut->contrast_correction), curve);
-  compute_user_correction(lut);
 
   /*
    * TODO check that these are wraparound curves and all that
@@ -1474,26 +1573,75 @@ stpi_compute_lut(stp_vars_t *v)
   stp_dprintf(STP_DBG_LUT, v, " brightness %.3f\n", lut->brightness);
   stp_dprintf(STP_DBG_LUT, v, " screen_gamma %.3f\n", lut->screen_gamma);
 
-  for (i = 0; i < STP_CHANNEL_LIMIT; i++)
+  gcr = lut_needs_gcr(lut);
+  cache_status = stpi_color_cache_load(v, lut, gcr, &cache_key);
+  if (cache_status <= 0)
     {
-      if (lut->output_color_description->channel_count < 1 &&
-	  i < lut->out_channels)
-	setup_channel(v, i, &(raw_channel_params[i]));
-      else if (i < channel_param_count &&
-	       lut->output_color_description->channels & (1 << i))
-	setup_channel(v, i, &(channel_params[i]));
+      compute_lut_curves(v, lut, gcr);
+      if (cache_status == 0)
+	stpi_color_cache_save(v, lut, gcr, &cache_key);
     }
-  if (((lut->output_color_description->channels & CMASK_CMYK) == CMASK_CMYK) &&
-      (lut->color_correction->correction == COLOR_CORRECTION_DESATURATED ||
-       lut->input_color_description->color_id == COLOR_ID_GRAY ||
-       lut->input_color_description->color_id == COLOR_ID_WHITE ||
-       lut->input_color_description->color_id == COLOR_ID_RGB ||
-       lut->input_color_description->color_id == COLOR_ID_CMY))
-    initialize_gcr_curve(v);
+  compute_plan(v, lut);
   if (stp_check_file_parameter(v, "LUTDumpFile", STP_PARAMETER_ACTIVE))
     stpi_dump_lut_to_file(v, stp_get_file_parameter(v, "LUTDumpFile"));
 }
 
+/*
+ * A lut kept in a render session for the pages after the one it was
+ * computed for, with the GCR curve that stpi_compute_lut() gave the
+ * channel code.
+ */
+typedef struct
+{
+  stpi_color_hash_t key;
+  lut_t *lut;
+  int gcr;
+  stp_curve_t *gcr_curve;
+} kept_lut_t;
+
+static void
+free_kept_lut(void *vkept)
+{
+  kept_lut_t *kept = (kept_lut_t *) vkept;
+  free_lut(kept->lut);
+  if (kept->gcr_curve)
+    stp_curve_destroy(kept->gcr_curve);
+  stp_free(kept);
+}
+
+static void
+keep_lut(stp_vars_t *v, lut_t *lut, const stpi_color_hash_t *key)
+{
+  kept_lut_t *kept = stp_zalloc(sizeof(kept_lut_t));
+  const stp_curve_t *gcr_curve = stp_channel_get_gcr_curve(v);
+  kept->key = *key;
+  kept->lut = lut;
+  kept->gcr = lut_needs_gcr(lut);
+  if (kept->gcr && gcr_curve)
+    kept->gcr_curve = stp_curve_create_copy(gcr_curve);
+  lut->refcount++;
+  stpi_session_set_data(v, "Color", kept, free_kept_lut);
+}
+
+/*
+ * If the session has a lut computed from the same settings, replace the
+ * newly allocated lut with it.  The per-page state is reset by the
+ * caller.
+ */
+static lut_t *
+reuse_kept_lut(stp_vars_t *v, const stpi_color_hash_t *key)
+{
+  kept_lut_t *kept = (kept_lut_t *) stpi_session_get_data(v, "Color");
+  if (!kept || kept->key.fnv != key->fnv || kept->key.sum != key->sum)
+    return NULL;
+  stp_dprintf(STP_DBG_LUT, v, "Reusing lut from the session\n");
+  kept->lut->refcount++;
+  stp_allocate_component_data(v, "Color", copy_lut, free_lut, kept->lut);
+  if (kept->gcr)
+    stp_channel_set_gcr_curve(v, kept->gcr_curve);
+  return kept->lut;
+}
+
 static int
 stpi_color_traditional_init(stp_vars_t *v,
 			    stp_image_t *image,
@@ -1560,7 +1708,42 @@ stpi_color_traditional_init(stp_vars_t *v,
       (get_color_correction_by_tag
        (lut->output_color_description->default_correction));
 
-  stpi_compute_lut(v);
+  if (lut->input_color_description->color_model == COLOR_UNKNOWN ||
+      lut->output_color_description->color_model == COLOR_UNKNOWN ||
+      lut->input_color_description->color_model ==
+      lut->output_color_description->color_model)
+    lut->invert_output = 0;
+  else
+    lut->invert_output = 1;
+
+  if (stpi_get_session(v))
+    {
+      stpi_color_hash_t key;
+      lut_t *kept;
+      stpi_color_cache_key(v, lut, lut_needs_gcr(lut), &key);
+      kept = reuse_kept_lut(v, &key);
+      if (kept)
+	{
+	  lut = kept;
+	  lut->channels_are_initialized = 0;
+	  lut->printed_colorfunc = 0;
+	  if (lut->image_width != stp_image_width(image))
+	    {
+	      STP_SAFE_FREE(lut->gray_tmp);
+	      STP_SAFE_FREE(lut->cmy_tmp);
+	    }
+	  STP_SAFE_FREE(lut->in_data);
+	  if (stp_check_file_parameter(v, "LUTDumpFile", STP_PARAMETER_ACTIVE))
+	    stpi_dump_lut_to_file(v, stp_get_file_parameter(v, "LUTDumpFile"));
+	}
+      else
+	{
+	  stpi_compute_lut(v);
+	  keep_lut(v, lut, &key);
+	}
+    }
+  else
+    stpi_compute_lut(v);
 
   lut->image_width = stp_image_width(image);
   total_channel_bits = lut->in_channels * lut->channel_depth;
@@ -1827,7 +2010,8 @@ static const stp_colorfuncs_t stpi_color_traditional_colorfuncs =
   &stpi_color_traditional_init,
   &stpi_color_traditional_get_row,
   &stpi_color_traditional_list_parameters,
-  &stpi_color_traditional_describe_parameter
+  &stpi_color_traditional_describe_parameter,
+  &stpi_color_traditional_convert_row
 };
 
 static stp_color_t stpi_color_traditional_module_data =
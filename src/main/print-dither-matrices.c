@@ -626,23 +626,16 @@ stpi_dither_array_create_from_file(const char* file, int x, int y)
   stp_mxml_node_t *doc;
   stp_array_t *ret = NULL;
 
-  FILE *fp = fopen(file, "r");
-  if (!fp)
-    {
-      stp_erprintf("stp_curve_create_from_file: unable to open %s: %s\n",
-		   file, strerror(errno));
-      return NULL;
-    }
-
   stp_xml_init();
 
   stp_deprintf(STP_DBG_XML,
 	       "stpi_dither_array_create_from_file: reading `%s'...\n", file);
 
-  doc = stp_mxmlLoadFile(NULL, fp, STP_MXML_NO_CALLBACK);
-  (void) fclose(fp);
-
-  if (doc)
+  doc = stpi_xml_load_file(file);
+  if (!doc)
+    stp_erprintf("stp_curve_create_from_file: unable to open %s: %s\n",
+		 file, strerror(errno));
+  else
     {
       ret = xml_doc_get_dither_array(doc, x, y);
       stp_mxmlDelete(doc);
@@ -686,6 +679,7 @@ void
 stpi_init_dither(void)
 {
   stp_register_xml_parser("dither-matrix", stp_xml_process_dither_matrix);
+  stpi_dither_threshold_init();
 }
 
 stp_array_t *
@@ -4254,80 +4254,75 @@ set_mask(unsigned char *cd_mask, int x_center, int scaled_x_where,
     }
 }
 
-static int
-escp2_print_data(stp_vars_t *v, stp_image_t *image)
+typedef struct
+{
+  unsigned char *cd_mask;
+  double outer_r_sq;
+  double inner_r_sq;
+  int x_center;
+} escp2_render_t;
+
+static const unsigned char *
+escp2_cd_mask(stp_vars_t *v, int y, void *data)
 {
   escp2_privdata_t *pd = get_privdata(v);
-  int errdiv  = stp_image_height(image) / pd->image_printed_height;
-  int errmod  = stp_image_height(image) % pd->image_printed_height;
-  int errval  = 0;
-  int errlast = -1;
-  int errline  = 0;
-  int y;
-  double outer_r_sq = 0;
-  double inner_r_sq = 0;
-  int x_center = pd->cd_x_offset * pd->res->printed_hres / pd->micro_units;
-  unsigned char *cd_mask = NULL;
-  if (pd->cd_outer_radius > 0)
-    {
-      cd_mask = stp_malloc(1 + (pd->image_printed_width + 7) / 8);
-      outer_r_sq = (double) pd->cd_outer_radius * (double) pd->cd_outer_radius;
-      inner_r_sq = (double) pd->cd_inner_radius * (double) pd->cd_inner_radius;
-    }
-
-  for (y = 0; y < pd->image_printed_height; y ++)
-    {
-      int duplicate_line = 1;
-      unsigned zero_mask;
-
-      if (errline != errlast)
-	{
-	  errlast = errline;
-	  duplicate_line = 0;
-	  if (stp_color_get_row(v, image, errline, &zero_mask))
-	    return 2;
-	}
-
-      if (cd_mask)
+  escp2_render_t *r = (escp2_render_t *) data;
+  int y_distance_from_center =
+    pd->cd_outer_radius -
+    ((y + pd->cd_y_offset) * pd->micro_units / pd->res->printed_vres);
+  if (y_distance_from_center < 0)
+    y_distance_from_center = -y_distance_from_center;
+  memset(r->cd_mask, 0, (pd->image_printed_width + 7) / 8);
+  if (y_distance_from_center < pd->cd_outer_radius)
+    {
+      double y_sq = (double) y_distance_from_center *
+	(double) y_distance_from_center;
+      int x_where = sqrt(r->outer_r_sq - y_sq) + .5;
+      int scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
+      set_mask(r->cd_mask, r->x_center, scaled_x_where,
+	       pd->image_printed_width, 1, 0);
+      if (y_distance_from_center < pd->cd_inner_radius)
 	{
-	  int y_distance_from_center =
-	    pd->cd_outer_radius -
-	    ((y + pd->cd_y_offset) * pd->micro_units / pd->res->printed_vres);
-	  if (y_distance_from_center < 0)
-	    y_distance_from_center = -y_distance_from_center;
-	  memset(cd_mask, 0, (pd->image_printed_width + 7) / 8);
-	  if (y_distance_from_center < pd->cd_outer_radius)
-	    {
-	      double y_sq = (double) y_distance_from_center *
-		(double) y_distance_from_center;
-	      int x_where = sqrt(outer_r_sq - y_sq) + .5;
-	      int scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
-	      set_mask(cd_mask, x_center, scaled_x_where,
-		       pd->image_printed_width, 1, 0);
-	      if (y_distance_from_center < pd->cd_inner_radius)
-		{
-		  x_where = sqrt(inner_r_sq - y_sq) + .5;
-		  scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
-		  set_mask(cd_mask, x_center, scaled_x_where,
-			   pd->image_printed_width, 1, 1);
-		}
-	    }
+	  x_where = sqrt(r->inner_r_sq - y_sq) + .5;
+	  scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
+	  set_mask(r->cd_mask, r->x_center, scaled_x_where,
+		   pd->image_printed_width, 1, 1);
 	}
+    }
+  return r->cd_mask;
+}
 
-      stp_dither(v, y, duplicate_line, zero_mask, cd_mask);
+static void
+escp2_write_row(stp_vars_t *v, int y, void *data)
+{
+  escp2_privdata_t *pd = get_privdata(v);
+  stp_write_weave(v, pd->cols);
+}
 
-      stp_write_weave(v, pd->cols);
-      errval += errmod;
-      errline += errdiv;
-      if (errval >= pd->image_printed_height)
-	{
-	  errval -= pd->image_printed_height;
-	  errline ++;
-	}
+static int
+escp2_print_data(stp_vars_t *v, stp_image_t *image)
+{
+  escp2_privdata_t *pd = get_privdata(v);
+  escp2_render_t r;
+  int status;
+  r.cd_mask = NULL;
+  r.outer_r_sq = 0;
+  r.inner_r_sq = 0;
+  r.x_center = pd->cd_x_offset * pd->res->printed_hres / pd->micro_units;
+  if (pd->cd_outer_radius > 0)
+    {
+      r.cd_mask = stp_malloc(1 + (pd->image_printed_width + 7) / 8);
+      r.outer_r_sq =
+	(double) pd->cd_outer_radius * (double) pd->cd_outer_radius;
+      r.inner_r_sq =
+	(double) pd->cd_inner_radius * (double) pd->cd_inner_radius;
     }
-  if (cd_mask)
-    stp_free(cd_mask);
-  return 1;
+  status = stpi_render_rows(v, image, pd->image_printed_height,
+			    r.cd_mask ? escp2_cd_mask : NULL,
+			    escp2_write_row, &r);
+  if (r.cd_mask)
+    stp_free(r.cd_mask);
+  return status;
 }
 
 static int
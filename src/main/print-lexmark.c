@@ -1570,6 +1570,13 @@ get_double_param(stp_vars_t *v, const char *param)
     return 1.0;
 }
 
+static void
+lexmark_write_row(stp_vars_t *v, int y, void *data)
+{
+  lexmark_linebufs_t *cols = (lexmark_linebufs_t *) data;
+  stp_write_weave(v, (unsigned char **)cols->v);
+}
+
 /**********************************************************
  * lexmark_print() - Print an image to a LEXMARK printer.
  **********************************************************/
@@ -1584,7 +1591,6 @@ static int
 lexmark_do_print(stp_vars_t *v, stp_image_t *image)
 {
   int		status = 1;
-  int		y;		/* Looping vars */
   int		xdpi, ydpi;	/* Resolution */
   int		n;		/* Output number */
   int page_width,	/* Width of page */
@@ -1597,14 +1603,7 @@ lexmark_do_print(stp_vars_t *v, stp_image_t *image)
     out_width,	/* Width of image on page in pixels */
     out_height,	/* Length of image on page */
     length,		/* Length of raster data in bytes*/
-    buf_length,     /* Length of raster data buffer (dmt) */
-    errdiv,		/* Error dividend */
-    errmod,		/* Error modulus */
-    errval,		/* Current error value */
-    errline,	/* Current raster line */
-    errlast;	/* Last raster line loaded */
-  unsigned      zero_mask;
-  int           image_height;
+    buf_length;     /* Length of raster data buffer (dmt) */
   int           use_dmt = 0;
   int pass_length=0;              /* count of inkjets for one pass */
   int add_top_offset=0;              /* additional top offset */
@@ -1766,8 +1765,6 @@ densityDivisor /= 1.2;
 
   stp_dprintf(STP_DBG_LEXMARK, v, "page_right %d, page_left %d, page_top %d, page_bottom %d, left %d, top %d\n",page_right, page_left, page_top, page_bottom,left, top);
 
-  image_height = stp_image_height(image);
-
   stp_default_media_size(v, &n, &page_true_height);
   lxm3200_linetoeject = (page_true_height * 1200) / 72;
 
@@ -2080,12 +2077,6 @@ densityDivisor /= 1.2;
   /* calculate the memory we need for one line of the printer image (hopefully we are right) */
   stp_dprintf(STP_DBG_LEXMARK, v, "---------- buffer mem size = %d\n", (((((pass_length/8)*11)/10)+40) * out_width)+200);
 
-  errdiv  = image_height / out_height;
-  errmod  = image_height % out_height;
-  errval  = 0;
-  errlast = -1;
-  errline  = 0;
-
   privdata.hoffset = left;
   privdata.ydpi = ydpi;
   privdata.model = model;
@@ -2094,31 +2085,8 @@ densityDivisor /= 1.2;
   privdata.physical_xdpi = physical_xdpi;
   privdata.bitwidth = 1;
 
-  for (y = 0; y < out_height; y ++)
-    {
-      int duplicate_line = 1;
-
-      if (errline != errlast)
-	{
-	  errlast = errline;
-	  duplicate_line = 0;
-	  if (stp_color_get_row(v, image, errline, &zero_mask))
-	    {
-	      status = 2;
-	      break;
-	    }
-	}
-      stp_dither(v, y, duplicate_line, zero_mask, NULL);
-      stp_write_weave(v, (unsigned char **)cols.v);
-
-      errval += errmod;
-      errline += errdiv;
-      if (errval >= out_height)
-	{
-	  errval -= out_height;
-	  errline ++;
-	}
-    }
+  status = stpi_render_rows(v, image, out_height, NULL, lexmark_write_row,
+			    &cols);
   stp_image_conclude(image);
 
   stp_flush_all(v);
@@ -46,6 +46,33 @@ struct stp_list_item
   struct stp_list_item *next;	/*!< Next node		*/
 };
 
+/** One slot of a name index. */
+typedef struct
+{
+  unsigned hash;		/*!< Hash of the item's name	*/
+  struct stp_list_item *item;	/*!< Item, or NULL if empty	*/
+} list_index_slot_t;
+
+/**
+ * A hash index of the items of a list by name or long name.
+ * Each name maps to the first item in the list with that name.  The
+ * table uses open addressing with linear probing, and is never more
+ * than half full.
+ */
+typedef struct
+{
+  list_index_slot_t *slots;	/*!< Hash table, NULL if not built	*/
+  int size;			/*!< Number of slots (a power of 2)	*/
+  int count;			/*!< Number of items in the table	*/
+  int duplicates;		/*!< Named items hidden by an earlier one	*/
+} list_index_t;
+
+/*
+ * Lists shorter than this are searched linearly; the index is built
+ * the first time a longer list misses the name cache.
+ */
+#define LIST_INDEX_MIN_LENGTH 8
+
 /** The internal representation of an stp_list_t list. */
 struct stp_list
 {
@@ -63,6 +90,8 @@ struct stp_list
   struct stp_list_item *name_cache_node;	/*!< Cached node (for name)		*/
   char *long_name_cache;			/*!< Cached long name			*/
   struct stp_list_item *long_name_cache_node;	/*!< Cached node (for long name)	*/
+  list_index_t name_index;			/*!< Items by name			*/
+  list_index_t long_name_index;			/*!< Items by long name			*/
 };
 
 /**
@@ -116,6 +145,192 @@ clear_cache(stp_list_t *list)
   set_long_name_cache(list, NULL, NULL);
 }
 
+static unsigned
+hash_name(const char *name)
+{
+  unsigned hash = 2166136261u;
+  while (*name)
+    hash = (hash ^ (unsigned char) *name++) * 16777619u;
+  return hash;
+}
+
+static void
+index_init(list_index_t *index)
+{
+  index->slots = NULL;
+  index->size = 0;
+  index->count = 0;
+  index->duplicates = 0;
+}
+
+static void
+index_free(list_index_t *index)
+{
+  if (index->slots)
+    stp_free(index->slots);
+  index_init(index);
+}
+
+/**
+ * Find the slot holding a name, or the empty slot where it belongs.
+ */
+static list_index_slot_t *
+index_slot(const list_index_t *index, stp_node_namefunc namefunc,
+	   const char *name, unsigned hash)
+{
+  int mask = index->size - 1;
+  int i = hash & mask;
+  while (index->slots[i].item &&
+	 (index->slots[i].hash != hash ||
+	  strcmp(name, namefunc(index->slots[i].item->data)) != 0))
+    i = (i + 1) & mask;
+  return &(index->slots[i]);
+}
+
+static void
+index_resize(list_index_t *index, int size)
+{
+  list_index_slot_t *old_slots = index->slots;
+  int old_size = index->size;
+  int i;
+  index->slots = stp_zalloc(sizeof(list_index_slot_t) * size);
+  index->size = size;
+  for (i = 0; i < old_size; i++)
+    if (old_slots[i].item)
+      {
+	int j = old_slots[i].hash & (size - 1);
+	while (index->slots[j].item)
+	  j = (j + 1) & (size - 1);
+	index->slots[j] = old_slots[i];
+      }
+  if (old_slots)
+    stp_free(old_slots);
+}
+
+/**
+ * Add an item to an index.  If an item of the same name is already
+ * indexed, the new item replaces it if it comes first in the list.
+ * @param index the index to use.
+ * @param namefunc the function giving the name to index by.
+ * @param item the item, which must already be linked into the list.
+ * @param order 1 if the item is known to precede any other item of the
+ * same name, -1 if it is known to follow them, or 0 if not known.
+ */
+static void
+index_add(list_index_t *index, stp_node_namefunc namefunc,
+	  stp_list_item_t *item, int order)
+{
+  const char *name = namefunc(item->data);
+  list_index_slot_t *slot;
+  unsigned hash;
+  if (!name)
+    return;
+  if (2 * (index->count + 1) > index->size)
+    index_resize(index, index->size ? index->size * 2 : 32);
+  hash = hash_name(name);
+  slot = index_slot(index, namefunc, name, hash);
+  if (slot->item)
+    {
+      index->duplicates++;
+      if (order == 0)
+	{
+	  stp_list_item_t *later = item->next;
+	  while (later && later != slot->item)
+	    later = later->next;
+	  order = later ? 1 : -1;
+	}
+      if (order > 0)
+	slot->item = item;
+      return;
+    }
+  slot->hash = hash;
+  slot->item = item;
+  index->count++;
+}
+
+/**
+ * Remove an item, which is still linked into the list, from an index.
+ */
+static void
+index_remove(list_index_t *index, stp_node_namefunc namefunc,
+	     stp_list_item_t *item)
+{
+  const char *name = namefunc(item->data);
+  list_index_slot_t *slot;
+  stp_list_item_t *next;
+  int mask = index->size - 1;
+  int i, j;
+  if (!name)
+    return;
+  slot = index_slot(index, namefunc, name, hash_name(name));
+  if (slot->item != item)
+    {
+      /* A duplicate hidden by an earlier item */
+      index->duplicates--;
+      return;
+    }
+  if (index->duplicates > 0)
+    {
+      /* The next item of the same name, if any, takes the slot */
+      for (next = item->next; next; next = next->next)
+	{
+	  const char *next_name = namefunc(next->data);
+	  if (next_name && strcmp(name, next_name) == 0)
+	    {
+	      slot->item = next;
+	      index->duplicates--;
+	      return;
+	    }
+	}
+    }
+  /*
+   * Empty the slot, and move back any later entries in the same run
+   * that would no longer be found from their home slot.
+   */
+  index->count--;
+  i = slot - index->slots;
+  j = i;
+  for (;;)
+    {
+      int home;
+      index->slots[i].item = NULL;
+      do
+	{
+	  j = (j + 1) & mask;
+	  if (!index->slots[j].item)
+	    return;
+	  home = index->slots[j].hash & mask;
+	}
+      while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+      index->slots[i] = index->slots[j];
+      i = j;
+    }
+}
+
+static void
+index_build(list_index_t *index, const stp_list_t *list,
+	    stp_node_namefunc namefunc)
+{
+  stp_list_item_t *item;
+  int size = 32;
+  while (size < 2 * list->length)
+    size *= 2;
+  index_free(index);
+  index_resize(index, size);
+  /* Going backwards, each item precedes the ones already indexed */
+  for (item = list->end; item; item = item->prev)
+    index_add(index, namefunc, item, 1);
+}
+
+static stp_list_item_t *
+index_find(list_index_t *index, const stp_list_t *list,
+	   stp_node_namefunc namefunc, const char *name)
+{
+  if (!index->slots)
+    index_build(index, list, namefunc);
+  return index_slot(index, namefunc, name, hash_name(name))->item;
+}
+
 void
 stp_list_node_free_data (void *item)
 {
@@ -152,6 +367,8 @@ stp_list_create(void)
   list->name_cache_node = NULL;
   list->long_name_cache = NULL;
   list->long_name_cache_node = NULL;
+  index_init(&(list->name_index));
+  index_init(&(list->long_name_index));
 
   stp_deprintf(STP_DBG_LIST, "stp_list_head constructor\n");
   return list;
@@ -195,6 +412,8 @@ stp_list_destroy(stp_list_t *list)
 
   check_list(list);
   clear_cache(list);
+  index_free(&(list->name_index));
+  index_free(&(list->long_name_index));
   cur = list->start;
   while(cur)
     {
@@ -382,7 +601,10 @@ stp_list_get_item_by_name(const stp_list_t *list, const char *name)
 	}
     }
 
-  node = stp_list_get_item_by_name_internal(list, name);
+  if (list->length >= LIST_INDEX_MIN_LENGTH)
+    node = index_find(&(ulist->name_index), list, list->namefunc, name);
+  else
+    node = stp_list_get_item_by_name_internal(list, name);
 
   if (node)
     set_name_cache(ulist, name, node);
@@ -456,7 +678,11 @@ stp_list_get_item_by_long_name(const stp_list_t *list, const char *long_name)
 	}
     }
 
-  node = stp_list_get_item_by_long_name_internal(list, long_name);
+  if (list->length >= LIST_INDEX_MIN_LENGTH)
+    node = index_find(&(ulist->long_name_index), list, list->long_namefunc,
+		      long_name);
+  else
+    node = stp_list_get_item_by_long_name_internal(list, long_name);
 
   if (node)
     set_long_name_cache(ulist, long_name, node);
@@ -500,6 +726,7 @@ void
 stp_list_set_namefunc(stp_list_t *list, stp_node_namefunc namefunc)
 {
   check_list(list);
+  index_free(&(list->name_index));
   list->namefunc = namefunc;
 }
 
@@ -515,6 +742,7 @@ void
 stp_list_set_long_namefunc(stp_list_t *list, stp_node_namefunc long_namefunc)
 {
   check_list(list);
+  index_free(&(list->long_name_index));
   list->long_namefunc = long_namefunc;
 }
 
@@ -577,7 +805,7 @@ stp_list_item_create(stp_list_t *list,
 
   if (list->sortfunc)
     {
-      /* set np to the previous node (before the insertion */
+      /* find the last node that sorts before the new one */
       lnn = list->end;
       while (lnn)
 	{
@@ -585,6 +813,8 @@ stp_list_item_create(stp_list_t *list,
 	    break;
 	  lnn = lnn->prev;
 	}
+      /* the new node goes after it */
+      lnn = lnn ? lnn->next : list->start;
     }
 #if 0
   /*
@@ -611,41 +841,30 @@ stp_list_item_create(stp_list_t *list,
   else
     lnn = next;
 
-  /* got lnp; now insert the new ln */
-
-  /* set next */
+  /* got lnn; now insert the new ln before it, or at the end if NULL */
   ln->next = lnn;
+  ln->prev = lnn ? lnn->prev : list->end;
 
-  if (!ln->prev) /* insert at start of list */
-    {
-      if (list->start) /* list not empty */
-	ln->prev = list->end;
-      else
-	list->start = ln;
-      list->end = ln;
-    }
-
-  /* set prev (already set if at start of list) */
-
-  if (!ln->prev && ln->next) /* insert at end of list */
-    ln->prev = ln->next->prev;
-
-  if (list->start == ln->next) /* prev was old end */
-    {
-      list->start = ln;
-    }
-
-  /* set next->prev */
   if (ln->next)
     ln->next->prev = ln;
+  else
+    list->end = ln;
 
-  /* set prev->next */
   if (ln->prev)
     ln->prev->next = ln;
+  else
+    list->start = ln;
 
   /* increment reference count */
   list->length++;
 
+  /* an item added at the end follows any others of the same name */
+  if (list->name_index.slots)
+    index_add(&(list->name_index), list->namefunc, ln, ln->next ? 0 : -1);
+  if (list->long_name_index.slots)
+    index_add(&(list->long_name_index), list->long_namefunc, ln,
+	      ln->next ? 0 : -1);
+
   stp_deprintf(STP_DBG_LIST, "stp_list_node constructor\n");
   return 0;
 }
@@ -657,6 +876,10 @@ stp_list_item_destroy(stp_list_t *list, stp_list_item_t *item)
   check_list(list);
 
   clear_cache(list);
+  if (list->name_index.slots)
+    index_remove(&(list->name_index), list->namefunc, item);
+  if (list->long_name_index.slots)
+    index_remove(&(list->long_name_index), list->long_namefunc, item);
   /* decrement reference count */
   list->length--;
 
@@ -79,6 +79,8 @@
 #define MAX_INK_CHANNELS	3
 #define MAX_BYTES_PER_CHANNEL	2
 #define SIZE_THRESHOLD		6
+#define DYESUB_RING_ROWS	4
+#define DYESUB_TILE		32
 
 /*
  * Random implementation from POSIX.1-2001 to yield reproducible results.
@@ -194,13 +196,22 @@ typedef struct {
   int plane_interlacing;
   int row_interlacing;
   char empty_byte[MAX_INK_CHANNELS];  /* one for each color plane */
-  unsigned short **image_data;
+  unsigned short *image_data;	/* see dyesub_read_image() */
+  int image_stride;		/* shorts per row of image_data */
   int outh_px, outw_px, outt_px, outb_px, outl_px, outr_px;
   int imgh_px, imgw_px;
   int prnh_px, prnw_px, prnt_px, prnb_px, prnl_px, prnr_px;
   int print_mode;	/* portrait or landscape */
-  int image_rows;
+  int image_rows;		/* rows held in image_data */
+  int image_streaming;		/* image_data is a ring of rows */
+  int image_next_row;		/* next image row to read into the ring */
+  int image_failed;
+  stp_image_t *image;
   int plane_lefttoright;
+  int *col_map;			/* image offset of each output column */
+  unsigned short *row_data;	/* converted row, one run per ink channel */
+  int row_cached, channel_cached;
+  unsigned char *line;		/* one row of output */
 } dyesub_print_vars_t;
 
 typedef struct /* printer specific parameters */
@@ -5262,176 +5273,328 @@ dyesub_interpolate(int oldval, int oldsize, int newsize)
 static void
 dyesub_free_image(dyesub_print_vars_t *pv, stp_image_t *image)
 {
-  unsigned short** image_data = pv->image_data;
-  int image_px_height = pv->image_rows;
-  int i;
+  if (pv->image_data)
+    stp_free(pv->image_data);
+  pv->image_data = NULL;
+}
 
-  for (i = 0; i< image_px_height; i++)
-    if (image_data[i])
-      stp_free(image_data[i]);
-  if (image_data)
-    stp_free(image_data);
+static int
+dyesub_read_row(stp_vars_t *v,
+		dyesub_print_vars_t *pv,
+		int row,
+		unsigned short *dest)
+{
+  unsigned int zero_mask;
+
+  if (stp_color_get_row(v, pv->image, row, &zero_mask))
+    {
+      stp_deprintf(STP_DBG_DYESUB,
+		   "dyesub_read_row: "
+		   "stp_color_get_row(..., %d, ...) == 0\n", row);
+      return 0;
+    }
+  memcpy(dest, stp_channel_get_output(v),
+	 stp_image_width(pv->image) * pv->ink_channels * sizeof(short));
+  return 1;
 }
 
-static unsigned short **
+/*
+ * Set up image_data, which holds one of:
+ *
+ * - a ring of DYESUB_RING_ROWS rows that are read as they are printed,
+ *   when the image is printed once from top to bottom (portrait and not
+ *   plane interlaced);
+ * - the whole image, when each plane is printed in turn;
+ * - the whole image transposed, so that each row printed in landscape
+ *   mode (a column of the image) is contiguous.  The image is read
+ *   DYESUB_TILE rows at a time and transposed a tile at a time.
+ */
+static int
 dyesub_read_image(stp_vars_t *v,
 		dyesub_print_vars_t *pv,
 		stp_image_t *image)
 {
   int image_px_width  = stp_image_width(image);
   int image_px_height = stp_image_height(image);
-  int row_size = image_px_width * pv->ink_channels * sizeof(short);
-  unsigned short **image_data;
-  unsigned int zero_mask;
+  int row_size = image_px_width * pv->ink_channels;
   int i;
 
-  image_data = stp_zalloc(image_px_height * sizeof(unsigned short *));
-  pv->image_rows = 0;
-  if (!image_data)
-    return NULL;	/* ? out of memory ? */
+  pv->image = image;
+  pv->image_next_row = 0;
+  pv->image_failed = 0;
 
-  for (i = 0; i < image_px_height; i++)
+  if (pv->print_mode != DYESUB_LANDSCAPE && !pv->plane_interlacing)
     {
-      if (stp_color_get_row(v, image, i, &zero_mask))
-        {
-	  stp_deprintf(STP_DBG_DYESUB,
-	  	"dyesub_read_image: "
-		"stp_color_get_row(..., %d, ...) == 0\n", i);
-	  dyesub_free_image(pv, image);
-	  return NULL;
-	}	
-      image_data[i] = stp_malloc(row_size);
-      pv->image_rows = i+1;
-      if (!image_data[i])
-        {
-	  stp_deprintf(STP_DBG_DYESUB,
-	  	"dyesub_read_image: "
-		"(image_data[%d] = stp_malloc()) == NULL\n", i);
-	  dyesub_free_image(pv, image);
-	  return NULL;
-	}	
-      memcpy(image_data[i], stp_channel_get_output(v), row_size);
+      pv->image_streaming = 1;
+      pv->image_rows = MIN(DYESUB_RING_ROWS, image_px_height);
+      pv->image_stride = row_size;
+      pv->image_data = stp_malloc(pv->image_rows * row_size * sizeof(short));
     }
-  return image_data;
+  else if (pv->print_mode != DYESUB_LANDSCAPE)
+    {
+      pv->image_streaming = 0;
+      pv->image_rows = image_px_height;
+      pv->image_stride = row_size;
+      pv->image_data = stp_malloc(pv->image_rows * row_size * sizeof(short));
+      for (i = 0; i < image_px_height; i++)
+	if (!dyesub_read_row(v, pv, i, pv->image_data + i * row_size))
+	  {
+	    dyesub_free_image(pv, image);
+	    return 0;
+	  }
+    }
+  else
+    {
+      unsigned short *tile = stp_malloc(DYESUB_TILE * row_size * sizeof(short));
+      int ink_channels = pv->ink_channels;
+      int r0, c0, r, c, k;
+
+      pv->image_streaming = 0;
+      pv->image_rows = image_px_width;
+      pv->image_stride = image_px_height * ink_channels;
+      pv->image_data = stp_malloc(pv->image_rows * pv->image_stride
+				  * sizeof(short));
+      for (r0 = 0; r0 < image_px_height; r0 += DYESUB_TILE)
+	{
+	  int rows = MIN(DYESUB_TILE, image_px_height - r0);
+	  for (r = 0; r < rows; r++)
+	    if (!dyesub_read_row(v, pv, r0 + r, tile + r * row_size))
+	      {
+		stp_free(tile);
+		dyesub_free_image(pv, image);
+		return 0;
+	      }
+	  for (c0 = 0; c0 < image_px_width; c0 += DYESUB_TILE)
+	    {
+	      int cols = MIN(DYESUB_TILE, image_px_width - c0);
+	      for (c = c0; c < c0 + cols; c++)
+		{
+		  unsigned short *dest =
+		    pv->image_data + c * pv->image_stride + r0 * ink_channels;
+		  const unsigned short *src = tile + c * ink_channels;
+		  for (r = 0; r < rows; r++, src += row_size)
+		    for (k = 0; k < ink_channels; k++)
+		      *dest++ = src[k];
+		}
+	    }
+	}
+      stp_free(tile);
+    }
+  return 1;
 }
 
-static int
-dyesub_print_pixel(stp_vars_t *v,
+/*
+ * Return row `row' of image_data, reading it first when streaming.  Rows
+ * are printed in order, so a row is never wanted after the ring has moved
+ * past it.  Once a row cannot be read, no later row is returned either.
+ */
+static const unsigned short *
+dyesub_image_row(stp_vars_t *v,
 		dyesub_print_vars_t *pv,
-		const dyesub_cap_t *caps,
-		int row,
-		int col,
-		int plane)
+		int row)
 {
-  unsigned short ink[MAX_INK_CHANNELS], *out;
-  int i, j, b;
+  if (!pv->image_streaming)
+    return pv->image_data + row * pv->image_stride;
 
-  if (pv->print_mode == DYESUB_LANDSCAPE)
-    { /* "rotate" image */
-      dyesub_swap_ints(&col, &row);
-      row = (pv->imgw_px - 1) - row;
+  while (pv->image_next_row <= row)
+    {
+      unsigned short *dest = pv->image_data +
+	(pv->image_next_row % pv->image_rows) * pv->image_stride;
+      if (!pv->image_failed &&
+	  !dyesub_read_row(v, pv, pv->image_next_row, dest))
+	pv->image_failed = 1;
+      pv->image_next_row++;
     }
+  if (pv->image_failed || row <= pv->image_next_row - 1 - pv->image_rows)
+    return NULL;
+  return pv->image_data + (row % pv->image_rows) * pv->image_stride;
+}
 
-  out = &(pv->image_data[row][col * pv->out_channels]);
+/*
+ * The column map, the converted row and the output line are set up once
+ * per job.  col_map holds, for each output column, the offset of its pixel
+ * in a row of image_data.  In landscape mode the rows of image_data are
+ * the columns of the image, so the offset is that of the image row.
+ */
+static void
+dyesub_init_rows(dyesub_print_vars_t *pv)
+{
+  int out_bytes = ((pv->plane_interlacing || pv->row_interlacing) ? 1 : pv->ink_channels)
+  					* pv->bytes_per_ink_channel;
+  int outw_px = MAX(pv->outw_px, 1);
+  int line_px = MAX(pv->prnw_px, MAX(pv->outl_px, 0) + outw_px
+		    + MAX(pv->prnw_px - pv->outr_px, 0));
+  int w, col;
 
-  for (i = 0; i < pv->ink_channels; i++)
+  pv->col_map = stp_malloc(outw_px * sizeof(int));
+  for (w = 0; w < pv->outw_px; w++)
     {
-      if (pv->out_channels == pv->ink_channels)
-        { /* copy out_channel (image) to equiv ink_channel (printer) */
-		if (dyesub_feature(caps, DYESUB_FEATURE_RGBtoYCBCR)) {
-			/* Convert RGB -> YCbCr (JPEG YCbCr444 coefficients) */
-			double R, G, B;
-			double Y, Cr, Cb;
-			R = out[0];
-			G = out[1];
-			B = out[2];
-			
-			Y  = R *  0.29900 + G *  0.58700 + B *  0.11400;
-			Cb = R * -0.16874 + G * -0.33126 + B *  0.50000 + 32768;
-			Cr = R *  0.50000 + G * -0.41869 + B * -0.08131 + 32768;
-			
-			ink[0] = Y;
-			ink[1] = Cb;
-			ink[2] = Cr;
-
-			// XXX this is sub-optimal; we compute the full YCbCr
-			// values and throw away 2/3 for each pixel printed
-			// if we are plane or row interleaved
-		} else {
-			ink[i] = out[i];
-		}
-        }
-      else if (pv->out_channels < pv->ink_channels)
-        { /* several ink_channels (printer) "share" same out_channel (image) */
-          ink[i] = out[i * pv->out_channels / pv->ink_channels];
-        }
-      else /* (pv->out_channels > pv->ink_channels) */
-        { /* merge several out_channels (image) into ink_channel (printer) */
-          int avg = 0;
-          for (j = 0; j < pv->out_channels / pv->ink_channels; j++)
-            avg += out[j + i * pv->out_channels / pv->ink_channels];
-	  ink[i] = avg * pv->ink_channels / pv->out_channels;
-	}
+      col = dyesub_interpolate(w, pv->outw_px, pv->imgw_px);
+      if (pv->plane_lefttoright)
+	col = pv->imgw_px - col - 1;
+      if (pv->print_mode == DYESUB_LANDSCAPE)
+	pv->col_map[w] = (pv->imgw_px - 1 - col) * pv->out_channels;
+      else
+	pv->col_map[w] = col * pv->out_channels;
     }
-   
-  /* Downscale 16bpp to output bpp */
-  /* FIXME:  Do we want to round? */
-  if (pv->bytes_per_ink_channel == 1) 
-    {
-      unsigned char *ink_u8 = (unsigned char *) ink;
-      for (i = 0; i < pv->ink_channels; i++) {
-#if 0
-             if (dyesub_feature(caps, DYESUB_FEATURE_RGBtoYCBCR))
-                     ink_u8[i] = ink[i] >> 8;
-             else
-#endif
-                     ink_u8[i] = ink[i] / 257;
-      }
-    } 
-  else if (pv->bits_per_ink_channel != 16)
+  pv->row_data = stp_malloc(outw_px * pv->ink_channels * sizeof(unsigned short));
+  pv->row_cached = -1;
+  pv->line = stp_malloc(line_px * out_bytes);
+}
+
+static void
+dyesub_free_rows(dyesub_print_vars_t *pv)
+{
+  stp_free(pv->col_map);
+  stp_free(pv->row_data);
+  stp_free(pv->line);
+  pv->col_map = NULL;
+  pv->row_data = NULL;
+  pv->line = NULL;
+}
+
+/*
+ * Convert ink channel `channel' (or all of them if it is -1) of a row into
+ * row_data, one run of outw_px values per channel, already scaled to the
+ * printer's depth and byte order.  The last row converted is kept, so that
+ * rows repeated by scaling or row interlacing are only converted once.
+ * Returns 0 if the row could not be read.
+ */
+static int
+dyesub_convert_row(stp_vars_t *v,
+		dyesub_print_vars_t *pv,
+		const dyesub_cap_t *caps,
+		int row,
+		int channel)
+{
+  int outw_px = pv->outw_px;
+  int first = channel < 0 ? 0 : channel;
+  int last = channel < 0 ? pv->ink_channels - 1 : channel;
+  const unsigned short *image_row;
+  int i, j, w;
+
+  if (pv->row_cached == row &&
+      (pv->channel_cached < 0 || pv->channel_cached == channel))
+    return 1;
+  image_row = dyesub_image_row(v, pv, row);
+  if (!image_row)
+    return 0;
+
+  /* Gather the pixels of the row, channel by channel */
+  for (i = first; i <= last; i++)
     {
-      for (i = 0; i < pv->ink_channels; i++)
-	ink[i] = ink[i] >> (16 - pv->bits_per_ink_channel);
-    }
+      unsigned short *ink = pv->row_data + i * outw_px;
+      int span = 1, offset = i;
+
+      if (pv->out_channels < pv->ink_channels)
+	/* several ink_channels (printer) "share" same out_channel (image) */
+	offset = i * pv->out_channels / pv->ink_channels;
+      else if (pv->out_channels > pv->ink_channels)
+	{ /* merge several out_channels (image) into ink_channel (printer) */
+	  span = pv->out_channels / pv->ink_channels;
+	  offset = i * pv->out_channels / pv->ink_channels;
+	}
 
-  /* Byteswap as needed */
-  if (pv->bytes_per_ink_channel == 2 && pv->byteswap)
-    for (i = 0; i < pv->ink_channels; i++)
-      ink[i] = ((ink[i] >> 8) & 0xff) | ((ink[i] & 0xff) << 8);
+      for (w = 0; w < outw_px; w++)
+	{
+	  const unsigned short *out = image_row + pv->col_map[w];
 
-  if (pv->plane_interlacing || pv->row_interlacing)
-    stp_zfwrite((char *) ink + (plane * pv->bytes_per_ink_channel), 
-		pv->bytes_per_ink_channel, 1, v);
-  else
-      /* print inks in correct order, eg. RGB  BGR */
-      for (b = 0; b < pv->ink_channels; b++)
-	stp_zfwrite((char *) ink + (pv->bytes_per_ink_channel * (pv->ink_order[b]-1)), 
-		    pv->bytes_per_ink_channel, 1, v);
+	  if (pv->out_channels == pv->ink_channels &&
+	      dyesub_feature(caps, DYESUB_FEATURE_RGBtoYCBCR))
+	    {
+	      /* Convert RGB -> YCbCr (JPEG YCbCr444 coefficients) */
+	      double R = out[0], G = out[1], B = out[2];
+	      if (i == 0)
+		ink[w] = R *  0.29900 + G *  0.58700 + B *  0.11400;
+	      else if (i == 1)
+		ink[w] = R * -0.16874 + G * -0.33126 + B *  0.50000 + 32768;
+	      else
+		ink[w] = R *  0.50000 + G * -0.41869 + B * -0.08131 + 32768;
+	    }
+	  else if (span == 1)
+	    ink[w] = out[offset];
+	  else
+	    {
+	      int avg = 0;
+	      for (j = 0; j < span; j++)
+		avg += out[j + offset];
+	      ink[w] = avg * pv->ink_channels / pv->out_channels;
+	    }
+	}
+
+      /* Downscale 16bpp to output bpp */
+      /* FIXME:  Do we want to round? */
+      if (pv->bytes_per_ink_channel == 1)
+	for (w = 0; w < outw_px; w++)
+	  ink[w] = ink[w] / 257;
+      else if (pv->bits_per_ink_channel != 16)
+	for (w = 0; w < outw_px; w++)
+	  ink[w] = ink[w] >> (16 - pv->bits_per_ink_channel);
+
+      /* Byteswap as needed */
+      if (pv->bytes_per_ink_channel == 2 && pv->byteswap)
+	for (w = 0; w < outw_px; w++)
+	  ink[w] = ((ink[w] >> 8) & 0xff) | ((ink[w] & 0xff) << 8);
+    }
 
+  pv->row_cached = row;
+  pv->channel_cached = channel;
   return 1;
 }
 
+/*
+ * Store one row of the image at `line', either just ink channel `plane'
+ * when interlacing or every channel in the printer's ink order.  Returns 0
+ * if the row could not be read.
+ */
 static int
 dyesub_print_row(stp_vars_t *v,
 		dyesub_print_vars_t *pv,
 		const dyesub_cap_t *caps,
 		int row,
-		int plane)
+		int plane,
+		unsigned char *line)
 {
-  int ret = 0;
-  int w, col;
-  
-  for (w = 0; w < pv->outw_px; w++)
+  int outw_px = pv->outw_px;
+  int w, b;
+
+  if (pv->plane_interlacing || pv->row_interlacing)
     {
-      col = dyesub_interpolate(w, pv->outw_px, pv->imgw_px);
-      if (pv->plane_lefttoright)
-	      ret = dyesub_print_pixel(v, pv, caps, row, pv->imgw_px - col - 1, plane);
+      const unsigned short *ink;
+      if (!dyesub_convert_row(v, pv, caps, row,
+			      pv->row_interlacing ? -1 : plane))
+	return 0;
+      ink = pv->row_data + plane * outw_px;
+      if (pv->bytes_per_ink_channel == 1)
+	for (w = 0; w < outw_px; w++)
+	  line[w] = ink[w];
       else
-	      ret = dyesub_print_pixel(v, pv, caps, row, col, plane);
-      if (ret > 1)
-      	break;
+	memcpy(line, ink, outw_px * sizeof(unsigned short));
     }
-  return ret;
+  else
+    {
+      if (!dyesub_convert_row(v, pv, caps, row, -1))
+	return 0;
+      /* print inks in correct order, eg. RGB  BGR */
+      for (b = 0; b < pv->ink_channels; b++)
+	{
+	  const unsigned short *ink =
+	    pv->row_data + (pv->ink_order[b] - 1) * outw_px;
+	  if (pv->bytes_per_ink_channel == 1)
+	    {
+	      unsigned char *out = line + b;
+	      for (w = 0; w < outw_px; w++, out += pv->ink_channels)
+		*out = ink[w];
+	    }
+	  else
+	    {
+	      unsigned char *out = line + b * 2;
+	      for (w = 0; w < outw_px; w++, out += pv->ink_channels * 2)
+		memcpy(out, &ink[w], 2);
+	    }
+	}
+    }
+  return 1;
 }
 
 static int
@@ -5444,6 +5607,19 @@ dyesub_print_plane(stp_vars_t *v,
   int h, row, p;
   int out_bytes = ((pv->plane_interlacing || pv->row_interlacing) ? 1 : pv->ink_channels)
   					* pv->bytes_per_ink_channel;
+  int left_px = 0, right_px = 0;
+  int line_px = MAX(pv->prnw_px, MAX(pv->outl_px, 0) + MAX(pv->outw_px, 1)
+		    + MAX(pv->prnw_px - pv->outr_px, 0));
+
+  if (dyesub_feature(caps, DYESUB_FEATURE_FULL_WIDTH))
+    {
+      if (pv->outl_px > 0)
+	left_px = pv->outl_px;		/* empty part left of image area */
+      if (pv->outr_px < pv->prnw_px)
+	right_px = pv->prnw_px - pv->outr_px;	/* ...and right of it */
+    }
+  /* Only the image part of the line changes from row to row */
+  (void) memset(pv->line, pv->empty_byte[plane], line_px * out_bytes);
 
   for (h = 0; h <= pv->prnb_px - pv->prnt_px; h++)
     {
@@ -5464,28 +5640,24 @@ dyesub_print_plane(stp_vars_t *v,
 
       if (h + pv->prnt_px < pv->outt_px || h + pv->prnt_px >= pv->outb_px)
         { /* empty part above or below image area */
-          dyesub_nputc(v, pv->empty_byte[plane], out_bytes * pv->prnw_px);
+	  (void) memset(pv->line, pv->empty_byte[plane],
+			out_bytes * pv->prnw_px);
+	  stp_zfwrite((char *) pv->line, out_bytes * pv->prnw_px, 1, v);
 	}
       else
         {
-	  if (dyesub_feature(caps, DYESUB_FEATURE_FULL_WIDTH)
-	  	&& pv->outl_px > 0)
-	    { /* empty part left of image area */
-              dyesub_nputc(v, pv->empty_byte[plane], out_bytes * pv->outl_px);
-	    }
-
 	  row = dyesub_interpolate(h + pv->prnt_px - pv->outt_px,
 	  					pv->outh_px, pv->imgh_px);
 	  stp_deprintf(STP_DBG_DYESUB,
 	  	"dyesub_print_plane: h = %d, row = %d\n", h, row);
-	  ret = dyesub_print_row(v, pv, caps, row, p);
-
-	  if (dyesub_feature(caps, DYESUB_FEATURE_FULL_WIDTH)
-	  	&& pv->outr_px < pv->prnw_px)
-	    { /* empty part right of image area */
-	      dyesub_nputc(v, pv->empty_byte[plane], out_bytes
-	      				* (pv->prnw_px - pv->outr_px));
-	    }
+	  ret = dyesub_print_row(v, pv, caps, row, p,
+				 pv->line + left_px * out_bytes);
+	  if (!ret)
+	    /* keep the job well formed, leaving the rest of the image blank */
+	    (void) memset(pv->line + left_px * out_bytes, pv->empty_byte[plane],
+			  out_bytes * pv->outw_px);
+	  stp_zfwrite((char *) pv->line,
+		      out_bytes * (left_px + pv->outw_px + right_px), 1, v);
 	}
 
       if (h + pv->prnt_px == privdata.block_max_h)
@@ -5637,7 +5809,15 @@ dyesub_do_print(stp_vars_t *v, stp_image_t *image)
 #endif    
   }
 
-  pv.image_data = dyesub_read_image(v, &pv, image);
+  pv.plane_interlacing = dyesub_feature(caps, DYESUB_FEATURE_PLANE_INTERLACE);
+  pv.row_interlacing = dyesub_feature(caps, DYESUB_FEATURE_ROW_INTERLACE);
+  pv.plane_lefttoright = dyesub_feature(caps, DYESUB_FEATURE_PLANE_LEFTTORIGHT);
+  pv.print_mode = page_mode;
+  if (!dyesub_read_image(v, &pv, image))
+    {
+      stp_image_conclude(image);
+      return 2;
+    }
   if (ink_type) {
 	  if (dyesub_feature(caps, DYESUB_FEATURE_RGBtoYCBCR)) {
 		  pv.empty_byte[0] = 0xff; /* Y */
@@ -5657,16 +5837,6 @@ dyesub_do_print(stp_vars_t *v, stp_image_t *image)
 	  pv.empty_byte[1] = 0x0;
 	  pv.empty_byte[2] = 0x0;
   }
-  
-  pv.plane_interlacing = dyesub_feature(caps, DYESUB_FEATURE_PLANE_INTERLACE);
-  pv.row_interlacing = dyesub_feature(caps, DYESUB_FEATURE_ROW_INTERLACE);
-  pv.plane_lefttoright = dyesub_feature(caps, DYESUB_FEATURE_PLANE_LEFTTORIGHT);
-  pv.print_mode = page_mode;
-  if (!pv.image_data)
-    {
-      stp_image_conclude(image);
-      return 2;
-    }
   /* /FIXME */
 
   /* FIXME:  Provide a way of disabling/altering these curves */
@@ -5726,6 +5896,8 @@ dyesub_do_print(stp_vars_t *v, stp_image_t *image)
   privdata.print_mode = pv.print_mode;
   privdata.bpp = pv.bits_per_ink_channel;
 
+  dyesub_init_rows(&pv);
+
   /* printer init */
   dyesub_exec(v, caps->printer_init_func, "caps->printer_init");
 
@@ -5746,6 +5918,9 @@ dyesub_do_print(stp_vars_t *v, stp_image_t *image)
   /* printer end */
   dyesub_exec(v, caps->printer_end_func, "caps->printer_end");
 
+  dyesub_free_rows(&pv);
+  if (pv.image_failed)
+    status = 2;
   dyesub_free_image(&pv, image);
   stp_image_conclude(image);
   return status;
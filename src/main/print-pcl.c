@@ -44,6 +44,7 @@
  */
 static void	pcl_mode0(stp_vars_t *, unsigned char *, int, int);
 static void	pcl_mode2(stp_vars_t *, unsigned char *, int, int);
+static void	pcl_mode_adaptive(stp_vars_t *, unsigned char *, int, int);
 
 #ifndef MAX
 #  define MAX(a, b) ((a) > (b) ? (a) : (b))
@@ -62,6 +63,14 @@ typedef struct
   int duplex;
   int tumble;
   int use_crd;
+  int use_delta;		/* Mode 3 (delta row) may be used */
+  int use_crdr;			/* Mode 9 (compressed replacement) may be used */
+  int comp_mode;		/* Compression mode currently selected */
+  unsigned char *delta_buf;	/* Mode 3 output */
+  unsigned char *crdr_buf;	/* Mode 9 output */
+  unsigned char **seed_rows;	/* Previous row sent, per plane */
+  int seed_count;		/* Number of seed rows allocated */
+  int plane;			/* Plane within the current row */
 } pcl_privdata_t;
 
 /*
@@ -330,6 +339,9 @@ typedef struct {
 #define PCL_PRINTER_CUSTOM_SIZE	32	/* Custom sizes supported */
 #define PCL_PRINTER_BLANKLINE	64	/* Blank line removal supported */
 #define PCL_PRINTER_DUPLEX	128	/* Printer can have duplexer */
+#define PCL_PRINTER_DELTA_ROW	256	/* Delta row (mode 3) compression */
+#define PCL_PRINTER_CRDR	512	/* Compressed replacement delta row
+					   (mode 9) compression */
 
 /*
  * FIXME - the 520 shouldn't be lumped in with the 500 as it supports
@@ -810,7 +822,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {7, 41, 18, 18},
     {7, 41, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_DJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_DJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     dj500_papersizes,
     basic_papertypes,
     dj_papersources,
@@ -823,7 +836,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {7, 33, 18, 18},
     {7, 33, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMY,
-    PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     dj500_papersizes,
     basic_papertypes,
     dj_papersources,
@@ -837,7 +851,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {7, 33, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMY,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     dj540_papersizes,
     basic_papertypes,
     dj_papersources,
@@ -850,7 +865,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {3, 33, 18, 18},
     {5, 33, 10, 10},
     PCL_COLOR_CMYK,
-    PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
 /* The 550/560 support COM10 and DL envelope, but the control codes
    are negative, indicating landscape mode. This needs thinking about! */
     dj340_papersizes,
@@ -866,7 +882,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {0, 33, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMY,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW | PCL_PRINTER_CRDR,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -880,7 +897,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {0, 33, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW | PCL_PRINTER_CRDR,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -894,7 +912,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {0, 33, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK | PCL_COLOR_CMYKcm,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW | PCL_PRINTER_CRDR,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -908,7 +927,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {5, 33, 10, 10},
     PCL_COLOR_CMYK | PCL_COLOR_CMYK4,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW | PCL_PRINTER_CRDR,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -922,7 +942,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {0, 33, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK | PCL_COLOR_CMYK4b,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW | PCL_PRINTER_CRDR,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -936,7 +957,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {5, 33, 10, 10},	/* Oliver Vecernik */
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DUPLEX |
+      PCL_PRINTER_DELTA_ROW | PCL_PRINTER_CRDR,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -950,7 +972,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {5, 33, 10, 10},
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW | PCL_PRINTER_CRDR,
     dj1220_papersizes,
     basic_papertypes,
     emptylist,
@@ -964,7 +987,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {5, 33, 10, 10},
     PCL_COLOR_CMYK | PCL_COLOR_CMYK4,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     dj1100_papersizes,
     basic_papertypes,
     dj_papersources,
@@ -978,7 +1002,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMY,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     dj1200_papersizes,
     basic_papertypes,
     dj_papersources,
@@ -992,7 +1017,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW | PCL_PRINTER_CRDR,
     dj1200_papersizes,
     basic_papertypes,
     dj_papersources,
@@ -1006,7 +1032,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {0, 35, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     dj2000_papersizes,
     new_papertypes,
     dj_papersources,
@@ -1020,7 +1047,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     dj2500_papersizes,
     new_papertypes,
     dj2500_papersources,
@@ -1098,7 +1126,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1111,7 +1140,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1124,7 +1154,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1137,7 +1168,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1150,7 +1182,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1163,7 +1196,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljtabloid_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1176,7 +1210,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1189,7 +1224,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1203,7 +1239,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX |
+      PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1217,7 +1254,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX |
+      PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1231,7 +1269,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX |
+      PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1245,7 +1284,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX |
+      PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1259,7 +1299,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX |
+      PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1273,7 +1314,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX |
+      PCL_PRINTER_DELTA_ROW,
     ljtabloid_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1287,7 +1329,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX |
+      PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -2124,6 +2167,20 @@ pcl_describe_output(const stp_vars_t *v)
     return "Grayscale";
 }
 
+/*
+ * 'pcl_clear_seed_rows()' - Reset the delta compression seed rows to white,
+ *                           as the printer does on a Y offset.
+ */
+
+static void
+pcl_clear_seed_rows(pcl_privdata_t *pd)
+{
+  int i;
+
+  for (i = 0; i < pd->seed_count; i++)
+    memset(pd->seed_rows[i], 0, pd->height);
+}
+
 /*
  * 'pcl_print()' - Print an image to an HP printer.
  */
@@ -2165,6 +2222,7 @@ pcl_printfunc(stp_vars_t *v)
 	      stp_deprintf(STP_DBG_PCL, "Blank Lines = %d\n", pd->blank_lines);
 	      stp_zprintf(v, "\033*b%dY", pd->blank_lines);
 	      pd->blank_lines=0;
+	      pcl_clear_seed_rows(pd);	/* Y clears the seed rows */
 	    }
 	  else;
 	}
@@ -2250,6 +2308,13 @@ get_double_param(stp_vars_t *v, const char *param)
     return 1.0;
 }
 
+static void
+pcl_write_row(stp_vars_t *v, int y, void *data)
+{
+  pcl_printfunc(v);
+  stp_deprintf(STP_DBG_PCL, "pcl_print: y = %d\n", y);
+}
+
 static int
 pcl_do_print(stp_vars_t *v, stp_image_t *image)
 {
@@ -2279,14 +2344,7 @@ pcl_do_print(stp_vars_t *v, stp_image_t *image)
 		page_right,
 		page_bottom,
 		out_width,	/* Width of image on page */
-		out_height,	/* Height of image on page */
-		errdiv,		/* Error dividend */
-		errmod,		/* Error modulus */
-		errval,		/* Current error value */
-		errline,	/* Current raster line */
-		errlast;	/* Last raster line loaded */
-  unsigned	zero_mask;
-  int           image_height;
+		out_height;	/* Height of image on page */
   const pcl_cap_t *caps;		/* Printer capabilities */
   int		planes = 3;	/* # of output planes */
   int		pcl_media_size; /* PCL media size code */
@@ -2315,7 +2373,6 @@ pcl_do_print(stp_vars_t *v, stp_image_t *image)
   */
 
   stp_image_init(image);
-  image_height = stp_image_height(image);
 
  /*
   * Figure out the output resolution...
@@ -2375,8 +2432,6 @@ pcl_do_print(stp_vars_t *v, stp_image_t *image)
   left -= page_left;
   top -= page_top;
 
-  image_height = stp_image_height(image);
-
  /*
   * Set media size here because it is needed by the margin calculation code.
   */
@@ -2747,11 +2802,37 @@ pcl_do_print(stp_vars_t *v, stp_image_t *image)
 
 /* Allocate buffer for pcl_mode2 tiff compression */
 
+  privdata.use_delta = 0;
+  privdata.use_crdr = 0;
+  privdata.comp_mode = 2;
+  privdata.delta_buf = NULL;
+  privdata.crdr_buf = NULL;
+  privdata.seed_rows = NULL;
+  privdata.seed_count = 0;
+  privdata.plane = 0;
+
   if ((caps->stp_printer_type & PCL_PRINTER_TIFF) == PCL_PRINTER_TIFF &&
       !(stp_get_debug_level() & STP_DBG_NO_COMPRESSION))
   {
     privdata.comp_buf = stp_malloc((privdata.height + 128 + 7) * 129 / 128);
-    privdata.writefunc = pcl_mode2;
+    privdata.use_delta = ((caps->stp_printer_type & PCL_PRINTER_DELTA_ROW) ==
+			  PCL_PRINTER_DELTA_ROW);
+    privdata.use_crdr = ((caps->stp_printer_type & PCL_PRINTER_CRDR) ==
+			 PCL_PRINTER_CRDR);
+    if (privdata.use_delta || privdata.use_crdr)
+    {
+      /*
+       * Neither delta encoding can grow a row by more than one command
+       * byte per data byte plus a few offset extension bytes.
+       */
+      if (privdata.use_delta)
+	privdata.delta_buf = stp_malloc(privdata.height * 2 + 16);
+      if (privdata.use_crdr)
+	privdata.crdr_buf = stp_malloc(privdata.height * 2 + 16);
+      privdata.writefunc = pcl_mode_adaptive;
+    }
+    else
+      privdata.writefunc = pcl_mode2;
   }
   else
   {
@@ -2876,11 +2957,6 @@ pcl_do_print(stp_vars_t *v, stp_image_t *image)
 
   (void) stp_color_init(v, image, 65536);
 
-  errdiv  = image_height / out_height;
-  errmod  = image_height % out_height;
-  errval  = 0;
-  errlast = -1;
-  errline  = 0;
   privdata.blank_lines = 0;
 #ifndef PCL_DEBUG_DISABLE_BLANKLINE_REMOVAL
   privdata.do_blank = ((caps->stp_printer_type & PCL_PRINTER_BLANKLINE) ==
@@ -2890,31 +2966,7 @@ pcl_do_print(stp_vars_t *v, stp_image_t *image)
 #endif
   stp_allocate_component_data(v, "Driver", NULL, NULL, &privdata);
 
-  for (y = 0; y < out_height; y ++)
-  {
-    int duplicate_line = 1;
-    if (errline != errlast)
-    {
-      errlast = errline;
-      duplicate_line = 0;
-      if (stp_color_get_row(v, image, errline, &zero_mask))
-	{
-	  status = 2;
-	  break;
-	}
-    }
-    stp_dither(v, y, duplicate_line, zero_mask, NULL);
-    pcl_printfunc(v);
-    stp_deprintf(STP_DBG_PCL,"pcl_print: y = %d, line = %d, val = %d, mod = %d, height = %d\n",
-		  y, errline, errval, errmod, out_height);
-    errval += errmod;
-    errline += errdiv;
-    if (errval >= out_height)
-    {
-      errval -= out_height;
-      errline ++;
-    }
-  }
+  status = stpi_render_rows(v, image, out_height, NULL, pcl_write_row, NULL);
 
 /* Output trailing blank lines (may not be required?) */
 
@@ -2948,6 +3000,16 @@ pcl_do_print(stp_vars_t *v, stp_image_t *image)
 
   if (privdata.comp_buf != NULL)
     stp_free(privdata.comp_buf);
+  if (privdata.delta_buf != NULL)
+    stp_free(privdata.delta_buf);
+  if (privdata.crdr_buf != NULL)
+    stp_free(privdata.crdr_buf);
+  if (privdata.seed_rows != NULL)
+  {
+    for (y = 0; y < privdata.seed_count; y++)
+      stp_free(privdata.seed_rows[y]);
+    stp_free(privdata.seed_rows);
+  }
 
   if ((caps->stp_printer_type & PCL_PRINTER_NEW_ERG) == PCL_PRINTER_NEW_ERG)
     stp_puts("\033*rC", v);
@@ -3036,6 +3098,244 @@ pcl_mode2(stp_vars_t *v,		/* I - Print file or command */
 }
 
 
+/*
+ * 'pcl_put_extension()' - Write the extension bytes of a mode 3 or mode 9
+ *                         offset or count: 255 for as long as needed, then
+ *                         the remainder (which may be zero).
+ */
+
+static unsigned char *
+pcl_put_extension(unsigned char *out, int value)
+{
+  while (value >= 255)
+  {
+    *out++ = 255;
+    value -= 255;
+  }
+  *out++ = value;
+  return out;
+}
+
+
+/*
+ * 'pcl_delta_row()' - Encode a line against its seed row using mode 3
+ *                     (delta row) compression.  Returns the encoded length;
+ *                     zero means the line is identical to the seed row.
+ */
+
+static int
+pcl_delta_row(const unsigned char *line,	/* I - Line to send */
+	      const unsigned char *seed,	/* I - Previous line */
+	      int           len,		/* I - Length of line */
+	      unsigned char *out)		/* O - Encoded line */
+{
+  unsigned char *start = out;
+  int last = 0;				/* End of the last replacement */
+  int i = 0;
+
+  while (i < len)
+  {
+    int first, offset;
+
+    while (i < len && line[i] == seed[i])
+      i++;
+    if (i >= len)
+      break;
+    first = i;
+    while (i < len && line[i] != seed[i])
+      i++;
+
+   /*
+    * Each command replaces up to 8 bytes.  The offset is relative to the
+    * end of the previous replacement, so only the first command of a run
+    * carries one.
+    */
+
+    offset = first - last;
+    while (first < i)
+    {
+      int count = i - first > 8 ? 8 : i - first;
+
+      *out++ = ((count - 1) << 5) | (offset < 31 ? offset : 31);
+      if (offset >= 31)
+	out = pcl_put_extension(out, offset - 31);
+      memcpy(out, line + first, count);
+      out += count;
+      first += count;
+      offset = 0;
+    }
+    last = i;
+  }
+  return out - start;
+}
+
+
+/*
+ * 'pcl_crdr()' - Encode a line against its seed row using mode 9
+ *                (compressed replacement delta row) compression.  Changed
+ *                spans are sent as literal or run-length replacements.
+ *                Returns the encoded length; zero means the line is
+ *                identical to the seed row.
+ */
+
+static int
+pcl_crdr(const unsigned char *line,		/* I - Line to send */
+	 const unsigned char *seed,		/* I - Previous line */
+	 int           len,			/* I - Length of line */
+	 unsigned char *out)			/* O - Encoded line */
+{
+  unsigned char *start = out;
+  int last = 0;				/* End of the last replacement */
+  int i = 0;
+
+  while (i < len)
+  {
+    int first, end;
+
+    while (i < len && line[i] == seed[i])
+      i++;
+    if (i >= len)
+      break;
+    first = i;
+    while (i < len && line[i] != seed[i])
+      i++;
+    end = i;
+
+    while (first < end)
+    {
+      int offset = first - last;
+      int lit = first;
+      int count;
+
+     /*
+      * Collect literal bytes up to the next run of three or more
+      * identical bytes, which is cheaper sent run-length encoded.
+      */
+
+      while (lit < end &&
+	     !(lit + 2 < end && line[lit] == line[lit + 1] &&
+	       line[lit] == line[lit + 2]))
+	lit++;
+      if (lit > first)
+      {
+	count = lit - first;
+	*out++ = ((offset < 15 ? offset : 15) << 3) |
+	  (count - 1 < 7 ? count - 1 : 7);
+	if (offset >= 15)
+	  out = pcl_put_extension(out, offset - 15);
+	if (count - 1 >= 7)
+	  out = pcl_put_extension(out, count - 1 - 7);
+	memcpy(out, line + first, count);
+	out += count;
+	first = lit;
+	last = lit;
+	continue;
+      }
+
+      count = 1;
+      while (first + count < end && line[first + count] == line[first])
+	count++;
+      *out++ = 0x80 | ((offset < 3 ? offset : 3) << 5) |
+	(count - 2 < 31 ? count - 2 : 31);
+      if (offset >= 3)
+	out = pcl_put_extension(out, offset - 3);
+      if (count - 2 >= 31)
+	out = pcl_put_extension(out, count - 2 - 31);
+      *out++ = line[first];
+      first += count;
+      last = first;
+    }
+  }
+  return out - start;
+}
+
+
+/*
+ * 'pcl_mode_adaptive()' - Send PCL graphics using whichever of mode 2 (TIFF),
+ *                         mode 3 (delta row) and mode 9 (compressed
+ *                         replacement delta row) needs the fewest bytes.
+ */
+
+static void
+pcl_mode_adaptive(stp_vars_t *v,	/* I - Print file or command */
+		  unsigned char *line,	/* I - Output bitmap data */
+		  int           height,	/* I - Height of bitmap data */
+		  int           last_plane) /* I - True if this is the last plane */
+{
+  pcl_privdata_t *pd =
+    (pcl_privdata_t *) stp_get_component_data(v, "Driver");
+  unsigned char *comp_ptr;
+  unsigned char *seed;
+  const unsigned char *best;
+  int best_len, best_mode, best_cost;
+  int plane = pd->plane;
+
+  if (plane >= pd->seed_count)
+  {
+    int i;
+    pd->seed_rows = stp_realloc(pd->seed_rows,
+				(plane + 1) * sizeof(unsigned char *));
+    for (i = pd->seed_count; i <= plane; i++)
+      pd->seed_rows[i] = stp_zalloc(pd->height);
+    pd->seed_count = plane + 1;
+  }
+  seed = pd->seed_rows[plane];
+
+ /*
+  * Switching modes costs a couple of bytes in the command, so the current
+  * mode wins ties and near misses.
+  */
+
+  stp_pack_tiff(v, line, height, pd->comp_buf, &comp_ptr, NULL, NULL);
+  best = pd->comp_buf;
+  best_len = comp_ptr - pd->comp_buf;
+  best_mode = 2;
+  best_cost = best_len + (pd->comp_mode != 2 ? 2 : 0);
+
+  if (pd->use_delta)
+  {
+    int len = pcl_delta_row(line, seed, height, pd->delta_buf);
+    int cost = len + (pd->comp_mode != 3 ? 2 : 0);
+    if (cost < best_cost)
+    {
+      best = pd->delta_buf;
+      best_len = len;
+      best_mode = 3;
+      best_cost = cost;
+    }
+  }
+  if (pd->use_crdr)
+  {
+    int len = pcl_crdr(line, seed, height, pd->crdr_buf);
+    int cost = len + (pd->comp_mode != 9 ? 2 : 0);
+    if (cost < best_cost)
+    {
+      best = pd->crdr_buf;
+      best_len = len;
+      best_mode = 9;
+      best_cost = cost;
+    }
+  }
+
+ /*
+  * Send a line of raster graphics...
+  */
+
+  if (best_mode != pd->comp_mode)
+  {
+    stp_zprintf(v, "\033*b%dm%d%c", best_mode, best_len,
+		last_plane ? 'W' : 'V');
+    pd->comp_mode = best_mode;
+  }
+  else
+    stp_zprintf(v, "\033*b%d%c", best_len, last_plane ? 'W' : 'V');
+  stp_zfwrite((const char *)best, best_len, 1, v);
+
+  memcpy(seed, line, height);
+  pd->plane = last_plane ? 0 : plane + 1;
+}
+
+
 static stp_family_t print_pcl_module_data =
   {
     &print_pcl_printfuncs,
@@ -0,0 +1,232 @@
+/*
+ *   Render sessions: state kept from one page of a job to the next
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * A filter printing a long job calls stp_print() once per page, and each
+ * call verifies the settings and builds the color tables and dither
+ * matrix from scratch, although they are almost always the same as for
+ * the previous page.  A session remembers them.
+ *
+ * The session records the settings of the page it last printed.  When
+ * the next page's settings are the same, apart from the page number, the
+ * color and dither code may pick up what they left in the session (see
+ * stpi_session_get_data()); when anything else has changed, everything
+ * kept is thrown away first.  Verification results are remembered for a
+ * few sets of settings, since the driver verifies its own copy of the
+ * settings as well as the caller's.
+ *
+ * The session reaches the color and dither code as component data of the
+ * vars being printed, which copies of those vars share.  A session serves
+ * one page at a time.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#include <string.h>
+
+#define SESSION_VERIFY_SLOTS 4
+
+/* The only setting that is expected to change from page to page */
+#define PAGE_PARAMETER "PageNumber"
+
+typedef struct
+{
+  stp_vars_t *settings;
+  int status;
+} verified_settings_t;
+
+typedef struct
+{
+  char *name;
+  void *data;
+  stp_free_data_func_t freefunc;
+} session_data_t;
+
+struct stp_session
+{
+  stp_vars_t *settings;		/* Settings of the last page printed */
+  stp_list_t *data;		/* State kept for those settings */
+  verified_settings_t verified[SESSION_VERIFY_SLOTS];
+  int next_verified;
+};
+
+static const char *
+session_data_namefunc(const void *item)
+{
+  return ((const session_data_t *) item)->name;
+}
+
+static void
+session_data_freefunc(void *item)
+{
+  session_data_t *sd = (session_data_t *) item;
+  if (sd->freefunc)
+    (sd->freefunc)(sd->data);
+  stp_free(sd->name);
+  stp_free(sd);
+}
+
+static stp_list_t *
+create_session_data_list(void)
+{
+  stp_list_t *ret = stp_list_create();
+  stp_list_set_freefunc(ret, session_data_freefunc);
+  stp_list_set_namefunc(ret, session_data_namefunc);
+  return ret;
+}
+
+stp_session_t *
+stp_session_create(void)
+{
+  stp_session_t *session = stp_zalloc(sizeof(stp_session_t));
+  session->data = create_session_data_list();
+  return session;
+}
+
+void
+stp_session_destroy(stp_session_t *session)
+{
+  int i;
+  if (!session)
+    return;
+  stp_list_destroy(session->data);
+  if (session->settings)
+    stp_vars_destroy(session->settings);
+  for (i = 0; i < SESSION_VERIFY_SLOTS; i++)
+    if (session->verified[i].settings)
+      stp_vars_destroy(session->verified[i].settings);
+  stp_free(session);
+}
+
+/*
+ * The page number is left out when settings are compared, so it has to
+ * be checked on its own.
+ */
+static int
+page_parameter_ok(stp_vars_t *v)
+{
+  if (!stp_check_int_parameter(v, PAGE_PARAMETER, STP_PARAMETER_INACTIVE))
+    return 1;
+  return stp_verify_parameter(v, PAGE_PARAMETER, 1) == PARAMETER_OK;
+}
+
+int
+stp_session_verify(stp_session_t *session, stp_vars_t *v)
+{
+  verified_settings_t *slot;
+  int i;
+  for (i = 0; i < SESSION_VERIFY_SLOTS; i++)
+    {
+      slot = &(session->verified[i]);
+      if (slot->settings &&
+	  stpi_vars_settings_equal(slot->settings, v, PAGE_PARAMETER) &&
+	  page_parameter_ok(v))
+	{
+	  stp_dprintf(STP_DBG_VARS, v, "Session: settings already verified\n");
+	  stp_set_verified(v, slot->status);
+	  return slot->status;
+	}
+    }
+  slot = &(session->verified[session->next_verified]);
+  session->next_verified = (session->next_verified + 1) % SESSION_VERIFY_SLOTS;
+  if (slot->settings)
+    stp_vars_destroy(slot->settings);
+  slot->status = stpi_verify_settings(v);
+  slot->settings = stp_vars_create_copy(v);
+  return slot->status;
+}
+
+int
+stp_session_print(stp_session_t *session, const stp_vars_t *v,
+		  stp_image_t *image)
+{
+  stp_vars_t *nv;
+  int status;
+  if (!session->settings ||
+      !stpi_vars_settings_equal(session->settings, v, PAGE_PARAMETER))
+    {
+      stp_dprintf(STP_DBG_VARS, v, "Session: new settings\n");
+      stp_list_destroy(session->data);
+      session->data = create_session_data_list();
+      if (session->settings)
+	stp_vars_destroy(session->settings);
+      session->settings = stp_vars_create_copy(v);
+    }
+  nv = stp_vars_create_copy(v);
+  stp_allocate_component_data(nv, "Session", NULL, NULL, session);
+  status = stp_print(nv, image);
+  stp_vars_destroy(nv);
+  return status;
+}
+
+stp_session_t *
+stpi_get_session(const stp_vars_t *v)
+{
+  return (stp_session_t *) stp_get_component_data(v, "Session");
+}
+
+/*
+ * State kept in the session of the page being printed, by name; NULL if
+ * there is none, or if the page is not being printed in a session.  The
+ * caller still has to check that what it finds fits the page: it is only
+ * known to have been made for the same settings.
+ */
+void *
+stpi_session_get_data(const stp_vars_t *v, const char *name)
+{
+  stp_session_t *session = stpi_get_session(v);
+  stp_list_item_t *item;
+  if (!session)
+    return NULL;
+  item = stp_list_get_item_by_name(session->data, name);
+  if (item)
+    return ((session_data_t *) stp_list_item_get_data(item))->data;
+  else
+    return NULL;
+}
+
+/*
+ * Hand state over to the session, replacing (and freeing) anything kept
+ * under the same name.  Without a session the data is freed at once.
+ */
+void
+stpi_session_set_data(const stp_vars_t *v, const char *name, void *data,
+		      stp_free_data_func_t freefunc)
+{
+  stp_session_t *session = stpi_get_session(v);
+  session_data_t *sd;
+  stp_list_item_t *item;
+  if (!session)
+    {
+      if (freefunc)
+	(freefunc)(data);
+      return;
+    }
+  item = stp_list_get_item_by_name(session->data, name);
+  if (item)
+    stp_list_item_destroy(session->data, item);
+  sd = stp_malloc(sizeof(session_data_t));
+  sd->name = stp_strdup(name);
+  sd->data = data;
+  sd->freefunc = freefunc;
+  stp_list_item_create(session->data, NULL, sd);
+}
@@ -86,13 +86,29 @@ typedef struct
     }									\
 }
 
+/*
+ * Printer commands are short, so they are normally formatted on the
+ * stack; only longer output is allocated.
+ */
+#define ZPRINTF_BUFSIZE 256
+
 void
 stp_zprintf(const stp_vars_t *v, const char *format, ...)
 {
+  char buf[ZPRINTF_BUFSIZE];
   char *result;
   int bytes;
+  va_list args;
+  va_start(args, format);
+  bytes = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (bytes >= 0 && bytes < sizeof(buf))
+    {
+      stpi_vars_output(v, buf, bytes);
+      return;
+    }
   STPI_VASPRINTF(result, bytes, format);
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), result, bytes);
+  stpi_vars_output(v, result, bytes);
   stp_free(result);
 }
 
@@ -121,20 +137,20 @@ stp_catprintf(char **strp, const char *format, ...)
 void
 stp_zfwrite(const char *buf, size_t bytes, size_t nitems, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), buf, bytes * nitems);
+  stpi_vars_output(v, buf, bytes * nitems);
 }
 
 void
 stp_write_raw(const stp_raw_t *raw, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), raw->data, raw->bytes);
+  stpi_vars_output(v, raw->data, raw->bytes);
 }
 
 void
 stp_putc(int ch, const stp_vars_t *v)
 {
-  unsigned char a = (unsigned char) ch;
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), (char *) &a, 1);
+  char a = (unsigned char) ch;
+  stpi_vars_output(v, &a, 1);
 }
 
 #define BYTE(expr, byteno) (((expr) >> (8 * byteno)) & 0xff)
@@ -142,45 +158,53 @@ stp_putc(int ch, const stp_vars_t *v)
 void
 stp_put16_le(unsigned short sh, const stp_vars_t *v)
 {
-  stp_putc(BYTE(sh, 0), v);
-  stp_putc(BYTE(sh, 1), v);
+  char buf[2];
+  buf[0] = BYTE(sh, 0);
+  buf[1] = BYTE(sh, 1);
+  stpi_vars_output(v, buf, 2);
 }
 
 void
 stp_put16_be(unsigned short sh, const stp_vars_t *v)
 {
-  stp_putc(BYTE(sh, 1), v);
-  stp_putc(BYTE(sh, 0), v);
+  char buf[2];
+  buf[0] = BYTE(sh, 1);
+  buf[1] = BYTE(sh, 0);
+  stpi_vars_output(v, buf, 2);
 }
 
 void
 stp_put32_le(unsigned int in, const stp_vars_t *v)
 {
-  stp_putc(BYTE(in, 0), v);
-  stp_putc(BYTE(in, 1), v);
-  stp_putc(BYTE(in, 2), v);
-  stp_putc(BYTE(in, 3), v);
+  char buf[4];
+  buf[0] = BYTE(in, 0);
+  buf[1] = BYTE(in, 1);
+  buf[2] = BYTE(in, 2);
+  buf[3] = BYTE(in, 3);
+  stpi_vars_output(v, buf, 4);
 }
 
 void
 stp_put32_be(unsigned int in, const stp_vars_t *v)
 {
-  stp_putc(BYTE(in, 3), v);
-  stp_putc(BYTE(in, 2), v);
-  stp_putc(BYTE(in, 1), v);
-  stp_putc(BYTE(in, 0), v);
+  char buf[4];
+  buf[0] = BYTE(in, 3);
+  buf[1] = BYTE(in, 2);
+  buf[2] = BYTE(in, 1);
+  buf[3] = BYTE(in, 0);
+  stpi_vars_output(v, buf, 4);
 }
 
 void
 stp_puts(const char *s, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), s, strlen(s));
+  stpi_vars_output(v, s, strlen(s));
 }
 
 void
 stp_putraw(const stp_raw_t *r, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), r->data, r->bytes);
+  stpi_vars_output(v, r->data, r->bytes);
 }
 
 void
@@ -488,6 +512,9 @@ stp_init(void)
       stpi_init_printer();
       stpi_init_paper();
       stpi_init_dither();
+      stpi_init_color_kernels();
+      stpi_init_pack_kernels();
+      stpi_init_bit_kernels();
       /* Load modules */
       if (stp_module_load())
 	return 1;
@@ -63,6 +63,15 @@ struct stp_compdata
   void *data;
 };
 
+#define OUTBUF_SIZE 65536
+
+typedef struct			/* Output not yet sent to outfunc */
+{
+  int refcount;			/* Vars objects sharing the buffer */
+  size_t bytes;			/* Bytes waiting in data */
+  char *data;			/* OUTBUF_SIZE bytes, allocated when used */
+} outbuf_t;
+
 struct stp_vars			/* Plug-in variables */
 {
   char *driver;			/* Name of printer "driver" */
@@ -76,7 +85,9 @@ struct stp_vars			/* Plug-in variables */
   stp_list_t *params[STP_PARAMETER_TYPE_INVALID];
   stp_list_t *internal_data;
   void (*outfunc)(void *data, const char *buffer, size_t bytes);
+  void (*outvfunc)(void *data, const stp_raw_t *vec, int count);
   void *outdata;
+  outbuf_t *outbuf;		/* Shared with copies */
   void (*errfunc)(void *data, const char *buffer, size_t bytes);
   void *errdata;
   int verified;			/* Ensure that params are OK! */
@@ -239,10 +250,15 @@ static void *
 compdata_copyfunc(const void *item)
 {
   const compdata_t *cd = (const compdata_t *) (item);
+  compdata_t *ret = stp_malloc(sizeof(compdata_t));
+  ret->name = stp_strdup(cd->name);
+  ret->copyfunc = cd->copyfunc;
+  ret->freefunc = cd->freefunc;
   if (cd->copyfunc)
-    return (cd->copyfunc)(cd->data);
+    ret->data = (cd->copyfunc)(cd->data);
   else
-    return cd->data;
+    ret->data = cd->data;
+  return ret;
 }
 
 void
@@ -304,7 +320,29 @@ copy_compdata_list(const stp_list_t *src)
   const stp_list_item_t *item = stp_list_get_start(src);
   while (item)
     {
-      stp_list_item_create(ret, NULL, compdata_copyfunc(item));
+      stp_list_item_create(ret, NULL,
+			   compdata_copyfunc(stp_list_item_get_data(item)));
+      item = stp_list_item_next(item);
+    }
+  return ret;
+}
+
+/*
+ * The copy refers to the same component data as the original, and
+ * neither copies nor frees it.
+ */
+static stp_list_t *
+share_compdata_list(const stp_list_t *src)
+{
+  stp_list_t *ret = create_compdata_list();
+  const stp_list_item_t *item = stp_list_get_start(src);
+  while (item)
+    {
+      const compdata_t *cd = (const compdata_t *) stp_list_item_get_data(item);
+      compdata_t *shared = stp_zalloc(sizeof(compdata_t));
+      shared->name = stp_strdup(cd->name);
+      shared->data = cd->data;
+      stp_list_item_create(ret, NULL, shared);
       item = stp_list_item_next(item);
     }
   return ret;
@@ -332,6 +370,103 @@ stp_default_settings(void)
   return (stp_vars_t *) &default_vars;
 }
 
+static outbuf_t *
+outbuf_create(void)
+{
+  outbuf_t *ob = stp_zalloc(sizeof(outbuf_t));
+  ob->refcount = 1;
+  return ob;
+}
+
+static void
+outbuf_release(stp_vars_t *v)
+{
+  if (v->outbuf)
+    {
+      stp_flush_output(v);
+      if (--v->outbuf->refcount == 0)
+	{
+	  STP_SAFE_FREE(v->outbuf->data);
+	  stp_free(v->outbuf);
+	}
+      v->outbuf = NULL;
+    }
+}
+
+/*
+ * Send the output buffer, and then stop sharing it with other vars
+ * objects, before the destination of the output changes.
+ */
+static void
+outbuf_detach(stp_vars_t *v)
+{
+  if (v->outbuf)
+    {
+      stp_flush_output(v);
+      if (v->outbuf->refcount > 1)
+	{
+	  v->outbuf->refcount--;
+	  v->outbuf = outbuf_create();
+	}
+    }
+}
+
+void
+stp_flush_output(const stp_vars_t *v)
+{
+  outbuf_t *ob;
+  CHECK_VARS(v);
+  ob = v->outbuf;
+  if (ob && ob->bytes > 0)
+    {
+      size_t bytes = ob->bytes;
+      ob->bytes = 0;
+      if (v->outfunc)
+	(v->outfunc)(v->outdata, ob->data, bytes);
+    }
+}
+
+void
+stpi_vars_output(const stp_vars_t *v, const char *data, size_t bytes)
+{
+  outbuf_t *ob = v->outbuf;
+  if (!ob)
+    {
+      if (v->outfunc)
+	(v->outfunc)(v->outdata, data, bytes);
+      return;
+    }
+  if (bytes <= OUTBUF_SIZE - ob->bytes)
+    {
+      if (!ob->data)
+	ob->data = stp_malloc(OUTBUF_SIZE);
+      memcpy(ob->data + ob->bytes, data, bytes);
+      ob->bytes += bytes;
+    }
+  else if (bytes < OUTBUF_SIZE)
+    {
+      stp_flush_output(v);
+      memcpy(ob->data, data, bytes);
+      ob->bytes = bytes;
+    }
+  else if (v->outvfunc && ob->bytes > 0)
+    {
+      stp_raw_t vec[2];
+      vec[0].data = ob->data;
+      vec[0].bytes = ob->bytes;
+      vec[1].data = data;
+      vec[1].bytes = bytes;
+      ob->bytes = 0;
+      (v->outvfunc)(v->outdata, vec, 2);
+    }
+  else
+    {
+      stp_flush_output(v);
+      if (v->outfunc)
+	(v->outfunc)(v->outdata, data, bytes);
+    }
+}
+
 stp_vars_t *
 stp_vars_create(void)
 {
@@ -353,6 +488,7 @@ stp_vars_destroy(stp_vars_t *v)
   for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
     stp_list_destroy(v->params[i]);
   stp_list_destroy(v->internal_data);
+  outbuf_release(v);
   STP_SAFE_FREE(v->driver);
   STP_SAFE_FREE(v->color_conversion);
   stp_free(v);
@@ -418,11 +554,31 @@ DEF_FUNCS(width, int, stp)
 DEF_FUNCS(height, int, stp)
 DEF_FUNCS(page_width, int, stp)
 DEF_FUNCS(page_height, int, stp)
-DEF_FUNCS(outdata, void *, stp)
 DEF_FUNCS(errdata, void *, stp)
-DEF_FUNCS(outfunc, stp_outfunc_t, stp)
+DEF_FUNCS(outvfunc, stp_outvfunc_t, stp)
 DEF_FUNCS(errfunc, stp_outfunc_t, stp)
 
+#define DEF_OUTPUT_FUNCS(s, t, pre)			\
+void							\
+pre##_set_##s(stp_vars_t *v, t val)			\
+{							\
+  CHECK_VARS(v);                                        \
+  if (v->s != val)					\
+    outbuf_detach(v);					\
+  v->verified = 0;					\
+  v->s = val;						\
+}							\
+							\
+t							\
+pre##_get_##s(const stp_vars_t *v)			\
+{							\
+  CHECK_VARS(v);                                        \
+  return v->s;						\
+}
+
+DEF_OUTPUT_FUNCS(outdata, void *, stp)
+DEF_OUTPUT_FUNCS(outfunc, stp_outfunc_t, stp)
+
 void
 stp_set_verified(stp_vars_t *v, int val)
 {
@@ -1424,13 +1580,11 @@ stp_fill_parameter_settings(stp_parameter_t *desc,
     }
 }
 
-void
-stp_vars_copy(stp_vars_t *vd, const stp_vars_t *vs)
+static void
+vars_copy(stp_vars_t *vd, const stp_vars_t *vs, int share_components)
 {
   int i;
 
-  if (vs == vd)
-    return;
   stp_set_driver(vd, stp_get_driver(vs));
   stp_set_color_conversion(vd, stp_get_color_conversion(vs));
   stp_set_left(vd, stp_get_left(vs));
@@ -1439,20 +1593,169 @@ stp_vars_copy(stp_vars_t *vd, const stp_vars_t *vs)
   stp_set_height(vd, stp_get_height(vs));
   stp_set_page_width(vd, stp_get_page_width(vs));
   stp_set_page_height(vd, stp_get_page_height(vs));
+  outbuf_release(vd);
   stp_set_outdata(vd, stp_get_outdata(vs));
   stp_set_errdata(vd, stp_get_errdata(vs));
   stp_set_outfunc(vd, stp_get_outfunc(vs));
+  stp_set_outvfunc(vd, stp_get_outvfunc(vs));
   stp_set_errfunc(vd, stp_get_errfunc(vs));
+  if (vs->outbuf)
+    {
+      vd->outbuf = vs->outbuf;
+      vd->outbuf->refcount++;
+    }
+  else
+    vd->outbuf = outbuf_create();
   for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
     {
       stp_list_destroy(vd->params[i]);
       vd->params[i] = copy_value_list(vs->params[i]);
     }
   stp_list_destroy(vd->internal_data);
-  vd->internal_data = copy_compdata_list(vs->internal_data);
+  if (share_components)
+    vd->internal_data = share_compdata_list(vs->internal_data);
+  else
+    vd->internal_data = copy_compdata_list(vs->internal_data);
   stp_set_verified(vd, stp_get_verified(vs));
 }
 
+void
+stp_vars_copy(stp_vars_t *vd, const stp_vars_t *vs)
+{
+  if (vs == vd)
+    return;
+  vars_copy(vd, vs, 0);
+}
+
+static int
+strings_equal(const char *a, const char *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+  return strcmp(a, b) == 0;
+}
+
+static int
+sequences_equal(const stp_sequence_t *a, const stp_sequence_t *b)
+{
+  double alow, ahigh, blow, bhigh;
+  const double *adata, *bdata;
+  size_t asize, bsize;
+  stp_sequence_get_bounds(a, &alow, &ahigh);
+  stp_sequence_get_bounds(b, &blow, &bhigh);
+  if (alow != blow || ahigh != bhigh)
+    return 0;
+  stp_sequence_get_data(a, &asize, &adata);
+  stp_sequence_get_data(b, &bsize, &bdata);
+  if (asize != bsize)
+    return 0;
+  return asize == 0 || memcmp(adata, bdata, asize * sizeof(double)) == 0;
+}
+
+static int
+curves_equal(const stp_curve_t *a, const stp_curve_t *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+  return (stp_curve_get_wrap(a) == stp_curve_get_wrap(b) &&
+	  stp_curve_is_piecewise(a) == stp_curve_is_piecewise(b) &&
+	  stp_curve_get_interpolation_type(a) ==
+	  stp_curve_get_interpolation_type(b) &&
+	  stp_curve_get_gamma(a) == stp_curve_get_gamma(b) &&
+	  sequences_equal(stp_curve_get_sequence(a), stp_curve_get_sequence(b)));
+}
+
+static int
+arrays_equal(const stp_array_t *a, const stp_array_t *b)
+{
+  int ax, ay, bx, by;
+  if (a == NULL || b == NULL)
+    return a == b;
+  stp_array_get_size(a, &ax, &ay);
+  stp_array_get_size(b, &bx, &by);
+  return (ax == bx && ay == by &&
+	  sequences_equal(stp_array_get_sequence(a), stp_array_get_sequence(b)));
+}
+
+static int
+values_equal(const value_t *a, const value_t *b)
+{
+  if (a->typ != b->typ || a->active != b->active)
+    return 0;
+  switch (a->typ)
+    {
+    case STP_PARAMETER_TYPE_CURVE:
+      return curves_equal(a->value.cval, b->value.cval);
+    case STP_PARAMETER_TYPE_ARRAY:
+      return arrays_equal(a->value.aval, b->value.aval);
+    case STP_PARAMETER_TYPE_STRING_LIST:
+    case STP_PARAMETER_TYPE_FILE:
+    case STP_PARAMETER_TYPE_RAW:
+      return (a->value.rval.bytes == b->value.rval.bytes &&
+	      (a->value.rval.bytes == 0 ||
+	       memcmp(a->value.rval.data, b->value.rval.data,
+		      a->value.rval.bytes) == 0));
+    case STP_PARAMETER_TYPE_INT:
+    case STP_PARAMETER_TYPE_DIMENSION:
+    case STP_PARAMETER_TYPE_BOOLEAN:
+      return a->value.ival == b->value.ival;
+    case STP_PARAMETER_TYPE_DOUBLE:
+      return a->value.dval == b->value.dval;
+    default:
+      return 1;
+    }
+}
+
+static int
+value_lists_equal(const stp_list_t *a, const stp_list_t *b,
+		  const char *ignore)
+{
+  const stp_list_item_t *item = stp_list_get_start(a);
+  int acount = 0;
+  int bcount = stp_list_get_length(b);
+  if (ignore && stp_list_get_item_by_name(b, ignore))
+    bcount--;
+  while (item)
+    {
+      const value_t *aval = (const value_t *) stp_list_item_get_data(item);
+      if (!ignore || strcmp(aval->name, ignore) != 0)
+	{
+	  const stp_list_item_t *bitem =
+	    stp_list_get_item_by_name(b, aval->name);
+	  if (!bitem ||
+	      !values_equal(aval, (const value_t *) stp_list_item_get_data(bitem)))
+	    return 0;
+	  acount++;
+	}
+      item = stp_list_item_next(item);
+    }
+  return acount == bcount;
+}
+
+/*
+ * Do two vars objects hold the same settings?  Output functions and
+ * component data are not settings, and the parameter named by ignore (if
+ * any) is left out of the comparison.
+ */
+int
+stpi_vars_settings_equal(const stp_vars_t *a, const stp_vars_t *b,
+			 const char *ignore)
+{
+  int i;
+  CHECK_VARS(a);
+  CHECK_VARS(b);
+  if (!strings_equal(a->driver, b->driver) ||
+      !strings_equal(a->color_conversion, b->color_conversion) ||
+      a->left != b->left || a->top != b->top ||
+      a->width != b->width || a->height != b->height ||
+      a->page_width != b->page_width || a->page_height != b->page_height)
+    return 0;
+  for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
+    if (!value_lists_equal(a->params[i], b->params[i], ignore))
+      return 0;
+  return 1;
+}
+
 void
 stpi_vars_print_error(const stp_vars_t *v, const char *prefix)
 {
@@ -1565,6 +1868,20 @@ stp_vars_create_copy(const stp_vars_t *vs)
   return (vd);
 }
 
+/*
+ * A copy of the settings that shares the component data of the original
+ * rather than copying it, so that another thread can work on the same
+ * job through it without looking anything up in the original.  It must
+ * be destroyed before the original.
+ */
+stp_vars_t *
+stpi_vars_create_shared_copy(const stp_vars_t *vs)
+{
+  stp_vars_t *vd = stp_vars_create();
+  vars_copy(vd, vs, 1);
+  return (vd);
+}
+
 static const char *
 param_namefunc(const void *item)
 {
@@ -35,6 +35,9 @@
 #ifdef HAVE_LIMITS_H
 #include <limits.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 static int
 gcd(int x, int y)
@@ -52,6 +55,8 @@ gcd(int x, int y)
 	return y;
 }
 
+typedef struct weave_table weave_table_t;
+
 typedef struct stpi_softweave
 {
   stp_linebufs_t *linebases;	/* Base address of each row buffer */
@@ -70,7 +75,7 @@ typedef struct stpi_softweave
   int virtual_jets;		/* Number of jets per color, taking into */
 				/* account the head offset */
   int separation;		/* Offset from one jet to the next in rows */
-  void *weaveparm;		/* Weave calculation parameter block */
+  weave_table_t *table;		/* Shared pass table for this weave */
 
   int horizontal_weave;		/* Number of horizontal passes required */
 				/* This is > 1 for some of the ultra-high */
@@ -94,6 +99,11 @@ typedef struct stpi_softweave
   unsigned char *s[STP_MAX_WEAVE];
   unsigned char *fold_buf;
   unsigned char *comp_buf;
+  unsigned char *blank_comp;	/* A white line as packed by pack, */
+  size_t blank_comp_length;	/* made the first time one comes up */
+  int blank_first;
+  int blank_last;
+  int blank_active;
   stp_weave_t wcache;
   int rcache;
   int vcache;
@@ -677,6 +687,174 @@ stpi_calculate_row_parameters(void *vw,		/* I - weave parameters */
 	*ojetsused = jetsused;
 }
 
+/*
+ * Pass tables
+ *
+ * Everything stpi_calculate_row_parameters works out depends only on the
+ * head geometry, the oversampling, the strategy and the rows being
+ * printed, so for each (row, subpass) on the page we work it out once and
+ * keep the answers in a table that the rest of the weave simply indexes.
+ * The tables are shared through a small process-wide cache, so that
+ * back to back jobs at the same resolution and page size skip the setup
+ * entirely.  Pages too tall to tabulate fall back to computing each row
+ * from the pass maps.
+ */
+
+#define WEAVE_CACHE_SIZE 4
+#define WEAVE_TABLE_MAX_ENTRIES (1 << 20)
+
+typedef struct
+{
+  int pass;
+  int jet;
+  int logicalpassstart;
+  int missingstartrows;
+  int jetsused;
+} weave_row_t;
+
+struct weave_table
+{
+  int separation;
+  int jets;
+  int oversample;
+  int firstrow;
+  int lastrow;
+  int pageheight;
+  stp_weave_strategy_t strategy;
+  int refcount;
+  int cached;
+  unsigned last_used;
+  cooked_t *params;
+  weave_row_t *rows;		/* Indexed by (row - firstrow) * oversample */
+				/* + subpass; NULL if the page is too tall */
+};
+
+static weave_table_t *weave_cache[WEAVE_CACHE_SIZE];
+static unsigned weave_clock;
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t weave_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_CACHE() pthread_mutex_lock(&weave_lock)
+#define UNLOCK_CACHE() pthread_mutex_unlock(&weave_lock)
+#else
+#define LOCK_CACHE()
+#define UNLOCK_CACHE()
+#endif
+
+static int
+weave_table_matches(const weave_table_t *t, int separation, int jets,
+		    int oversample, int firstrow, int lastrow, int pageheight,
+		    stp_weave_strategy_t strategy)
+{
+  return (t->separation == separation && t->jets == jets &&
+	  t->oversample == oversample && t->firstrow == firstrow &&
+	  t->lastrow == lastrow && t->pageheight == pageheight &&
+	  t->strategy == strategy);
+}
+
+static weave_table_t *
+build_weave_table(int separation, int jets, int oversample, int firstrow,
+		  int lastrow, int pageheight, stp_weave_strategy_t strategy,
+		  stp_vars_t *v)
+{
+  weave_table_t *t = stp_zalloc(sizeof(weave_table_t));
+  size_t entries = (size_t) (lastrow - firstrow + 1) * oversample;
+  t->separation = separation;
+  t->jets = jets;
+  t->oversample = oversample;
+  t->firstrow = firstrow;
+  t->lastrow = lastrow;
+  t->pageheight = pageheight;
+  t->strategy = strategy;
+  t->params = initialize_weave_params(separation, jets, oversample, firstrow,
+				      lastrow, pageheight, strategy, v);
+  /*
+   * The table outlives this job, so it mustn't hang on to its vars.
+   */
+  t->params->rw.v = NULL;
+  if (lastrow >= firstrow && entries <= WEAVE_TABLE_MAX_ENTRIES)
+    {
+      weave_row_t *r;
+      int row, subpass;
+      r = t->rows = stp_malloc(entries * sizeof(weave_row_t));
+      for (row = firstrow; row <= lastrow; row++)
+	for (subpass = 0; subpass < oversample; subpass++, r++)
+	  stpi_calculate_row_parameters(t->params, row, subpass, &r->pass,
+					&r->jet, &r->logicalpassstart,
+					&r->missingstartrows, &r->jetsused);
+    }
+  return t;
+}
+
+static void
+free_weave_table(weave_table_t *t)
+{
+  if (t->rows)
+    stp_free(t->rows);
+  stpi_destroy_weave_params(t->params);
+  stp_free(t);
+}
+
+static weave_table_t *
+acquire_weave_table(int separation, int jets, int oversample, int firstrow,
+		    int lastrow, int pageheight, stp_weave_strategy_t strategy,
+		    stp_vars_t *v)
+{
+  weave_table_t *t = NULL;
+  int victim = -1;
+  int i;
+  LOCK_CACHE();
+  for (i = 0; i < WEAVE_CACHE_SIZE; i++)
+    {
+      weave_table_t *entry = weave_cache[i];
+      if (entry && weave_table_matches(entry, separation, jets, oversample,
+				       firstrow, lastrow, pageheight,
+				       strategy))
+	{
+	  t = entry;
+	  break;
+	}
+      if (!entry)
+	{
+	  if (victim < 0 || weave_cache[victim])
+	    victim = i;
+	}
+      else if (entry->refcount == 0 &&
+	       (victim < 0 || (weave_cache[victim] &&
+			       entry->last_used <
+			       weave_cache[victim]->last_used)))
+	victim = i;
+    }
+  if (!t)
+    {
+      t = build_weave_table(separation, jets, oversample, firstrow, lastrow,
+			    pageheight, strategy, v);
+      if (victim >= 0)
+	{
+	  if (weave_cache[victim])
+	    free_weave_table(weave_cache[victim]);
+	  weave_cache[victim] = t;
+	  t->cached = 1;
+	}
+    }
+  else
+    stp_dprintf(STP_DBG_WEAVE_PARAMS, v, "Reusing cached weave table\n");
+  t->refcount++;
+  t->last_used = ++weave_clock;
+  UNLOCK_CACHE();
+  return t;
+}
+
+static void
+release_weave_table(weave_table_t *t)
+{
+  if (!t)
+    return;
+  LOCK_CACHE();
+  if (--t->refcount == 0 && !t->cached)
+    free_weave_table(t);
+  UNLOCK_CACHE();
+}
+
 /*
  * "Soft" weave
  *
@@ -973,6 +1151,8 @@ stpi_destroy_weave(void *vsw)
     stp_free(sw->fold_buf);
   if (sw->comp_buf)
     stp_free(sw->comp_buf);
+  if (sw->blank_comp)
+    stp_free(sw->blank_comp);
   for (i = 0; i < STP_MAX_WEAVE; i++)
     if (sw->s[i])
       stp_free(sw->s[i]);
@@ -996,7 +1176,7 @@ stpi_destroy_weave(void *vsw)
   stp_free(sw->linebases);
   stp_free(sw->linebounds);
   stp_free(sw->head_offset);
-  stpi_destroy_weave_params(sw->weaveparm);
+  release_weave_table(sw->table);
   stp_free(vsw);
 }
 
@@ -1095,9 +1275,9 @@ stp_initialize_weave(stp_vars_t *v,
     sw->virtual_jets += (maxHeadOffset + sw->separation - 1) / sw->separation;
   last_line = first_line + line_count - 1 + maxHeadOffset;
 
-  sw->weaveparm = initialize_weave_params(sw->separation, sw->jets,
-                                          sw->oversample, first_line, last_line,
-                                          page_height, weave_strategy, v);
+  sw->table = acquire_weave_table(sw->separation, sw->jets, sw->oversample,
+				  first_line, last_line, page_height,
+				  weave_strategy, v);
   /*
    * The value of vmod limits how many passes may be unfinished at a time.
    * If pass x is not yet printed, pass x+vmod cannot be started.
@@ -1170,6 +1350,7 @@ static void
 weave_parameters_by_row(const stp_vars_t *v, stpi_softweave_t *sw,
 			int row, int vertical_subpass, stp_weave_t *w)
 {
+  const weave_table_t *t = sw->table;
   int jetsused;
   int sub_repeat_count = vertical_subpass % sw->repeat_count;
   /*
@@ -1178,6 +1359,22 @@ weave_parameters_by_row(const stp_vars_t *v, stpi_softweave_t *sw,
    */
   vertical_subpass /= sw->repeat_count;
 
+  if (t->rows && row >= t->firstrow && row <= t->lastrow &&
+      vertical_subpass >= 0 && vertical_subpass < t->oversample)
+    {
+      const weave_row_t *r =
+	&(t->rows[(row - t->firstrow) * t->oversample + vertical_subpass]);
+      w->row = row;
+      w->pass = (r->pass * sw->repeat_count) + sub_repeat_count;
+      w->jet = r->jet;
+      w->logicalpassstart = r->logicalpassstart;
+      w->missingstartrows = r->missingstartrows;
+      w->physpassstart = r->logicalpassstart +
+	sw->separation * r->missingstartrows;
+      w->physpassend = w->physpassstart + sw->separation * (r->jetsused - 1);
+      return;
+    }
+
   if (sw->rcache == row && sw->vcache == vertical_subpass)
     {
       memcpy(w, &sw->wcache, sizeof(stp_weave_t));
@@ -1188,7 +1385,7 @@ weave_parameters_by_row(const stp_vars_t *v, stpi_softweave_t *sw,
   sw->vcache = vertical_subpass;
 
   w->row = row;
-  stpi_calculate_row_parameters(sw->weaveparm, row, vertical_subpass,
+  stpi_calculate_row_parameters(t->params, row, vertical_subpass,
 				&w->pass, &w->jet, &w->logicalpassstart,
 				&w->missingstartrows, &jetsused);
 
@@ -1600,6 +1797,25 @@ finalize_row(stp_vars_t *v, int row)
     }
 }
 
+/*
+ * A row of a color with no ink folds, unpacks and splits into white
+ * lines for every pass, and they all pack the same way, so the packed
+ * white line is made once and copied from then on.
+ */
+static void
+pack_blank_line(stp_vars_t *v, stpi_softweave_t *sw, int xlength)
+{
+  unsigned char *blank = stp_zalloc(sw->bitwidth * xlength);
+  unsigned char *comp_ptr;
+  sw->blank_active = (sw->pack)(v, blank, sw->bitwidth * xlength,
+				sw->comp_buf, &comp_ptr, &(sw->blank_first),
+				&(sw->blank_last));
+  sw->blank_comp_length = comp_ptr - sw->comp_buf;
+  sw->blank_comp = stp_malloc(sw->blank_comp_length + 1);
+  memcpy(sw->blank_comp, sw->comp_buf, sw->blank_comp_length);
+  stp_free(blank);
+}
+
 void
 stp_write_weave(stp_vars_t *v, unsigned char *const cols[])
 {
@@ -1653,6 +1869,24 @@ stp_write_weave(stp_vars_t *v, unsigned char *const cols[])
 		stpi_get_linebounds(v, sw, sw->lineno, pass, offset);
 	    }
 
+	  if (cols[j][0] == 0 &&
+	      memcmp(cols[j], cols[j] + 1, length * sw->bitwidth - 1) == 0)
+	    {
+	      if (!sw->blank_comp)
+		pack_blank_line(v, sw, xlength);
+	      for (i = 0; i < h_passes; i++)
+		{
+		  if (sw->blank_first < linebounds[i]->start_pos[j])
+		    linebounds[i]->start_pos[j] = sw->blank_first;
+		  if (sw->blank_last > linebounds[i]->end_pos[j])
+		    linebounds[i]->end_pos[j] = sw->blank_last;
+		  add_to_row(v, sw, sw->lineno, sw->blank_comp,
+			     sw->blank_comp_length, j, sw->blank_active,
+			     cpass + i);
+		}
+	      continue;
+	    }
+
 	  if (sw->bitwidth == 2)
 	    {
 	      stp_fold(cols[j], length, sw->fold_buf);
@@ -526,7 +526,7 @@ stp_describe_output(const stp_vars_t *v)
 }
 
 int
-stp_verify(stp_vars_t *v)
+stpi_verify_settings(stp_vars_t *v)
 {
   const stp_printfuncs_t *printfuncs =
     stpi_get_printfuncs(stp_get_printer(v));
@@ -539,12 +539,23 @@ stp_verify(stp_vars_t *v)
   return status;
 }
 
+int
+stp_verify(stp_vars_t *v)
+{
+  stp_session_t *session = stpi_get_session(v);
+  if (session)
+    return stp_session_verify(session, v);
+  return stpi_verify_settings(v);
+}
+
 int
 stp_print(const stp_vars_t *v, stp_image_t *image)
 {
   const stp_printfuncs_t *printfuncs =
     stpi_get_printfuncs(stp_get_printer(v));
-  return (printfuncs->print)(v, image);
+  int status = (printfuncs->print)(v, image);
+  stp_flush_output(v);
+  return status;
 }
 
 int
@@ -556,7 +567,11 @@ stp_start_job(const stp_vars_t *v, stp_image_t *image)
       strcmp(stp_get_string_parameter(v, "JobMode"), "Page") == 0)
     return 1;
   if (printfuncs->start_job)
-    return (printfuncs->start_job)(v, image);
+    {
+      int status = (printfuncs->start_job)(v, image);
+      stp_flush_output(v);
+      return status;
+    }
   else
     return 1;
 }
@@ -570,7 +585,11 @@ stp_end_job(const stp_vars_t *v, stp_image_t *image)
       strcmp(stp_get_string_parameter(v, "JobMode"), "Page") == 0)
     return 1;
   if (printfuncs->end_job)
-    return (printfuncs->end_job)(v, image);
+    {
+      int status = (printfuncs->end_job)(v, image);
+      stp_flush_output(v);
+      return status;
+    }
   else
     return 1;
 }
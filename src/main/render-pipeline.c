@@ -0,0 +1,476 @@
+/*
+ *   Row rendering, optionally as a pipeline of threads
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * The drivers that use the dither all render a page the same way: each
+ * output row is made from the image row that maps onto it, which is read
+ * and color converted only if the previous output row didn't use it too,
+ * then dithered, and then written out by the driver (normally through
+ * the weave).  stpi_render_rows() runs that loop for the driver.
+ *
+ * With the RenderPipeline parameter set, the loop is split into four
+ * stages -- color conversion, channel conversion, dithering, and output
+ * -- each on its own thread, with a short queue between each stage and
+ * the next.  Each stage keeps its own state and sees the rows in order,
+ * so the output is identical to what the single threaded loop produces.
+ * Every stage works through its own copy of the settings
+ * (stpi_vars_create_shared_copy()), since looking up component data is
+ * not safe from several threads at once.  The output stage runs on the
+ * calling thread, so the driver's output code does too.  The color stage
+ * goes through the color module's convert_row function, so with a color
+ * module that doesn't provide one the rows are rendered on the calling
+ * thread as before.
+ *
+ * The color and channel code set themselves up while converting the first
+ * row, and the dither while dithering it, so the rows that use the first
+ * image row are always rendered before any thread is started.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <limits.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/*
+ * Which image row each output row comes from, stepping through the rows
+ * as the drivers always have.
+ */
+typedef struct
+{
+  int rows;			/* Output rows */
+  int errdiv;
+  int errmod;
+  int errval;
+  int errline;			/* Image row for the current output row */
+  int errlast;			/* Image row last converted */
+} row_map_t;
+
+static void
+row_map_init(row_map_t *map, int image_rows, int rows)
+{
+  map->rows = rows;
+  map->errdiv = image_rows / rows;
+  map->errmod = image_rows % rows;
+  map->errval = 0;
+  map->errline = 0;
+  map->errlast = -1;
+}
+
+static void
+row_map_next(row_map_t *map)
+{
+  map->errval += map->errmod;
+  map->errline += map->errdiv;
+  if (map->errval >= map->rows)
+    {
+      map->errval -= map->rows;
+      map->errline++;
+    }
+}
+
+static int
+render_row(stp_vars_t *v, stp_image_t *image, row_map_t *map, int y,
+	   unsigned *zero_mask, stpi_render_mask_func_t mask,
+	   stpi_render_output_func_t output, void *data)
+{
+  int duplicate_line = 1;
+  if (map->errline != map->errlast)
+    {
+      map->errlast = map->errline;
+      duplicate_line = 0;
+      if (stp_color_get_row(v, image, map->errline, zero_mask))
+	return 2;
+    }
+  stp_dither(v, y, duplicate_line, *zero_mask,
+	     mask ? (mask)(v, y, data) : NULL);
+  (output)(v, y, data);
+  row_map_next(map);
+  return 1;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+#define PIPELINE_DEPTH 4	/* Rows queued between one stage and the next */
+
+typedef struct
+{
+  int source_row;		/* Image row */
+  int first_row;		/* Output rows made from it */
+  int rows;
+  unsigned zero_mask;
+  int planar;			/* Converted rows only */
+  int ink_first;
+  int ink_last;
+  void *data;
+} slot_t;
+
+typedef struct
+{
+  slot_t slots[PIPELINE_DEPTH];
+  int produced;
+  int consumed;
+  int closed;			/* Nothing more will be produced */
+} queue_t;
+
+typedef struct
+{
+  stp_image_t *image;
+  stpi_color_convert_row_func_t convert_row;
+  stpi_render_mask_func_t mask;
+  stpi_render_output_func_t output;
+  void *data;
+  row_map_t map;		/* Where the color stage starts */
+  int first_row;
+  size_t input_size;		/* Samples per channel input row */
+  size_t output_size;		/* Samples per channel output row */
+  stp_vars_t *color_vars;
+  stp_vars_t *channel_vars;
+  stp_vars_t *dither_vars;
+  stp_vars_t *output_vars;
+  queue_t colored;		/* Color -> channel */
+  queue_t converted;		/* Channel -> dither */
+  queue_t dithered;		/* Dither -> output */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int started;
+  int abandoned;		/* Not all the threads could be started */
+  int status;
+} pipeline_t;
+
+static void
+queue_init(queue_t *q, size_t bytes)
+{
+  int i;
+  memset(q, 0, sizeof(queue_t));
+  for (i = 0; i < PIPELINE_DEPTH; i++)
+    q->slots[i].data = stp_malloc(bytes);
+}
+
+static void
+queue_free(queue_t *q)
+{
+  int i;
+  for (i = 0; i < PIPELINE_DEPTH; i++)
+    stp_free(q->slots[i].data);
+}
+
+/*
+ * The next slot to fill, once there is room for it.
+ */
+static slot_t *
+queue_begin_put(pipeline_t *p, queue_t *q)
+{
+  slot_t *slot;
+  pthread_mutex_lock(&(p->lock));
+  while (q->produced - q->consumed >= PIPELINE_DEPTH)
+    pthread_cond_wait(&(p->cond), &(p->lock));
+  slot = &(q->slots[q->produced % PIPELINE_DEPTH]);
+  pthread_mutex_unlock(&(p->lock));
+  return slot;
+}
+
+static void
+queue_end_put(pipeline_t *p, queue_t *q)
+{
+  pthread_mutex_lock(&(p->lock));
+  q->produced++;
+  pthread_cond_broadcast(&(p->cond));
+  pthread_mutex_unlock(&(p->lock));
+}
+
+/*
+ * The next slot to use, or NULL if the queue is closed and empty.
+ */
+static slot_t *
+queue_begin_get(pipeline_t *p, queue_t *q)
+{
+  slot_t *slot = NULL;
+  pthread_mutex_lock(&(p->lock));
+  while (q->produced == q->consumed && !q->closed)
+    pthread_cond_wait(&(p->cond), &(p->lock));
+  if (q->produced > q->consumed)
+    slot = &(q->slots[q->consumed % PIPELINE_DEPTH]);
+  pthread_mutex_unlock(&(p->lock));
+  return slot;
+}
+
+static void
+queue_end_get(pipeline_t *p, queue_t *q)
+{
+  pthread_mutex_lock(&(p->lock));
+  q->consumed++;
+  pthread_cond_broadcast(&(p->cond));
+  pthread_mutex_unlock(&(p->lock));
+}
+
+static void
+queue_close(pipeline_t *p, queue_t *q)
+{
+  pthread_mutex_lock(&(p->lock));
+  q->closed = 1;
+  pthread_cond_broadcast(&(p->cond));
+  pthread_mutex_unlock(&(p->lock));
+}
+
+/*
+ * Threads wait here until all of them have been started; returns 0 if
+ * the pipeline is not going to run after all.
+ */
+static int
+stage_start(pipeline_t *p)
+{
+  int ok;
+  pthread_mutex_lock(&(p->lock));
+  while (!p->started && !p->abandoned)
+    pthread_cond_wait(&(p->cond), &(p->lock));
+  ok = !p->abandoned;
+  pthread_mutex_unlock(&(p->lock));
+  return ok;
+}
+
+/*
+ * Read and color convert each image row that is used, noting which
+ * output rows it makes.
+ */
+static void *
+color_stage(void *arg)
+{
+  pipeline_t *p = (pipeline_t *) arg;
+  row_map_t map = p->map;
+  int y = p->first_row;
+  if (!stage_start(p))
+    return NULL;
+  while (y < map.rows)
+    {
+      slot_t *slot = queue_begin_put(p, &(p->colored));
+      slot->source_row = map.errline;
+      slot->first_row = y;
+      slot->rows = 0;
+      if ((p->convert_row)(p->color_vars, p->image, map.errline,
+			   slot->data, &(slot->zero_mask)))
+	{
+	  p->status = 2;
+	  break;
+	}
+      do
+	{
+	  slot->rows++;
+	  y++;
+	  row_map_next(&map);
+	}
+      while (y < map.rows && map.errline == slot->source_row);
+      queue_end_put(p, &(p->colored));
+    }
+  queue_close(p, &(p->colored));
+  return NULL;
+}
+
+static void *
+channel_stage(void *arg)
+{
+  pipeline_t *p = (pipeline_t *) arg;
+  slot_t *in;
+  if (!stage_start(p))
+    return NULL;
+  while ((in = queue_begin_get(p, &(p->colored))) != NULL)
+    {
+      slot_t *out = queue_begin_put(p, &(p->converted));
+      const unsigned short *converted;
+      memcpy(stp_channel_get_input(p->channel_vars), in->data,
+	     p->input_size * sizeof(unsigned short));
+      out->zero_mask = in->zero_mask;
+      stp_channel_convert(p->channel_vars, &(out->zero_mask));
+      converted = stpi_dither_get_input(p->channel_vars, &(out->planar));
+      memcpy(out->data, converted, p->output_size * sizeof(unsigned short));
+      out->ink_first = 0;
+      out->ink_last = INT_MAX - 1;
+      stpi_channel_get_ink_extent(p->channel_vars,
+				  &(out->ink_first), &(out->ink_last));
+      out->source_row = in->source_row;
+      out->first_row = in->first_row;
+      out->rows = in->rows;
+      queue_end_get(p, &(p->colored));
+      queue_end_put(p, &(p->converted));
+    }
+  queue_close(p, &(p->converted));
+  return NULL;
+}
+
+static void *
+dither_stage(void *arg)
+{
+  pipeline_t *p = (pipeline_t *) arg;
+  slot_t *in;
+  if (!stage_start(p))
+    return NULL;
+  while ((in = queue_begin_get(p, &(p->converted))) != NULL)
+    {
+      int i;
+      for (i = 0; i < in->rows; i++)
+	{
+	  int y = in->first_row + i;
+	  slot_t *out = queue_begin_put(p, &(p->dithered));
+	  const unsigned char *mask =
+	    p->mask ? (p->mask)(p->dither_vars, y, p->data) : NULL;
+	  stpi_dither_row(p->dither_vars, y, in->data, in->planar,
+			  in->ink_first, in->ink_last, i > 0, in->zero_mask,
+			  mask);
+	  stpi_dither_save_row(p->dither_vars, out->data);
+	  out->first_row = y;
+	  queue_end_put(p, &(p->dithered));
+	}
+      queue_end_get(p, &(p->converted));
+    }
+  queue_close(p, &(p->dithered));
+  return NULL;
+}
+
+/*
+ * Render rows first_row onward through the pipeline.  Returns 0 without
+ * rendering anything if the threads can't be started.
+ */
+static int
+render_pipelined(stp_vars_t *v, stp_image_t *image,
+		 stpi_color_convert_row_func_t convert_row, const row_map_t *map,
+		 int first_row, stpi_render_mask_func_t mask,
+		 stpi_render_output_func_t output, void *data)
+{
+  static void *(*const stages[])(void *) =
+    { color_stage, channel_stage, dither_stage };
+  pthread_t threads[3];
+  int thread_count = 0;
+  pipeline_t p;
+  slot_t *slot;
+  int i;
+
+  memset(&p, 0, sizeof(pipeline_t));
+  p.image = image;
+  p.convert_row = convert_row;
+  p.mask = mask;
+  p.output = output;
+  p.data = data;
+  p.map = *map;
+  p.first_row = first_row;
+  p.status = 1;
+  stpi_channel_get_row_sizes(v, &(p.input_size), &(p.output_size));
+  p.color_vars = stpi_vars_create_shared_copy(v);
+  p.channel_vars = stpi_vars_create_shared_copy(v);
+  p.dither_vars = stpi_vars_create_shared_copy(v);
+  p.output_vars = stpi_vars_create_shared_copy(v);
+  stpi_dither_divert_output(v, p.output_vars);
+  queue_init(&(p.colored), p.input_size * sizeof(unsigned short));
+  queue_init(&(p.converted), p.output_size * sizeof(unsigned short));
+  queue_init(&(p.dithered), stpi_dither_get_row_size(v));
+  pthread_mutex_init(&(p.lock), NULL);
+  pthread_cond_init(&(p.cond), NULL);
+
+  for (i = 0; i < 3; i++)
+    {
+      if (pthread_create(&(threads[i]), NULL, stages[i], &p) != 0)
+	break;
+      thread_count++;
+    }
+  pthread_mutex_lock(&(p.lock));
+  if (thread_count == 3)
+    p.started = 1;
+  else
+    p.abandoned = 1;
+  pthread_cond_broadcast(&(p.cond));
+  pthread_mutex_unlock(&(p.lock));
+
+  if (p.started)
+    while ((slot = queue_begin_get(&p, &(p.dithered))) != NULL)
+      {
+	stpi_dither_load_row(p.output_vars, slot->data);
+	(output)(p.output_vars, slot->first_row, data);
+	queue_end_get(&p, &(p.dithered));
+      }
+
+  for (i = 0; i < thread_count; i++)
+    pthread_join(threads[i], NULL);
+  pthread_cond_destroy(&(p.cond));
+  pthread_mutex_destroy(&(p.lock));
+  queue_free(&(p.dithered));
+  queue_free(&(p.converted));
+  queue_free(&(p.colored));
+  stpi_dither_restore_output(v, p.output_vars);
+  stp_vars_destroy(p.output_vars);
+  stp_vars_destroy(p.dither_vars);
+  stp_vars_destroy(p.channel_vars);
+  stp_vars_destroy(p.color_vars);
+  return p.started ? p.status : 0;
+}
+
+#endif
+
+/*
+ * Render rows output rows from the image, calling mask (if not NULL)
+ * for the mask to dither each row with, and output to write out each
+ * dithered row.  The vars object passed to them may not be v, and
+ * without RenderPipeline they are called on the calling thread.
+ * Returns 1 on success, or 2 if the image could not be read.
+ */
+int
+stpi_render_rows(stp_vars_t *v, stp_image_t *image, int rows,
+		 stpi_render_mask_func_t mask,
+		 stpi_render_output_func_t output, void *data)
+{
+  row_map_t map;
+  unsigned zero_mask = 0;
+  int y = 0;
+  if (rows <= 0)
+    return 1;
+  row_map_init(&map, stp_image_height(image), rows);
+#ifdef HAVE_PTHREAD_H
+  if (stp_check_boolean_parameter(v, "RenderPipeline", STP_PARAMETER_ACTIVE) &&
+      stp_get_boolean_parameter(v, "RenderPipeline") &&
+      stpi_color_get_convert_row(v))
+    {
+      int status;
+      do
+	{
+	  status = render_row(v, image, &map, y, &zero_mask, mask, output,
+			      data);
+	  if (status != 1)
+	    return status;
+	  y++;
+	}
+      while (y < rows && map.errline == map.errlast);
+      if (y == rows)
+	return 1;
+      status = render_pipelined(v, image, stpi_color_get_convert_row(v),
+				&map, y, mask, output, data);
+      if (status)
+	return status;
+    }
+#endif
+  for (; y < rows; y++)
+    {
+      int status = render_row(v, image, &map, y, &zero_mask, mask, output,
+			      data);
+      if (status != 1)
+	return status;
+    }
+  return 1;
+}
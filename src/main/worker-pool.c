@@ -0,0 +1,209 @@
+/*
+ *   Worker thread pool for data-parallel operations
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * A worker pool runs a batch of numbered tasks on a fixed set of threads
+ * and returns when all of them have completed.  Tasks are handed out in
+ * increasing order, so a task may safely wait (via
+ * stpi_worker_pool_wait()) on progress posted by any lower-numbered task
+ * of the same batch.  Without thread support, or with a NULL pool, the
+ * tasks are simply run in order on the calling thread, which preserves
+ * that guarantee trivially.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+struct stpi_worker_pool
+{
+  int threads;			/* Including the calling thread */
+#ifdef HAVE_PTHREAD_H
+  pthread_t *workers;
+  int worker_count;
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;	/* A new batch has been posted */
+  pthread_cond_t done_cond;	/* The last task of a batch has completed */
+  pthread_mutex_t progress_lock;
+  pthread_cond_t progress_cond;
+  stpi_worker_func_t func;
+  void *data;
+  int tasks;
+  int next_task;
+  int tasks_done;
+  int shutdown;
+#endif
+};
+
+#ifdef HAVE_PTHREAD_H
+static void *
+worker_thread(void *arg)
+{
+  stpi_worker_pool_t *pool = (stpi_worker_pool_t *) arg;
+  pthread_mutex_lock(&(pool->lock));
+  while (1)
+    {
+      int task;
+      while (!pool->shutdown && pool->next_task >= pool->tasks)
+	pthread_cond_wait(&(pool->work_cond), &(pool->lock));
+      if (pool->shutdown)
+	break;
+      task = pool->next_task++;
+      pthread_mutex_unlock(&(pool->lock));
+      (pool->func)(pool->data, task);
+      pthread_mutex_lock(&(pool->lock));
+      if (++pool->tasks_done == pool->tasks)
+	pthread_cond_signal(&(pool->done_cond));
+    }
+  pthread_mutex_unlock(&(pool->lock));
+  return NULL;
+}
+#endif
+
+stpi_worker_pool_t *
+stpi_worker_pool_create(int threads)
+{
+#ifdef HAVE_PTHREAD_H
+  stpi_worker_pool_t *pool;
+  int i;
+  if (threads <= 1)
+    return NULL;
+  pool = stp_zalloc(sizeof(stpi_worker_pool_t));
+  pthread_mutex_init(&(pool->lock), NULL);
+  pthread_cond_init(&(pool->work_cond), NULL);
+  pthread_cond_init(&(pool->done_cond), NULL);
+  pthread_mutex_init(&(pool->progress_lock), NULL);
+  pthread_cond_init(&(pool->progress_cond), NULL);
+  pool->workers = stp_malloc(sizeof(pthread_t) * (threads - 1));
+  for (i = 0; i < threads - 1; i++)
+    {
+      if (pthread_create(&(pool->workers[i]), NULL, worker_thread, pool) != 0)
+	break;
+      pool->worker_count++;
+    }
+  pool->threads = pool->worker_count + 1;
+  if (pool->worker_count == 0)
+    {
+      stpi_worker_pool_destroy(pool);
+      return NULL;
+    }
+  return pool;
+#else
+  return NULL;
+#endif
+}
+
+void
+stpi_worker_pool_destroy(stpi_worker_pool_t *pool)
+{
+#ifdef HAVE_PTHREAD_H
+  int i;
+  if (!pool)
+    return;
+  pthread_mutex_lock(&(pool->lock));
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&(pool->work_cond));
+  pthread_mutex_unlock(&(pool->lock));
+  for (i = 0; i < pool->worker_count; i++)
+    pthread_join(pool->workers[i], NULL);
+  pthread_cond_destroy(&(pool->progress_cond));
+  pthread_mutex_destroy(&(pool->progress_lock));
+  pthread_cond_destroy(&(pool->done_cond));
+  pthread_cond_destroy(&(pool->work_cond));
+  pthread_mutex_destroy(&(pool->lock));
+  stp_free(pool->workers);
+  stp_free(pool);
+#endif
+}
+
+int
+stpi_worker_pool_get_threads(const stpi_worker_pool_t *pool)
+{
+  return pool ? pool->threads : 1;
+}
+
+void
+stpi_worker_pool_run(stpi_worker_pool_t *pool, stpi_worker_func_t func,
+		     void *data, int tasks)
+{
+  int i;
+#ifdef HAVE_PTHREAD_H
+  if (pool && tasks > 1)
+    {
+      pthread_mutex_lock(&(pool->lock));
+      pool->func = func;
+      pool->data = data;
+      pool->tasks = tasks;
+      pool->next_task = 0;
+      pool->tasks_done = 0;
+      pthread_cond_broadcast(&(pool->work_cond));
+      /* The calling thread takes its share of the batch too */
+      while (pool->next_task < pool->tasks)
+	{
+	  int task = pool->next_task++;
+	  pthread_mutex_unlock(&(pool->lock));
+	  (func)(data, task);
+	  pthread_mutex_lock(&(pool->lock));
+	  pool->tasks_done++;
+	}
+      while (pool->tasks_done < pool->tasks)
+	pthread_cond_wait(&(pool->done_cond), &(pool->lock));
+      pool->tasks = 0;
+      pool->next_task = 0;
+      pthread_mutex_unlock(&(pool->lock));
+      return;
+    }
+#endif
+  for (i = 0; i < tasks; i++)
+    (func)(data, i);
+}
+
+void
+stpi_worker_pool_post(stpi_worker_pool_t *pool, int *counter, int value)
+{
+#ifdef HAVE_PTHREAD_H
+  if (pool)
+    {
+      pthread_mutex_lock(&(pool->progress_lock));
+      *counter = value;
+      pthread_cond_broadcast(&(pool->progress_cond));
+      pthread_mutex_unlock(&(pool->progress_lock));
+      return;
+    }
+#endif
+  *counter = value;
+}
+
+void
+stpi_worker_pool_wait(stpi_worker_pool_t *pool, const int *counter, int value)
+{
+#ifdef HAVE_PTHREAD_H
+  if (pool)
+    {
+      pthread_mutex_lock(&(pool->progress_lock));
+      while (*counter < value)
+	pthread_cond_wait(&(pool->progress_cond), &(pool->progress_lock));
+      pthread_mutex_unlock(&(pool->progress_lock));
+    }
+#endif
+}
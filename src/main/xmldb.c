@@ -0,0 +1,645 @@
+/*
+ *   Precompiled XML data
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Tokenizing the printer, paper and dither matrix XML files accounts for
+ * much of the time a short job spends before printing.  At build time,
+ * compile-xml parses every data file once and stores the resulting node
+ * trees in XMLDB_NAME next to them: fixed-size node and attribute records
+ * that refer into one table of unique strings.  At run time the database
+ * is mapped once per data directory and the tree for a file is rebuilt
+ * straight from the records, without looking at the XML text at all.
+ *
+ * A file is only taken from the database if it is listed there with the
+ * same size and has not been modified since the database was written;
+ * otherwise, and if there is no usable database, the file is parsed as
+ * before.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include <gutenprint/mxml.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#define XMLDB_MAGIC "STPXDB\0\1"
+#define XMLDB_BYTE_ORDER 0x01020304u
+#define XMLDB_FORMAT 1
+#define XMLDB_VERSION_SIZE 24
+
+typedef struct
+{
+  char magic[8];
+  unsigned byte_order;		/* Rejects databases from other hosts */
+  unsigned format;
+  char version[XMLDB_VERSION_SIZE];
+  unsigned file_count;
+  unsigned node_count;
+  unsigned attr_count;
+  unsigned string_size;
+  unsigned files_offset;	/* Byte offsets from the start of the file */
+  unsigned nodes_offset;
+  unsigned attrs_offset;
+  unsigned strings_offset;
+  unsigned total_size;
+} xmldb_header_t;
+
+typedef struct
+{
+  unsigned name;		/* Path relative to the data directory */
+  unsigned size;		/* Size of the source file */
+  unsigned first_node;
+  unsigned node_count;
+  unsigned first_attr;
+  unsigned attr_count;
+} xmldb_file_t;
+
+/*
+ * The nodes of a file are stored in document order: the children of an
+ * element follow it directly and the last of them is flagged, so a tree
+ * is rebuilt in one pass over its nodes.  Elements take their attributes
+ * from the attribute table in the same order.
+ */
+typedef struct
+{
+  unsigned value;		/* Element name or text string */
+  unsigned flags;
+} xmldb_node_t;
+
+#define NODE_TEXT		0x1
+#define NODE_CHILDREN		0x2
+#define NODE_LAST		0x4
+#define NODE_COUNT_SHIFT	3	/* Attribute count or whitespace flag */
+
+typedef struct
+{
+  unsigned name;
+  unsigned value;
+} xmldb_attr_t;
+
+typedef struct
+{
+  const struct xmldb *db;
+  unsigned node;
+  unsigned node_end;
+  unsigned attr;
+  unsigned attr_end;
+  int error;
+} xmldb_cursor_t;
+
+typedef struct xmldb
+{
+  char *directory;
+  char *image;			/* NULL if the directory has no database */
+  size_t size;
+  int mapped;
+  time_t mtime;
+  const xmldb_header_t *header;
+  const xmldb_file_t *files;
+  const xmldb_node_t *nodes;
+  const xmldb_attr_t *attrs;
+  const char *strings;
+} xmldb_t;
+
+static stp_list_t *xmldb_list;
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t xmldb_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_XMLDB() pthread_mutex_lock(&xmldb_lock)
+#define UNLOCK_XMLDB() pthread_mutex_unlock(&xmldb_lock)
+#else
+#define LOCK_XMLDB()
+#define UNLOCK_XMLDB()
+#endif
+
+static const char *
+xmldb_namefunc(const void *item)
+{
+  return ((const xmldb_t *) item)->directory;
+}
+
+static int
+valid_xmldb(xmldb_t *db)
+{
+  const xmldb_header_t *h = (const xmldb_header_t *) db->image;
+  unsigned i;
+  if (db->size < sizeof(xmldb_header_t) ||
+      memcmp(h->magic, XMLDB_MAGIC, sizeof(h->magic)) != 0 ||
+      h->byte_order != XMLDB_BYTE_ORDER || h->format != XMLDB_FORMAT ||
+      strncmp(h->version, VERSION, XMLDB_VERSION_SIZE) != 0 ||
+      h->total_size != db->size)
+    return 0;
+  if (h->files_offset > db->size ||
+      h->file_count > (db->size - h->files_offset) / sizeof(xmldb_file_t) ||
+      h->nodes_offset > db->size ||
+      h->node_count > (db->size - h->nodes_offset) / sizeof(xmldb_node_t) ||
+      h->attrs_offset > db->size ||
+      h->attr_count > (db->size - h->attrs_offset) / sizeof(xmldb_attr_t) ||
+      h->strings_offset > db->size ||
+      h->string_size > db->size - h->strings_offset ||
+      h->string_size == 0 ||
+      db->image[h->strings_offset + h->string_size - 1] != '\0' ||
+      (h->files_offset | h->nodes_offset | h->attrs_offset) %
+      sizeof(unsigned) != 0)
+    return 0;
+  db->header = h;
+  db->files = (const xmldb_file_t *) (db->image + h->files_offset);
+  db->nodes = (const xmldb_node_t *) (db->image + h->nodes_offset);
+  db->attrs = (const xmldb_attr_t *) (db->image + h->attrs_offset);
+  db->strings = db->image + h->strings_offset;
+  for (i = 0; i < h->file_count; i++)
+    {
+      const xmldb_file_t *f = &(db->files[i]);
+      if (f->name >= h->string_size ||
+	  (i > 0 && strcmp(db->strings + db->files[i - 1].name,
+			   db->strings + f->name) >= 0) ||
+	  f->node_count == 0 || f->first_node > h->node_count ||
+	  f->node_count > h->node_count - f->first_node ||
+	  f->first_attr > h->attr_count ||
+	  f->attr_count > h->attr_count - f->first_attr)
+	return 0;
+    }
+  return 1;
+}
+
+static void
+open_xmldb(xmldb_t *db)
+{
+  char *file_name = stpi_path_merge(db->directory, XMLDB_NAME);
+  struct stat sbuf;
+  int fd = open(file_name, O_RDONLY);
+  if (fd < 0)
+    {
+      stp_free(file_name);
+      return;
+    }
+  if (fstat(fd, &sbuf) == 0 && sbuf.st_size > 0)
+    {
+      db->size = sbuf.st_size;
+      db->mtime = sbuf.st_mtime;
+#ifdef HAVE_SYS_MMAN_H
+      db->image = mmap(NULL, db->size, PROT_READ, MAP_SHARED, fd, 0);
+      if (db->image != MAP_FAILED)
+	db->mapped = 1;
+      else
+#endif
+	{
+	  db->image = stp_malloc(db->size);
+	  if (read(fd, db->image, db->size) != (ssize_t) db->size)
+	    db->size = 0;
+	}
+      if (!valid_xmldb(db))
+	{
+	  stp_deprintf(STP_DBG_XML, "xmldb: %s is not usable\n", file_name);
+#ifdef HAVE_SYS_MMAN_H
+	  if (db->mapped)
+	    (void) munmap(db->image, db->size);
+	  else
+#endif
+	    stp_free(db->image);
+	  db->image = NULL;
+	}
+      else
+	stp_deprintf(STP_DBG_XML, "xmldb: using %s (%u files)\n", file_name,
+		     db->header->file_count);
+    }
+  (void) close(fd);
+  stp_free(file_name);
+}
+
+/*
+ * Databases stay open for the life of the process; there is one per data
+ * directory, and a directory without one is remembered as well.
+ */
+static xmldb_t *
+get_xmldb(const char *directory)
+{
+  stp_list_item_t *item;
+  xmldb_t *db;
+  if (!xmldb_list)
+    {
+      xmldb_list = stp_list_create();
+      stp_list_set_namefunc(xmldb_list, xmldb_namefunc);
+    }
+  item = stp_list_get_item_by_name(xmldb_list, directory);
+  if (item)
+    return (xmldb_t *) stp_list_item_get_data(item);
+  db = stp_zalloc(sizeof(xmldb_t));
+  db->directory = stp_strdup(directory);
+  open_xmldb(db);
+  stp_list_item_create(xmldb_list, NULL, db);
+  return db;
+}
+
+static const xmldb_file_t *
+find_file(const xmldb_t *db, const char *name)
+{
+  int low = 0;
+  int high = db->header->file_count - 1;
+  while (low <= high)
+    {
+      int middle = (low + high) / 2;
+      int cmp = strcmp(name, db->strings + db->files[middle].name);
+      if (cmp == 0)
+	return &(db->files[middle]);
+      else if (cmp < 0)
+	high = middle - 1;
+      else
+	low = middle + 1;
+    }
+  return NULL;
+}
+
+static const char *
+get_string(xmldb_cursor_t *c, unsigned offset)
+{
+  if (offset >= c->db->header->string_size)
+    {
+      c->error = 1;
+      return "";
+    }
+  return c->db->strings + offset;
+}
+
+/*
+ * A damaged database cannot make this read outside the tables; it only
+ * sets the error flag, and the caller then throws the tree away.
+ */
+static stp_mxml_node_t *
+build_node(xmldb_cursor_t *c, stp_mxml_node_t *parent)
+{
+  const xmldb_node_t *n = &(c->db->nodes[c->node++]);
+  unsigned count = n->flags >> NODE_COUNT_SHIFT;
+  stp_mxml_node_t *node;
+  if (n->flags & NODE_TEXT)
+    return stp_mxmlNewText(parent, count, get_string(c, n->value));
+  node = stp_mxmlNewElement(parent, get_string(c, n->value));
+  if (count > c->attr_end - c->attr)
+    {
+      c->error = 1;
+      return node;
+    }
+  for (; count > 0; count--, c->attr++)
+    {
+      const xmldb_attr_t *a = &(c->db->attrs[c->attr]);
+      stp_mxmlElementSetAttr(node, get_string(c, a->name),
+			     get_string(c, a->value));
+    }
+  if (n->flags & NODE_CHILDREN)
+    {
+      const xmldb_node_t *child;
+      do
+	{
+	  if (c->error || c->node >= c->node_end)
+	    {
+	      c->error = 1;
+	      break;
+	    }
+	  child = &(c->db->nodes[c->node]);
+	  build_node(c, node);
+	}
+      while (!(child->flags & NODE_LAST));
+    }
+  return node;
+}
+
+static stp_mxml_node_t *
+build_file(const xmldb_t *db, const xmldb_file_t *f)
+{
+  xmldb_cursor_t cursor;
+  stp_mxml_node_t *root;
+  cursor.db = db;
+  cursor.node = f->first_node;
+  cursor.node_end = f->first_node + f->node_count;
+  cursor.attr = f->first_attr;
+  cursor.attr_end = f->first_attr + f->attr_count;
+  cursor.error = 0;
+  root = build_node(&cursor, NULL);
+  if (cursor.error || cursor.node != cursor.node_end ||
+      cursor.attr != cursor.attr_end)
+    {
+      stp_deprintf(STP_DBG_XML, "xmldb: %s: damaged entry for %s\n",
+		   db->directory, db->strings + f->name);
+      stp_mxmlDelete(root);
+      return NULL;
+    }
+  return root;
+}
+
+static stp_mxml_node_t *
+load_from_xmldb(const char *file)
+{
+  stp_list_t *dir_list = stpi_data_path();
+  stp_list_item_t *item = stp_list_get_start(dir_list);
+  stp_mxml_node_t *answer = NULL;
+  while (item)
+    {
+      const char *dn = (const char *) stp_list_item_get_data(item);
+      size_t length = strlen(dn);
+      while (length > 1 && dn[length - 1] == '/')
+	length--;
+      if (strncmp(file, dn, length) == 0 && file[length] == '/')
+	{
+	  const char *name = file + length;
+	  xmldb_t *db;
+	  const xmldb_file_t *f = NULL;
+	  struct stat sbuf;
+	  while (*name == '/')
+	    name++;
+	  LOCK_XMLDB();
+	  db = get_xmldb(dn);
+	  if (db->image)
+	    f = find_file(db, name);
+	  if (f && stat(file, &sbuf) == 0 && sbuf.st_size == f->size &&
+	      sbuf.st_mtime <= db->mtime)
+	    answer = build_file(db, f);
+	  UNLOCK_XMLDB();
+	  break;
+	}
+      item = stp_list_item_next(item);
+    }
+  stp_list_destroy(dir_list);
+  if (answer)
+    stp_deprintf(STP_DBG_XML, "xmldb: %s from database\n", file);
+  return answer;
+}
+
+stp_mxml_node_t *
+stpi_xml_load_file(const char *file)
+{
+  stp_mxml_node_t *doc = load_from_xmldb(file);
+  if (!doc)
+    doc = stp_mxmlLoadFromFile(NULL, file, STP_MXML_NO_CALLBACK);
+  return doc;
+}
+
+/*
+ * Writing the database.  Strings are shared through a small hash table,
+ * which matters for the dither matrices, whose text is mostly numbers.
+ */
+
+typedef struct
+{
+  xmldb_file_t *files;
+  xmldb_node_t *nodes;
+  xmldb_attr_t *attrs;
+  char *strings;
+  unsigned file_count;
+  unsigned node_count;
+  unsigned node_space;
+  unsigned attr_count;
+  unsigned attr_space;
+  unsigned string_size;
+  unsigned string_space;
+  unsigned *hash;		/* String offset + 1, or 0 for an empty slot */
+  unsigned hash_size;
+  unsigned hash_count;
+} xmldb_writer_t;
+
+static unsigned
+hash_string(const char *s)
+{
+  unsigned h = 2166136261u;
+  while (*s)
+    h = (h ^ (unsigned char) *s++) * 16777619u;
+  return h;
+}
+
+static void
+grow_hash(xmldb_writer_t *w)
+{
+  unsigned *old = w->hash;
+  unsigned old_size = w->hash_size;
+  unsigned i;
+  w->hash_size = old_size ? old_size * 2 : 4096;
+  w->hash = stp_zalloc(w->hash_size * sizeof(unsigned));
+  for (i = 0; i < old_size; i++)
+    if (old[i])
+      {
+	unsigned slot = hash_string(w->strings + old[i] - 1) &
+	  (w->hash_size - 1);
+	while (w->hash[slot])
+	  slot = (slot + 1) & (w->hash_size - 1);
+	w->hash[slot] = old[i];
+      }
+  STP_SAFE_FREE(old);
+}
+
+static unsigned
+add_string(xmldb_writer_t *w, const char *s)
+{
+  unsigned slot;
+  size_t length;
+  if (!s)
+    s = "";
+  if (w->hash_count * 2 >= w->hash_size)
+    grow_hash(w);
+  slot = hash_string(s) & (w->hash_size - 1);
+  while (w->hash[slot])
+    {
+      if (strcmp(w->strings + w->hash[slot] - 1, s) == 0)
+	return w->hash[slot] - 1;
+      slot = (slot + 1) & (w->hash_size - 1);
+    }
+  length = strlen(s) + 1;
+  while (w->string_size + length > w->string_space)
+    {
+      w->string_space = w->string_space ? w->string_space * 2 : 65536;
+      w->strings = stp_realloc(w->strings, w->string_space);
+    }
+  memcpy(w->strings + w->string_size, s, length);
+  w->hash[slot] = w->string_size + 1;
+  w->hash_count++;
+  w->string_size += length;
+  return w->string_size - length;
+}
+
+static int
+add_node(xmldb_writer_t *w, stp_mxml_node_t *node, int last)
+{
+  xmldb_node_t *n;
+  stp_mxml_node_t *child;
+  int i;
+  if (w->node_count == w->node_space)
+    {
+      w->node_space = w->node_space ? w->node_space * 2 : 4096;
+      w->nodes = stp_realloc(w->nodes, w->node_space * sizeof(xmldb_node_t));
+    }
+  n = &(w->nodes[w->node_count++]);
+  n->flags = last ? NODE_LAST : 0;
+  if (node->type == STP_MXML_TEXT)
+    {
+      n->flags |= NODE_TEXT |
+	((node->value.text.whitespace ? 1 : 0) << NODE_COUNT_SHIFT);
+      n->value = add_string(w, node->value.text.string);
+      return 1;
+    }
+  else if (node->type != STP_MXML_ELEMENT)
+    return 0;
+  n->flags |= node->value.element.num_attrs << NODE_COUNT_SHIFT;
+  if (node->child)
+    n->flags |= NODE_CHILDREN;
+  n->value = add_string(w, node->value.element.name);
+  while (w->attr_count + node->value.element.num_attrs > w->attr_space)
+    {
+      w->attr_space = w->attr_space ? w->attr_space * 2 : 4096;
+      w->attrs = stp_realloc(w->attrs, w->attr_space * sizeof(xmldb_attr_t));
+    }
+  for (i = 0; i < node->value.element.num_attrs; i++)
+    {
+      w->attrs[w->attr_count].name =
+	add_string(w, node->value.element.attrs[i].name);
+      w->attrs[w->attr_count].value =
+	add_string(w, node->value.element.attrs[i].value);
+      w->attr_count++;
+    }
+  /* This moves the node array, so n is not used past here */
+  for (child = node->child; child; child = child->next)
+    if (!add_node(w, child, child->next == NULL))
+      return 0;
+  return 1;
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+  return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+int
+stpi_xmldb_write(const char *db_file, const char *directory,
+		 int count, const char **files)
+{
+  xmldb_writer_t w;
+  xmldb_header_t header;
+  const char **names = stp_malloc(count * sizeof(const char *));
+  FILE *fp;
+  int status = 0;
+  int i;
+
+  memset(&w, 0, sizeof(w));
+  memcpy(names, files, count * sizeof(const char *));
+  qsort(names, count, sizeof(const char *), compare_names);
+  w.files = stp_zalloc(count * sizeof(xmldb_file_t));
+  for (i = 0; i < count && status == 0; i++)
+    {
+      char *file_name;
+      struct stat sbuf;
+      stp_mxml_node_t *doc;
+      if (i > 0 && strcmp(names[i - 1], names[i]) == 0)
+	continue;
+      file_name = stpi_path_merge(directory, names[i]);
+      doc = stp_mxmlLoadFromFile(NULL, file_name, STP_MXML_NO_CALLBACK);
+      if (!doc || stat(file_name, &sbuf) != 0)
+	{
+	  stp_erprintf("stpi_xmldb_write: unable to read %s\n", file_name);
+	  status = 1;
+	}
+      else
+	{
+	  xmldb_file_t *f = &(w.files[w.file_count++]);
+	  f->first_node = w.node_count;
+	  f->first_attr = w.attr_count;
+	  if (!add_node(&w, doc, 1))
+	    {
+	      stp_erprintf("stpi_xmldb_write: %s: unsupported node type\n",
+			   file_name);
+	      status = 1;
+	    }
+	  f->name = add_string(&w, names[i]);
+	  f->size = sbuf.st_size;
+	  f->node_count = w.node_count - f->first_node;
+	  f->attr_count = w.attr_count - f->first_attr;
+	}
+      if (doc)
+	stp_mxmlDelete(doc);
+      stp_free(file_name);
+    }
+  if (w.string_size == 0)
+    add_string(&w, "");
+
+  if (status == 0)
+    {
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, XMLDB_MAGIC, sizeof(header.magic));
+      header.byte_order = XMLDB_BYTE_ORDER;
+      header.format = XMLDB_FORMAT;
+      strncpy(header.version, VERSION, XMLDB_VERSION_SIZE);
+      header.file_count = w.file_count;
+      header.node_count = w.node_count;
+      header.attr_count = w.attr_count;
+      header.string_size = w.string_size;
+      header.files_offset = sizeof(header);
+      header.nodes_offset =
+	header.files_offset + w.file_count * sizeof(xmldb_file_t);
+      header.attrs_offset =
+	header.nodes_offset + w.node_count * sizeof(xmldb_node_t);
+      header.strings_offset =
+	header.attrs_offset + w.attr_count * sizeof(xmldb_attr_t);
+      header.total_size = header.strings_offset + w.string_size;
+      fp = fopen(db_file, "wb");
+      if (!fp)
+	{
+	  stp_erprintf("stpi_xmldb_write: unable to create %s: %s\n",
+		       db_file, strerror(errno));
+	  status = 1;
+	}
+      else
+	{
+	  if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+	      fwrite(w.files, sizeof(xmldb_file_t), w.file_count, fp) !=
+	      w.file_count ||
+	      fwrite(w.nodes, sizeof(xmldb_node_t), w.node_count, fp) !=
+	      w.node_count ||
+	      fwrite(w.attrs, sizeof(xmldb_attr_t), w.attr_count, fp) !=
+	      w.attr_count ||
+	      fwrite(w.strings, 1, w.string_size, fp) != w.string_size)
+	    status = 1;
+	  if (fclose(fp) != 0)
+	    status = 1;
+	  if (status)
+	    stp_erprintf("stpi_xmldb_write: error writing %s\n", db_file);
+	}
+    }
+  STP_SAFE_FREE(w.files);
+  STP_SAFE_FREE(w.nodes);
+  STP_SAFE_FREE(w.attrs);
+  STP_SAFE_FREE(w.strings);
+  STP_SAFE_FREE(w.hash);
+  stp_free(names);
+  return status;
+}
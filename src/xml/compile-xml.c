@@ -0,0 +1,40 @@
+/*
+ * Precompile the XML data files
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Usage: compile-xml output-file data-directory file...
+ *
+ * The files are named relative to the data directory, as the library
+ * looks them up.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <gutenprint/gutenprint.h>
+#include "../main/gutenprint-internal.h"
+
+int
+main(int argc, char **argv)
+{
+  if (argc < 3)
+    {
+      fprintf(stderr, "Usage: %s output-file data-directory file...\n",
+	      argv[0]);
+      return 1;
+    }
+  return stpi_xmldb_write(argv[1], argv[2], argc - 3,
+			  (const char **) (argv + 3));
+}
@@ -0,0 +1,494 @@
+/*
+ *   Check and time the bit plane fold, split and unpack kernels
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Every kernel level the machine supports is compared against reference
+ * versions written one bit at a time from the layouts documented in
+ * bit-ops.c.  Each pair of input planes is run through all 65536
+ * combinations of values, every byte value is unpacked at every position
+ * within a vector, and random lines of every short length exercise the
+ * leftover bytes at the end of a line.  Output buffers are filled with a
+ * marker first so that a kernel writing too far is caught too.  The
+ * throughput of each kernel at each level is reported at the end.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "../src/main/gutenprint-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define MARKER 0xa5
+#define SLACK 16
+#define MAX_LENGTH (65536 * 3)
+#define BENCH_LENGTH 2880
+#define BENCH_SECONDS 0.05
+
+static const char *kernel_names[] = { "portable", "sse2", "avx2" };
+
+static int test_count = 0;
+static int error_count = 0;
+
+static unsigned char in_buf[MAX_LENGTH * 8];
+static unsigned char expect_buf[MAX_LENGTH * 8 + SLACK];
+static unsigned char result_buf[MAX_LENGTH * 8 + SLACK];
+
+typedef struct
+{
+  unsigned char *buf;
+  int bit;
+} bit_writer_t;
+
+static void
+put_bit(bit_writer_t *w, int value)
+{
+  if (value)
+    w->buf[w->bit / 8] |= 0x80 >> (w->bit % 8);
+  w->bit++;
+}
+
+static int
+get_bit(const unsigned char *buf, int bit)
+{
+  return (buf[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+/*
+ * Interleave n planes of single_length bytes, one bit of each plane per
+ * pixel with the last plane first.
+ */
+static void
+ref_fold(const unsigned char *line, int single_length, int n,
+	 unsigned char *outbuf)
+{
+  bit_writer_t w;
+  int i, bit, plane;
+  w.buf = outbuf;
+  w.bit = 0;
+  memset(outbuf, 0, single_length * n);
+  for (i = 0; i < single_length; i++)
+    for (bit = 0; bit < 8; bit++)
+      for (plane = n - 1; plane >= 0; plane--)
+	put_bit(&w, get_bit(line + plane * single_length, i * 8 + bit));
+}
+
+/*
+ * The 3-2-3 layout drops the high plane of every third pixel, starting
+ * with the second.  Three bytes of each plane make eight bytes of output,
+ * which are written only when one of them is nonzero.
+ */
+static void
+ref_fold_323(const unsigned char *line, int single_length,
+	     unsigned char *outbuf)
+{
+  int i, pixel, plane;
+  memset(outbuf, 0, single_length * 3);
+  for (i = 0; i < single_length; i += 3)
+    {
+      unsigned char group[3][3];
+      int nonzero = 0;
+      bit_writer_t w;
+      for (plane = 0; plane < 3; plane++)
+	for (pixel = 0; pixel < 3; pixel++)
+	  {
+	    group[plane][pixel] = i + pixel < single_length ?
+	      line[plane * single_length + i + pixel] : 0;
+	    nonzero |= group[plane][pixel];
+	  }
+      if (!nonzero)
+	continue;
+      memset(outbuf + i / 3 * 8, 0, 8);
+      w.buf = outbuf + i / 3 * 8;
+      w.bit = 0;
+      for (pixel = 0; pixel < 24; pixel++)
+	for (plane = 2; plane >= 0; plane--)
+	  if (plane < 2 || pixel % 3 != 1)
+	    put_bit(&w, get_bit(group[plane], pixel));
+    }
+}
+
+/*
+ * Deal the nonzero pixels of each byte, lowest first, to the output rows
+ * in turn.
+ */
+static void
+ref_split(int length, int bits, int n, const unsigned char *in,
+	  int increment, unsigned char **outs)
+{
+  int row = 0;
+  int i, k;
+  for (i = 1; i < n; i++)
+    memset(outs[i * increment], 0, length * bits);
+  for (i = 0; i < length * bits; i++)
+    {
+      outs[0][i] = 0;
+      for (k = 0; k < 8; k += bits)
+	{
+	  unsigned mask = ((1 << bits) - 1) << k;
+	  if (in[i] & mask)
+	    {
+	      outs[row][i] |= in[i] & mask;
+	      row += increment;
+	      if (row >= n * increment)
+		row = 0;
+	    }
+	}
+    }
+}
+
+/*
+ * The number of input bytes that stp_unpack reads for a given length.
+ */
+static int
+unpack_input_bytes(int length, int bits, int n)
+{
+  if (bits == 1)
+    return n == 16 ? length * 2 : length;
+  else
+    return n == 16 ? ((length + 1) / 2) * 4 : length * 2;
+}
+
+/*
+ * Pixel p of the input goes to plane p % n, in order, each plane
+ * starting on a byte boundary.
+ */
+static void
+ref_unpack(int length, int bits, int n, const unsigned char *in,
+	   unsigned char **outs)
+{
+  int in_bits = unpack_input_bytes(length, bits, n) * 8;
+  int plane_bytes = (in_bits / n + 7) / 8;
+  bit_writer_t w[16];
+  int p, b;
+  for (p = 0; p < n; p++)
+    {
+      w[p].buf = outs[p];
+      w[p].bit = 0;
+      memset(outs[p], 0, plane_bytes);
+    }
+  for (p = 0; p * bits < in_bits; p++)
+    for (b = 0; b < bits; b++)
+      put_bit(&w[p % n], get_bit(in, p * bits + b));
+}
+
+static void
+check(int level, const char *what, int length, int ok)
+{
+  test_count++;
+  if (!ok)
+    {
+      error_count++;
+      printf("%s %s failed (length %d)\n", kernel_names[level], what, length);
+    }
+}
+
+static void
+run_fold(int kind, const unsigned char *line, int length, unsigned char *out)
+{
+  switch (kind)
+    {
+    case 2:
+      stp_fold(line, length, out);
+      break;
+    case 3:
+      stp_fold_3bit(line, length, out);
+      break;
+    case 4:
+      stp_fold_4bit(line, length, out);
+      break;
+    case 8:
+      stp_fold_8bit(line, length, out);
+      break;
+    default:
+      stp_fold_3bit_323(line, length, out);
+      break;
+    }
+}
+
+static void
+run_ref_fold(int kind, const unsigned char *line, int length,
+	     unsigned char *out)
+{
+  if (kind == 323)
+    ref_fold_323(line, length, out);
+  else
+    ref_fold(line, length, kind, out);
+}
+
+static const char *
+fold_name(int kind)
+{
+  switch (kind)
+    {
+    case 2:
+      return "stp_fold";
+    case 3:
+      return "stp_fold_3bit";
+    case 4:
+      return "stp_fold_4bit";
+    case 8:
+      return "stp_fold_8bit";
+    default:
+      return "stp_fold_3bit_323";
+    }
+}
+
+static void
+check_fold_line(int level, int kind, int length)
+{
+  int planes = kind == 323 ? 3 : kind;
+  int bytes = length * planes + (kind == 323 ? 6 : 0) + SLACK;
+  memset(expect_buf, MARKER, bytes);
+  memset(result_buf, MARKER, bytes);
+  run_ref_fold(kind, in_buf, length, expect_buf);
+  run_fold(kind, in_buf, length, result_buf);
+  check(level, fold_name(kind), length, !memcmp(expect_buf, result_buf, bytes));
+}
+
+static void
+fill_random(unsigned char *buf, int bytes)
+{
+  int density = rand() % 4;
+  int i;
+  for (i = 0; i < bytes; i++)
+    {
+      if (density == 0 && rand() % 3)
+	buf[i] = 0;
+      else if (density == 1)
+	buf[i] = 1 << (rand() % 8);
+      else
+	buf[i] = rand();
+    }
+}
+
+static void
+check_fold(int level, int kind)
+{
+  int planes = kind == 323 ? 3 : kind;
+  int length, pass, a, b, i;
+
+  /*
+   * Every pair of planes sees all 65536 combinations, with the other
+   * planes random.  The 3-2-3 layout repeats each value three times so
+   * that each lands at every position within its group.
+   */
+  for (a = 0; a < planes; a++)
+    for (b = a + 1; b < planes; b++)
+      {
+	int repeat = kind == 323 ? 3 : 1;
+	length = 65536 * repeat;
+	fill_random(in_buf, length * planes);
+	for (i = 0; i < length; i++)
+	  {
+	    in_buf[a * length + i] = (i / repeat) & 0xff;
+	    in_buf[b * length + i] = (i / repeat) >> 8;
+	  }
+	check_fold_line(level, kind, length);
+      }
+
+  for (length = 0; length < 200; length++)
+    for (pass = 0; pass < 10; pass++)
+      {
+	fill_random(in_buf, length * planes);
+	check_fold_line(level, kind, length);
+      }
+}
+
+static void
+check_unpack_line(int level, int bits, int n, int length)
+{
+  int in_bytes = unpack_input_bytes(length, bits, n);
+  int plane_bytes = (in_bytes * 8 / n + 7) / 8;
+  int stride = plane_bytes + SLACK;
+  unsigned char *expect[16];
+  unsigned char *result[16];
+  char name[32];
+  int p;
+  for (p = 0; p < n; p++)
+    {
+      expect[p] = expect_buf + p * stride;
+      result[p] = result_buf + p * stride;
+    }
+  memset(expect_buf, MARKER, n * stride);
+  memset(result_buf, MARKER, n * stride);
+  ref_unpack(length, bits, n, in_buf, expect);
+  stp_unpack(length, bits, n, in_buf, result);
+  sprintf(name, "stp_unpack %d bit %d", bits, n);
+  check(level, name, length, !memcmp(expect_buf, result_buf, n * stride));
+}
+
+static void
+check_unpack(int level, int bits, int n)
+{
+  int length, pass, i;
+
+  /*
+   * Every byte value at each of 32 positions, which covers every position
+   * within the widest vector.
+   */
+  for (i = 0; i < 256 * 32; i++)
+    in_buf[i] = (i / 32 + (i % 32) * 97) & 0xff;
+  length = 256 * 32;
+  if (bits == 2 || n == 16)
+    length /= 2;
+  check_unpack_line(level, bits, n, length);
+
+  for (length = 0; length < 200; length++)
+    for (pass = 0; pass < 10; pass++)
+      {
+	fill_random(in_buf, unpack_input_bytes(length, bits, n));
+	check_unpack_line(level, bits, n, length);
+      }
+}
+
+static void
+check_split(void)
+{
+  static const int counts[] = { 2, 3, 4 };
+  unsigned char *expect[8];
+  unsigned char *result[8];
+  int c, bits, increment, length, pass, i;
+  for (c = 0; c < 3; c++)
+    for (bits = 1; bits <= 2; bits++)
+      for (increment = 1; increment <= 2; increment++)
+	for (length = 0; length < 600; length += length < 40 ? 1 : 97)
+	  for (pass = 0; pass < 4; pass++)
+	    {
+	      int n = counts[c];
+	      int bytes = length * bits;
+	      int stride = bytes + SLACK;
+	      char name[40];
+	      for (i = 0; i < 8; i++)
+		{
+		  expect[i] = expect_buf + i * stride;
+		  result[i] = result_buf + i * stride;
+		}
+	      if (pass == 0)
+		for (i = 0; i < bytes; i++)
+		  in_buf[i] = i;
+	      else
+		fill_random(in_buf, bytes);
+	      memset(expect_buf, MARKER, 8 * stride);
+	      memset(result_buf, MARKER, 8 * stride);
+	      ref_split(length, bits, n, in_buf, increment, expect);
+	      stp_split(length, bits, n, in_buf, increment, result);
+	      sprintf(name, "stp_split %d bit %d by %d", bits, n, increment);
+	      check(0, name, length, !memcmp(expect_buf, result_buf, 8 * stride));
+	    }
+}
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+ * Time one kernel on dense random planes of BENCH_LENGTH bytes, as from a
+ * wide line at high resolution, and report megabytes of input per second.
+ */
+static void
+bench(int level, int fold_kind, int bits, int n)
+{
+  unsigned char *outs[16];
+  const char *name;
+  char buf[32];
+  int planes = fold_kind ? (fold_kind == 323 ? 3 : fold_kind) : 1;
+  int length = BENCH_LENGTH;
+  int in_bytes, calls = 0, p;
+  double start, elapsed;
+
+  if (fold_kind)
+    {
+      in_bytes = length * planes;
+      name = fold_name(fold_kind);
+    }
+  else
+    {
+      length = BENCH_LENGTH / (n == 16 ? 2 * bits : bits);
+      in_bytes = unpack_input_bytes(length, bits, n);
+      sprintf(buf, "stp_unpack %d bit %d", bits, n);
+      name = buf;
+      for (p = 0; p < n; p++)
+	outs[p] = result_buf + p * (length * 2 + SLACK);
+    }
+  for (p = 0; p < in_bytes; p++)
+    in_buf[p] = rand();
+  start = now();
+  do
+    {
+      int i;
+      for (i = 0; i < 100; i++)
+	{
+	  if (fold_kind)
+	    run_fold(fold_kind, in_buf, length, result_buf);
+	  else
+	    stp_unpack(length, bits, n, in_buf, outs);
+	}
+      calls += 100;
+      elapsed = now() - start;
+    }
+  while (elapsed < BENCH_SECONDS);
+  printf("%-22s %-8s %9.1f MB/s\n", name, kernel_names[level],
+	 calls * (double) in_bytes / elapsed / 1000000);
+}
+
+static const int fold_kinds[] = { 2, 3, 323, 4, 8 };
+static const int unpack_counts[] = { 2, 4, 8, 16 };
+
+int
+main(int argc, char **argv)
+{
+  int levels, level, i, bits;
+  stp_init();
+  srand(1);
+  levels = stpi_bit_kernels_set_level(-1);
+  for (level = 0; level <= levels; level++)
+    {
+      stpi_bit_kernels_set_level(level);
+      for (i = 0; i < 5; i++)
+	check_fold(level, fold_kinds[i]);
+      for (bits = 1; bits <= 2; bits++)
+	for (i = 0; i < 4; i++)
+	  check_unpack(level, bits, unpack_counts[i]);
+    }
+  check_split();
+
+  for (i = 0; i < 5; i++)
+    for (level = 0; level <= levels; level++)
+      {
+	stpi_bit_kernels_set_level(level);
+	bench(level, fold_kinds[i], 0, 0);
+      }
+  for (bits = 1; bits <= 2; bits++)
+    for (i = 0; i < 4; i++)
+      for (level = 0; level <= levels; level++)
+	{
+	  stpi_bit_kernels_set_level(level);
+	  bench(level, 0, bits, unpack_counts[i]);
+	}
+  stpi_bit_kernels_set_level(-1);
+  printf("%d tests, %d failed\n", test_count, error_count);
+  return error_count ? 1 : 0;
+}
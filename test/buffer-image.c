@@ -0,0 +1,221 @@
+/*
+ *   Check buffered images
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Every row of a buffered image, flipped each way, must match the row
+ * of the source image it comes from, read with its pixels in reverse
+ * order when flipped from side to side.  Source rows must be read only
+ * as far as they are needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "../src/main/gutenprint-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+  int width;
+  int height;
+  int rows_read;
+  int concluded;
+} source_t;
+
+static int test_count = 0;
+static int error_count = 0;
+
+static unsigned char
+source_byte(int row, size_t offset)
+{
+  return (row * 31 + offset * 7 + (offset >> 8)) & 0xff;
+}
+
+static int
+source_width(stp_image_t *image)
+{
+  return ((source_t *) image->rep)->width;
+}
+
+static int
+source_height(stp_image_t *image)
+{
+  return ((source_t *) image->rep)->height;
+}
+
+static stp_image_status_t
+source_get_row(stp_image_t *image, unsigned char *data, size_t byte_limit,
+	       int row)
+{
+  source_t *source = (source_t *) image->rep;
+  size_t i;
+  source->rows_read++;
+  for (i = 0; i < byte_limit; i++)
+    data[i] = source_byte(row, i);
+  return STP_IMAGE_STATUS_OK;
+}
+
+static void
+source_conclude(stp_image_t *image)
+{
+  ((source_t *) image->rep)->concluded = 1;
+}
+
+static stp_image_t *
+source_image(source_t *source, int width, int height)
+{
+  stp_image_t *image = stp_zalloc(sizeof(stp_image_t));
+  memset(source, 0, sizeof(source_t));
+  source->width = width;
+  source->height = height;
+  image->width = source_width;
+  image->height = source_height;
+  image->get_row = source_get_row;
+  image->conclude = source_conclude;
+  image->rep = source;
+  return image;
+}
+
+static void
+check(int ok, const char *what, int bpp, int width, unsigned flags)
+{
+  test_count++;
+  if (!ok)
+    {
+      printf("%s, %d bytes per pixel, width %d, flags %u: FAILED\n",
+	     what, bpp, width, flags);
+      error_count++;
+    }
+}
+
+/* The row as the buffered image should return it */
+static void
+expected_row(unsigned char *data, size_t byte_limit, int width, int height,
+	     int row, unsigned flags)
+{
+  int bpp = byte_limit / width;
+  int i, j;
+  if (flags & BUFFER_FLAG_FLIP_Y)
+    row = height - row - 1;
+  for (i = 0; i < width; i++)
+    for (j = 0; j < bpp; j++)
+      {
+	size_t offset = (flags & BUFFER_FLAG_FLIP_X) ?
+	  byte_limit - (i + 1) * bpp + j : i * bpp + j;
+	data[i * bpp + j] = source_byte(row, offset);
+      }
+}
+
+static void
+test_rows(int bpp, int width, size_t padding, unsigned flags)
+{
+  int height = 5;
+  size_t byte_limit = width * bpp + padding;
+  size_t pixel_bytes = width * bpp;
+  unsigned char *data = stp_malloc(byte_limit);
+  unsigned char *expected = stp_malloc(byte_limit);
+  source_t source;
+  stp_image_t *image =
+    stpi_buffer_image(source_image(&source, width, height), flags);
+  int ok = 1, lent = 1;
+  int row;
+
+  if (!(flags & BUFFER_FLAG_FLIP_Y))
+    {
+      stp_image_get_row(image, data, byte_limit, 1);
+      check(source.rows_read == 2, "rows are read as needed",
+	    bpp, width, flags);
+    }
+  for (row = 0; row < height; row++)
+    {
+      const unsigned char *ptr;
+      expected_row(expected, byte_limit, width, height, row, flags);
+      if (stp_image_get_row(image, data, byte_limit, row) !=
+	  STP_IMAGE_STATUS_OK || memcmp(data, expected, pixel_bytes))
+	ok = 0;
+      if (stp_image_get_row_ptr(image, &ptr, byte_limit, row) !=
+	  STP_IMAGE_STATUS_OK)
+	ok = 0;
+      else if (!ptr)
+	lent = 0;
+      else if (memcmp(ptr, expected, pixel_bytes))
+	ok = 0;
+    }
+  check(ok, "rows", bpp, width, flags);
+  check(lent, "rows are lent", bpp, width, flags);
+  check(source.rows_read == height, "each row is read once",
+	bpp, width, flags);
+  stp_image_conclude(image);
+  check(source.concluded, "source is concluded", bpp, width, flags);
+  stp_free(data);
+  stp_free(expected);
+}
+
+/*
+ * An image too big to allocate comfortably; only the rows that are read
+ * should ever be touched.
+ */
+static void
+test_big_image(void)
+{
+  int width = 8192, height = 4096, bpp = 4;
+  size_t byte_limit = width * bpp;
+  unsigned char *data = stp_malloc(byte_limit);
+  unsigned char *expected = stp_malloc(byte_limit);
+  source_t source;
+  stp_image_t *image =
+    stpi_buffer_image(source_image(&source, width, height),
+		      BUFFER_FLAG_FLIP_X);
+  int row, ok = 1;
+  for (row = 0; row < 4; row++)
+    {
+      expected_row(expected, byte_limit, width, height, row,
+		   BUFFER_FLAG_FLIP_X);
+      if (stp_image_get_row(image, data, byte_limit, row) !=
+	  STP_IMAGE_STATUS_OK || memcmp(data, expected, byte_limit))
+	ok = 0;
+    }
+  check(ok && source.rows_read == 4, "big image", bpp, width,
+	BUFFER_FLAG_FLIP_X);
+  stp_image_conclude(image);
+  stp_free(data);
+  stp_free(expected);
+}
+
+int
+main(int argc, char **argv)
+{
+  static const int widths[] = { 1, 2, 7, 64, 333 };
+  int bpp, w;
+  unsigned flags;
+  stp_init();
+  for (bpp = 1; bpp <= 8; bpp++)
+    for (w = 0; w < sizeof(widths) / sizeof(int); w++)
+      for (flags = 0; flags < 4; flags++)
+	{
+	  test_rows(bpp, widths[w], 0, flags);
+	  if (widths[w] > bpp)
+	    test_rows(bpp, widths[w], bpp - 1, flags);
+	}
+  test_big_image();
+  printf("%d tests, %d failed\n", test_count, error_count);
+  return error_count ? 1 : 0;
+}
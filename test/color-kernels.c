@@ -0,0 +1,150 @@
+/*
+ *   Check the color conversion row kernels against each other
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Every SIMD level the machine supports must produce exactly what the
+ * portable kernels produce.  Row lengths are chosen to exercise both the
+ * vector loops and the leftover samples at the end of a row.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "../src/main/gutenprint-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PIXELS 1031
+#define MAX_SAMPLES (MAX_PIXELS * 4)
+
+static const char *level_names[] = { "portable", "SSE2", "AVX2" };
+static const int row_pixels[] = { 1, 7, 8, 15, 16, 17, 33, 64, 255, MAX_PIXELS };
+
+static int test_count = 0;
+static int error_count = 0;
+
+static unsigned short raw_16[MAX_SAMPLES];
+static unsigned char raw_8[MAX_SAMPLES];
+static unsigned short tables[4][65536];
+
+static unsigned short expect[MAX_SAMPLES];
+static unsigned short result[MAX_SAMPLES];
+
+static void
+check(int level, const char *what, int pixels, int channels,
+      int ok)
+{
+  test_count++;
+  if (!ok)
+    {
+      error_count++;
+      printf("%s %s failed (%d pixels, %d channels)\n",
+	     level_names[level], what, pixels, channels);
+    }
+}
+
+static void
+fill_data(int pixels, int channels)
+{
+  int i;
+  for (i = 0; i < pixels * channels; i++)
+    {
+      /* Leave some channels entirely zero */
+      if ((i % channels) == (pixels % (channels + 1)))
+	raw_16[i] = 0;
+      else
+	raw_16[i] = rand() & 0xffff;
+      raw_8[i] = raw_16[i] >> 8;
+    }
+}
+
+static int
+same(int samples)
+{
+  return memcmp(expect, result, samples * sizeof(unsigned short)) == 0;
+}
+
+static void
+test_level(int level, int pixels, int channels)
+{
+  const unsigned short *lookup[4];
+  int samples = pixels * channels;
+  int bits, i;
+  for (bits = 8; bits <= 16; bits += 8)
+    {
+      const void *in = bits == 8 ? (const void *) raw_8 : (const void *) raw_16;
+      unsigned multiplier = 65535 / ((1 << bits) - 1);
+      unsigned nz;
+      for (i = 0; i < 2; i++)
+	{
+	  stpi_color_kernels_set_level(STPI_COLOR_KERNELS_PORTABLE);
+	  stpi_color_scale_row(in, bits, multiplier, i ? 0xffff : 0, samples,
+			       expect);
+	  stpi_color_kernels_set_level(level);
+	  stpi_color_scale_row(in, bits, multiplier, i ? 0xffff : 0, samples,
+			       result);
+	  check(level, "scale", pixels, channels, same(samples));
+
+	  stpi_color_kernels_set_level(STPI_COLOR_KERNELS_PORTABLE);
+	  stpi_color_threshold_row(in, bits, i, samples, expect);
+	  nz = stpi_color_nonzero_channels(expect, pixels, channels);
+	  stpi_color_kernels_set_level(level);
+	  stpi_color_threshold_row(in, bits, i, samples, result);
+	  check(level, "threshold", pixels, channels, same(samples));
+	  check(level, "nonzero", pixels, channels,
+		nz == stpi_color_nonzero_channels(result, pixels, channels));
+	}
+    }
+
+  for (i = 0; i < channels; i++)
+    lookup[i] = tables[i];
+  for (i = 0; i < 2; i++)
+    {
+      memcpy(expect, raw_16, samples * sizeof(unsigned short));
+      memcpy(result, raw_16, samples * sizeof(unsigned short));
+      stpi_color_kernels_set_level(STPI_COLOR_KERNELS_PORTABLE);
+      stpi_color_lookup_row(expect, pixels, channels, lookup, i);
+      stpi_color_kernels_set_level(level);
+      stpi_color_lookup_row(result, pixels, channels, lookup, i);
+      check(level, "lookup", pixels, channels, same(samples));
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+  int best, level, channels, i, j;
+  stp_init();
+  best = stpi_color_kernels_set_level(-1);
+  for (i = 0; i < 4; i++)
+    for (j = 0; j < 65536; j++)
+      tables[i][j] = rand() & 0xffff;
+  for (level = STPI_COLOR_KERNELS_PORTABLE; level <= best; level++)
+    for (channels = 1; channels <= 4; channels++)
+      for (i = 0; i < sizeof(row_pixels) / sizeof(int); i++)
+	{
+	  fill_data(row_pixels[i], channels);
+	  test_level(level, row_pixels[i], channels);
+	}
+  stpi_color_kernels_set_level(-1);
+  printf("%d tests through %s, %d failed\n", test_count, level_names[best],
+	 error_count);
+  return error_count ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+/*
+ *   Check the 3D color lookup table against exact color conversion
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * RGB input is converted to CMY once exactly and once through each size
+ * of ColorLUTSize, and the worst and mean differences must stay within
+ * the limits below.  The image mixes random colors with gray and
+ * saturated ramps, where interpolation errors would show first.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include <gutenprint/gutenprint-module.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDTH 512
+#define HEIGHT 16
+#define HALF_8_BIT_STEP 128.5
+
+typedef struct
+{
+  const char *correction;
+  double saturation;
+  double brightness;
+  double contrast;
+} settings_t;
+
+static const settings_t settings[] =
+{
+  { "Accurate", 1.0, 1.0, 1.0 },
+  { "Accurate", 0.5, 1.0, 1.0 },
+  { "Accurate", 1.5, 1.0, 1.3 },
+  { "Accurate", 2.0, 0.8, 1.0 },
+  { "Bright", 1.0, 1.0, 1.0 },
+  { "Bright", 1.8, 1.2, 0.8 },
+  { "Hue", 1.0, 1.0, 1.0 },
+  { "Hue", 0.7, 1.0, 1.5 },
+};
+
+/*
+ * Limits in 16-bit units for each table size.  A single sample may be
+ * well off where the conversion itself has a sharp corner; the mean must
+ * stay small.  With 8-bit input the exact conversion truncates to 8 bits
+ * before the channel curves and the table does not, so the mean may be
+ * off by a further half step there.
+ */
+static const struct
+{
+  int size;
+  int max_error;
+  double mean_error;
+} limits[] =
+{
+  { 17, 4000, 200.0 },
+  { 33, 2000, 80.0 },
+};
+
+static int bit_depth;
+static unsigned short image_data[HEIGHT][WIDTH * 3];
+static unsigned short exact[HEIGHT][WIDTH * 3];
+static unsigned short approximate[HEIGHT][WIDTH * 3];
+
+static void image_init(stp_image_t *image) { }
+static void image_reset(stp_image_t *image) { }
+static int image_width(stp_image_t *image) { return WIDTH; }
+static int image_height(stp_image_t *image) { return HEIGHT; }
+static void image_conclude(stp_image_t *image) { }
+
+static const char *
+image_get_appname(stp_image_t *image)
+{
+  return "color-lut3d";
+}
+
+static stp_image_status_t
+image_get_row(stp_image_t *image, unsigned char *data, size_t byte_limit,
+	      int row)
+{
+  int i;
+  if (bit_depth == 16)
+    memcpy(data, image_data[row], WIDTH * 3 * sizeof(unsigned short));
+  else
+    for (i = 0; i < WIDTH * 3; i++)
+      data[i] = image_data[row][i] >> 8;
+  return STP_IMAGE_STATUS_OK;
+}
+
+static stp_image_t image =
+{
+  image_init, image_reset, image_width, image_height, image_get_row,
+  image_get_appname, image_conclude, NULL
+};
+
+static void
+fill_image(void)
+{
+  int row, i;
+  for (row = 0; row < HEIGHT; row++)
+    for (i = 0; i < WIDTH; i++)
+      {
+	unsigned short *rgb = &(image_data[row][i * 3]);
+	unsigned ramp = i * 65535 / (WIDTH - 1);
+	switch (row % 4)
+	  {
+	  case 0:
+	    rgb[0] = rgb[1] = rgb[2] = ramp;
+	    break;
+	  case 1:
+	    rgb[0] = ramp;
+	    rgb[1] = 65535 - ramp;
+	    rgb[2] = (row * 4096) & 0xffff;
+	    break;
+	  default:
+	    rgb[0] = rand() & 0xffff;
+	    rgb[1] = rand() & 0xffff;
+	    rgb[2] = rand() & 0xffff;
+	    break;
+	  }
+      }
+}
+
+static void
+error_func(void *data, const char *buffer, size_t bytes)
+{
+  fwrite(buffer, 1, bytes, stderr);
+}
+
+static int
+convert(const settings_t *s, int lut_size,
+	unsigned short output[HEIGHT][WIDTH * 3])
+{
+  stp_vars_t *v = stp_vars_create();
+  int row, status = 0;
+  char depth[8];
+  stp_set_errfunc(v, error_func);
+  stp_set_string_parameter(v, "InputImageType", "RGB");
+  stp_set_string_parameter(v, "STPIOutputType", "CMY");
+  stp_set_string_parameter(v, "ColorCorrection", s->correction);
+  sprintf(depth, "%d", bit_depth);
+  stp_set_string_parameter(v, "ChannelBitDepth", depth);
+  stp_set_float_parameter(v, "Saturation", s->saturation);
+  stp_set_float_parameter(v, "Brightness", s->brightness);
+  stp_set_float_parameter(v, "Contrast", s->contrast);
+  stp_set_int_parameter(v, "ColorLUTSize", lut_size);
+  /* Listing the parameters sets up the standard curves, as a driver would */
+  stp_parameter_list_destroy(stp_color_list_parameters(v));
+  for (row = 0; row < 3; row++)
+    stp_channel_add(v, row, 0, 1.0);
+  stp_color_init(v, &image, 65536);
+  for (row = 0; row < HEIGHT; row++)
+    {
+      unsigned zero_mask;
+      if (stp_color_get_row(v, &image, row, &zero_mask))
+	{
+	  status = 1;
+	  break;
+	}
+      memcpy(output[row], stp_channel_get_input(v),
+	     WIDTH * 3 * sizeof(unsigned short));
+    }
+  stp_vars_destroy(v);
+  return status;
+}
+
+int
+main(int argc, char **argv)
+{
+  int failures = 0;
+  int i, j;
+  stp_init();
+  fill_image();
+  for (bit_depth = 8; bit_depth <= 16; bit_depth += 8)
+    for (i = 0; i < sizeof(settings) / sizeof(settings_t); i++)
+      {
+	const settings_t *s = &(settings[i]);
+	if (convert(s, 0, exact))
+	  {
+	    printf("%s: cannot convert image\n", s->correction);
+	    return 1;
+	  }
+	for (j = 0; j < sizeof(limits) / sizeof(limits[0]); j++)
+	  {
+	    int max_error = 0;
+	    double total = 0;
+	    double mean;
+	    double mean_limit = limits[j].mean_error;
+	    int row, k;
+	    convert(s, limits[j].size, approximate);
+	    for (row = 0; row < HEIGHT; row++)
+	      for (k = 0; k < WIDTH * 3; k++)
+		{
+		  int error = abs(exact[row][k] - approximate[row][k]);
+		  total += error;
+		  if (error > max_error)
+		    max_error = error;
+		}
+	    mean = total / (HEIGHT * WIDTH * 3);
+	    if (bit_depth == 8)
+	      mean_limit += HALF_8_BIT_STEP;
+	    if (max_error > limits[j].max_error || mean > mean_limit)
+	      failures++;
+	    printf("%2d bits %-8s sat %.1f bright %.1f contrast %.1f "
+		   "size %d: max %5d mean %7.2f%s\n", bit_depth,
+		   s->correction, s->saturation, s->brightness, s->contrast,
+		   limits[j].size, max_error, mean,
+		   (max_error > limits[j].max_error || mean > mean_limit) ?
+		   "  FAILED" : "");
+	  }
+      }
+  return failures ? 1 : 0;
+}
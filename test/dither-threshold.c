@@ -0,0 +1,225 @@
+/*
+ *   Check the threshold kernels of the ordered and very fast dithers
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * The ordered and very fast dithers threshold a row at a time with a
+ * portable kernel or, where the machine supports them, SSE2 or AVX2
+ * kernels.  Every kernel level the machine supports dithers the same
+ * rows, interleaved and planar, at a range of widths (so that rows end
+ * partway through a group of 8 pixels), with the standard matrices and
+ * with an odd sized matrix that has thresholds of 0 and above 65535.
+ * Each must produce exactly what the portable kernel does.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "../src/main/gutenprint-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHANNELS 4
+#define ROWS 40
+#define MAX_WIDTH 1031
+#define MATRIX_X 23
+#define MATRIX_Y 19
+
+static const char *kernel_names[] = { "portable", "sse2", "avx2" };
+static const char *algorithms[] = { "VeryFast", "Ordered" };
+static const int widths[] = { 8, 13, 64, 71, 1031 };
+
+static int test_count = 0;
+static int error_count = 0;
+
+static int image_columns;
+static unsigned short input[ROWS][MAX_WIDTH * CHANNELS];
+static unsigned short planar_input[ROWS][MAX_WIDTH * CHANNELS];
+static unsigned odd_matrix[MATRIX_X * MATRIX_Y];
+
+static const stp_dotsize_t single_dotsize[] =
+{
+  { 0x1, 1.0 }
+};
+
+static const stp_shade_t shades[] =
+{
+  { 1.0, 1, single_dotsize }
+};
+
+static int
+image_width(stp_image_t *image)
+{
+  return image_columns;
+}
+
+static stp_image_t test_image =
+{
+  NULL,
+  NULL,
+  image_width,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL
+};
+
+/*
+ * Each row has white stretches, gradients, solid ink and noise, so that
+ * groups of 8 pixels are all off, all on and mixed.
+ */
+static void
+make_input(int width)
+{
+  int row, x, c;
+  for (row = 0; row < ROWS; row++)
+    for (x = 0; x < width; x++)
+      for (c = 0; c < CHANNELS; c++)
+	{
+	  unsigned value;
+	  switch ((x / 16 + row + c) % 5)
+	    {
+	    case 0:
+	      value = 0;
+	      break;
+	    case 1:
+	      value = x * 65535 / width;
+	      break;
+	    case 2:
+	      value = 65535;
+	      break;
+	    case 3:
+	      value = rand() & 0xffff;
+	      break;
+	    default:
+	      value = (rand() & 0xff) * (row + 1);
+	      break;
+	    }
+	  input[row][x * CHANNELS + c] = value;
+	  planar_input[row][c * width + x] = value;
+	}
+}
+
+static void
+make_odd_matrix(void)
+{
+  int i;
+  for (i = 0; i < MATRIX_X * MATRIX_Y; i++)
+    {
+      switch (i % 17)
+	{
+	case 0:
+	  odd_matrix[i] = 0;
+	  break;
+	case 1:
+	  odd_matrix[i] = 65536 + rand() % 10000;
+	  break;
+	default:
+	  odd_matrix[i] = rand() % 65536;
+	  break;
+	}
+    }
+}
+
+/*
+ * Dither all the rows, leaving each channel's output for each row in
+ * result.
+ */
+static void
+dither_rows(const char *algorithm, int planar, int width, int odd,
+	    unsigned char *result)
+{
+  static const stp_dither_matrix_generic_t matrix =
+    { MATRIX_X, MATRIX_Y, sizeof(unsigned), 1, odd_matrix };
+  int length = (width + 7) / 8;
+  unsigned char *channels[CHANNELS];
+  stp_vars_t *v = stp_vars_create();
+  int row, c;
+
+  stp_set_string_parameter(v, "DitherAlgorithm", algorithm);
+  stp_set_boolean_parameter(v, "DitherPlanar", planar);
+  image_columns = width;
+  stp_dither_init(v, &test_image, width, 1, 1);
+  if (odd)
+    stp_dither_set_matrix(v, &matrix, 0, 0, 0);
+  for (c = 0; c < CHANNELS; c++)
+    {
+      channels[c] = stp_malloc(length);
+      stp_dither_add_channel(v, channels[c], c, 0);
+      stp_dither_set_inks_full(v, c, 1, shades, 1.0, 1.0);
+    }
+  for (row = 0; row < ROWS; row++)
+    {
+      stp_dither_internal(v, row, planar ? planar_input[row] : input[row],
+			  0, 0, NULL);
+      for (c = 0; c < CHANNELS; c++)
+	memcpy(result + (row * CHANNELS + c) * length, channels[c], length);
+    }
+  stp_vars_destroy(v);
+  for (c = 0; c < CHANNELS; c++)
+    stp_free(channels[c]);
+}
+
+static void
+check_level(int level, const char *algorithm, int planar, int width, int odd)
+{
+  size_t size = ROWS * CHANNELS * ((width + 7) / 8);
+  unsigned char *expect = stp_malloc(size);
+  unsigned char *result = stp_malloc(size);
+
+  stpi_dither_threshold_set_level(STPI_DITHER_THRESHOLD_PORTABLE);
+  dither_rows(algorithm, planar, width, odd, expect);
+  stpi_dither_threshold_set_level(level);
+  dither_rows(algorithm, planar, width, odd, result);
+  test_count++;
+  if (memcmp(expect, result, size) != 0)
+    {
+      printf("%s %s, %s, %d pixels, %s matrix: FAILED\n",
+	     kernel_names[level], algorithm,
+	     planar ? "planar" : "interleaved", width,
+	     odd ? "odd" : "standard");
+      error_count++;
+    }
+  stp_free(expect);
+  stp_free(result);
+}
+
+int
+main(int argc, char **argv)
+{
+  int levels, level, a, planar, w, odd;
+  stp_init();
+  srand(1);
+  make_odd_matrix();
+  levels = stpi_dither_threshold_set_level(-1);
+  for (w = 0; w < sizeof(widths) / sizeof(int); w++)
+    {
+      make_input(widths[w]);
+      for (level = 1; level <= levels; level++)
+	for (a = 0; a < sizeof(algorithms) / sizeof(const char *); a++)
+	  for (planar = 0; planar <= 1; planar++)
+	    for (odd = 0; odd <= 1; odd++)
+	      check_level(level, algorithms[a], planar, widths[w], odd);
+    }
+  stpi_dither_threshold_set_level(-1);
+  printf("%d tests through %s, %d failed\n", test_count,
+	 kernel_names[levels], error_count);
+  return error_count ? 1 : 0;
+}
@@ -0,0 +1,287 @@
+/*
+ *   Check and time list lookups by name and long name
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Items with repeated names are added to the end of a list or inserted
+ * before an item already in it, and removed from anywhere in it, at
+ * random.  After every change a name must find the first item of that
+ * name, just as walking the list does, and so must the name and long
+ * name of an item just inserted.  Then every printer and paper, and a
+ * name that does not exist, is looked up both through the list and by
+ * walking it, and the times are reported.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define NAMES 40
+#define EDITS 20000
+#define PASSES 20
+
+typedef struct
+{
+  char name[16];
+  char long_name[16];
+} item_t;
+
+static int test_count = 0;
+static int error_count = 0;
+
+static const char *
+item_namefunc(const void *item)
+{
+  return ((const item_t *) item)->name;
+}
+
+static const char *
+item_long_namefunc(const void *item)
+{
+  return ((const item_t *) item)->long_name;
+}
+
+static stp_list_item_t *
+walk_list(const stp_list_t *list, stp_node_namefunc namefunc,
+	  const char *name)
+{
+  stp_list_item_t *item = stp_list_get_start(list);
+  while (item && strcmp(name, (*namefunc)(stp_list_item_get_data(item))))
+    item = stp_list_item_next(item);
+  return item;
+}
+
+static void
+check_lookup(const stp_list_t *list, const char *name, const char *long_name)
+{
+  test_count++;
+  if (stp_list_get_item_by_name(list, name) !=
+      walk_list(list, item_namefunc, name))
+    {
+      printf("list: wrong item for name %s\n", name);
+      error_count++;
+    }
+  test_count++;
+  if (stp_list_get_item_by_long_name(list, long_name) !=
+      walk_list(list, item_long_namefunc, long_name))
+    {
+      printf("list: wrong item for long name %s\n", long_name);
+      error_count++;
+    }
+}
+
+/*
+ * Only the first lookup after a change is sure to miss the list's cache
+ * of the last item found, which may find a later item of the same name.
+ */
+static void
+check_name(const stp_list_t *list)
+{
+  char name[16];
+  char long_name[16];
+  sprintf(name, "n%d", rand() % (NAMES + 2));
+  sprintf(long_name, "l%d", rand() % (NAMES + 2));
+  check_lookup(list, name, long_name);
+}
+
+static void
+test_edits(void)
+{
+  stp_list_t *list = stp_list_create();
+  int i;
+  stp_list_set_freefunc(list, stp_list_node_free_data);
+  stp_list_set_namefunc(list, item_namefunc);
+  stp_list_set_long_namefunc(list, item_long_namefunc);
+  for (i = 0; i < EDITS; i++)
+    {
+      int length = stp_list_get_length(list);
+      if (length > 0 && rand() % 3 == 0)
+	{
+	  stp_list_item_destroy(list, stp_list_get_item_by_index
+				(list, rand() % length));
+	  check_name(list);
+	}
+      else if (length > 0 && rand() % 2 == 0)
+	{
+	  /* Whether this precedes the other items of its name isn't known */
+	  item_t *item = stp_malloc(sizeof(item_t));
+	  sprintf(item->name, "n%d", rand() % NAMES);
+	  sprintf(item->long_name, "l%d", rand() % NAMES);
+	  stp_list_item_create(list, stp_list_get_item_by_index
+			       (list, rand() % length), item);
+	  check_lookup(list, item->name, item->long_name);
+	}
+      else
+	{
+	  item_t *item = stp_malloc(sizeof(item_t));
+	  sprintf(item->name, "n%d", rand() % NAMES);
+	  sprintf(item->long_name, "l%d", rand() % NAMES);
+	  stp_list_item_create(list, NULL, item);
+	  check_name(list);
+	}
+    }
+  stp_list_destroy(list);
+}
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+typedef struct
+{
+  const char *what;
+  int (*count)(void);
+  const void *(*get_by_index)(int);
+  const char *(*get_key)(const void *);
+  const void *(*lookup)(const char *);
+} lookup_t;
+
+static const void *
+printer_by_index(int idx)
+{
+  return stp_get_printer_by_index(idx);
+}
+
+static const char *
+printer_driver(const void *printer)
+{
+  return stp_printer_get_driver(printer);
+}
+
+static const char *
+printer_long_name(const void *printer)
+{
+  return stp_printer_get_long_name(printer);
+}
+
+static const void *
+printer_by_driver(const char *driver)
+{
+  return stp_get_printer_by_driver(driver);
+}
+
+static const void *
+printer_by_long_name(const char *long_name)
+{
+  return stp_get_printer_by_long_name(long_name);
+}
+
+static const void *
+paper_by_index(int idx)
+{
+  return stp_get_papersize_by_index(idx);
+}
+
+static const char *
+paper_name(const void *paper)
+{
+  return ((const stp_papersize_t *) paper)->name;
+}
+
+static const void *
+paper_by_name(const char *name)
+{
+  return stp_get_papersize_by_name(name);
+}
+
+static const lookup_t lookups[] =
+{
+  { "printers by driver", stp_printer_model_count, printer_by_index,
+    printer_driver, printer_by_driver },
+  { "printers by long name", stp_printer_model_count, printer_by_index,
+    printer_long_name, printer_by_long_name },
+  { "papers by name", stp_known_papersizes, paper_by_index,
+    paper_name, paper_by_name },
+};
+
+/*
+ * Look up every item, and one that does not exist, first through the
+ * list and then by walking it from the start, which is only done once.
+ * The names are shuffled so that the list's cache of the last item
+ * found does not help.
+ */
+static void
+time_lookups(const lookup_t *l)
+{
+  int count = (*l->count)();
+  const char **keys = stp_malloc(sizeof(const char *) * (count + 1));
+  const void **found = stp_malloc(sizeof(const void *) * (count + 1));
+  double indexed, walked, start;
+  int pass, i, j;
+  for (i = 0; i < count; i++)
+    keys[i] = (*l->get_key)((*l->get_by_index)(i));
+  keys[count] = "No such name";
+  for (i = count; i > 0; i--)
+    {
+      const char *tmp = keys[i];
+      j = rand() % (i + 1);
+      keys[i] = keys[j];
+      keys[j] = tmp;
+    }
+
+  start = now();
+  for (pass = 0; pass < PASSES; pass++)
+    for (i = 0; i <= count; i++)
+      found[i] = (*l->lookup)(keys[i]);
+  indexed = now() - start;
+
+  start = now();
+  for (i = 0; i <= count; i++)
+    {
+      const void *item = NULL;
+      for (j = 0; j < count; j++)
+	if (!strcmp(keys[i], (*l->get_key)((*l->get_by_index)(j))))
+	  {
+	    item = (*l->get_by_index)(j);
+	    break;
+	  }
+      test_count++;
+      if (item != found[i])
+	{
+	  printf("%s: wrong item for %s\n", l->what, keys[i]);
+	  error_count++;
+	}
+    }
+  walked = now() - start;
+
+  printf("%-22s %5d items: %8.3f us per lookup, walking the list %8.3f us\n",
+	 l->what, count, indexed * 1000000 / (PASSES * (count + 1)),
+	 walked * 1000000 / (count + 1));
+  stp_free(keys);
+  stp_free(found);
+}
+
+int
+main(int argc, char **argv)
+{
+  int i;
+  stp_init();
+  test_edits();
+  for (i = 0; i < sizeof(lookups) / sizeof(lookup_t); i++)
+    time_lookups(&(lookups[i]));
+  printf("%d tests, %d failed\n", test_count, error_count);
+  return error_count ? 1 : 0;
+}
@@ -0,0 +1,242 @@
+/*
+ *   Check buffering of printer output
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Output written through a vars object and its copies must reach the
+ * output function in the order it was written, in few calls, and all of
+ * it by the time it is flushed or the vars objects are destroyed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+  char *data;
+  size_t bytes;
+  int calls;
+  int vcalls;
+} sink_t;
+
+static int test_count = 0;
+static int error_count = 0;
+
+static void
+sink_add(sink_t *sink, const void *data, size_t bytes)
+{
+  sink->data = stp_realloc(sink->data, sink->bytes + bytes);
+  memcpy(sink->data + sink->bytes, data, bytes);
+  sink->bytes += bytes;
+}
+
+static void
+writefunc(void *data, const char *buffer, size_t bytes)
+{
+  sink_t *sink = (sink_t *) data;
+  sink->calls++;
+  sink_add(sink, buffer, bytes);
+}
+
+static void
+writevfunc(void *data, const stp_raw_t *vec, int count)
+{
+  sink_t *sink = (sink_t *) data;
+  int i;
+  sink->vcalls++;
+  for (i = 0; i < count; i++)
+    sink_add(sink, vec[i].data, vec[i].bytes);
+}
+
+static void
+check(int ok, const char *what)
+{
+  test_count++;
+  if (!ok)
+    {
+      printf("%s: FAILED\n", what);
+      error_count++;
+    }
+}
+
+static void
+check_output(const sink_t *sink, const sink_t *expected, const char *what)
+{
+  check(sink->bytes == expected->bytes &&
+	(sink->bytes == 0 ||
+	 !memcmp(sink->data, expected->data, sink->bytes)), what);
+}
+
+/*
+ * Write a mixture of small and large pieces through v and a copy of it,
+ * recording what should come out in expected.
+ */
+static void
+write_mixture(stp_vars_t *v, sink_t *expected, int pieces)
+{
+  static char big[200000];
+  stp_vars_t *nv = stp_vars_create_copy(v);
+  char num[32];
+  int i;
+
+  for (i = 0; i < sizeof(big); i++)
+    big[i] = rand();
+  for (i = 0; i < pieces; i++)
+    {
+      const stp_vars_t *w = (i % 3) ? v : nv;
+      switch (rand() % 6)
+	{
+	case 0:
+	  stp_putc(i, w);
+	  num[0] = i;
+	  sink_add(expected, num, 1);
+	  break;
+	case 1:
+	  stp_put16_be(i, w);
+	  num[0] = i >> 8;
+	  num[1] = i;
+	  sink_add(expected, num, 2);
+	  break;
+	case 2:
+	  stp_put32_le(i * 65537, w);
+	  num[0] = (i * 65537);
+	  num[1] = (i * 65537) >> 8;
+	  num[2] = (i * 65537) >> 16;
+	  num[3] = (i * 65537) >> 24;
+	  sink_add(expected, num, 4);
+	  break;
+	case 3:
+	  stp_zprintf(w, "\033*b%dW", i);
+	  sprintf(num, "\033*b%dW", i);
+	  sink_add(expected, num, strlen(num));
+	  break;
+	case 4:
+	  {
+	    size_t bytes = rand() % 2000;
+	    stp_zfwrite(big, bytes, 1, w);
+	    sink_add(expected, big, bytes);
+	  }
+	  break;
+	case 5:
+	  {
+	    size_t bytes = rand() % sizeof(big);
+	    stp_zfwrite(big, bytes, 1, w);
+	    sink_add(expected, big, bytes);
+	  }
+	  break;
+	}
+    }
+  stp_vars_destroy(nv);
+}
+
+static void
+test_mixture(int vectored)
+{
+  sink_t sink, expected;
+  stp_vars_t *v = stp_vars_create();
+  memset(&sink, 0, sizeof(sink));
+  memset(&expected, 0, sizeof(expected));
+  stp_set_outfunc(v, writefunc);
+  if (vectored)
+    stp_set_outvfunc(v, writevfunc);
+  stp_set_outdata(v, &sink);
+
+  write_mixture(v, &expected, 5000);
+  stp_flush_output(v);
+  check_output(&sink, &expected, vectored ? "vectored output" : "output");
+  check(!vectored || sink.vcalls > 0, "vectored output is used");
+
+  write_mixture(v, &expected, 100);
+  stp_vars_destroy(v);
+  check_output(&sink, &expected, "output when destroyed");
+  stp_free(sink.data);
+  stp_free(expected.data);
+}
+
+static void
+test_small_writes(void)
+{
+  sink_t sink;
+  stp_vars_t *v = stp_vars_create();
+  int i;
+  memset(&sink, 0, sizeof(sink));
+  stp_set_outfunc(v, writefunc);
+  stp_set_outdata(v, &sink);
+  for (i = 0; i < 100000; i++)
+    stp_putc(i, v);
+  stp_flush_output(v);
+  check(sink.bytes == 100000, "small writes");
+  check(sink.calls < 100000 / 1000, "small writes are coalesced");
+  stp_vars_destroy(v);
+  stp_free(sink.data);
+}
+
+/*
+ * A copy that is sent elsewhere stops sharing the buffer, after what was
+ * already written has been sent to the old destination.
+ */
+static void
+test_redirect(void)
+{
+  sink_t first, second;
+  stp_vars_t *v = stp_vars_create();
+  stp_vars_t *nv;
+  char longstring[1000];
+  memset(&first, 0, sizeof(first));
+  memset(&second, 0, sizeof(second));
+  stp_set_outfunc(v, writefunc);
+  stp_set_outdata(v, &first);
+
+  stp_puts("a", v);
+  nv = stp_vars_create_copy(v);
+  stp_puts("b", nv);
+  stp_set_outdata(nv, &second);
+  check(first.bytes == 2 && !memcmp(first.data, "ab", 2),
+	"output is sent before it is redirected");
+  stp_puts("c", nv);
+  stp_puts("d", v);
+  memset(longstring, 'x', sizeof(longstring) - 1);
+  longstring[sizeof(longstring) - 1] = 0;
+  stp_zprintf(v, "%s", longstring);
+  stp_vars_destroy(nv);
+  check(second.bytes == 1 && second.data[0] == 'c',
+	"redirected output goes to the new destination");
+  stp_vars_destroy(v);
+  check(first.bytes == 3 + strlen(longstring) &&
+	!memcmp(first.data, "abd", 3) &&
+	!memcmp(first.data + 3, longstring, strlen(longstring)),
+	"output stays with the original destination");
+  stp_free(first.data);
+  stp_free(second.data);
+}
+
+int
+main(int argc, char **argv)
+{
+  stp_init();
+  test_mixture(0);
+  test_mixture(1);
+  test_small_writes();
+  test_redirect();
+  printf("%d tests, %d failed\n", test_count, error_count);
+  return error_count ? 1 : 0;
+}
@@ -0,0 +1,250 @@
+/*
+ *   Check and time the run-length packers
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * stp_pack_tiff() and stp_pack_uncompressed() are run with each scanning
+ * kernel on synthetic lines and on files of dithered lines saved by
+ * testdither (see run-pack-bench).  Every kernel must give the same
+ * output, first and last nonzero byte as a plain byte-at-a-time packer.
+ * The time to pack each file is reported for every kernel.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "../src/main/gutenprint-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define PASSES 5
+
+static const char *kernel_names[] = { "portable", "sse2", "avx2" };
+
+static int test_count = 0;
+static int error_count = 0;
+
+/*
+ * The packer one byte at a time.  A repeated run starts at the first
+ * byte that begins three equal bytes, or two bytes before the end of
+ * the line if there is none.
+ */
+static int
+reference_pack(const unsigned char *line, int length, unsigned char *out,
+	       int *first, int *last)
+{
+  unsigned char *start = out;
+  int pos = 0;
+  int i;
+  *first = 0;
+  *last = 0;
+  for (i = 0; i < length; i++)
+    if (line[i])
+      *last = i;
+  while (*first < length && line[*first] == 0)
+    (*first)++;
+  while (pos < length)
+    {
+      int literal_end = pos;
+      int run;
+      if (length - pos >= 3)
+	{
+	  literal_end = length - 2;
+	  for (i = pos; i + 2 < length; i++)
+	    if (line[i] == line[i + 1] && line[i + 1] == line[i + 2])
+	      {
+		literal_end = i;
+		break;
+	      }
+	}
+      while (pos < literal_end)
+	{
+	  int count = literal_end - pos > 128 ? 128 : literal_end - pos;
+	  *out++ = count - 1;
+	  memcpy(out, line + pos, count);
+	  out += count;
+	  pos += count;
+	}
+      run = 1;
+      while (pos + run < length && line[pos + run] == line[pos])
+	run++;
+      while (run > 0)
+	{
+	  int count = run > 128 ? 128 : run;
+	  *out++ = 1 - count;
+	  *out++ = line[pos];
+	  run -= count;
+	  pos += count;
+	}
+    }
+  return out - start;
+}
+
+static void
+check_line(const unsigned char *line, int length, const char *kernel)
+{
+  unsigned char *expected = stp_malloc(length * 2 + 2);
+  unsigned char *packed = stp_malloc(length * 2 + 2);
+  unsigned char *comp_ptr;
+  int expected_bytes, first, last, efirst, elast, status;
+
+  expected_bytes = reference_pack(line, length, expected, &efirst, &elast);
+  status = stp_pack_tiff(NULL, line, length, packed, &comp_ptr, &first, &last);
+  test_count++;
+  if (comp_ptr - packed != expected_bytes ||
+      memcmp(packed, expected, expected_bytes) ||
+      first != efirst || last != elast || status != (efirst <= elast))
+    {
+      printf("%s: packed line of %d bytes differs\n", kernel, length);
+      error_count++;
+    }
+  stp_pack_tiff(NULL, line, length, packed, &comp_ptr, NULL, NULL);
+  test_count++;
+  if (comp_ptr - packed != expected_bytes ||
+      memcmp(packed, expected, expected_bytes))
+    {
+      printf("%s: packed line of %d bytes differs without first and last\n",
+	     kernel, length);
+      error_count++;
+    }
+  status = stp_pack_uncompressed(NULL, line, length, packed, &comp_ptr,
+				 &first, &last);
+  test_count++;
+  if (comp_ptr - packed != length || memcmp(packed, line, length) ||
+      first != efirst || last != elast || status != (efirst <= elast))
+    {
+      printf("%s: uncompressed line of %d bytes differs\n", kernel, length);
+      error_count++;
+    }
+  stp_free(expected);
+  stp_free(packed);
+}
+
+/*
+ * Lines of every length up to a few vectors, made of runs and literal
+ * stretches with zero margins, so that run boundaries fall everywhere
+ * within a vector.
+ */
+static void
+check_synthetic(const char *kernel)
+{
+  unsigned char line[2000];
+  int length, pass, i;
+  srand(1);
+  for (length = 0; length < 300; length++)
+    for (pass = 0; pass < 20; pass++)
+      {
+	i = 0;
+	while (i < length)
+	  {
+	    int count = 1 + rand() % (pass < 10 ? 5 : 200);
+	    int literal = rand() % 2;
+	    unsigned char value = rand() % 3 ? 0 : rand();
+	    while (count-- > 0 && i < length)
+	      line[i++] = literal ? rand() % 3 : value;
+	  }
+	check_line(line, length, kernel);
+      }
+  memset(line, 0, sizeof(line));
+  check_line(line, sizeof(line), kernel);
+  line[sizeof(line) - 1] = 1;
+  check_line(line, sizeof(line), kernel);
+}
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+bench_file(const char *name, int levels)
+{
+  FILE *fp = fopen(name, "rb");
+  unsigned char *lines, *packed;
+  size_t count = 0, allocated = 0, i;
+  int length, level, pass;
+  if (!fp || fscanf(fp, "%d", &length) != 1 || length <= 0 ||
+      getc(fp) != '\n')
+    {
+      printf("%s: cannot read lines\n", name);
+      error_count++;
+      if (fp)
+	fclose(fp);
+      return;
+    }
+  lines = NULL;
+  do
+    {
+      if (count == allocated)
+	{
+	  allocated = allocated ? allocated * 2 : 1024;
+	  lines = stp_realloc(lines, allocated * length);
+	}
+    }
+  while (fread(lines + count * length, length, 1, fp) == 1 && ++count);
+  fclose(fp);
+  packed = stp_malloc(length * 2 + 2);
+
+  for (level = 0; level <= levels; level++)
+    {
+      size_t total = 0;
+      double start;
+      stpi_pack_kernels_set_level(level);
+      for (i = 0; i < count; i++)
+	check_line(lines + i * length, length, kernel_names[level]);
+      start = now();
+      for (pass = 0; pass < PASSES; pass++)
+	for (i = 0; i < count; i++)
+	  {
+	    unsigned char *comp_ptr;
+	    int first, last;
+	    stp_pack_tiff(NULL, lines + i * length, length, packed, &comp_ptr,
+			  &first, &last);
+	    total += comp_ptr - packed;
+	  }
+      printf("%s: %lu lines of %d bytes, %-8s %8.1f MB/s, packed to %.1f%%\n",
+	     name, (unsigned long) count, length, kernel_names[level],
+	     PASSES * count * (double) length / (now() - start) / 1000000,
+	     count ? 100.0 * total / (PASSES * count * (double) length) : 0);
+    }
+  stp_free(lines);
+  stp_free(packed);
+}
+
+int
+main(int argc, char **argv)
+{
+  int levels, level, i;
+  stp_init();
+  levels = stpi_pack_kernels_set_level(-1);
+  for (level = 0; level <= levels; level++)
+    {
+      stpi_pack_kernels_set_level(level);
+      check_synthetic(kernel_names[level]);
+    }
+  for (i = 1; i < argc; i++)
+    bench_file(argv[i], levels);
+  stpi_pack_kernels_set_level(-1);
+  printf("%d tests, %d failed\n", test_count, error_count);
+  return error_count ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+/*
+ *   Print a test image through a PCL driver
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Usage: pcl-print driver [parameter value]... > file
+ *
+ * Writes the raw printer output for a synthetic image to standard output,
+ * for run-pcl-unprint to decode with pcl-unprint.  The image mixes the
+ * things the raster compression modes care about: repeated rows, small
+ * changes from one row to the next, runs of white and noisy gradients.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IMAGE_WIDTH 320
+#define IMAGE_HEIGHT 240
+
+static void
+writefunc(void *data, const char *buffer, size_t bytes)
+{
+  fwrite(buffer, 1, bytes, (FILE *) data);
+}
+
+static void
+image_init(stp_image_t *image)
+{
+}
+
+static void
+image_reset(stp_image_t *image)
+{
+}
+
+static int
+image_width(stp_image_t *image)
+{
+  return IMAGE_WIDTH;
+}
+
+static int
+image_height(stp_image_t *image)
+{
+  return IMAGE_HEIGHT;
+}
+
+static const char *
+image_get_appname(stp_image_t *image)
+{
+  return "pcl-print";
+}
+
+static void
+image_conclude(stp_image_t *image)
+{
+}
+
+static stp_image_status_t
+image_get_row(stp_image_t *image, unsigned char *data, size_t limit, int row)
+{
+  int band = row / 30;
+  int x;
+
+  for (x = 0; x < IMAGE_WIDTH; x++)
+    {
+      unsigned char *pixel = data + x * 3;
+      int r = 255, g = 255, b = 255;
+
+      switch (band)
+	{
+	case 0:			/* Identical rows of solid blocks */
+	  if ((x / 40) & 1)
+	    r = g = b = 0;
+	  else if ((x / 20) & 1)
+	    r = 0;
+	  break;
+	case 1:			/* White */
+	case 5:
+	  break;
+	case 2:			/* Diagonal lines on white */
+	case 6:
+	  if ((x + row) % 64 < 3 || (x - row + 640) % 97 < 2)
+	    {
+	      r = 0;
+	      g = band == 2 ? 0 : 128;
+	    }
+	  break;
+	case 3:			/* Horizontal gradient */
+	  r = x * 255 / IMAGE_WIDTH;
+	  g = 255 - r;
+	  b = (row * 8) & 255;
+	  break;
+	case 4:			/* Sparse dots */
+	  if (((x * 7 + row * 13) % 53) == 0)
+	    r = g = b = 0;
+	  break;
+	default:		/* Vertical gradient */
+	  r = g = b = (row - band * 30) * 255 / 30;
+	  break;
+	}
+      pixel[0] = r;
+      pixel[1] = g;
+      pixel[2] = b;
+    }
+  return STP_IMAGE_STATUS_OK;
+}
+
+static stp_image_t test_image =
+{
+  image_init,
+  image_reset,
+  image_width,
+  image_height,
+  image_get_row,
+  image_get_appname,
+  image_conclude,
+  NULL
+};
+
+int
+main(int argc, char **argv)
+{
+  const stp_printer_t *printer;
+  stp_vars_t *v;
+  int left, right, bottom, top;
+  int i;
+
+  if (argc < 2 || (argc % 2) != 0)
+    {
+      fprintf(stderr, "Usage: %s driver [parameter value]...\n", argv[0]);
+      return 2;
+    }
+  stp_init();
+  printer = stp_get_printer_by_driver(argv[1]);
+  if (!printer)
+    {
+      fprintf(stderr, "%s: unknown driver %s\n", argv[0], argv[1]);
+      return 2;
+    }
+  v = stp_vars_create();
+  stp_set_printer_defaults(v, printer);
+  stp_set_outfunc(v, writefunc);
+  stp_set_errfunc(v, writefunc);
+  stp_set_outdata(v, stdout);
+  stp_set_errdata(v, stderr);
+  stp_set_string_parameter(v, "InputImageType", "RGB");
+  stp_set_string_parameter(v, "ChannelBitDepth", "8");
+  for (i = 2; i < argc; i += 2)
+    stp_set_string_parameter(v, argv[i], argv[i + 1]);
+
+  stp_get_imageable_area(v, &left, &right, &bottom, &top);
+  stp_set_left(v, left);
+  stp_set_top(v, top);
+  stp_set_width(v, IMAGE_WIDTH);
+  stp_set_height(v, IMAGE_HEIGHT);
+  if (!stp_verify(v))
+    {
+      fprintf(stderr, "%s: settings for %s do not verify\n", argv[0], argv[1]);
+      return 1;
+    }
+  stp_start_job(v, &test_image);
+  if (!stp_print(v, &test_image))
+    return 1;
+  stp_end_job(v, &test_image);
+  stp_vars_destroy(v);
+  return 0;
+}
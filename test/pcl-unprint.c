@@ -41,10 +41,10 @@ static const char *id="@(#) $Id: pcl-unprint.c,v 1.11 2004/09/17 18:38:28 rleigh
 #define READ_SIZE 1024
 
 /*
- * Largest data attached to a command. 1024 means that we can have up to 8192
+ * Largest data attached to a command. 4096 means that we can have up to 32768
  * pixels in a row
  */
-#define MAX_DATA 1024
+#define MAX_DATA 4096
 
 FILE *read_fd,*write_fd;
 char read_buffer[READ_SIZE];
@@ -212,6 +212,10 @@ void fill_buffer (void);
 void pcl_read_command (void);
 void write_grey (output_t *output, image_t *image);
 void write_colour (output_t *output, image_t *image);
+int decode_delta (char *in_buffer, int data_length, char *seed_buf,
+    int maxlen);
+int decode_crdr (char *in_buffer, int data_length, char *seed_buf,
+    int maxlen);
 int decode_tiff (char *in_buffer, int data_length, char *decode_buf,
                  int maxlen);
 void pcl_reset (image_t *i);
@@ -755,6 +759,144 @@ int decode_tiff(char *in_buffer,		/* I: Data buffer */
     return(dpos);
 }
 
+/*
+ * decode_extension() - Add up the extension bytes of a mode 3 or mode 9
+ * offset or count.
+ */
+
+static int decode_extension(char *in_buffer,	/* I: Data buffer */
+			    int data_length,	/* I: Length of data */
+			    int *pos)		/* I/O: Position in data */
+{
+    int value = 0;
+    int byte;
+
+    do {
+	if (*pos >= data_length) {
+	    fprintf(stderr, "ERROR: Truncated extension byte!\n");
+	    exit(EXIT_FAILURE);
+	}
+	byte = (unsigned char) in_buffer[(*pos)++];
+	value += byte;
+    } while (byte == 255);
+    return(value);
+}
+
+/*
+ * decode_replace() - Replace part of a seed row, checking that it fits.
+ */
+
+static void decode_replace(char *seed_buf,	/* I/O: Seed row */
+			   int dpos,		/* I: Offset in seed row */
+			   const char *data,	/* I: Replacement, or NULL */
+			   int fill,		/* I: Fill byte if data is NULL */
+			   int count,		/* I: Bytes to replace */
+			   int maxlen)		/* I: Length of seed row */
+{
+    if (dpos + count > maxlen) {
+	fprintf(stderr, "ERROR: Too much expanded data (%d)!\n", dpos + count);
+	exit(EXIT_FAILURE);
+    }
+    if (data)
+	memcpy(&seed_buf[dpos], data, (size_t) count);
+    else
+	memset(&seed_buf[dpos], fill, (size_t) count);
+}
+
+/*
+ * decode_delta() - Apply a delta row (mode 3) encoded buffer to the seed row
+ */
+
+int decode_delta(char *in_buffer,		/* I: Data buffer */
+		 int data_length,		/* I: Length of data */
+		 char *seed_buf,		/* I/O: Seed row */
+		 int maxlen)			/* I: Length of seed_buf */
+{
+/* Each command byte holds the count of replacement bytes (1-8) in the
+ * top three bits and the offset from the end of the previous replacement
+ * in the bottom five.  An offset of 31 is followed by extension bytes.
+ */
+
+    int pos = 0;
+    int dpos = 0;
+
+    while (pos < data_length) {
+	int command = (unsigned char) in_buffer[pos++];
+	int count = (command >> 5) + 1;
+	int offset = command & 31;
+
+	if (offset == 31)
+	    offset += decode_extension(in_buffer, data_length, &pos);
+	dpos += offset;
+	if (pos + count > data_length) {
+	    fprintf(stderr, "ERROR: Truncated delta row data!\n");
+	    exit(EXIT_FAILURE);
+	}
+	decode_replace(seed_buf, dpos, &in_buffer[pos], 0, count, maxlen);
+	pos += count;
+	dpos += count;
+    }
+    return(maxlen);
+}
+
+/*
+ * decode_crdr() - Apply a compressed replacement delta row (mode 9) encoded
+ * buffer to the seed row
+ */
+
+int decode_crdr(char *in_buffer,		/* I: Data buffer */
+		int data_length,		/* I: Length of data */
+		char *seed_buf,			/* I/O: Seed row */
+		int maxlen)			/* I: Length of seed_buf */
+{
+/* A command byte with the top bit clear is followed by literal data; the
+ * offset is in bits 3-6 and the count (less one) in bits 0-2.  With the top
+ * bit set, one byte follows that is repeated; the offset is in bits 5-6
+ * and the count (less two) in bits 0-4.  A field at its maximum value is
+ * followed by extension bytes, offset first.
+ */
+
+    int pos = 0;
+    int dpos = 0;
+
+    while (pos < data_length) {
+	int command = (unsigned char) in_buffer[pos++];
+	int offset, count;
+
+	if (command & 0x80) {
+	    offset = (command >> 5) & 3;
+	    count = (command & 31) + 2;
+	    if (offset == 3)
+		offset += decode_extension(in_buffer, data_length, &pos);
+	    if (count == 33)
+		count += decode_extension(in_buffer, data_length, &pos);
+	    if (pos >= data_length) {
+		fprintf(stderr, "ERROR: Truncated replacement data!\n");
+		exit(EXIT_FAILURE);
+	    }
+	    dpos += offset;
+	    decode_replace(seed_buf, dpos, NULL, in_buffer[pos++], count, maxlen);
+	}
+	else {
+	    offset = (command >> 3) & 15;
+	    count = (command & 7) + 1;
+	    if (offset == 15)
+		offset += decode_extension(in_buffer, data_length, &pos);
+	    if (count == 8)
+		count += decode_extension(in_buffer, data_length, &pos);
+	    if (pos + count > data_length) {
+		fprintf(stderr, "ERROR: Truncated replacement data!\n");
+		exit(EXIT_FAILURE);
+	    }
+	    dpos += offset;
+	    decode_replace(seed_buf, dpos, &in_buffer[pos], 0, count, maxlen);
+	    pos += count;
+	}
+	dpos += count;
+    }
+    return(maxlen);
+}
+
 /*
  * pcl_reset() - Rest image parameters to default
  */
@@ -990,9 +1132,11 @@ int main(int argc, char *argv[])
 		}
 
 		if ((image_data.compression_type != PCL_COMPRESSION_NONE) &&
-			(image_data.compression_type != PCL_COMPRESSION_TIFF)) {
+			(image_data.compression_type != PCL_COMPRESSION_TIFF) &&
+			(image_data.compression_type != PCL_COMPRESSION_DELTA) &&
+			(image_data.compression_type != PCL_COMPRESSION_CRDR)) {
 		    fprintf(stderr,
-			"Sorry, only 'no compression' or 'tiff compression' handled.\n");
+			"Sorry, only 'no', 'tiff', 'delta row' or 'compressed row delta replacement' compression handled.\n");
 		    i++;
 		}
 
@@ -1048,37 +1192,37 @@ int main(int argc, char *argv[])
 		    if (output_data.black_data_rows_per_row != 0) {
 			output_data.black_bufs = stp_malloc(output_data.black_data_rows_per_row * sizeof (char *));
 			for (i=0; i < output_data.black_data_rows_per_row; i++) {
-			    output_data.black_bufs[i] = stp_malloc(output_data.buffer_length * sizeof (char));
+			    output_data.black_bufs[i] = stp_zalloc(output_data.buffer_length * sizeof (char));
 			}
 		    }
 		    if (output_data.cyan_data_rows_per_row != 0) {
 			output_data.cyan_bufs = stp_malloc(output_data.cyan_data_rows_per_row * sizeof (char *));
 			for (i=0; i < output_data.cyan_data_rows_per_row; i++) {
-			    output_data.cyan_bufs[i] = stp_malloc(output_data.buffer_length * sizeof (char));
+			    output_data.cyan_bufs[i] = stp_zalloc(output_data.buffer_length * sizeof (char));
 			}
 		    }
 		    if (output_data.magenta_data_rows_per_row != 0) {
 			output_data.magenta_bufs = stp_malloc(output_data.magenta_data_rows_per_row * sizeof (char *));
 			for (i=0; i < output_data.magenta_data_rows_per_row; i++) {
-			    output_data.magenta_bufs[i] = stp_malloc(output_data.buffer_length * sizeof (char));
+			    output_data.magenta_bufs[i] = stp_zalloc(output_data.buffer_length * sizeof (char));
 			}
 		    }
 		    if (output_data.yellow_data_rows_per_row != 0) {
 			output_data.yellow_bufs = stp_malloc(output_data.yellow_data_rows_per_row * sizeof (char *));
 			for (i=0; i < output_data.yellow_data_rows_per_row; i++) {
-			    output_data.yellow_bufs[i] = stp_malloc(output_data.buffer_length * sizeof (char));
+			    output_data.yellow_bufs[i] = stp_zalloc(output_data.buffer_length * sizeof (char));
 			}
 		    }
 		    if (output_data.lcyan_data_rows_per_row != 0) {
 			output_data.lcyan_bufs = stp_malloc(output_data.lcyan_data_rows_per_row * sizeof (char *));
 			for (i=0; i < output_data.lcyan_data_rows_per_row; i++) {
-			     output_data.lcyan_bufs[i] = stp_malloc(output_data.buffer_length * sizeof (char));
+			     output_data.lcyan_bufs[i] = stp_zalloc(output_data.buffer_length * sizeof (char));
 			}
 		    }
 		    if (output_data.lmagenta_data_rows_per_row != 0) {
 			output_data.lmagenta_bufs = stp_malloc(output_data.lmagenta_data_rows_per_row * sizeof (char *));
 			for (i=0; i < output_data.lmagenta_data_rows_per_row; i++) {
-			    output_data.lmagenta_bufs[i] = stp_malloc(output_data.buffer_length * sizeof (char));
+			    output_data.lmagenta_bufs[i] = stp_zalloc(output_data.buffer_length * sizeof (char));
 			}
 		    }
 
@@ -1482,6 +1626,9 @@ int main(int argc, char *argv[])
 		    case PCL_COMPRESSION_TIFF :
 			fprintf(stderr, "TIFF\n");
 			break;
+		    case PCL_COMPRESSION_DELTA :
+			fprintf(stderr, "Delta Row\n");
+			break;
 		    case PCL_COMPRESSION_CRDR :
 			fprintf(stderr, "Compressed Row Delta Replacement\n");
 			break;
@@ -1643,12 +1790,32 @@ int main(int argc, char *argv[])
  * Accumulate the data rows for each output row,then write the image.
  */
 
-		    if (image_data.compression_type == PCL_COMPRESSION_NONE) {
+/*
+ * The delta modes update the previous row for this plane (the seed row) in
+ * place; the others replace it, leaving anything not sent white.
+ */
+
+		    switch (image_data.compression_type) {
+		    case PCL_COMPRESSION_DELTA :
+			output_data.active_length = decode_delta(data_buffer, numeric_arg, received_rows[current_data_row], output_data.buffer_length);
+			break;
+		    case PCL_COMPRESSION_CRDR :
+			output_data.active_length = decode_crdr(data_buffer, numeric_arg, received_rows[current_data_row], output_data.buffer_length);
+			break;
+		    case PCL_COMPRESSION_NONE :
+			if (numeric_arg > output_data.buffer_length) {
+			    fprintf(stderr, "ERROR: Too much data (%d)!\n", numeric_arg);
+			    exit(EXIT_FAILURE);
+			}
 			memcpy(received_rows[current_data_row], &data_buffer, (size_t) numeric_arg);
 			output_data.active_length = numeric_arg;
-		    }
-		    else
+			break;
+		    default :
 			output_data.active_length = decode_tiff(data_buffer, numeric_arg, received_rows[current_data_row], output_data.buffer_length);
+			break;
+		    }
+		    memset(received_rows[current_data_row] + output_data.active_length, 0,
+			(size_t) (output_data.buffer_length - output_data.active_length));
 
 		    if (command == PCL_DATA_LAST) {
 			if (image_data.colour_type == PCL_MONO)
@@ -0,0 +1,231 @@
+/*
+ *   Check and time planar channel rows handed to the dither
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * A synthetic CMYK page is split into 6, 8 and 11 inks by the channel
+ * code and dithered with each dither algorithm, once with interleaved
+ * rows and once with DitherPlanar set.  The dithered output must be the
+ * same both ways.  For both layouts the best of three times is reported
+ * for converting and dithering the page, and for the dither alone.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "../src/main/gutenprint-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define IMAGE_WIDTH 2880
+#define IMAGE_HEIGHT 240
+#define LINE_LENGTH ((IMAGE_WIDTH + 7) / 8)
+#define MAX_INKS 16
+#define PASSES 3
+
+static int test_count = 0;
+static int error_count = 0;
+
+typedef struct
+{
+  int inks;
+  int shades[4];		/* Shades of K, C, M and Y */
+} ink_config_t;
+
+static const ink_config_t configs[] =
+{
+  { 6, { 1, 2, 2, 1 } },
+  { 8, { 2, 2, 2, 2 } },
+  { 11, { 3, 3, 3, 2 } },
+};
+
+static const char *algorithms[] =
+{
+  "VeryFast", "Ordered", "OrderedNew", "Predithered", "EvenTone", "Adaptive"
+};
+
+#define SHADE(density, name)					\
+{  density, sizeof(name)/sizeof(stp_dotsize_t), name  }
+
+static const stp_dotsize_t single_dotsize[] =
+{
+  { 0x1, 1.0 }
+};
+
+/* Light to dark, for channels with one, two and three inks */
+static const stp_shade_t shades[3][3] =
+{
+  { SHADE(1.0, single_dotsize) },
+  { SHADE(0.33, single_dotsize), SHADE(1.0, single_dotsize) },
+  { SHADE(0.15, single_dotsize), SHADE(0.4, single_dotsize),
+    SHADE(1.0, single_dotsize) },
+};
+
+static unsigned char lines[MAX_INKS][LINE_LENGTH];
+
+static int
+image_width(stp_image_t *image)
+{
+  return IMAGE_WIDTH;
+}
+
+static stp_image_t image =
+{
+  NULL,
+  NULL,
+  image_width,
+  NULL,
+  NULL,
+  NULL,
+};
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+ * Bands of gradients, white, text-like strokes and flat color, with a
+ * white margin on either side.
+ */
+static void
+fill_row(unsigned short *data, int row)
+{
+  int x, i;
+  memset(data, 0, sizeof(unsigned short) * 4 * IMAGE_WIDTH);
+  for (x = IMAGE_WIDTH / 16; x < IMAGE_WIDTH - IMAGE_WIDTH / 16; x++)
+    {
+      unsigned short *pixel = data + x * 4;
+      switch ((row / 40) % 4)
+	{
+	case 0:
+	  for (i = 0; i < 4; i++)
+	    pixel[i] = (x * 23 + row * 97 + i * 16384) & 65535;
+	  break;
+	case 1:
+	  break;
+	case 2:
+	  if ((x / 3 + row) % 11 < 2)
+	    pixel[0] = 65535;
+	  break;
+	default:
+	  pixel[1] = 40000;
+	  pixel[2] = 20000;
+	  break;
+	}
+    }
+}
+
+typedef struct
+{
+  double total;
+  double dither;
+} page_time_t;
+
+static unsigned
+dither_page(const ink_config_t *config, const char *algorithm, int planar,
+	    page_time_t *elapsed)
+{
+  stp_vars_t *v = stp_vars_create();
+  unsigned checksum = 0;
+  double start;
+  int i, j, row;
+
+  stp_set_string_parameter(v, "DitherAlgorithm", algorithm);
+  stp_set_boolean_parameter(v, "DitherPlanar", planar);
+  stp_dither_init(v, &image, IMAGE_WIDTH, 720, 720);
+  for (i = 0, j = 0; i < 4; i++)
+    {
+      const stp_shade_t *s = shades[config->shades[i] - 1];
+      int k;
+      for (k = 0; k < config->shades[i]; k++, j++)
+	{
+	  stp_channel_add(v, i, k, s[k].value);
+	  stp_dither_add_channel(v, lines[j], i, k);
+	}
+      stp_dither_set_inks_full(v, i, config->shades[i], s, 1.0, 1.0);
+    }
+  stp_channel_initialize(v, &image, 4);
+
+  elapsed->total = 0;
+  elapsed->dither = 0;
+  for (row = 0; row < IMAGE_HEIGHT; row++)
+    {
+      unsigned zero_mask;
+      double dither_start;
+      fill_row(stp_channel_get_input(v), row);
+      start = now();
+      stp_channel_convert(v, &zero_mask);
+      dither_start = now();
+      stp_dither(v, row, 0, zero_mask, NULL);
+      elapsed->dither += now() - dither_start;
+      elapsed->total += now() - start;
+      for (i = 0; i < config->inks; i++)
+	for (j = 0; j < LINE_LENGTH; j++)
+	  checksum = checksum * 31 + lines[i][j];
+    }
+  stp_vars_destroy(v);
+  return checksum;
+}
+
+int
+main(int argc, char **argv)
+{
+  int c, a;
+  stp_init();
+  for (c = 0; c < sizeof(configs) / sizeof(ink_config_t); c++)
+    for (a = 0; a < sizeof(algorithms) / sizeof(const char *); a++)
+      {
+	page_time_t best[2] = { { 0, 0 }, { 0, 0 } };
+	unsigned interleaved = 0, planar = 0;
+	int pass;
+	for (pass = 0; pass < PASSES; pass++)
+	  {
+	    page_time_t t;
+	    interleaved = dither_page(&configs[c], algorithms[a], 0, &t);
+	    if (pass == 0 || t.total < best[0].total)
+	      best[0].total = t.total;
+	    if (pass == 0 || t.dither < best[0].dither)
+	      best[0].dither = t.dither;
+	    planar = dither_page(&configs[c], algorithms[a], 1, &t);
+	    if (pass == 0 || t.total < best[1].total)
+	      best[1].total = t.total;
+	    if (pass == 0 || t.dither < best[1].dither)
+	      best[1].dither = t.dither;
+	  }
+	test_count++;
+	if (planar != interleaved)
+	  {
+	    printf("%d inks, %s: planar output differs\n",
+		   configs[c].inks, algorithms[a]);
+	    error_count++;
+	  }
+	printf("%2d inks, %-12s interleaved %6.1f ms (dither %5.1f), "
+	       "planar %6.1f ms (dither %5.1f)\n",
+	       configs[c].inks, algorithms[a], best[0].total * 1000,
+	       best[0].dither * 1000, best[1].total * 1000,
+	       best[1].dither * 1000);
+      }
+  printf("%d tests, %d failed\n", test_count, error_count);
+  return error_count ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+/*
+ *   Shared setup for the tests that print a test image
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include "print-harness.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+int test_count = 0;
+int error_count = 0;
+
+int image_rows = 48;
+int bad_row = -1;
+
+double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+void
+check(int ok, const char *driver, const char *what)
+{
+  test_count++;
+  if (!ok)
+    {
+      printf("%s: %s: FAILED\n", driver, what);
+      error_count++;
+    }
+}
+
+static void
+writefunc(void *data, const char *buffer, size_t bytes)
+{
+  sink_t *sink = (sink_t *) data;
+  sink->data = stp_realloc(sink->data, sink->bytes + bytes);
+  memcpy(sink->data + sink->bytes, buffer, bytes);
+  sink->bytes += bytes;
+}
+
+static void
+errfunc(void *data, const char *buffer, size_t bytes)
+{
+}
+
+static int
+image_width(stp_image_t *image)
+{
+  return IMAGE_WIDTH;
+}
+
+static int
+image_height(stp_image_t *image)
+{
+  return image_rows;
+}
+
+/*
+ * The top third is a gradient, the middle third a pattern of stripes,
+ * and the bottom third noise.
+ */
+static stp_image_status_t
+image_get_row(stp_image_t *image, unsigned char *data, size_t limit, int row)
+{
+  int bytes = limit / (IMAGE_WIDTH * 3);
+  int x, i;
+  if (bad_row >= 0 && row >= bad_row)
+    return STP_IMAGE_STATUS_ABORT;
+  for (x = 0; x < IMAGE_WIDTH; x++)
+    {
+      unsigned pixel[3];
+      if (row < image_rows / 3)
+	{
+	  pixel[0] = x * 65535 / IMAGE_WIDTH;
+	  pixel[1] = 65535 - pixel[0];
+	  pixel[2] = row * 65535 / image_rows;
+	}
+      else if (row < 2 * image_rows / 3)
+	pixel[0] = pixel[1] = pixel[2] = ((x / 8 + row) & 3) ? 65535 : 0;
+      else
+	pixel[0] = pixel[1] = pixel[2] = (x * row * 97) & 65535;
+      for (i = 0; i < 3; i++)
+	{
+	  if (bytes == 2)
+	    ((unsigned short *) data)[x * 3 + i] = pixel[i];
+	  else
+	    data[x * 3 + i] = pixel[i] >> 8;
+	}
+    }
+  return STP_IMAGE_STATUS_OK;
+}
+
+static const char *
+image_get_appname(stp_image_t *image)
+{
+  return "print-harness";
+}
+
+stp_image_t test_image =
+{
+  NULL,
+  NULL,
+  image_width,
+  image_height,
+  image_get_row,
+  image_get_appname,
+  NULL,
+  NULL
+};
+
+void
+set_parameter(stp_vars_t *v, const char *name, const char *value)
+{
+  if (!strncmp(value, "f:", 2))
+    stp_set_float_parameter(v, name, atof(value + 2));
+  else if (!strncmp(value, "b:", 2))
+    stp_set_boolean_parameter(v, name, atoi(value + 2));
+  else if (!strncmp(value, "i:", 2))
+    stp_set_int_parameter(v, name, atoi(value + 2));
+  else
+    stp_set_string_parameter(v, name, value);
+}
+
+stp_vars_t *
+printer_settings(const char *driver, sink_t *sink)
+{
+  const stp_printer_t *printer = stp_get_printer_by_driver(driver);
+  stp_vars_t *v;
+  if (!printer)
+    return NULL;
+  v = stp_vars_create();
+  stp_set_printer_defaults(v, printer);
+  stp_set_outfunc(v, writefunc);
+  stp_set_outdata(v, sink);
+  stp_set_errfunc(v, errfunc);
+  stp_set_string_parameter(v, "InputImageType", "RGB");
+  stp_set_string_parameter(v, "ChannelBitDepth", "8");
+  return v;
+}
+
+void
+place_image(stp_vars_t *v, int height)
+{
+  int left, right, bottom, top;
+  stp_get_imageable_area(v, &left, &right, &bottom, &top);
+  stp_set_left(v, left);
+  stp_set_top(v, top);
+  stp_set_width(v, IMAGE_WIDTH);
+  stp_set_height(v, height);
+}
+
+int
+report(void)
+{
+  printf("%d tests, %d failed\n", test_count, error_count);
+  return error_count ? 1 : 0;
+}
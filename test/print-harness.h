@@ -0,0 +1,69 @@
+/*
+ *   Shared setup for the tests that print a test image
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PRINT_HARNESS_H
+#define PRINT_HARNESS_H
+
+#include <gutenprint/gutenprint.h>
+
+#define IMAGE_WIDTH 320
+
+/* Printer output collected in memory */
+typedef struct
+{
+  char *data;
+  size_t bytes;
+} sink_t;
+
+extern int test_count;
+extern int error_count;
+
+/*
+ * The test image is IMAGE_WIDTH pixels of RGB, 8 or 16 bits per channel,
+ * with image_rows rows.  Rows from bad_row on can't be read, unless it
+ * is -1.
+ */
+extern int image_rows;
+extern int bad_row;
+extern stp_image_t test_image;
+
+extern double now(void);
+extern void check(int ok, const char *driver, const char *what);
+
+/*
+ * Set a parameter from a string: "f:", "b:" and "i:" prefixes give
+ * float, boolean and int values, and anything else is a string.
+ */
+extern void set_parameter(stp_vars_t *v, const char *name, const char *value);
+
+/*
+ * Settings for a driver's defaults, printing 8 bit RGB into sink, or
+ * NULL if there is no such driver.
+ */
+extern stp_vars_t *printer_settings(const char *driver, sink_t *sink);
+
+/*
+ * Place the image at the top left of the imageable area, height points
+ * high.  Call this after any setting that changes the page.
+ */
+extern void place_image(stp_vars_t *v, int height);
+
+/* Print the test counts, returning the exit status */
+extern int report(void);
+
+#endif /* PRINT_HARNESS_H */
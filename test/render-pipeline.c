@@ -0,0 +1,153 @@
+/*
+ *   Check printing with pipelined rendering
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * A page printed with RenderPipeline set must come out exactly as it
+ * does without it, whether the image has fewer rows than the page (so
+ * rows are repeated) or more (so rows are skipped), with dither
+ * algorithms that carry error from row to row, with the other dither
+ * options, when printing to a CD (which masks each row), and when the
+ * image can't be read to the end.  The time per page with and without
+ * the pipeline is reported.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include "print-harness.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *drivers[] =
+{
+  "escp2-r800", "escp2-c80", "pcl-g_6", "bjc-i9900", "lexmark-z52"
+};
+
+/*
+ * Settings to print with: name and value (NULL for the defaults), image
+ * rows, and printed height in points.
+ */
+typedef struct
+{
+  const char *name;
+  const char *value;
+  int rows;
+  int height;
+} case_t;
+
+static const case_t cases[] =
+{
+  { NULL, NULL, 48, 48 },
+  { NULL, NULL, 400, 12 },
+  { "DitherAlgorithm", "EvenTone", 48, 48 },
+  { "DitherAlgorithm", "Floyd", 96, 36 },
+  { "DitherAlgorithm", "Ordered", 48, 48 },
+  { "DitherPlanar", "b:1", 48, 48 },
+  { "DitherThreads", "i:2", 48, 48 },
+  { "ChannelBitDepth", "16", 48, 48 },
+};
+
+/*
+ * Print a page, returning the status from stp_print() (or -1 if the
+ * settings don't verify) and the time taken in *seconds.
+ */
+static int
+print_page(const char *driver, const case_t *c, int cd,
+	   int pipelined, sink_t *sink, double *seconds)
+{
+  stp_vars_t *v = printer_settings(driver, sink);
+  int status = -1;
+  double start;
+  if (!v)
+    return -1;
+  if (cd)
+    {
+      stp_set_string_parameter(v, "InputSlot", "CD");
+      stp_set_string_parameter(v, "PageSize", "CD5Inch");
+      stp_set_string_parameter(v, "CDInnerRadius", "Small");
+    }
+  if (c->name)
+    set_parameter(v, c->name, c->value);
+  if (pipelined)
+    stp_set_boolean_parameter(v, "RenderPipeline", 1);
+  place_image(v, c->height);
+  image_rows = c->rows;
+  start = now();
+  if (stp_verify(v))
+    status = stp_print(v, &test_image);
+  *seconds = now() - start;
+  stp_vars_destroy(v);
+  return status;
+}
+
+static void
+compare(const char *driver, const case_t *c, int cd,
+	const char *what, double *serial_time, double *pipelined_time)
+{
+  sink_t serial, pipelined;
+  double seconds;
+  int serial_status, pipelined_status;
+  memset(&serial, 0, sizeof(serial));
+  memset(&pipelined, 0, sizeof(pipelined));
+  serial_status = print_page(driver, c, cd, 0, &serial, &seconds);
+  if (serial_time)
+    *serial_time += seconds;
+  pipelined_status =
+    print_page(driver, c, cd, 1, &pipelined, &seconds);
+  if (pipelined_time)
+    *pipelined_time += seconds;
+  check(serial_status > 0 && serial_status == pipelined_status &&
+	serial.bytes == pipelined.bytes &&
+	!memcmp(serial.data, pipelined.data, serial.bytes), driver, what);
+  stp_free(serial.data);
+  stp_free(pipelined.data);
+}
+
+static void
+test_driver(const char *driver)
+{
+  double serial_time = 0;
+  double pipelined_time = 0;
+  int i;
+  bad_row = -1;
+  for (i = 0; i < sizeof(cases) / sizeof(case_t); i++)
+    {
+      char what[64];
+      sprintf(what, "%s %s, %d rows", cases[i].name ? cases[i].name : "defaults",
+	      cases[i].value ? cases[i].value : "", cases[i].rows);
+      compare(driver, &(cases[i]), 0, what, &serial_time, &pipelined_time);
+    }
+  bad_row = 30;
+  compare(driver, &(cases[0]), 0, "unreadable image", NULL, NULL);
+  bad_row = -1;
+  printf("%-12s %6.2f ms/page, %6.2f ms/page pipelined\n", driver,
+	 serial_time * 1000 / i, pipelined_time * 1000 / i);
+}
+
+int
+main(int argc, char **argv)
+{
+  int i;
+  stp_init();
+  for (i = 0; i < sizeof(drivers) / sizeof(const char *); i++)
+    test_driver(drivers[i]);
+  bad_row = -1;
+  compare("escp2-px1001", &(cases[0]), 1, "print to CD", NULL, NULL);
+  compare("escp2-px1001", &(cases[2]), 1, "print to CD", NULL, NULL);
+  return report();
+}
@@ -0,0 +1,163 @@
+/*
+ *   Check printing through a render session
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * A job printed page by page through a session must come out exactly as
+ * it does with stp_print(), both when every page has the same settings
+ * and when the settings change part way through the job.  Verification
+ * through a session must give the same answers as stp_verify().  The
+ * time per page with and without a session is reported.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include "print-harness.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE_HEIGHT 48
+#define PAGES 6
+
+static const char *drivers[] =
+{
+  "escp2-r800", "escp2-c80", "pcl-g_6", "bjc-i9900", "lexmark-z52"
+};
+
+/*
+ * Settings changed on some pages of a job: name, value, and the pages
+ * (a bit mask) that use the changed value.
+ */
+typedef struct
+{
+  const char *name;
+  const char *value;
+  unsigned pages;
+} page_change_t;
+
+static const page_change_t changes[] =
+{
+  { "Brightness", "f:1.2", 0x0c },
+  { "DitherAlgorithm", "Ordered", 0x10 },
+  { "ColorCorrection", "Bright", 0x18 },
+};
+
+static stp_vars_t *
+job_settings(const char *driver, sink_t *sink)
+{
+  stp_vars_t *v = printer_settings(driver, sink);
+  if (v)
+    place_image(v, IMAGE_HEIGHT);
+  return v;
+}
+
+/*
+ * Print a job of PAGES pages, with or without a session, applying the
+ * page changes if vary is set.  Returns the time spent per page.
+ */
+static double
+print_job(const char *driver, int use_session, int vary, sink_t *sink)
+{
+  stp_vars_t *job = job_settings(driver, sink);
+  stp_session_t *session = use_session ? stp_session_create() : NULL;
+  double start = now();
+  int page;
+  int ok = 1;
+
+  for (page = 0; page < PAGES && ok; page++)
+    {
+      stp_vars_t *v = stp_vars_create_copy(job);
+      int i;
+      stp_set_int_parameter(v, "PageNumber", page);
+      if (vary)
+	for (i = 0; i < sizeof(changes) / sizeof(page_change_t); i++)
+	  if (changes[i].pages & (1 << page))
+	    set_parameter(v, changes[i].name, changes[i].value);
+      if (session)
+	ok = stp_session_verify(session, v) &&
+	  stp_session_print(session, v, &test_image);
+      else
+	ok = stp_verify(v) && stp_print(v, &test_image);
+      stp_vars_destroy(v);
+    }
+  check(ok, driver, use_session ? "print with a session" : "print");
+  stp_session_destroy(session);
+  stp_vars_destroy(job);
+  return (now() - start) / PAGES;
+}
+
+static void
+test_print(const char *driver, int vary)
+{
+  sink_t plain, session;
+  double plain_time, session_time;
+  memset(&plain, 0, sizeof(plain));
+  memset(&session, 0, sizeof(session));
+  plain_time = print_job(driver, 0, vary, &plain);
+  session_time = print_job(driver, 1, vary, &session);
+  check(plain.bytes > 0 && plain.bytes == session.bytes &&
+	!memcmp(plain.data, session.data, plain.bytes), driver,
+	vary ? "output with changing settings" : "output");
+  if (!vary)
+    printf("%-12s %6.2f ms/page, %6.2f ms/page with a session\n", driver,
+	   plain_time * 1000, session_time * 1000);
+  stp_free(plain.data);
+  stp_free(session.data);
+}
+
+static void
+test_verify(const char *driver)
+{
+  sink_t sink;
+  stp_vars_t *good;
+  stp_vars_t *bad;
+  stp_session_t *session = stp_session_create();
+  memset(&sink, 0, sizeof(sink));
+  good = job_settings(driver, &sink);
+  bad = stp_vars_create_copy(good);
+  stp_set_string_parameter(bad, "Resolution", "NoSuchResolution");
+  check(stp_session_verify(session, good) == 1, driver, "verify");
+  check(stp_session_verify(session, bad) == 0, driver, "verify bad settings");
+  stp_set_int_parameter(good, "PageNumber", 3);
+  check(stp_session_verify(session, good) == 1, driver, "verify again");
+  check(stp_get_verified(good), driver, "settings are marked verified");
+  stp_set_int_parameter(good, "PageNumber", -1);
+  check(stp_session_verify(session, good) == stp_verify(good), driver,
+	"verify a bad page number");
+  check(stp_session_verify(session, bad) == 0, driver,
+	"verify bad settings again");
+  stp_vars_destroy(good);
+  stp_vars_destroy(bad);
+  stp_session_destroy(session);
+  stp_free(sink.data);
+}
+
+int
+main(int argc, char **argv)
+{
+  int i;
+  stp_init();
+  image_rows = IMAGE_HEIGHT;
+  for (i = 0; i < sizeof(drivers) / sizeof(const char *); i++)
+    {
+      test_print(drivers[i], 0);
+      test_print(drivers[i], 1);
+      test_verify(drivers[i]);
+    }
+  return report();
+}
@@ -31,6 +31,7 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
 
 /*
  * Definitions for dither test...
@@ -63,6 +64,11 @@ const char     *dither_name = NULL;
 int		dither_bits = 1;
 int		write_image = 1;
 int		quiet;
+int		dither_threads = 1;
+int		dither_planar = 0;	/* Pass rows a channel at a time */
+const char     *lines_name = NULL;	/* File to save dithered lines in */
+FILE	       *lines_fp = NULL;
+unsigned	output_checksum;	/* Checksum of all dithered output */
 unsigned short	white_line[IMAGE_WIDTH * 6],
 		black_line[IMAGE_WIDTH * 6],
 		color_line[IMAGE_WIDTH * 6],
@@ -125,6 +131,8 @@ static const stp_shade_t photo_2bit_shades[] =
 
 
 double compute_interval(struct timeval *tv1, struct timeval *tv2);
+unsigned checksum_line(unsigned sum, const unsigned char *line);
+void   record_line(const unsigned char *line);
 void   image_init(void);
 void   image_get_row(unsigned short *data, int row);
 void   write_gray(FILE *fp, unsigned char *black);
@@ -142,6 +150,29 @@ compute_interval(struct timeval *tv1, struct timeval *tv2)
     ((double) tv1->tv_sec + (double) tv1->tv_usec / 1000000.);
 }
 
+unsigned
+checksum_line(unsigned sum, const unsigned char *line)
+{
+  int i;
+  for (i = 0; i < ((IMAGE_WIDTH + 7) / 8) * dither_bits; i++)
+    sum = sum * 31 + line[i];
+  return sum;
+}
+
+/*
+ * Every dithered line goes into the output checksum and, if requested,
+ * into the lines file.  That file starts with the length of a line in
+ * bytes, in decimal on a line of its own, followed by the raw lines;
+ * pack-bench uses it to time the run-length packers on real data.
+ */
+void
+record_line(const unsigned char *line)
+{
+  output_checksum = checksum_line(output_checksum, line);
+  if (lines_fp)
+    fwrite(line, ((IMAGE_WIDTH + 7) / 8) * dither_bits, 1, lines_fp);
+}
+
 static void
 writefunc(void *file, const char *buf, size_t bytes)
 {
@@ -233,6 +264,8 @@ run_one_testdither(void)
       break;
     }
 
+  stp_set_int_parameter(v, "DitherThreads", dither_threads);
+  stp_set_boolean_parameter(v, "DitherPlanar", dither_planar);
   stp_dither_init(v, &theImage, IMAGE_WIDTH, 1, 1);
 
  /*
@@ -389,8 +422,17 @@ run_one_testdither(void)
 	perror("Create");
     }
 
+  if (lines_name)
+    {
+      if ((lines_fp = fopen(lines_name, "wb")) != NULL)
+	fprintf(lines_fp, "%d\n", ((IMAGE_WIDTH + 7) / 8) * dither_bits);
+      else
+	perror("Create");
+    }
+
   (void) gettimeofday(&tv1, NULL);
 
+  output_checksum = 0;
   for (i = 0; i < IMAGE_HEIGHT; i ++)
   {
     if (print_progress && !quiet && (i & 63) == 0)
@@ -404,6 +446,7 @@ run_one_testdither(void)
       case DITHER_GRAY :
           image_get_row(gray, i);
 	  stp_dither_internal(v, i, gray, 0, 0, NULL);
+	  record_line(black);
 	  if (fp)
 	    write_gray(fp, black);
 	  break;
@@ -411,6 +454,11 @@ run_one_testdither(void)
       case DITHER_CMYK :
           image_get_row(rgb, i);
 	  stp_dither_internal(v, i, rgb, 0, 0, NULL);
+	  record_line(cyan);
+	  record_line(magenta);
+	  record_line(yellow);
+	  if (stpi_dither_type == DITHER_CMYK)
+	    record_line(black);
 	  if (fp)
 	    write_color(fp, cyan, magenta, yellow, black);
 	  break;
@@ -418,6 +466,13 @@ run_one_testdither(void)
       case DITHER_PHOTO_CMYK :
           image_get_row(rgb, i);
 	  stp_dither_internal(v, i, rgb, 0, 0, NULL);
+	  record_line(cyan);
+	  record_line(lcyan);
+	  record_line(magenta);
+	  record_line(lmagenta);
+	  record_line(yellow);
+	  if (stpi_dither_type == DITHER_PHOTO_CMYK)
+	    record_line(black);
 	  if (fp)
 	    write_photo(fp, cyan, lcyan, magenta, lmagenta, yellow, black);
 	  break;
@@ -430,6 +485,11 @@ run_one_testdither(void)
 
   if (fp != NULL)
     fclose(fp);
+  if (lines_fp != NULL)
+    {
+      fclose(lines_fp);
+      lines_fp = NULL;
+    }
 
   if (!quiet)
     {
@@ -474,6 +534,24 @@ run_testdither_from_cmdline(int argc, char **argv)
 	  continue;
 	}
 
+      if (strncmp(argv[i], "threads=", 8) == 0)
+	{
+	  dither_threads = atoi(argv[i] + 8);
+	  continue;
+	}
+
+      if (strcmp(argv[i], "planar") == 0)
+	{
+	  dither_planar = 1;
+	  continue;
+	}
+
+      if (strncmp(argv[i], "lines=", 6) == 0)
+	{
+	  lines_name = argv[i] + 6;
+	  continue;
+	}
+
       for (j = 0; j < 5; j ++)
 	if (strcmp(argv[i], stpi_dither_types[j]) == 0)
 	  break;
@@ -532,6 +610,9 @@ run_standard_testdithers(void)
 	       image_type < sizeof(image_types) / sizeof(const char *);
 	       image_type++)
 	    {
+	      dither_threads = 1;
+	      if (image_type == IMAGE_MIXED)
+		srand(1);
 	      status = run_one_testdither();
 	      if (status)
 		{
@@ -543,6 +624,48 @@ run_standard_testdithers(void)
 	      else
 		printf(".");
 	      fflush(stdout);
+
+	      /*
+	       * Dithering with multiple threads must produce exactly the
+	       * same output as dithering on one thread.  Both runs reseed
+	       * the generator so that they see the same random image.
+	       */
+	      if (image_type == IMAGE_MIXED)
+		{
+		  unsigned serial_checksum = output_checksum;
+		  dither_threads = 4;
+		  srand(1);
+		  status = run_one_testdither();
+		  if (status || output_checksum != serial_checksum)
+		    {
+		      printf("%s %d %s %s threaded output differs\n",
+			     dither_name, dither_bits,
+			     stpi_dither_types[stpi_dither_type],
+			     image_types[image_type]);
+		      failures++;
+		    }
+		  else
+		    printf(".");
+		  fflush(stdout);
+		  dither_threads = 1;
+
+		  /* Nor may passing the rows a plane per channel */
+		  dither_planar = 1;
+		  srand(1);
+		  status = run_one_testdither();
+		  if (status || output_checksum != serial_checksum)
+		    {
+		      printf("%s %d %s %s planar output differs\n",
+			     dither_name, dither_bits,
+			     stpi_dither_types[stpi_dither_type],
+			     image_types[image_type]);
+		      failures++;
+		    }
+		  else
+		    printf(".");
+		  fflush(stdout);
+		  dither_planar = 0;
+		}
 	    }
       printf("\n");
       fflush(stdout);
@@ -569,6 +692,8 @@ image_get_row(unsigned short *data,
               int            row)
 {
   unsigned short *src;
+  int channels = 1;
+  int x, i;
 
 
   switch (image_type)
@@ -609,21 +734,30 @@ image_get_row(unsigned short *data,
   switch (stpi_dither_type)
     {
     case DITHER_GRAY:
-      memcpy(data, src, IMAGE_WIDTH * 2);
+      channels = 1;
       break;
     case DITHER_COLOR:
-      memcpy(data, src, IMAGE_WIDTH * 6);
+      channels = 3;
       break;
     case DITHER_CMYK:
-      memcpy(data, src, IMAGE_WIDTH * 8);
+      channels = 4;
       break;
     case DITHER_PHOTO:
-      memcpy(data, src, IMAGE_WIDTH * 10);
+      channels = 5;
       break;
     case DITHER_PHOTO_CMYK:
-      memcpy(data, src, IMAGE_WIDTH * 12);
+      channels = 6;
       break;
     }
+
+  if (dither_planar)
+    {
+      for (i = 0; i < channels; i++)
+	for (x = 0; x < IMAGE_WIDTH; x++)
+	  data[i * IMAGE_WIDTH + x] = src[x * channels + i];
+    }
+  else
+    memcpy(data, src, IMAGE_WIDTH * channels * 2);
 }
 
 
@@ -0,0 +1,177 @@
+/*
+ *   Check when XML data is taken from the precompiled database
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Each case gets a data directory of its own, since a database is opened
+ * once per directory.  The database is written from one version of an
+ * XML file, and the file is then replaced by another.  With the same
+ * size and an older time the database must be used; if the size
+ * differs, the file is newer than the database, or the database is
+ * damaged, truncated or missing, the XML file must be read instead.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include <gutenprint/mxml.h>
+#include "../src/main/gutenprint-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#define XML_FILE "test.xml"
+
+typedef enum
+{
+  DB_KEEP,
+  DB_DAMAGE,
+  DB_TRUNCATE,
+  DB_REMOVE
+} db_change_t;
+
+static int test_count = 0;
+static int error_count = 0;
+
+static char base_dir[] = "/tmp/xml-db-XXXXXX";
+
+static void
+write_xml(const char *file_name, const char *value)
+{
+  FILE *fp = fopen(file_name, "w");
+  if (!fp)
+    {
+      perror(file_name);
+      exit(1);
+    }
+  fprintf(fp, "<?xml version=\"1.0\"?>\n"
+	  "<gutenprint><setting value=\"%s\"/></gutenprint>\n", value);
+  fclose(fp);
+}
+
+static void
+change_db(const char *db_name, db_change_t change)
+{
+  struct stat sbuf;
+  FILE *fp;
+  switch (change)
+    {
+    case DB_DAMAGE:
+      fp = fopen(db_name, "r+");
+      if (fp)
+	{
+	  fputs("DAMAGED", fp);
+	  fclose(fp);
+	}
+      break;
+    case DB_TRUNCATE:
+      if (stat(db_name, &sbuf) != 0 ||
+	  truncate(db_name, sbuf.st_size / 2) != 0)
+	perror(db_name);
+      break;
+    case DB_REMOVE:
+      (void) unlink(db_name);
+      break;
+    default:
+      break;
+    }
+}
+
+/*
+ * Write the database from an XML file holding old_value, replace the
+ * file with one holding new_value, dated age seconds before the
+ * database, then load it and check which value it holds.
+ */
+static void
+check_load(const char *what, const char *old_value, const char *new_value,
+	   int age, db_change_t change, const char *expect)
+{
+  static int case_number = 0;
+  static const char *files[] = { XML_FILE };
+  char *dir, *xml_name, *db_name;
+  struct stat sbuf;
+  struct utimbuf times;
+  stp_mxml_node_t *doc, *node;
+  const char *value = NULL;
+
+  stp_asprintf(&dir, "%s/%d", base_dir, case_number++);
+  (void) mkdir(dir, 0700);
+  xml_name = stpi_path_merge(dir, XML_FILE);
+  db_name = stpi_path_merge(dir, XMLDB_NAME);
+  write_xml(xml_name, old_value);
+  test_count++;
+  if (stpi_xmldb_write(db_name, dir, 1, files) != 0 ||
+      stat(db_name, &sbuf) != 0)
+    {
+      printf("%s: can't write the database\n", what);
+      error_count++;
+      return;
+    }
+  write_xml(xml_name, new_value);
+  times.actime = times.modtime = sbuf.st_mtime - age;
+  (void) utime(xml_name, &times);
+  change_db(db_name, change);
+
+  setenv("STP_DATA_PATH", dir, 1);
+  doc = stpi_xml_load_file(xml_name);
+  if (doc)
+    {
+      node = stp_mxmlFindElement(doc, doc, "setting", NULL, NULL,
+				 STP_MXML_DESCEND);
+      if (node)
+	value = stp_mxmlElementGetAttr(node, "value");
+    }
+  if (!value || strcmp(value, expect) != 0)
+    {
+      printf("%s: got %s, expected %s: FAILED\n", what,
+	     value ? value : "nothing", expect);
+      error_count++;
+    }
+  if (doc)
+    stp_mxmlDelete(doc);
+  (void) unlink(xml_name);
+  (void) unlink(db_name);
+  (void) rmdir(dir);
+  stp_free(xml_name);
+  stp_free(db_name);
+  stp_free(dir);
+}
+
+int
+main(int argc, char **argv)
+{
+  stp_init();
+  if (!mkdtemp(base_dir))
+    {
+      perror(base_dir);
+      return 1;
+    }
+  check_load("unchanged file", "1", "2", 10, DB_KEEP, "1");
+  check_load("file of another size", "1", "22", 10, DB_KEEP, "22");
+  check_load("file newer than the database", "1", "3", -10, DB_KEEP, "3");
+  check_load("damaged database", "1", "4", 10, DB_DAMAGE, "4");
+  check_load("truncated database", "1", "5", 10, DB_TRUNCATE, "5");
+  check_load("no database", "1", "6", 10, DB_REMOVE, "6");
+  (void) rmdir(base_dir);
+  printf("%d tests, %d failed\n", test_count, error_count);
+  return error_count ? 1 : 0;
+}